@@ -58,6 +58,13 @@
 typedef void (*_BLog_log_func) (int channel, int level, const char *msg);
 typedef void (*_BLog_free_func) (void);
 
+typedef struct {
+    void (*begin) (void);
+    void (*append) (const char *fmt, va_list vl);
+    void (*append_bytes) (MemRef data);
+    void (*finish) (int channel, int level);
+} _BLog_recorder;
+
 struct _BLog_channel {
     const char *name;
     int loglevel;
@@ -70,6 +77,7 @@ struct _BLog_global {
     struct _BLog_channel channels[BLOG_NUM_CHANNELS];
     _BLog_log_func log_func;
     _BLog_free_func free_func;
+    const _BLog_recorder *recorder; // if set, messages are passed here instead of formatted into logbuf
     BMutex mutex;
 #ifndef NDEBUG
     int logging;
@@ -144,6 +152,7 @@ void BLog_Init (_BLog_log_func log_func, _BLog_free_func free_func)
     
     blog_global.log_func = log_func;
     blog_global.free_func = free_func;
+    blog_global.recorder = NULL;
 #ifndef NDEBUG
     blog_global.logging = 0;
 #endif
@@ -191,6 +200,11 @@ void BLog_Begin (void)
 {
     ASSERT(blog_global.initialized)
     
+    if (blog_global.recorder) {
+        blog_global.recorder->begin();
+        return;
+    }
+    
     BMutex_Lock(&blog_global.mutex);
     
 #ifndef NDEBUG
@@ -202,6 +216,12 @@ void BLog_Begin (void)
 void BLog_AppendVarArg (const char *fmt, va_list vl)
 {
     ASSERT(blog_global.initialized)
+    
+    if (blog_global.recorder) {
+        blog_global.recorder->append(fmt, vl);
+        return;
+    }
+    
 #ifndef NDEBUG
     ASSERT(blog_global.logging)
 #endif
@@ -221,7 +241,7 @@ void BLog_Append (const char *fmt, ...)
 {
     ASSERT(blog_global.initialized)
 #ifndef NDEBUG
-    ASSERT(blog_global.logging)
+    ASSERT(blog_global.recorder || blog_global.logging)
 #endif
     
     va_list vl;
@@ -233,6 +253,12 @@ void BLog_Append (const char *fmt, ...)
 void BLog_AppendBytes (MemRef data)
 {
     ASSERT(blog_global.initialized)
+    
+    if (blog_global.recorder) {
+        blog_global.recorder->append_bytes(data);
+        return;
+    }
+    
 #ifndef NDEBUG
     ASSERT(blog_global.logging)
 #endif
@@ -250,13 +276,18 @@ void BLog_AppendBytes (MemRef data)
 void BLog_Finish (int channel, int level)
 {
     ASSERT(blog_global.initialized)
-#ifndef NDEBUG
-    ASSERT(blog_global.logging)
-#endif
     ASSERT(channel >= 0 && channel < BLOG_NUM_CHANNELS)
     ASSERT(level >= BLOG_ERROR && level <= BLOG_DEBUG)
     ASSERT(BLog_WouldLog(channel, level))
     
+    if (blog_global.recorder) {
+        blog_global.recorder->finish(channel, level);
+        return;
+    }
+    
+#ifndef NDEBUG
+    ASSERT(blog_global.logging)
+#endif
     ASSERT(blog_global.logbuf_pos >= 0)
     ASSERT(blog_global.logbuf_pos < sizeof(blog_global.logbuf))
     ASSERT(blog_global.logbuf[blog_global.logbuf_pos] == '\0')
@@ -0,0 +1,980 @@
+/**
+ * @file BLog_async.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <structure/LinkedList1.h>
+
+#include "BLog_async.h"
+
+#include <generated/blog_channel_BLogAsync.h>
+
+// maximum size of a recorded message, including the header
+#define RECORD_MAX 4096
+
+// maximum length of a single conversion specification
+#define SPEC_MAX 32
+
+#define SEG_FMT 1
+#define SEG_BYTES 2
+
+#define LEN_NONE 0
+#define LEN_HH 1
+#define LEN_H 2
+#define LEN_L 3
+#define LEN_LL 4
+#define LEN_J 5
+#define LEN_Z 6
+#define LEN_T 7
+#define LEN_BIG_L 8
+
+#define ARG_NONE 0
+#define ARG_INT 1
+#define ARG_UINT 2
+#define ARG_DOUBLE 3
+#define ARG_LDOUBLE 4
+#define ARG_PTR 5
+#define ARG_STR 6
+
+struct spec {
+    const char *start;
+    size_t len;
+    int width_star;
+    int prec_star;
+    int prec;
+    int length;
+    int arg;
+};
+
+struct record_header {
+    uint32_t len;
+    uint16_t channel;
+    uint8_t level;
+    uint8_t unused;
+};
+
+struct ring {
+    // read-only after creation
+    char *buf;
+    size_t mask;
+    
+    // written by the owner thread
+    size_t head;
+    size_t dropped;
+    int dead;
+    size_t tail_cache;
+    int logging;
+    size_t rec_len;
+    char rec[RECORD_MAX];
+    
+    // written by the writer thread
+    size_t tail;
+    size_t dropped_reported;
+    LinkedList1Node list_node; // protected by rings_mutex
+};
+
+static struct {
+    _BLog_log_func log_func;
+    _BLog_free_func free_func;
+    size_t ring_size;
+    pthread_key_t key;
+    pthread_mutex_t rings_mutex;
+    LinkedList1 rings;
+    size_t lost;
+    size_t lost_reported;
+    sem_t sem;
+    int sleeping;
+    int quitting;
+    pthread_t thread;
+    char rec[RECORD_MAX];
+    char out[sizeof(blog_global.logbuf)];
+    size_t out_pos;
+} blog_async;
+
+static __thread struct ring *cur_ring;
+
+// Parses the conversion specification at p, which points to a '%'.
+// Returns a pointer to the character following it, or NULL if the
+// conversion cannot be recorded.
+static const char * parse_spec (const char *p, struct spec *s)
+{
+    ASSERT(*p == '%')
+    
+    s->start = p;
+    s->width_star = 0;
+    s->prec_star = 0;
+    s->prec = -1;
+    s->length = LEN_NONE;
+    
+    p++;
+    
+    // flags
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'') {
+        p++;
+    }
+    
+    // width
+    if (*p == '*') {
+        s->width_star = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    
+    // positional arguments
+    if (*p == '$') {
+        return NULL;
+    }
+    
+    // precision
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->prec_star = 1;
+            p++;
+        } else {
+            s->prec = 0;
+            while (*p >= '0' && *p <= '9') {
+                if (s->prec < RECORD_MAX) {
+                    s->prec = s->prec * 10 + (*p - '0');
+                }
+                p++;
+            }
+        }
+    }
+    
+    // length modifier
+    switch (*p) {
+        case 'h':
+            p++;
+            if (*p == 'h') {
+                s->length = LEN_HH;
+                p++;
+            } else {
+                s->length = LEN_H;
+            }
+            break;
+        case 'l':
+            p++;
+            if (*p == 'l') {
+                s->length = LEN_LL;
+                p++;
+            } else {
+                s->length = LEN_L;
+            }
+            break;
+        case 'j':
+            s->length = LEN_J;
+            p++;
+            break;
+        case 'z':
+            s->length = LEN_Z;
+            p++;
+            break;
+        case 't':
+            s->length = LEN_T;
+            p++;
+            break;
+        case 'L':
+            s->length = LEN_BIG_L;
+            p++;
+            break;
+    }
+    
+    // conversion
+    switch (*p) {
+        case 'd':
+        case 'i':
+            s->arg = ARG_INT;
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            s->arg = ARG_UINT;
+            break;
+        case 'c':
+            s->arg = ARG_INT;
+            if (s->length != LEN_NONE) {
+                return NULL;
+            }
+            break;
+        case 's':
+            s->arg = ARG_STR;
+            if (s->length != LEN_NONE) {
+                return NULL;
+            }
+            break;
+        case 'p':
+            s->arg = ARG_PTR;
+            if (s->length != LEN_NONE) {
+                return NULL;
+            }
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (s->length == LEN_BIG_L) {
+                s->arg = ARG_LDOUBLE;
+            } else if (s->length == LEN_NONE || s->length == LEN_L) {
+                s->arg = ARG_DOUBLE;
+            } else {
+                return NULL;
+            }
+            break;
+        case '%':
+            s->arg = ARG_NONE;
+            if (p != s->start + 1) {
+                return NULL;
+            }
+            break;
+        default:
+            return NULL;
+    }
+    
+    if ((s->arg == ARG_INT || s->arg == ARG_UINT) && s->length == LEN_BIG_L) {
+        return NULL;
+    }
+    
+    p++;
+    
+    s->len = p - s->start;
+    if (s->len >= SPEC_MAX) {
+        return NULL;
+    }
+    
+    return p;
+}
+
+static int rec_put (struct ring *r, const void *data, size_t len)
+{
+    if (len > RECORD_MAX - r->rec_len) {
+        return 0;
+    }
+    
+    memcpy(r->rec + r->rec_len, data, len);
+    r->rec_len += len;
+    
+    return 1;
+}
+
+static int record_fmt (struct ring *r, const char *fmt, va_list vl)
+{
+    uint8_t type = SEG_FMT;
+    if (!rec_put(r, &type, sizeof(type)) || !rec_put(r, &fmt, sizeof(fmt))) {
+        return 0;
+    }
+    
+    const char *p = fmt;
+    
+    while ((p = strchr(p, '%'))) {
+        struct spec s;
+        if (!(p = parse_spec(p, &s))) {
+            return 0;
+        }
+        
+        int prec = s.prec;
+        
+        if (s.width_star) {
+            int width = va_arg(vl, int);
+            if (!rec_put(r, &width, sizeof(width))) {
+                return 0;
+            }
+        }
+        
+        if (s.prec_star) {
+            prec = va_arg(vl, int);
+            if (!rec_put(r, &prec, sizeof(prec))) {
+                return 0;
+            }
+        }
+        
+        switch (s.arg) {
+            case ARG_NONE:
+                break;
+            
+            case ARG_INT:
+            case ARG_UINT: {
+                uintmax_t v;
+                switch (s.length) {
+                    case LEN_L: v = va_arg(vl, long); break;
+                    case LEN_LL: v = va_arg(vl, long long); break;
+                    case LEN_J: v = va_arg(vl, intmax_t); break;
+                    case LEN_Z: v = va_arg(vl, size_t); break;
+                    case LEN_T: v = va_arg(vl, ptrdiff_t); break;
+                    default: v = va_arg(vl, int); break;
+                }
+                if (!rec_put(r, &v, sizeof(v))) {
+                    return 0;
+                }
+            } break;
+            
+            case ARG_DOUBLE: {
+                double v = va_arg(vl, double);
+                if (!rec_put(r, &v, sizeof(v))) {
+                    return 0;
+                }
+            } break;
+            
+            case ARG_LDOUBLE: {
+                long double v = va_arg(vl, long double);
+                if (!rec_put(r, &v, sizeof(v))) {
+                    return 0;
+                }
+            } break;
+            
+            case ARG_PTR: {
+                void *v = va_arg(vl, void *);
+                if (!rec_put(r, &v, sizeof(v))) {
+                    return 0;
+                }
+            } break;
+            
+            case ARG_STR: {
+                const char *str = va_arg(vl, const char *);
+                uint32_t len = UINT32_MAX;
+                if (str) {
+                    size_t slen = (prec >= 0 ? strnlen(str, prec) : strlen(str));
+                    if (slen >= RECORD_MAX) {
+                        return 0;
+                    }
+                    len = slen;
+                }
+                if (!rec_put(r, &len, sizeof(len))) {
+                    return 0;
+                }
+                if (str && !rec_put(r, str, (size_t)len + 1)) {
+                    return 0;
+                }
+            } break;
+            
+            default: ASSERT(0);
+        }
+    }
+    
+    return 1;
+}
+
+static void record_bytes_segment (struct ring *r, const char *data, size_t len)
+{
+    uint8_t type = SEG_BYTES;
+    uint32_t len32;
+    
+    if (RECORD_MAX - r->rec_len < sizeof(type) + sizeof(len32)) {
+        return;
+    }
+    
+    size_t avail = RECORD_MAX - r->rec_len - sizeof(type) - sizeof(len32);
+    len32 = (len > avail ? avail : len);
+    
+    rec_put(r, &type, sizeof(type));
+    rec_put(r, &len32, sizeof(len32));
+    rec_put(r, data, len32);
+}
+
+static void ring_thread_exit (void *arg)
+{
+    struct ring *r = arg;
+    
+    // the writer will free the ring once it has written everything in it
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static struct ring * ring_create (void)
+{
+    struct ring *r = malloc(sizeof(*r));
+    if (!r) {
+        goto fail0;
+    }
+    
+    if (!(r->buf = malloc(blog_async.ring_size))) {
+        goto fail1;
+    }
+    
+    r->mask = blog_async.ring_size - 1;
+    r->head = 0;
+    r->dropped = 0;
+    r->dead = 0;
+    r->tail_cache = 0;
+    r->logging = 0;
+    r->tail = 0;
+    r->dropped_reported = 0;
+    
+    if (pthread_setspecific(blog_async.key, r) != 0) {
+        goto fail2;
+    }
+    
+    ASSERT_FORCE(pthread_mutex_lock(&blog_async.rings_mutex) == 0)
+    LinkedList1_Append(&blog_async.rings, &r->list_node);
+    ASSERT_FORCE(pthread_mutex_unlock(&blog_async.rings_mutex) == 0)
+    
+    return r;
+    
+fail2:
+    free(r->buf);
+fail1:
+    free(r);
+fail0:
+    return NULL;
+}
+
+static void ring_free (struct ring *r)
+{
+    free(r->buf);
+    free(r);
+}
+
+static void recorder_begin (void)
+{
+    struct ring *r = cur_ring;
+    
+    if (!r) {
+        if (!(r = ring_create())) {
+            __atomic_fetch_add(&blog_async.lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        cur_ring = r;
+    }
+    
+    ASSERT(!r->logging)
+    
+    r->logging = 1;
+    r->rec_len = sizeof(struct record_header);
+}
+
+static void recorder_append (const char *fmt, va_list vl)
+{
+    struct ring *r = cur_ring;
+    if (!r) {
+        return;
+    }
+    ASSERT(r->logging)
+    
+    size_t rec_len = r->rec_len;
+    
+    va_list vl2;
+    va_copy(vl2, vl);
+    int res = record_fmt(r, fmt, vl2);
+    va_end(vl2);
+    
+    if (!res) {
+        // can't record this one, format it now
+        r->rec_len = rec_len;
+        
+        char buf[sizeof(blog_global.logbuf)];
+        int w = vsnprintf(buf, sizeof(buf), fmt, vl);
+        if (w > 0) {
+            record_bytes_segment(r, buf, (w >= sizeof(buf) ? sizeof(buf) - 1 : w));
+        }
+    }
+}
+
+static void recorder_append_bytes (MemRef data)
+{
+    struct ring *r = cur_ring;
+    if (!r) {
+        return;
+    }
+    ASSERT(r->logging)
+    
+    record_bytes_segment(r, data.ptr, data.len);
+}
+
+static void recorder_finish (int channel, int level)
+{
+    struct ring *r = cur_ring;
+    if (!r) {
+        return;
+    }
+    ASSERT(r->logging)
+    
+    r->logging = 0;
+    
+    struct record_header h;
+    h.len = r->rec_len;
+    h.channel = channel;
+    h.level = level;
+    h.unused = 0;
+    memcpy(r->rec, &h, sizeof(h));
+    
+    // check for space, looking at the writer's position only if needed
+    size_t head = r->head;
+    if (r->rec_len > r->mask + 1 - (head - r->tail_cache)) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (r->rec_len > r->mask + 1 - (head - r->tail_cache)) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    
+    // copy the record into the ring, possibly wrapping around
+    size_t pos = head & r->mask;
+    size_t first = r->mask + 1 - pos;
+    if (first > r->rec_len) {
+        first = r->rec_len;
+    }
+    memcpy(r->buf + pos, r->rec, first);
+    memcpy(r->buf, r->rec + first, r->rec_len - first);
+    
+    __atomic_store_n(&r->head, head + r->rec_len, __ATOMIC_RELEASE);
+    
+    // wake up the writer if it is going to sleep; pairs with the fence in writer_thread
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&blog_async.sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&blog_async.sleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&blog_async.sem);
+    }
+}
+
+static const _BLog_recorder recorder = {
+    recorder_begin,
+    recorder_append,
+    recorder_append_bytes,
+    recorder_finish
+};
+
+static void ring_copy_out (struct ring *r, size_t at, void *data, size_t len)
+{
+    size_t pos = at & r->mask;
+    size_t first = r->mask + 1 - pos;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, r->buf + pos, first);
+    memcpy((char *)data + first, r->buf, len - first);
+}
+
+static void out_advance (int w)
+{
+    if (w < 0) {
+        return;
+    }
+    
+    if (w >= sizeof(blog_async.out) - blog_async.out_pos) {
+        blog_async.out_pos = sizeof(blog_async.out) - 1;
+    } else {
+        blog_async.out_pos += w;
+    }
+}
+
+static void out_literal (const char *data, size_t len)
+{
+    size_t avail = (sizeof(blog_async.out) - 1) - blog_async.out_pos;
+    len = (len > avail ? avail : len);
+    
+    memcpy(blog_async.out + blog_async.out_pos, data, len);
+    blog_async.out_pos += len;
+    blog_async.out[blog_async.out_pos] = '\0';
+}
+
+static const char * rec_get (const char *p, void *data, size_t len)
+{
+    memcpy(data, p, len);
+    return p + len;
+}
+
+#define FORMAT_ARG(value) ( \
+    s.width_star ? \
+        (s.prec_star ? snprintf(dst, avail, spec, width, prec, (value)) : snprintf(dst, avail, spec, width, (value))) : \
+        (s.prec_star ? snprintf(dst, avail, spec, prec, (value)) : snprintf(dst, avail, spec, (value))) \
+)
+
+static const char * write_fmt (const char *p)
+{
+    const char *fmt;
+    p = rec_get(p, &fmt, sizeof(fmt));
+    
+    while (1) {
+        const char *pct = strchr(fmt, '%');
+        out_literal(fmt, (pct ? pct - fmt : strlen(fmt)));
+        if (!pct) {
+            break;
+        }
+        
+        struct spec s;
+        fmt = parse_spec(pct, &s);
+        ASSERT(fmt)
+        
+        char spec[SPEC_MAX];
+        memcpy(spec, s.start, s.len);
+        spec[s.len] = '\0';
+        
+        int width = 0;
+        int prec = 0;
+        if (s.width_star) {
+            p = rec_get(p, &width, sizeof(width));
+        }
+        if (s.prec_star) {
+            p = rec_get(p, &prec, sizeof(prec));
+        }
+        
+        char *dst = blog_async.out + blog_async.out_pos;
+        size_t avail = sizeof(blog_async.out) - blog_async.out_pos;
+        int w = 0;
+        
+        switch (s.arg) {
+            case ARG_NONE: {
+                out_literal("%", 1);
+            } break;
+            
+            case ARG_INT: {
+                uintmax_t v;
+                p = rec_get(p, &v, sizeof(v));
+                switch (s.length) {
+                    case LEN_L: w = FORMAT_ARG((long)v); break;
+                    case LEN_LL: w = FORMAT_ARG((long long)v); break;
+                    case LEN_J: w = FORMAT_ARG((intmax_t)v); break;
+                    case LEN_Z: w = FORMAT_ARG((size_t)v); break;
+                    case LEN_T: w = FORMAT_ARG((ptrdiff_t)v); break;
+                    default: w = FORMAT_ARG((int)v); break;
+                }
+            } break;
+            
+            case ARG_UINT: {
+                uintmax_t v;
+                p = rec_get(p, &v, sizeof(v));
+                switch (s.length) {
+                    case LEN_L: w = FORMAT_ARG((unsigned long)v); break;
+                    case LEN_LL: w = FORMAT_ARG((unsigned long long)v); break;
+                    case LEN_J: w = FORMAT_ARG((uintmax_t)v); break;
+                    case LEN_Z: w = FORMAT_ARG((size_t)v); break;
+                    case LEN_T: w = FORMAT_ARG((ptrdiff_t)v); break;
+                    default: w = FORMAT_ARG((unsigned int)v); break;
+                }
+            } break;
+            
+            case ARG_DOUBLE: {
+                double v;
+                p = rec_get(p, &v, sizeof(v));
+                w = FORMAT_ARG(v);
+            } break;
+            
+            case ARG_LDOUBLE: {
+                long double v;
+                p = rec_get(p, &v, sizeof(v));
+                w = FORMAT_ARG(v);
+            } break;
+            
+            case ARG_PTR: {
+                void *v;
+                p = rec_get(p, &v, sizeof(v));
+                w = FORMAT_ARG(v);
+            } break;
+            
+            case ARG_STR: {
+                uint32_t len;
+                p = rec_get(p, &len, sizeof(len));
+                const char *str = NULL;
+                if (len != UINT32_MAX) {
+                    str = p;
+                    p += (size_t)len + 1;
+                }
+                w = FORMAT_ARG(str);
+            } break;
+            
+            default: ASSERT(0);
+        }
+        
+        out_advance(w);
+    }
+    
+    return p;
+}
+
+static void write_record (const char *rec)
+{
+    struct record_header h;
+    memcpy(&h, rec, sizeof(h));
+    
+    blog_async.out_pos = 0;
+    blog_async.out[0] = '\0';
+    
+    const char *p = rec + sizeof(h);
+    const char *end = rec + h.len;
+    
+    while (p < end) {
+        uint8_t type;
+        p = rec_get(p, &type, sizeof(type));
+        
+        switch (type) {
+            case SEG_FMT: {
+                p = write_fmt(p);
+            } break;
+            
+            case SEG_BYTES: {
+                uint32_t len;
+                p = rec_get(p, &len, sizeof(len));
+                out_literal(p, len);
+                p += len;
+            } break;
+            
+            default: ASSERT(0);
+        }
+    }
+    
+    ASSERT(p == end)
+    
+    blog_async.log_func(h.channel, h.level, blog_async.out);
+}
+
+static void report_dropped (size_t num, const char *reason)
+{
+    // BLog_WouldLog can't be used here, BLog_Free may have already been called
+    if (blog_global.channels[BLOG_CURRENT_CHANNEL].loglevel < BLOG_WARNING) {
+        return;
+    }
+    
+    snprintf(blog_async.out, sizeof(blog_async.out), "dropped %zu messages (%s)", num, reason);
+    blog_async.log_func(BLOG_CURRENT_CHANNEL, BLOG_WARNING, blog_async.out);
+}
+
+static int drain_ring (struct ring *r)
+{
+    int count = 0;
+    
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    
+    while (r->tail != head) {
+        struct record_header h;
+        ring_copy_out(r, r->tail, &h, sizeof(h));
+        ASSERT(h.len >= sizeof(h))
+        ASSERT(h.len <= RECORD_MAX)
+        ring_copy_out(r, r->tail, blog_async.rec, h.len);
+        
+        // give the space back before formatting
+        __atomic_store_n(&r->tail, r->tail + h.len, __ATOMIC_RELEASE);
+        
+        write_record(blog_async.rec);
+        count++;
+    }
+    
+    size_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->dropped_reported) {
+        report_dropped(dropped - r->dropped_reported, "ring buffer full");
+        r->dropped_reported = dropped;
+    }
+    
+    return count;
+}
+
+static int drain_all (void)
+{
+    int count = 0;
+    
+    ASSERT_FORCE(pthread_mutex_lock(&blog_async.rings_mutex) == 0)
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&blog_async.rings);
+    while (node) {
+        struct ring *r = UPPER_OBJECT(node, struct ring, list_node);
+        node = LinkedList1Node_Next(node);
+        
+        // check for death first so that we drain everything the thread wrote
+        int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+        
+        count += drain_ring(r);
+        
+        if (dead) {
+            LinkedList1_Remove(&blog_async.rings, &r->list_node);
+            ring_free(r);
+        }
+    }
+    
+    ASSERT_FORCE(pthread_mutex_unlock(&blog_async.rings_mutex) == 0)
+    
+    size_t lost = __atomic_load_n(&blog_async.lost, __ATOMIC_RELAXED);
+    if (lost != blog_async.lost_reported) {
+        report_dropped(lost - blog_async.lost_reported, "out of memory");
+        blog_async.lost_reported = lost;
+    }
+    
+    return count;
+}
+
+static int any_pending (void)
+{
+    int res = 0;
+    
+    ASSERT_FORCE(pthread_mutex_lock(&blog_async.rings_mutex) == 0)
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&blog_async.rings); node; node = LinkedList1Node_Next(node)) {
+        struct ring *r = UPPER_OBJECT(node, struct ring, list_node);
+        if (__atomic_load_n(&r->head, __ATOMIC_RELAXED) != r->tail || __atomic_load_n(&r->dead, __ATOMIC_RELAXED)) {
+            res = 1;
+            break;
+        }
+    }
+    
+    ASSERT_FORCE(pthread_mutex_unlock(&blog_async.rings_mutex) == 0)
+    
+    return res;
+}
+
+static void * writer_thread (void *unused)
+{
+    while (1) {
+        // everything committed before quitting was set will be drained below
+        int quitting = __atomic_load_n(&blog_async.quitting, __ATOMIC_ACQUIRE);
+        
+        if (drain_all() > 0) {
+            continue;
+        }
+        
+        if (quitting) {
+            break;
+        }
+        
+        // announce that we're going to sleep, then check again, so that
+        // a message committed in between is not missed
+        __atomic_store_n(&blog_async.sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        
+        if (any_pending() || __atomic_load_n(&blog_async.quitting, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&blog_async.sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        
+        while (sem_wait(&blog_async.sem) < 0 && errno == EINTR);
+    }
+    
+    return NULL;
+}
+
+static void async_free (void)
+{
+    // stop the writer; it writes out everything before exiting
+    __atomic_store_n(&blog_async.quitting, 1, __ATOMIC_SEQ_CST);
+    sem_post(&blog_async.sem);
+    ASSERT_FORCE(pthread_join(blog_async.thread, NULL) == 0)
+    
+    // free remaining rings
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&blog_async.rings))) {
+        struct ring *r = UPPER_OBJECT(node, struct ring, list_node);
+        LinkedList1_Remove(&blog_async.rings, &r->list_node);
+        ring_free(r);
+    }
+    cur_ring = NULL;
+    
+    sem_destroy(&blog_async.sem);
+    pthread_mutex_destroy(&blog_async.rings_mutex);
+    pthread_key_delete(blog_async.key);
+    
+    // free the original logger
+    blog_async.free_func();
+}
+
+int BLog_MakeAsync (size_t ring_size)
+{
+    ASSERT(blog_global.initialized)
+    ASSERT(!blog_global.recorder)
+    
+    // the ring size must be a power of two, and big enough for any record
+    size_t size = 2 * RECORD_MAX;
+    while (size < ring_size) {
+        if (size > SIZE_MAX / 2) {
+            BLog(BLOG_ERROR, "ring size too large");
+            goto fail0;
+        }
+        size *= 2;
+    }
+    
+    blog_async.log_func = blog_global.log_func;
+    blog_async.free_func = blog_global.free_func;
+    blog_async.ring_size = size;
+    blog_async.lost = 0;
+    blog_async.lost_reported = 0;
+    blog_async.sleeping = 0;
+    blog_async.quitting = 0;
+    LinkedList1_Init(&blog_async.rings);
+    cur_ring = NULL;
+    
+    if (pthread_key_create(&blog_async.key, ring_thread_exit) != 0) {
+        BLog(BLOG_ERROR, "pthread_key_create failed");
+        goto fail0;
+    }
+    
+    if (pthread_mutex_init(&blog_async.rings_mutex, NULL) != 0) {
+        BLog(BLOG_ERROR, "pthread_mutex_init failed");
+        goto fail1;
+    }
+    
+    if (sem_init(&blog_async.sem, 0, 0) < 0) {
+        BLog(BLOG_ERROR, "sem_init failed");
+        goto fail2;
+    }
+    
+    // start the writer with all signals blocked, so that it doesn't get
+    // signals meant to be handled by the main thread
+    sigset_t sset_all;
+    sigfillset(&sset_all);
+    sigset_t sset_old;
+    if (pthread_sigmask(SIG_SETMASK, &sset_all, &sset_old) != 0) {
+        BLog(BLOG_ERROR, "pthread_sigmask failed");
+        goto fail3;
+    }
+    
+    int res = pthread_create(&blog_async.thread, NULL, writer_thread, NULL);
+    
+    ASSERT_FORCE(pthread_sigmask(SIG_SETMASK, &sset_old, NULL) == 0)
+    
+    if (res != 0) {
+        BLog(BLOG_ERROR, "pthread_create failed");
+        goto fail3;
+    }
+    
+    blog_global.free_func = async_free;
+    blog_global.recorder = &recorder;
+    
+    return 1;
+    
+fail3:
+    sem_destroy(&blog_async.sem);
+fail2:
+    pthread_mutex_destroy(&blog_async.rings_mutex);
+fail1:
+    pthread_key_delete(blog_async.key);
+fail0:
+    return 0;
+}
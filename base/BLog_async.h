@@ -0,0 +1,73 @@
+/**
+ * @file BLog_async.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Asynchronous BLog backend.
+ * 
+ * Once enabled, logging a message does not format it. Instead, the format
+ * string pointer and the raw arguments (with %s strings copied) are recorded
+ * into a ring buffer belonging to the logging thread, without taking any lock.
+ * A dedicated writer thread formats the messages and passes them to the
+ * logger which was set up before (stdout, syslog...).
+ * 
+ * Each thread's ring buffer has a fixed size. If a message does not fit, it is
+ * dropped and counted; the writer reports the number of dropped messages.
+ * Messages from different threads may be written out of order relative to each
+ * other. Pending messages are flushed by {@link BLog_Free}.
+ * 
+ * Format strings must stay valid until the message is written; in practice
+ * they are string literals. Conversions which cannot be recorded (%n, %m,
+ * wide characters, positional arguments) make the message be formatted in the
+ * logging thread instead.
+ */
+
+#ifndef BADVPN_BLOG_ASYNC_H
+#define BADVPN_BLOG_ASYNC_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+#define BLOG_ASYNC_DEFAULT_RING_SIZE 1048576
+
+/**
+ * Makes the current logger asynchronous.
+ * Must be called after one of the BLog_Init* functions, before any other
+ * thread logs anything. Afterwards {@link BLog_Free} stops the writer thread,
+ * after it has written all pending messages, and then frees the original logger.
+ * All other threads must have stopped logging by then.
+ * 
+ * @param ring_size size of each thread's ring buffer in bytes. Will be rounded
+ *                  up to a power of two. Use BLOG_ASYNC_DEFAULT_RING_SIZE if unsure.
+ * @return 1 on success, 0 on failure. On failure, the logger is left as it was.
+ */
+int BLog_MakeAsync (size_t ring_size) WARN_UNUSED;
+
+#endif
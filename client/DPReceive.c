@@ -104,12 +104,24 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
         goto out;
     }
     
-    // inform sink of received packet
-    if (peer->dp_sink) {
+    // group frames don't report keep-alive state, so only inform sink of other packets
+    if (peer->dp_sink && !(flags & DATAPROTO_FLAGS_GROUP)) {
         DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES));
     }
     
-    if (num_ids == 1) {
+    if (num_ids == 0 && (flags & DATAPROTO_FLAGS_GROUP)) {
+        // group frames are sent by their source directly
+        if (from_id != peer->peer_id) {
+            BLog(BLOG_WARNING, "group frame source must be the sending peer");
+            goto out;
+        }
+        
+        // let the frame decider analyze the frame
+        FrameDeciderPeer_Analyze(peer->decider_peer, data, data_len);
+        
+        // pass frame to device
+        local = 1;
+    } else if (num_ids == 1) {
         // find source peer
         if (!(src_peer = find_peer(device, from_id))) {
             BLog(BLOG_INFO, "source peer %d not known", (int)from_id);
@@ -168,7 +180,7 @@ out:
     }
 }
 
-int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time)
+int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time, int relay_headroom, int relay_tailroom)
 {
     ASSERT(device_mtu >= 0)
     ASSERT(device_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
@@ -187,7 +199,7 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
     o->packet_mtu = DATAPROTO_MAX_OVERHEAD + o->device_mtu;
     
     // init relay router
-    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, o->reactor)) {
+    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, relay_headroom, relay_tailroom, o->reactor)) {
         BLog(BLOG_ERROR, "DPRelayRouter_Init failed");
         goto fail0;
     }
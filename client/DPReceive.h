@@ -82,7 +82,7 @@ typedef struct DPReceiveReceiver_s {
     DebugObject d_obj;
 } DPReceiveReceiver;
 
-int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time) WARN_UNUSED;
+int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time, int relay_headroom, int relay_tailroom) WARN_UNUSED;
 void DPReceiveDevice_Free (DPReceiveDevice *o);
 void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id);
 
@@ -141,10 +141,12 @@ static void router_dp_source_handler (DPRelayRouter *o, const uint8_t *frame, in
     o->current_flow = NULL;
 }
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int headroom, int tailroom, BReactor *reactor)
 {
     ASSERT(frame_mtu >= 0)
     ASSERT(frame_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     
     // init arguments
     o->frame_mtu = frame_mtu;
@@ -153,7 +155,7 @@ int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
     BufferWriter_Init(&o->writer, frame_mtu, BReactor_PendingGroup(reactor));
     
     // init DataProtoSource
-    if (!DataProtoSource_Init(&o->dp_source, BufferWriter_GetOutput(&o->writer), (DataProtoSource_handler)router_dp_source_handler, o, reactor)) {
+    if (!DataProtoSource_Init(&o->dp_source, BufferWriter_GetOutput(&o->writer), headroom, tailroom, (DataProtoSource_handler)router_dp_source_handler, o, reactor)) {
         BLog(BLOG_ERROR, "DataProtoSource_Init failed");
         goto fail1;
     }
@@ -74,7 +74,7 @@ struct DPRelay_flow {
     LinkedList1Node sink_list_node;
 };
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor) WARN_UNUSED;
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int headroom, int tailroom, BReactor *reactor) WARN_UNUSED;
 void DPRelayRouter_Free (DPRelayRouter *o);
 void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets, int inactivity_time);
 
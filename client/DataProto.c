@@ -224,13 +224,17 @@ void flow_buffer_qflow_handler_busy (struct DataProtoFlow_buffer *b)
     flow_buffer_finish_detach(b);
 }
 
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user)
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, int headroom, int tailroom, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user)
 {
     ASSERT(PacketPassInterface_HasCancel(output))
     ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTO_MAX_OVERHEAD)
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     
     // init arguments
     o->reactor = reactor;
+    o->headroom = headroom;
+    o->tailroom = tailroom;
     o->handler = handler;
     o->user = user;
     
@@ -261,8 +265,8 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
     PacketRecvBlocker_Init(&o->ka_blocker, DataProtoKeepaliveSource_GetOutput(&o->ka_source), BReactor_PendingGroup(o->reactor));
     
     // init keepalive buffer
-    if (!SinglePacketBuffer_Init(&o->ka_buffer, PacketRecvBlocker_GetOutput(&o->ka_blocker), PacketPassFairQueueFlow_GetInput(&o->ka_qflow), BReactor_PendingGroup(o->reactor))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
+    if (!SinglePacketBuffer_Init2(&o->ka_buffer, PacketRecvBlocker_GetOutput(&o->ka_blocker), PacketPassFairQueueFlow_GetInput(&o->ka_qflow), o->headroom, o->tailroom, BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "SinglePacketBuffer_Init2 failed");
         goto fail2;
     }
     
@@ -357,12 +361,16 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
     refresh_up_job(o);
 }
 
-int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor)
+int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, int headroom, int tailroom, DataProtoSource_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(PacketRecvInterface_GetMTU(input) <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     ASSERT(handler)
     
     // init arguments
+    o->headroom = headroom;
+    o->tailroom = tailroom;
     o->handler = handler;
     o->user = user;
     o->reactor = reactor;
@@ -371,7 +379,7 @@ int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataPr
     o->frame_mtu = PacketRecvInterface_GetMTU(input);
     
     // init router
-    if (!PacketRouter_Init(&o->router, DATAPROTO_MAX_OVERHEAD + o->frame_mtu, DATAPROTO_MAX_OVERHEAD, input, (PacketRouter_handler)source_router_handler, o, BReactor_PendingGroup(reactor))) {
+    if (!PacketRouter_Init(&o->router, DATAPROTO_MAX_OVERHEAD + o->frame_mtu, o->headroom, o->tailroom, DATAPROTO_MAX_OVERHEAD, input, (PacketRouter_handler)source_router_handler, o, BReactor_PendingGroup(reactor))) {
         BLog(BLOG_ERROR, "PacketRouter_Init failed");
         goto fail0;
     }
@@ -433,7 +441,7 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     }
     
     // init route buffer
-    if (!RouteBuffer_Init(&b->rbuf, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, buf_out, num_packets)) {
+    if (!RouteBuffer_Init(&b->rbuf, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, source->headroom, source->tailroom, buf_out, num_packets)) {
         BLog(BLOG_ERROR, "RouteBuffer_Init failed");
         goto fail1;
     }
@@ -520,6 +528,8 @@ void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink)
     ASSERT(!o->sink_desired)
     ASSERT(sink)
     ASSERT(o->source->frame_mtu <= sink->frame_mtu)
+    ASSERT(o->source->headroom >= sink->headroom)
+    ASSERT(o->source->tailroom >= sink->tailroom)
     struct DataProtoFlow_buffer *b = o->b;
     
     if (b->sink) {
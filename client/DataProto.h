@@ -62,6 +62,8 @@ struct DataProtoFlow_buffer;
 typedef struct {
     BReactor *reactor;
     int frame_mtu;
+    int headroom;
+    int tailroom;
     PacketPassFairQueue queue;
     PacketPassInactivityMonitor monitor;
     PacketPassNotifier notifier;
@@ -89,6 +91,8 @@ typedef struct {
     void *user;
     BReactor *reactor;
     int frame_mtu;
+    int headroom;
+    int tailroom;
     PacketRouter router;
     uint8_t *current_buf;
     int current_recv_len;
@@ -127,6 +131,11 @@ struct DataProtoFlow_buffer {
  * @param reactor reactor we live in
  * @param output output interface. Must support cancel functionality. Its MTU must be
  *               >=DATAPROTO_MAX_OVERHEAD.
+ * @param headroom number of bytes before each packet which the output may modify
+ *                 until it is done with the packet, allowing it to prepend headers
+ *                 in place. Must be >=0.
+ * @param tailroom number of bytes after each packet which the output may modify
+ *                 until it is done with the packet. Must be >=0.
  * @param keepalive_time keepalive time
  * @param tolerance_time after how long of not having received anything from the peer
  *                       to consider the link down
@@ -134,7 +143,7 @@ struct DataProtoFlow_buffer {
  * @param user value to pass to handler
  * @return 1 on success, 0 on failure
  */
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user) WARN_UNUSED;
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, int headroom, int tailroom, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user) WARN_UNUSED;
 
 /**
  * Frees the sink.
@@ -159,13 +168,19 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving);
  * 
  * @param o the object
  * @param input frame input. Its input MTU must be <= INT_MAX - DATAPROTO_MAX_OVERHEAD.
+ * @param headroom number of bytes to reserve before each buffered packet. Must be >=0.
+ *                 Flows of this source can only be attached to sinks whose headroom
+ *                 is not larger.
+ * @param tailroom number of bytes to reserve after each buffered packet. Must be >=0.
+ *                 Flows of this source can only be attached to sinks whose tailroom
+ *                 is not larger.
  * @param handler handler called when a frame arrives to allow the user to route it to
  *                appropriate {@link DataProtoFlow}'s.
  * @param user value passed to handler
  * @param reactor reactor we live in
  * @return 1 on success, 0 on failure
  */
-int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
+int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, int headroom, int tailroom, DataProtoSource_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
 
 /**
  * Frees the source.
@@ -222,7 +237,8 @@ void DataProtoFlow_Route (DataProtoFlow *o, int more);
  * 
  * @param o the object
  * @param sink sink to attach to. This flow's frame_mtu must be <=
- *             (output MTU of sink) - DATAPROTO_MAX_OVERHEAD.
+ *             (output MTU of sink) - DATAPROTO_MAX_OVERHEAD. The headroom and tailroom
+ *             of this flow's source must be >= those of the sink.
  */
 void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink);
 
@@ -0,0 +1,325 @@
+/**
+ * @file DatagramGroupEncoder.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/balign.h>
+#include <protocol/dataproto.h>
+#include <protocol/fragmentproto.h>
+#include <base/BLog.h>
+
+#include <client/DatagramGroupEncoder.h>
+
+#include <generated/blog_channel_DatagramGroupEncoder.h>
+
+static DatagramGroupEncoder_packet * packet_new (DatagramGroupEncoder *o);
+static void feed_next (DatagramGroupEncoder *o);
+static void disassembler_input_handler_done (DatagramGroupEncoder *o);
+static void encoder_output_handler_done (DatagramGroupEncoder *o, int data_len);
+
+DatagramGroupEncoder_packet * packet_new (DatagramGroupEncoder *o)
+{
+    // allocate packet and data together
+    DatagramGroupEncoder_packet *p = (DatagramGroupEncoder_packet *)BAlloc(sizeof(*p) + DATAGRAMGROUP_CHANNEL_HEADER_SIZE + o->carrier_mtu);
+    if (!p) {
+        return NULL;
+    }
+    
+    p->refcnt = 1;
+    p->data = (uint8_t *)(p + 1);
+    p->refs = NULL;
+    
+    // write channel header
+    p->data[0] = DATAGRAMGROUP_CHANNEL_GROUP;
+    
+    return p;
+}
+
+void feed_next (DatagramGroupEncoder *o)
+{
+    ASSERT(o->frames_fed <= o->frames_used)
+    
+    if (o->feeding || o->frames_fed == o->frames_used) {
+        return;
+    }
+    
+    // give next frame to disassembler
+    struct DatagramGroupEncoder_frame *f = &o->frames[(o->frames_start + o->frames_fed) % o->num_frames];
+    PacketPassInterface_Sender_Send(FragmentProtoDisassembler_GetInput(&o->disassembler), f->data, f->len);
+    
+    o->feeding = 1;
+    o->frames_fed++;
+}
+
+void disassembler_input_handler_done (DatagramGroupEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->feeding)
+    
+    // frame was fed
+    o->feeding = 0;
+    
+    feed_next(o);
+}
+
+void encoder_output_handler_done (DatagramGroupEncoder *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->frames_used > 0)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->carrier_mtu)
+    
+    DatagramGroupEncoder_packet *p = o->out_packet;
+    p->len = DATAGRAMGROUP_CHANNEL_HEADER_SIZE + data_len;
+    
+    // the datagram belongs to the oldest frame; datagrams never contain
+    // chunks of more than one frame because latency is disabled
+    struct DatagramGroupEncoder_frame *f = &o->frames[o->frames_start];
+    ASSERT(o->frames_fed > 0)
+    ASSERT(f->datagrams_left > 0)
+    
+    // allocate buffer for the next datagram; if this fails,
+    // drop this datagram and reuse its buffer
+    if (!(o->out_packet = packet_new(o))) {
+        BLog(BLOG_ERROR, "failed to allocate datagram");
+        o->out_packet = p;
+    } else {
+        // allocate references
+        if (!(p->refs = (DatagramGroupEncoder_ref *)BAllocArray(f->num_dest_ids, sizeof(p->refs[0])))) {
+            BLog(BLOG_ERROR, "failed to allocate references");
+        } else {
+            // pass datagram to destinations
+            for (int i = 0; i < f->num_dest_ids; i++) {
+                p->refs[i].packet = p;
+                o->handler_datagram(o->user, f->dest_ids[i], &p->refs[i]);
+            }
+        }
+        
+        // release our reference
+        DatagramGroupEncoder_packet_Unref(p);
+    }
+    
+    // free frame after its last datagram
+    if (--f->datagrams_left == 0) {
+        o->frames_start = (o->frames_start + 1) % o->num_frames;
+        o->frames_used--;
+        o->frames_fed--;
+    }
+    
+    // receive next datagram
+    PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&o->encoder), o->out_packet->data + DATAGRAMGROUP_CHANNEL_HEADER_SIZE);
+}
+
+int DatagramGroupEncoder_Init (DatagramGroupEncoder *o, BReactor *reactor, peerid_t source_id, int frame_mtu, int socket_mtu,
+                               struct spproto_security_params sp_params, int num_frames, int max_dest_ids, BThreadWorkDispatcher *twd,
+                               void *user, DatagramGroupEncoder_handler_datagram handler_datagram)
+{
+    ASSERT(frame_mtu >= 0)
+    ASSERT(frame_mtu <= UINT16_MAX - sizeof(struct dataproto_header))
+    ASSERT(num_frames > 0)
+    ASSERT(max_dest_ids > 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->source_id = source_id;
+    o->frame_mtu = frame_mtu;
+    o->max_dest_ids = max_dest_ids;
+    o->num_frames = num_frames;
+    o->user = user;
+    o->handler_datagram = handler_datagram;
+    o->sp_params = datagramgroup_sp_params(sp_params);
+    
+    // calculate SPProto payload MTU
+    if ((o->payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, socket_mtu - DATAGRAMGROUP_CHANNEL_HEADER_SIZE)) <= (int)sizeof(struct fragmentproto_chunk_header)) {
+        BLog(BLOG_ERROR, "socket MTU is too small");
+        goto fail0;
+    }
+    
+    // calculate SPProto carrier MTU
+    if ((o->carrier_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->payload_mtu)) < 0) {
+        BLog(BLOG_ERROR, "spproto_carrier_mtu_for_payload_mtu failed !?");
+        goto fail0;
+    }
+    
+    int input_mtu = sizeof(struct dataproto_header) + o->frame_mtu;
+    
+    // allocate frames
+    if (!(o->frames = (struct DatagramGroupEncoder_frame *)BAllocArray(o->num_frames, sizeof(o->frames[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // allocate frame data
+    if (!(o->frames_data = (uint8_t *)BAllocArray(o->num_frames, input_mtu))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    // allocate frame destinations
+    if (!(o->frames_dest_ids = (peerid_t *)BAllocArray2(o->num_frames, o->max_dest_ids, sizeof(peerid_t)))) {
+        BLog(BLOG_ERROR, "BAllocArray2 failed");
+        goto fail2;
+    }
+    
+    // init frames
+    for (int i = 0; i < o->num_frames; i++) {
+        o->frames[i].data = o->frames_data + (size_t)i * input_mtu;
+        o->frames[i].dest_ids = o->frames_dest_ids + (size_t)i * o->max_dest_ids;
+    }
+    o->frames_start = 0;
+    o->frames_used = 0;
+    o->frames_fed = 0;
+    o->feeding = 0;
+    
+    // init disassembler; latency is disabled so that every datagram
+    // contains chunks of only one frame
+    FragmentProtoDisassembler_Init(&o->disassembler, o->reactor, input_mtu, o->payload_mtu, -1, -1);
+    PacketPassInterface_Sender_Init(FragmentProtoDisassembler_GetInput(&o->disassembler), (PacketPassInterface_handler_done)disassembler_input_handler_done, o);
+    
+    // init encoder
+    if (!SPProtoEncoder_Init(&o->encoder, FragmentProtoDisassembler_GetOutput(&o->disassembler), o->sp_params, 0, 1, BReactor_PendingGroup(o->reactor), twd)) {
+        BLog(BLOG_ERROR, "SPProtoEncoder_Init failed");
+        goto fail3;
+    }
+    PacketRecvInterface_Receiver_Init(SPProtoEncoder_GetOutput(&o->encoder), (PacketRecvInterface_handler_done)encoder_output_handler_done, o);
+    
+    // allocate first datagram
+    if (!(o->out_packet = packet_new(o))) {
+        BLog(BLOG_ERROR, "failed to allocate datagram");
+        goto fail4;
+    }
+    
+    // start receiving datagrams
+    PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&o->encoder), o->out_packet->data + DATAGRAMGROUP_CHANNEL_HEADER_SIZE);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail4:
+    SPProtoEncoder_Free(&o->encoder);
+fail3:
+    FragmentProtoDisassembler_Free(&o->disassembler);
+    BFree(o->frames_dest_ids);
+fail2:
+    BFree(o->frames_data);
+fail1:
+    BFree(o->frames);
+fail0:
+    return 0;
+}
+
+void DatagramGroupEncoder_Free (DatagramGroupEncoder *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free encoder
+    SPProtoEncoder_Free(&o->encoder);
+    
+    // free disassembler
+    FragmentProtoDisassembler_Free(&o->disassembler);
+    
+    // release datagram being encoded
+    DatagramGroupEncoder_packet_Unref(o->out_packet);
+    
+    // free frames
+    BFree(o->frames_dest_ids);
+    BFree(o->frames_data);
+    BFree(o->frames);
+}
+
+void DatagramGroupEncoder_SetEncryptionKey (DatagramGroupEncoder *o, uint8_t *encryption_key)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    
+    SPProtoEncoder_SetEncryptionKey(&o->encoder, encryption_key);
+}
+
+void DatagramGroupEncoder_SubmitFrame (DatagramGroupEncoder *o, const uint8_t *frame, int frame_len, const peerid_t *dest_ids, int num_dest_ids)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(frame_len >= 0)
+    ASSERT(frame_len <= o->frame_mtu)
+    ASSERT(num_dest_ids > 0)
+    ASSERT(num_dest_ids <= o->max_dest_ids)
+    
+    // check space
+    if (o->frames_used == o->num_frames) {
+        BLog(BLOG_NOTICE, "buffer full");
+        return;
+    }
+    
+    struct DatagramGroupEncoder_frame *f = &o->frames[(o->frames_start + o->frames_used) % o->num_frames];
+    
+    // write header
+    struct dataproto_header header;
+    header.flags = htol8(DATAPROTO_FLAGS_GROUP);
+    header.from_id = htol16(o->source_id);
+    header.num_peer_ids = htol16(0);
+    memcpy(f->data, &header, sizeof(header));
+    
+    // write frame
+    memcpy(f->data + sizeof(header), frame, frame_len);
+    f->len = sizeof(header) + frame_len;
+    
+    // write destinations
+    memcpy(f->dest_ids, dest_ids, num_dest_ids * sizeof(dest_ids[0]));
+    f->num_dest_ids = num_dest_ids;
+    
+    // every datagram is filled with a single chunk of the frame, except the last one
+    f->datagrams_left = bdivide_up(f->len, o->payload_mtu - sizeof(struct fragmentproto_chunk_header));
+    
+    o->frames_used++;
+    
+    feed_next(o);
+}
+
+void DatagramGroupEncoder_packet_Ref (DatagramGroupEncoder_packet *p)
+{
+    ASSERT(p->refcnt > 0)
+    
+    p->refcnt++;
+}
+
+void DatagramGroupEncoder_packet_Unref (DatagramGroupEncoder_packet *p)
+{
+    ASSERT(p->refcnt > 0)
+    
+    if (--p->refcnt > 0) {
+        return;
+    }
+    
+    if (p->refs) {
+        BFree(p->refs);
+    }
+    BFree(p);
+}
@@ -0,0 +1,222 @@
+/**
+ * @file DatagramGroupEncoder.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Encoder of frames sent to many peers at once, which encodes each frame only
+ * once and shares the resulting datagrams among the peers' {@link DatagramPeerIO}s.
+ */
+
+#ifndef BADVPN_CLIENT_DATAGRAMGROUPENCODER_H
+#define BADVPN_CLIENT_DATAGRAMGROUPENCODER_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <protocol/scproto.h>
+#include <protocol/spproto.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <threadwork/BThreadWork.h>
+#include <client/FragmentProtoDisassembler.h>
+#include <client/SPProtoEncoder.h>
+
+// When group datagrams are enabled, every datagram of a DatagramPeerIO starts
+// with a byte identifying the channel it belongs to: either the peer's own
+// SPProto stream, or the group stream of the peer which sent it.
+#define DATAGRAMGROUP_CHANNEL_HEADER_SIZE 1
+#define DATAGRAMGROUP_CHANNEL_PEER 0
+#define DATAGRAMGROUP_CHANNEL_GROUP 1
+
+struct DatagramGroupEncoder_ref_s;
+
+/**
+ * Handler function called when a datagram has been encoded, once for each
+ * destination of the frame it belongs to.
+ * To send the datagram to the destination, the handler should pass the reference
+ * to {@link DatagramPeerIO_SubmitGroupDatagram}.
+ * 
+ * @param user as in {@link DatagramGroupEncoder_Init}
+ * @param dest_id destination peer ID, as given to {@link DatagramGroupEncoder_SubmitFrame}
+ * @param ref reference to the datagram for this destination
+ */
+typedef void (*DatagramGroupEncoder_handler_datagram) (void *user, peerid_t dest_id, struct DatagramGroupEncoder_ref_s *ref);
+
+/**
+ * An encoded datagram, shared by the destinations of the frame.
+ * It is freed when the last reference is released.
+ */
+typedef struct {
+    int refcnt;
+    int len;
+    uint8_t *data;
+    struct DatagramGroupEncoder_ref_s *refs;
+} DatagramGroupEncoder_packet;
+
+/**
+ * A destination's reference to an encoded datagram.
+ * The list node may be used by whoever holds the reference.
+ */
+typedef struct DatagramGroupEncoder_ref_s {
+    DatagramGroupEncoder_packet *packet;
+    LinkedList1Node list_node;
+} DatagramGroupEncoder_ref;
+
+struct DatagramGroupEncoder_frame {
+    uint8_t *data;
+    int len;
+    peerid_t *dest_ids;
+    int num_dest_ids;
+    int datagrams_left;
+};
+
+/**
+ * Encoder of frames sent to many peers at once, which encodes each frame only
+ * once and shares the resulting datagrams among the peers' {@link DatagramPeerIO}s.
+ * 
+ * A submitted frame is given a DataProto header with the DATAPROTO_FLAGS_GROUP flag
+ * and no destination IDs, split into datagrams with FragmentProto and encoded with
+ * SPProto, using the group key of this peer. Each datagram is encoded once, into a
+ * reference-counted buffer which starts with the DATAGRAMGROUP_CHANNEL_GROUP channel
+ * header, and the same buffer is queued for sending to every destination.
+ * Since the group key is known to all destinations, OTPs are not used.
+ * 
+ * Frames are queued in a ring buffer of a fixed number of frames, and frames
+ * submitted while it is full are dropped.
+ */
+typedef struct {
+    BReactor *reactor;
+    peerid_t source_id;
+    int frame_mtu;
+    int max_dest_ids;
+    int num_frames;
+    void *user;
+    DatagramGroupEncoder_handler_datagram handler_datagram;
+    struct spproto_security_params sp_params;
+    int payload_mtu;
+    int carrier_mtu;
+    struct DatagramGroupEncoder_frame *frames;
+    uint8_t *frames_data;
+    peerid_t *frames_dest_ids;
+    int frames_start;
+    int frames_used;
+    int frames_fed;
+    int feeding;
+    FragmentProtoDisassembler disassembler;
+    SPProtoEncoder encoder;
+    DatagramGroupEncoder_packet *out_packet;
+    DebugObject d_obj;
+} DatagramGroupEncoder;
+
+/**
+ * Returns the security parameters used for group datagrams, given the
+ * parameters used for datagrams of individual peers. This is the same,
+ * except that OTPs and packet counters are disabled.
+ * 
+ * @param sp_params security parameters of individual peers
+ * @return security parameters of group datagrams
+ */
+static struct spproto_security_params datagramgroup_sp_params (struct spproto_security_params sp_params)
+{
+    spproto_assert_security_params(sp_params);
+    
+    sp_params.otp_mode = SPPROTO_OTP_MODE_NONE;
+    sp_params.otp_num = 0;
+    sp_params.counter_mode = SPPROTO_COUNTER_MODE_NONE;
+    
+    return sp_params;
+}
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param source_id our peer ID, written to the DataProto header of frames
+ * @param frame_mtu maximum frame size. Must be >=0 and <=UINT16_MAX-sizeof(struct dataproto_header).
+ * @param socket_mtu maximum datagram size, including the channel header.
+ *                   This should be the same as given to {@link DatagramPeerIO_Init}.
+ * @param sp_params security parameters of individual peers; see {@link datagramgroup_sp_params}
+ * @param num_frames number of frames in the ring buffer. Must be >0.
+ * @param max_dest_ids maximum number of destinations of a frame. Must be >0.
+ * @param twd thread work dispatcher
+ * @param user value passed to handler
+ * @param handler_datagram handler called for every encoded datagram and destination
+ * @return 1 on success, 0 on failure
+ */
+int DatagramGroupEncoder_Init (DatagramGroupEncoder *o, BReactor *reactor, peerid_t source_id, int frame_mtu, int socket_mtu,
+                               struct spproto_security_params sp_params, int num_frames, int max_dest_ids, BThreadWorkDispatcher *twd,
+                               void *user, DatagramGroupEncoder_handler_datagram handler_datagram) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * Datagrams still referenced by destinations are not freed until they are released.
+ * 
+ * @param o the object
+ */
+void DatagramGroupEncoder_Free (DatagramGroupEncoder *o);
+
+/**
+ * Sets the group encryption key.
+ * Encryption must be enabled in the security parameters.
+ * Frames are not encoded until a key is set.
+ * 
+ * @param o the object
+ * @param encryption_key key to use
+ */
+void DatagramGroupEncoder_SetEncryptionKey (DatagramGroupEncoder *o, uint8_t *encryption_key);
+
+/**
+ * Submits a frame to be encoded and sent to the given destinations.
+ * The frame and destination IDs are copied. If the ring buffer is full,
+ * the frame is dropped.
+ * 
+ * @param o the object
+ * @param frame frame data
+ * @param frame_len frame length. Must be >=0 and <=frame_mtu.
+ * @param dest_ids destination peer IDs
+ * @param num_dest_ids number of destinations. Must be >0 and <=max_dest_ids.
+ */
+void DatagramGroupEncoder_SubmitFrame (DatagramGroupEncoder *o, const uint8_t *frame, int frame_len, const peerid_t *dest_ids, int num_dest_ids);
+
+/**
+ * Takes an additional reference to a datagram.
+ * 
+ * @param p the datagram
+ */
+void DatagramGroupEncoder_packet_Ref (DatagramGroupEncoder_packet *p);
+
+/**
+ * Releases a reference to a datagram, freeing it if it was the last one.
+ * 
+ * @param p the datagram
+ */
+void DatagramGroupEncoder_packet_Unref (DatagramGroupEncoder_packet *p);
+
+#endif
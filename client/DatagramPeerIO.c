@@ -27,6 +27,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/minmax.h>
+
 #include <client/DatagramPeerIO.h>
 
 #include <generated/blog_channel_DatagramPeerIO.h>
@@ -34,14 +38,29 @@
 #define DATAGRAMPEERIO_MODE_NONE 0
 #define DATAGRAMPEERIO_MODE_CONNECT 1
 #define DATAGRAMPEERIO_MODE_BIND 2
+#define DATAGRAMPEERIO_MODE_SHARED_CONNECT 3
+#define DATAGRAMPEERIO_MODE_SHARED_BIND 4
+
+#define DATAGRAMPEERIO_SEND_BUSY_NONE 0
+#define DATAGRAMPEERIO_SEND_BUSY_PEER 1
+#define DATAGRAMPEERIO_SEND_BUSY_GROUP 2
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
 static void init_io (DatagramPeerIO *o);
 static void free_io (DatagramPeerIO *o);
+static void init_shared_io (DatagramPeerIO *o);
+static void free_shared_io (DatagramPeerIO *o);
 static void dgram_handler (DatagramPeerIO *o, int event);
 static void reset_mode (DatagramPeerIO *o);
+static void set_counter_direction (DatagramPeerIO *o, int bound);
 static void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void send_next (DatagramPeerIO *o);
+static void send_encoder_handler_done (DatagramPeerIO *o, int data_len);
+static void send_connector_handler_done (DatagramPeerIO *o);
+static void recv_connector_handler_done (DatagramPeerIO *o, int data_len);
+static void recv_decoder_handler_done (DatagramPeerIO *o);
+static void free_send_pipeline (DatagramPeerIO *o);
 
 void init_io (DatagramPeerIO *o)
 {
@@ -73,6 +92,24 @@ void free_io (DatagramPeerIO *o)
     BDatagram_RecvAsync_Free(&o->dgram);
 }
 
+void init_shared_io (DatagramPeerIO *o)
+{
+    // connect source
+    PacketRecvConnector_ConnectInput(&o->recv_connector, DatagramSharedSocket_entry_GetRecvIf(&o->shared_entry));
+    
+    // connect sink
+    PacketPassConnector_ConnectOutput(&o->send_connector, DatagramSharedSocket_entry_GetSendIf(&o->shared_entry));
+}
+
+void free_shared_io (DatagramPeerIO *o)
+{
+    // disconnect sink
+    PacketPassConnector_DisconnectOutput(&o->send_connector);
+    
+    // disconnect source
+    PacketRecvConnector_DisconnectInput(&o->recv_connector);
+}
+
 void dgram_handler (DatagramPeerIO *o, int event)
 {
     DebugObject_Access(&o->d_obj);
@@ -92,7 +129,8 @@ void dgram_handler (DatagramPeerIO *o, int event)
 
 void reset_mode (DatagramPeerIO *o)
 {
-    ASSERT(o->mode == DATAGRAMPEERIO_MODE_NONE || o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_NONE || o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND ||
+           o->mode == DATAGRAMPEERIO_MODE_SHARED_CONNECT || o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND)
     
     if (o->mode == DATAGRAMPEERIO_MODE_NONE) {
         return;
@@ -101,25 +139,52 @@ void reset_mode (DatagramPeerIO *o)
     // remove recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, NULL, NULL);
     
-    // free I/O
-    free_io(o);
-    
-    // free datagram object
-    BDatagram_Free(&o->dgram);
+    if (o->mode == DATAGRAMPEERIO_MODE_SHARED_CONNECT || o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+        // free I/O
+        free_shared_io(o);
+        
+        // free shared socket entry
+        DatagramSharedSocket_entry_Free(&o->shared_entry);
+    } else {
+        // free I/O
+        free_io(o);
+        
+        // free datagram object
+        BDatagram_Free(&o->dgram);
+    }
     
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
 }
 
+void set_counter_direction (DatagramPeerIO *o, int bound)
+{
+    // both directions use the same key, so packet counters and AEAD nonces tell which side sent a packet
+    if (SPPROTO_HAVE_COUNTER(o->sp_params) || SPPROTO_HAVE_AEAD(o->sp_params)) {
+        SPProtoEncoder_SetCounterDirection(&o->send_encoder, bound);
+    }
+    
+    if (SPPROTO_HAVE_COUNTER(o->sp_params)) {
+        SPProtoDecoder_SetCounterDirection(&o->recv_decoder, !bound);
+    }
+}
+
 void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len)
 {
-    ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND || o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND)
     DebugObject_Access(&o->d_obj);
     
-    // obtain addresses from last received packet
+    // obtain addresses of the authenticated packet; with a decoding pipeline,
+    // newer datagrams may already have been received from other addresses
     BAddr addr;
     BIPAddr local_addr;
-    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &addr, &local_addr))
+    SPProtoDecoder_GetOutputAddrs(&o->recv_decoder, &addr, &local_addr);
+    
+    if (o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+        // update addresses; the shared socket only receives from its own family
+        DatagramSharedSocket_entry_SetSendAddrs(&o->shared_entry, addr, local_addr);
+        return;
+    }
     
     // check address family just in case
     if (!BDatagram_AddressFamilySupported(addr.type)) {
@@ -131,6 +196,146 @@ void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_l
     BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
 }
 
+void send_next (DatagramPeerIO *o)
+{
+    if (o->send_busy != DATAGRAMPEERIO_SEND_BUSY_NONE) {
+        return;
+    }
+    
+    int have_group = !LinkedList1_IsEmpty(&o->send_group_queue);
+    
+    // alternate between our datagrams and group datagrams when both are waiting
+    if (o->send_len >= 0 && !(have_group && o->send_group_turn)) {
+        PacketPassInterface_Sender_Send(PacketPassConnector_GetInput(&o->send_connector), o->send_buf, o->channel_header_len + o->send_len);
+        o->send_busy = DATAGRAMPEERIO_SEND_BUSY_PEER;
+        o->send_group_turn = 1;
+    }
+    else if (have_group) {
+        DatagramGroupEncoder_ref *ref = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_group_queue), DatagramGroupEncoder_ref, list_node);
+        PacketPassInterface_Sender_Send(PacketPassConnector_GetInput(&o->send_connector), ref->packet->data, ref->packet->len);
+        o->send_busy = DATAGRAMPEERIO_SEND_BUSY_GROUP;
+        o->send_group_turn = 0;
+    }
+}
+
+void send_encoder_handler_done (DatagramPeerIO *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_len == -1)
+    ASSERT(data_len >= 0)
+    
+    // remember datagram
+    o->send_len = data_len;
+    
+    send_next(o);
+}
+
+void send_connector_handler_done (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_busy != DATAGRAMPEERIO_SEND_BUSY_NONE)
+    
+    if (o->send_busy == DATAGRAMPEERIO_SEND_BUSY_PEER) {
+        // receive next datagram from encoder
+        o->send_len = -1;
+        PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&o->send_encoder), o->send_buf + o->channel_header_len);
+    } else {
+        // release group datagram
+        DatagramGroupEncoder_ref *ref = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_group_queue), DatagramGroupEncoder_ref, list_node);
+        LinkedList1_Remove(&o->send_group_queue, &ref->list_node);
+        o->send_group_queue_len--;
+        DatagramGroupEncoder_packet_Unref(ref->packet);
+    }
+    
+    o->send_busy = DATAGRAMPEERIO_SEND_BUSY_NONE;
+    
+    send_next(o);
+}
+
+void recv_connector_handler_done (DatagramPeerIO *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->effective_socket_mtu)
+    
+    // remember addresses of the datagram for learning them once it is authenticated
+    if (o->mode == DATAGRAMPEERIO_MODE_BIND || o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+        BAddr addr;
+        BIPAddr local_addr;
+        if (o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+            ASSERT_EXECUTE(DatagramSharedSocket_entry_GetLastReceiveAddrs(&o->shared_entry, &addr, &local_addr))
+        } else {
+            ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &addr, &local_addr))
+        }
+        SPProtoDecoder_SetInputAddrs(&o->recv_decoder, addr, local_addr);
+    }
+    
+    // without group datagrams, everything is for our decoder
+    if (!o->have_group) {
+        if (data_len > PacketPassInterface_GetMTU(SPProtoDecoder_GetInput(&o->recv_decoder))) {
+            goto drop;
+        }
+        PacketPassInterface_Sender_Send(SPProtoDecoder_GetInput(&o->recv_decoder), o->recv_buf, data_len);
+        return;
+    }
+    
+    if (data_len < DATAGRAMGROUP_CHANNEL_HEADER_SIZE) {
+        PeerLog(o, BLOG_INFO, "datagram has no channel header");
+        goto drop;
+    }
+    
+    uint8_t *data = o->recv_buf + DATAGRAMGROUP_CHANNEL_HEADER_SIZE;
+    int len = data_len - DATAGRAMGROUP_CHANNEL_HEADER_SIZE;
+    
+    // pass datagram to the decoder of its channel
+    SPProtoDecoder *decoder;
+    switch (o->recv_buf[0]) {
+        case DATAGRAMGROUP_CHANNEL_PEER:
+            decoder = &o->recv_decoder;
+            break;
+        case DATAGRAMGROUP_CHANNEL_GROUP:
+            if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !o->have_group_key) {
+                goto drop;
+            }
+            decoder = &o->recv_group_decoder;
+            break;
+        default:
+            PeerLog(o, BLOG_INFO, "datagram has unknown channel");
+            goto drop;
+    }
+    
+    if (len > PacketPassInterface_GetMTU(SPProtoDecoder_GetInput(decoder))) {
+        PeerLog(o, BLOG_INFO, "datagram too long for channel");
+        goto drop;
+    }
+    
+    PacketPassInterface_Sender_Send(SPProtoDecoder_GetInput(decoder), data, len);
+    return;
+    
+drop:
+    PacketRecvInterface_Receiver_Recv(PacketRecvConnector_GetOutput(&o->recv_connector), o->recv_buf);
+}
+
+void recv_decoder_handler_done (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // receive next datagram
+    PacketRecvInterface_Receiver_Recv(PacketRecvConnector_GetOutput(&o->recv_connector), o->recv_buf);
+}
+
+void free_send_pipeline (DatagramPeerIO *o)
+{
+    // free the sender before the receiver of the interface between them
+    if (o->zero_copy) {
+        FragmentProtoDisassembler_Free(&o->send_disassembler);
+        SPProtoEncoder_Free(&o->send_encoder);
+    } else {
+        SPProtoEncoder_Free(&o->send_encoder);
+        FragmentProtoDisassembler_Free(&o->send_disassembler);
+    }
+}
+
 int DatagramPeerIO_Init (
     DatagramPeerIO *o,
     BReactor *reactor,
@@ -141,7 +346,11 @@ int DatagramPeerIO_Init (
     int num_frames,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
+    int pipeline_len,
+    int zero_copy,
     BThreadWorkDispatcher *twd,
+    PacketPassInterface *group_recv_userif,
+    int group_queue_size,
     void *user,
     BLog_logfunc logfunc,
     DatagramPeerIO_handler_error handler_error,
@@ -153,11 +362,16 @@ int DatagramPeerIO_Init (
     ASSERT(socket_mtu >= 0)
     spproto_assert_security_params(sp_params);
     ASSERT(num_frames > 0)
+    ASSERT(pipeline_len > 0)
+    ASSERT(zero_copy == 0 || zero_copy == 1)
+    ASSERT(!zero_copy || pipeline_len == 1)
     ASSERT(PacketPassInterface_GetMTU(recv_userif) >= payload_mtu)
     if (SPPROTO_HAVE_OTP(sp_params)) {
         ASSERT(otp_warning_count > 0)
         ASSERT(otp_warning_count <= sp_params.otp_num)
     }
+    ASSERT(!group_recv_userif || PacketPassInterface_GetMTU(group_recv_userif) >= payload_mtu)
+    ASSERT(!group_recv_userif || group_queue_size > 0)
     
     // set parameters
     o->reactor = reactor;
@@ -166,6 +380,10 @@ int DatagramPeerIO_Init (
     o->user = user;
     o->logfunc = logfunc;
     o->handler_error = handler_error;
+    o->have_group = !!group_recv_userif;
+    o->channel_header_len = (o->have_group ? DATAGRAMGROUP_CHANNEL_HEADER_SIZE : 0);
+    o->group_queue_size = group_queue_size;
+    o->zero_copy = zero_copy;
     
     // check num frames (for FragmentProtoAssembler)
     if (num_frames >= FPA_MAX_TIME) {
@@ -179,17 +397,41 @@ int DatagramPeerIO_Init (
         goto fail0;
     }
     
+    // check socket MTU (for channel header)
+    if (socket_mtu < o->channel_header_len) {
+        PeerLog(o, BLOG_ERROR, "socket MTU is too small");
+        goto fail0;
+    }
+    
     // calculate SPProto payload MTU
-    if ((o->spproto_payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, socket_mtu)) <= (int)sizeof(struct fragmentproto_chunk_header)) {
+    if ((o->spproto_payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, socket_mtu - o->channel_header_len)) <= (int)sizeof(struct fragmentproto_chunk_header)) {
         PeerLog(o, BLOG_ERROR, "socket MTU is too small");
         goto fail0;
     }
     
     // calculate effective socket MTU
-    if ((o->effective_socket_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->spproto_payload_mtu)) < 0) {
+    int carrier_mtu;
+    if ((carrier_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->spproto_payload_mtu)) < 0) {
         PeerLog(o, BLOG_ERROR, "spproto_carrier_mtu_for_payload_mtu failed !?");
         goto fail0;
     }
+    o->effective_socket_mtu = o->channel_header_len + carrier_mtu;
+    
+    // calculate group MTUs; group datagrams have different overhead because they don't use OTPs
+    struct spproto_security_params group_sp_params = datagramgroup_sp_params(o->sp_params);
+    int group_payload_mtu = 0;
+    if (o->have_group) {
+        if ((group_payload_mtu = spproto_payload_mtu_for_carrier_mtu(group_sp_params, socket_mtu - o->channel_header_len)) <= (int)sizeof(struct fragmentproto_chunk_header)) {
+            PeerLog(o, BLOG_ERROR, "socket MTU is too small");
+            goto fail0;
+        }
+        int group_carrier_mtu;
+        if ((group_carrier_mtu = spproto_carrier_mtu_for_payload_mtu(group_sp_params, group_payload_mtu)) < 0) {
+            PeerLog(o, BLOG_ERROR, "spproto_carrier_mtu_for_payload_mtu failed !?");
+            goto fail0;
+        }
+        o->effective_socket_mtu = bmax_int(o->effective_socket_mtu, o->channel_header_len + group_carrier_mtu);
+    }
     
     // init receiving
     
@@ -205,56 +447,123 @@ int DatagramPeerIO_Init (
     PacketPassNotifier_Init(&o->recv_notifier, FragmentProtoAssembler_GetInput(&o->recv_assembler), BReactor_PendingGroup(o->reactor));
     
     // init decoder
-    if (!SPProtoDecoder_Init(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
+    if (!SPProtoDecoder_Init(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, pipeline_len, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
         PeerLog(o, BLOG_ERROR, "SPProtoDecoder_Init failed");
         goto fail1;
     }
     SPProtoDecoder_SetHandlers(&o->recv_decoder, handler_otp_ready, user);
+    PacketPassInterface_Sender_Init(SPProtoDecoder_GetInput(&o->recv_decoder), (PacketPassInterface_handler_done)recv_decoder_handler_done, o);
+    
+    if (o->have_group) {
+        // init group assembler
+        if (!FragmentProtoAssembler_Init(&o->recv_group_assembler, group_payload_mtu, group_recv_userif, num_frames, fragmentproto_max_chunks_for_frame(group_payload_mtu, o->payload_mtu),
+                                         BReactor_PendingGroup(o->reactor), o->user, o->logfunc
+        )) {
+            PeerLog(o, BLOG_ERROR, "FragmentProtoAssembler_Init failed");
+            goto fail2;
+        }
+        
+        // init group decoder
+        if (!SPProtoDecoder_Init(&o->recv_group_decoder, FragmentProtoAssembler_GetInput(&o->recv_group_assembler), group_sp_params, 2, pipeline_len, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
+            PeerLog(o, BLOG_ERROR, "SPProtoDecoder_Init failed");
+            FragmentProtoAssembler_Free(&o->recv_group_assembler);
+            goto fail2;
+        }
+        PacketPassInterface_Sender_Init(SPProtoDecoder_GetInput(&o->recv_group_decoder), (PacketPassInterface_handler_done)recv_decoder_handler_done, o);
+        
+        // no group key yet
+        o->have_group_key = 0;
+    }
     
     // init connector
     PacketRecvConnector_Init(&o->recv_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+    PacketRecvInterface_Receiver_Init(PacketRecvConnector_GetOutput(&o->recv_connector), (PacketRecvInterface_handler_done)recv_connector_handler_done, o);
     
-    // init buffer
-    if (!SinglePacketBuffer_Init(&o->recv_buffer, PacketRecvConnector_GetOutput(&o->recv_connector), SPProtoDecoder_GetInput(&o->recv_decoder), BReactor_PendingGroup(o->reactor))) {
-        PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail2;
+    // allocate receive buffer
+    if (!(o->recv_buf = (uint8_t *)BAlloc(o->effective_socket_mtu))) {
+        PeerLog(o, BLOG_ERROR, "BAlloc failed");
+        goto fail3;
     }
     
     // init sending base
     
-    // init disassembler
-    FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency);
-    
-    // init encoder
-    if (!SPProtoEncoder_Init(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd)) {
-        PeerLog(o, BLOG_ERROR, "SPProtoEncoder_Init failed");
-        goto fail3;
+    if (o->zero_copy) {
+        // init encoder
+        if (!SPProtoEncoder_InitZeroCopy(&o->send_encoder, o->spproto_payload_mtu, o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd)) {
+            PeerLog(o, BLOG_ERROR, "SPProtoEncoder_InitZeroCopy failed");
+            goto fail4;
+        }
+        
+        // init disassembler, sending chunks to the encoder in place
+        if (!FragmentProtoDisassembler_InitZeroCopy(&o->send_disassembler, o->reactor, o->payload_mtu, SPProtoEncoder_GetInput(&o->send_encoder), -1,
+                                                    SPPROTO_HEADER_LEN(o->sp_params), SPPROTOENCODER_ZEROCOPY_TAILROOM
+        )) {
+            PeerLog(o, BLOG_ERROR, "FragmentProtoDisassembler_InitZeroCopy failed");
+            SPProtoEncoder_Free(&o->send_encoder);
+            goto fail4;
+        }
+    } else {
+        // init disassembler
+        FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency);
+        
+        // init encoder
+        if (!SPProtoEncoder_Init(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, pipeline_len, BReactor_PendingGroup(o->reactor), twd)) {
+            PeerLog(o, BLOG_ERROR, "SPProtoEncoder_Init failed");
+            FragmentProtoDisassembler_Free(&o->send_disassembler);
+            goto fail4;
+        }
     }
     SPProtoEncoder_SetHandlers(&o->send_encoder, handler_otp_warning, user);
+    PacketRecvInterface_Receiver_Init(SPProtoEncoder_GetOutput(&o->send_encoder), (PacketRecvInterface_handler_done)send_encoder_handler_done, o);
     
     // init connector
     PacketPassConnector_Init(&o->send_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+    PacketPassInterface_Sender_Init(PacketPassConnector_GetInput(&o->send_connector), (PacketPassInterface_handler_done)send_connector_handler_done, o);
     
-    // init buffer
-    if (!SinglePacketBuffer_Init(&o->send_buffer, SPProtoEncoder_GetOutput(&o->send_encoder), PacketPassConnector_GetInput(&o->send_connector), BReactor_PendingGroup(o->reactor))) {
-        PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail4;
+    // allocate send buffer
+    if (!(o->send_buf = (uint8_t *)BAlloc(o->effective_socket_mtu))) {
+        PeerLog(o, BLOG_ERROR, "BAlloc failed");
+        goto fail5;
     }
     
+    // write channel header
+    if (o->have_group) {
+        o->send_buf[0] = DATAGRAMGROUP_CHANNEL_PEER;
+    }
+    
+    // init group queue
+    LinkedList1_Init(&o->send_group_queue);
+    o->send_group_queue_len = 0;
+    o->send_group_turn = 0;
+    
+    // nothing is being sent
+    o->send_busy = DATAGRAMPEERIO_SEND_BUSY_NONE;
+    
+    // start receiving from encoder
+    o->send_len = -1;
+    PacketRecvInterface_Receiver_Recv(SPProtoEncoder_GetOutput(&o->send_encoder), o->send_buf + o->channel_header_len);
+    
+    // start receiving datagrams
+    PacketRecvInterface_Receiver_Recv(PacketRecvConnector_GetOutput(&o->recv_connector), o->recv_buf);
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail4:
+fail5:
     PacketPassConnector_Free(&o->send_connector);
-    SPProtoEncoder_Free(&o->send_encoder);
+    free_send_pipeline(o);
+fail4:
+    BFree(o->recv_buf);
 fail3:
-    FragmentProtoDisassembler_Free(&o->send_disassembler);
-    SinglePacketBuffer_Free(&o->recv_buffer);
-fail2:
     PacketRecvConnector_Free(&o->recv_connector);
+    if (o->have_group) {
+        SPProtoDecoder_Free(&o->recv_group_decoder);
+        FragmentProtoAssembler_Free(&o->recv_group_assembler);
+    }
+fail2:
     SPProtoDecoder_Free(&o->recv_decoder);
 fail1:
     PacketPassNotifier_Free(&o->recv_notifier);
@@ -270,15 +579,25 @@ void DatagramPeerIO_Free (DatagramPeerIO *o)
     // reset mode
     reset_mode(o);
     
+    // release queued group datagrams
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->send_group_queue); node;) {
+        DatagramGroupEncoder_ref *ref = UPPER_OBJECT(node, DatagramGroupEncoder_ref, list_node);
+        node = LinkedList1Node_Next(node);
+        DatagramGroupEncoder_packet_Unref(ref->packet);
+    }
+    
     // free sending base
-    SinglePacketBuffer_Free(&o->send_buffer);
+    BFree(o->send_buf);
     PacketPassConnector_Free(&o->send_connector);
-    SPProtoEncoder_Free(&o->send_encoder);
-    FragmentProtoDisassembler_Free(&o->send_disassembler);
+    free_send_pipeline(o);
     
     // free receiving
-    SinglePacketBuffer_Free(&o->recv_buffer);
+    BFree(o->recv_buf);
     PacketRecvConnector_Free(&o->recv_connector);
+    if (o->have_group) {
+        SPProtoDecoder_Free(&o->recv_group_decoder);
+        FragmentProtoAssembler_Free(&o->recv_group_assembler);
+    }
     SPProtoDecoder_Free(&o->recv_decoder);
     PacketPassNotifier_Free(&o->recv_notifier);
     FragmentProtoAssembler_Free(&o->recv_assembler);
@@ -318,6 +637,9 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
     // init I/O
     init_io(o);
     
+    // set packet counter direction
+    set_counter_direction(o, 0);
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_CONNECT;
     
@@ -353,6 +675,9 @@ int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr)
     // set recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
     
+    // set packet counter direction
+    set_counter_direction(o, 1);
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_BIND;
     
@@ -364,6 +689,68 @@ fail0:
     return 0;
 }
 
+int DatagramPeerIO_ConnectShared (DatagramPeerIO *o, DatagramSharedSocket *sock, uint64_t id, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(addr.type == sock->family)
+    ASSERT(o->effective_socket_mtu <= sock->mtu - DATAGRAMSHAREDSOCKET_HEADER_SIZE)
+    
+    // reset mode
+    reset_mode(o);
+    
+    // init shared socket entry
+    if (!DatagramSharedSocket_entry_Init(&o->shared_entry, sock, id, o->effective_socket_mtu)) {
+        PeerLog(o, BLOG_ERROR, "DatagramSharedSocket_entry_Init failed");
+        goto fail0;
+    }
+    
+    // set send address
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    DatagramSharedSocket_entry_SetSendAddrs(&o->shared_entry, addr, local_addr);
+    
+    // init I/O
+    init_shared_io(o);
+    
+    // set packet counter direction
+    set_counter_direction(o, 0);
+    
+    // set mode
+    o->mode = DATAGRAMPEERIO_MODE_SHARED_CONNECT;
+    
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+uint64_t DatagramPeerIO_BindShared (DatagramPeerIO *o, DatagramSharedSocket *sock)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->effective_socket_mtu <= sock->mtu - DATAGRAMSHAREDSOCKET_HEADER_SIZE)
+    
+    // reset mode
+    reset_mode(o);
+    
+    // init shared socket entry with an unused ID
+    uint64_t id = DatagramSharedSocket_GenerateID(sock);
+    ASSERT_EXECUTE(DatagramSharedSocket_entry_Init(&o->shared_entry, sock, id, o->effective_socket_mtu))
+    
+    // init I/O
+    init_shared_io(o);
+    
+    // set recv notifier handler
+    PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
+    
+    // set packet counter direction
+    set_counter_direction(o, 1);
+    
+    // set mode
+    o->mode = DATAGRAMPEERIO_MODE_SHARED_BIND;
+    
+    return id;
+}
+
 void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key)
 {
     ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
@@ -423,3 +810,34 @@ void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o)
     // remove receiving seeds
     SPProtoDecoder_RemoveOTPSeeds(&o->recv_decoder);
 }
+
+void DatagramPeerIO_SetGroupKey (DatagramPeerIO *o, uint8_t *encryption_key)
+{
+    ASSERT(o->have_group)
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    DebugObject_Access(&o->d_obj);
+    
+    // set group receiving key
+    SPProtoDecoder_SetEncryptionKey(&o->recv_group_decoder, encryption_key);
+    
+    o->have_group_key = 1;
+}
+
+void DatagramPeerIO_SubmitGroupDatagram (DatagramPeerIO *o, DatagramGroupEncoder_ref *ref)
+{
+    ASSERT(o->have_group)
+    ASSERT(ref->packet->len <= o->effective_socket_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    // drop if queue is full
+    if (o->send_group_queue_len >= o->group_queue_size) {
+        return;
+    }
+    
+    // queue datagram
+    DatagramGroupEncoder_packet_Ref(ref->packet);
+    LinkedList1_Append(&o->send_group_queue, &ref->list_node);
+    o->send_group_queue_len++;
+    
+    send_next(o);
+}
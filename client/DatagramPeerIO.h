@@ -39,6 +39,7 @@
 #include <misc/debug.h>
 #include <protocol/spproto.h>
 #include <protocol/fragmentproto.h>
+#include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
@@ -47,13 +48,21 @@
 #include <system/BTime.h>
 #include <flow/PacketPassInterface.h>
 #include <flow/PacketPassConnector.h>
-#include <flow/SinglePacketBuffer.h>
 #include <flow/PacketRecvConnector.h>
 #include <flow/PacketPassNotifier.h>
 #include <client/FragmentProtoDisassembler.h>
 #include <client/FragmentProtoAssembler.h>
 #include <client/SPProtoEncoder.h>
 #include <client/SPProtoDecoder.h>
+#include <client/DatagramSharedSocket.h>
+#include <client/DatagramGroupEncoder.h>
+
+/**
+ * Space needed before and after each packet sent to the send input of a
+ * {@link DatagramPeerIO} with zero-copy sending.
+ */
+#define DATAGRAMPEERIO_SEND_HEADROOM(_sp_params) ((int)sizeof(struct fragmentproto_chunk_header) + SPPROTO_HEADER_LEN(_sp_params))
+#define DATAGRAMPEERIO_SEND_TAILROOM SPPROTOENCODER_ZEROCOPY_TAILROOM
 
 /**
  * Callback function invoked when an error occurs with the peer connection.
@@ -95,6 +104,15 @@ typedef void (*DatagramPeerIO_handler_otp_ready) (void *user);
  *                 Datagrams are being received on the socket. Datagrams are not being
  *                 sent initially. When a datagram is received, its source address is
  *                 used as a destination address for sending datagrams.
+ *     - shared connecting, shared binding - like connecting and binding, but using
+ *                 an entry in a {@link DatagramSharedSocket} instead of an own socket.
+ *
+ * If group datagrams are enabled, every datagram starts with a channel header
+ * (DATAGRAMGROUP_CHANNEL_HEADER_SIZE bytes). Besides the datagrams encoded for the peer,
+ * datagrams encoded once for many peers by a {@link DatagramGroupEncoder} can then be
+ * sent, and datagrams which the peer encoded with its group key are received,
+ * decoded and passed to a separate user interface. Datagrams of both kinds are
+ * sent alternately when both are waiting.
  */
 typedef struct {
     DebugObject d_obj;
@@ -106,25 +124,42 @@ typedef struct {
     DatagramPeerIO_handler_error handler_error;
     int spproto_payload_mtu;
     int effective_socket_mtu;
+    int have_group;
+    int channel_header_len;
+    int group_queue_size;
+    int zero_copy;
     
     // sending base
     FragmentProtoDisassembler send_disassembler;
     SPProtoEncoder send_encoder;
-    SinglePacketBuffer send_buffer;
+    uint8_t *send_buf;
+    int send_len;
+    int send_busy;
+    LinkedList1 send_group_queue;
+    int send_group_queue_len;
+    int send_group_turn;
     PacketPassConnector send_connector;
     
     // receiving
     PacketRecvConnector recv_connector;
-    SinglePacketBuffer recv_buffer;
+    uint8_t *recv_buf;
     SPProtoDecoder recv_decoder;
     PacketPassNotifier recv_notifier;
     FragmentProtoAssembler recv_assembler;
     
+    // group receiving
+    int have_group_key;
+    SPProtoDecoder recv_group_decoder;
+    FragmentProtoAssembler recv_group_assembler;
+    
     // mode
     int mode;
     
     // datagram object
     BDatagram dgram;
+    
+    // shared socket entry
+    DatagramSharedSocket_entry shared_entry;
 } DatagramPeerIO;
 
 /**
@@ -147,7 +182,23 @@ typedef struct {
  * @param recv_userif interface to pass received packets to the user. Its MTU must be >=payload_mtu.
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
  *                          In this case, must be >0 and <=sp_params.otp_num.
+ * @param pipeline_len pipeline_len parameter to {@link SPProtoEncoder_Init} and
+ *                     {@link SPProtoDecoder_Init}. Must be >0.
+ * @param zero_copy whether to encode sent packets without first copying them into
+ *                  chunks. If 1, every packet sent to the send input must have
+ *                  DATAGRAMPEERIO_SEND_HEADROOM(sp_params) bytes of writable space before
+ *                  it and DATAGRAMPEERIO_SEND_TAILROOM bytes after it; packets which fit
+ *                  into one datagram are then only copied once, by the encryption.
+ *                  The latency parameter is not used, and pipeline_len must be 1.
+ *                  See {@link SPProtoEncoder_InitZeroCopy} for how long the memory of
+ *                  a packet being sent must remain valid. Must be 0 or 1.
  * @param twd thread work dispatcher
+ * @param group_recv_userif interface to pass packets received through the peer's group
+ *                          stream to, or NULL to disable group datagrams. Its MTU must
+ *                          be >=payload_mtu. Group datagrams must be enabled or disabled
+ *                          on both sides.
+ * @param group_queue_size if group datagrams are enabled, maximum number of queued datagrams
+ *                         submitted with {@link DatagramPeerIO_SubmitGroupDatagram}. Must be >0 then.
  * @param user value to pass to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
  * @param handler_error error handler
@@ -165,7 +216,11 @@ int DatagramPeerIO_Init (
     int num_frames,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
+    int pipeline_len,
+    int zero_copy,
     BThreadWorkDispatcher *twd,
+    PacketPassInterface *group_recv_userif,
+    int group_queue_size,
     void *user,
     BLog_logfunc logfunc,
     DatagramPeerIO_handler_error handler_error,
@@ -213,6 +268,33 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
  */
 int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
 
+/**
+ * Attempts to establish connection to the peer which has bound to an address,
+ * using a shared socket.
+ * On success, the interface enters shared connecting mode.
+ * On failure, the interface enters default mode.
+ *
+ * @param o the object
+ * @param sock shared socket to use. Its family must be the family of addr, and its
+ *             MTU must be at least DATAGRAMSHAREDSOCKET_HEADER_SIZE larger than
+ *             socket_mtu in {@link DatagramPeerIO_Init}.
+ * @param id ID assigned by the peer when it bound
+ * @param addr address to send packets to
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIO_ConnectShared (DatagramPeerIO *o, DatagramSharedSocket *sock, uint64_t id, BAddr addr) WARN_UNUSED;
+
+/**
+ * Waits for the peer to connect to a shared socket.
+ * The interface enters shared binding mode.
+ *
+ * @param o the object
+ * @param sock shared socket to use. Its MTU must be at least DATAGRAMSHAREDSOCKET_HEADER_SIZE
+ *             larger than socket_mtu in {@link DatagramPeerIO_Init}.
+ * @return ID the peer must use when connecting
+ */
+uint64_t DatagramPeerIO_BindShared (DatagramPeerIO *o, DatagramSharedSocket *sock);
+
 /**
  * Sets the encryption key to use for sending and receiving.
  * Encryption must be enabled.
@@ -268,4 +350,26 @@ void DatagramPeerIO_AddOTPRecvSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t
  */
 void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o);
 
+/**
+ * Sets the key the peer encrypts its group datagrams with.
+ * Group datagrams and encryption must be enabled.
+ * Until a key is set, the peer's group datagrams are discarded.
+ *
+ * @param o the object
+ * @param encryption_key key to use
+ */
+void DatagramPeerIO_SetGroupKey (DatagramPeerIO *o, uint8_t *encryption_key);
+
+/**
+ * Queues a datagram encoded by a {@link DatagramGroupEncoder} for sending to the peer.
+ * Group datagrams must be enabled, and the encoder must use the same socket MTU and
+ * security parameters as this object.
+ * If the queue is full, the datagram is not queued. Otherwise, a reference to the
+ * datagram is taken and ref is used until it is sent or the object is freed.
+ *
+ * @param o the object
+ * @param ref reference to the datagram, as passed to the encoder's datagram handler
+ */
+void DatagramPeerIO_SubmitGroupDatagram (DatagramPeerIO *o, DatagramGroupEncoder_ref *ref);
+
 #endif
@@ -0,0 +1,524 @@
+/**
+ * @file DatagramSharedSocket.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include <misc/offset.h>
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/compare.h>
+#include <base/BLog.h>
+#include <security/BRandom.h>
+
+#include <client/DatagramSharedSocket.h>
+
+#include <generated/blog_channel_DatagramSharedSocket.h>
+
+static int id_comparator (void *user, uint64_t *id1, uint64_t *id2);
+static int init_dgram (DatagramSharedSocket *o);
+static void free_dgram (DatagramSharedSocket *o);
+static void dgram_handler (DatagramSharedSocket *o, int event);
+static void start_recv (DatagramSharedSocket *o);
+static void entry_deliver (DatagramSharedSocket_entry *e, const uint8_t *data, int len, BAddr remote_addr, BIPAddr local_addr);
+static void entry_free_queue (DatagramSharedSocket_entry *e);
+static void dgram_recv_handler_done (DatagramSharedSocket *o, int data_len);
+static void send_next (DatagramSharedSocket *o);
+static void dgram_send_handler_done (DatagramSharedSocket *o);
+static void entry_send_handler_send (DatagramSharedSocket_entry *e, uint8_t *data, int data_len);
+static void entry_recv_handler_recv (DatagramSharedSocket_entry *e, uint8_t *data);
+
+int id_comparator (void *user, uint64_t *id1, uint64_t *id2)
+{
+    return B_COMPARE(*id1, *id2);
+}
+
+int init_dgram (DatagramSharedSocket *o)
+{
+    // init dgram
+    if (!BDatagram_Init(&o->dgram, o->family, o->reactor, o, (BDatagram_handler)dgram_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // bind dgram
+    if (o->have_bind_addr && !BDatagram_Bind(&o->dgram, o->bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail1;
+    }
+    
+    // init dgram send interface
+    BDatagram_SendAsync_Init(&o->dgram, o->mtu);
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&o->dgram), (PacketPassInterface_handler_done)dgram_send_handler_done, o);
+    
+    // init dgram recv interface
+    BDatagram_RecvAsync_Init(&o->dgram, o->mtu);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&o->dgram), (PacketRecvInterface_handler_done)dgram_recv_handler_done, o);
+    
+#ifdef BADVPN_LINUX
+    // send and receive in batches
+    if (!BDatagram_SetSendBatch(&o->dgram, DATAGRAMSHAREDSOCKET_BATCH_SIZE)) {
+        BLog(BLOG_ERROR, "BDatagram_SetSendBatch failed");
+        goto fail2;
+    }
+    if (!BDatagram_SetRecvBatch(&o->dgram, DATAGRAMSHAREDSOCKET_BATCH_SIZE)) {
+        BLog(BLOG_ERROR, "BDatagram_SetRecvBatch failed");
+        goto fail2;
+    }
+#endif
+    
+    // not sending
+    o->send_busy = 0;
+    
+    // start receiving
+    start_recv(o);
+    
+    return 1;
+    
+#ifdef BADVPN_LINUX
+fail2:
+    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&o->dgram);
+#endif
+fail1:
+    BDatagram_Free(&o->dgram);
+fail0:
+    return 0;
+}
+
+void free_dgram (DatagramSharedSocket *o)
+{
+    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&o->dgram);
+    BDatagram_Free(&o->dgram);
+}
+
+void dgram_handler (DatagramSharedSocket *o, int event)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BLog(BLOG_ERROR, "socket error, recreating socket");
+    
+    // free dgram; datagrams queued for entries are kept
+    free_dgram(o);
+    
+    // init dgram again
+    if (!(o->have_dgram = init_dgram(o))) {
+        // report error
+        o->handler_error(o->user);
+        return;
+    }
+    
+    // continue sending
+    send_next(o);
+}
+
+void start_recv (DatagramSharedSocket *o)
+{
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&o->dgram), o->recv_buf);
+}
+
+void entry_deliver (DatagramSharedSocket_entry *e, const uint8_t *data, int len, BAddr remote_addr, BIPAddr local_addr)
+{
+    ASSERT(e->recv_data)
+    ASSERT(len >= 0)
+    ASSERT(len <= e->mtu)
+    
+    // remember addresses
+    e->recv_remote_addr = remote_addr;
+    e->recv_local_addr = local_addr;
+    e->have_recv_addrs = 1;
+    
+    // pass packet to entry
+    memcpy(e->recv_data, data, len);
+    e->recv_data = NULL;
+    PacketRecvInterface_Done(&e->recv_iface, len);
+}
+
+void entry_free_queue (DatagramSharedSocket_entry *e)
+{
+    DatagramSharedSocket *o = e->s;
+    
+    // return queued datagrams to the free list
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&e->recv_queue)) {
+        LinkedList1_Remove(&e->recv_queue, node);
+        LinkedList1_Append(&o->recv_free_list, node);
+    }
+    e->recv_queue_len = 0;
+}
+
+void dgram_recv_handler_done (DatagramSharedSocket *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // check header
+    if (data_len < DATAGRAMSHAREDSOCKET_HEADER_SIZE) {
+        BLog(BLOG_INFO, "datagram too short");
+        goto recv_next;
+    }
+    
+    // read ID
+    uint64_t id;
+    memcpy(&id, o->recv_buf, sizeof(id));
+    id = ltoh64(id);
+    
+    // find entry
+    BAVLNode *tree_node = BAVL_LookupExact(&o->entries_tree, &id);
+    if (!tree_node) {
+        BLog(BLOG_INFO, "datagram with unknown ID");
+        goto recv_next;
+    }
+    DatagramSharedSocket_entry *e = UPPER_OBJECT(tree_node, DatagramSharedSocket_entry, tree_node);
+    
+    // check length
+    if (data_len - DATAGRAMSHAREDSOCKET_HEADER_SIZE > e->mtu) {
+        BLog(BLOG_INFO, "datagram too long for entry");
+        goto recv_next;
+    }
+    
+    uint8_t *data = o->recv_buf + DATAGRAMSHAREDSOCKET_HEADER_SIZE;
+    int len = data_len - DATAGRAMSHAREDSOCKET_HEADER_SIZE;
+    
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &remote_addr, &local_addr))
+    
+    // deliver now if the entry is receiving
+    if (e->recv_data) {
+        ASSERT(LinkedList1_IsEmpty(&e->recv_queue))
+        entry_deliver(e, data, len, remote_addr, local_addr);
+        goto recv_next;
+    }
+    
+    // otherwise queue the datagram for the entry, so other entries keep receiving
+    if (e->recv_queue_len == DATAGRAMSHAREDSOCKET_RECV_QUEUE_ENTRY_MAX || LinkedList1_IsEmpty(&o->recv_free_list)) {
+        e->recv_dropped++;
+        BLog(BLOG_DEBUG, "entry queue full, dropping datagram (%"PRIu64" dropped)", e->recv_dropped);
+        goto recv_next;
+    }
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->recv_free_list);
+    LinkedList1_Remove(&o->recv_free_list, node);
+    struct DatagramSharedSocket_queued *q = UPPER_OBJECT(node, struct DatagramSharedSocket_queued, list_node);
+    memcpy(q->data, data, len);
+    q->len = len;
+    q->remote_addr = remote_addr;
+    q->local_addr = local_addr;
+    LinkedList1_Append(&e->recv_queue, &q->list_node);
+    e->recv_queue_len++;
+    
+recv_next:
+    start_recv(o);
+}
+
+void send_next (DatagramSharedSocket *o)
+{
+    ASSERT(o->have_dgram)
+    
+    if (o->send_busy || LinkedList1_IsEmpty(&o->send_queue)) {
+        return;
+    }
+    
+    // take first entry from queue
+    DatagramSharedSocket_entry *e = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_queue), DatagramSharedSocket_entry, send_queue_node);
+    ASSERT(e->send_queued)
+    ASSERT(e->have_send_addrs)
+    LinkedList1_Remove(&o->send_queue, &e->send_queue_node);
+    e->send_queued = 0;
+    
+    // build datagram
+    uint64_t id = htol64(e->id);
+    memcpy(o->send_buf, &id, sizeof(id));
+    memcpy(o->send_buf + DATAGRAMSHAREDSOCKET_HEADER_SIZE, e->send_data, e->send_data_len);
+    
+    // send datagram
+    BDatagram_SetSendAddrs(&o->dgram, e->send_remote_addr, e->send_local_addr);
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&o->dgram), o->send_buf, DATAGRAMSHAREDSOCKET_HEADER_SIZE + e->send_data_len);
+    o->send_busy = 1;
+    
+    // the packet was copied, so the entry is done
+    PacketPassInterface_Done(&e->send_iface);
+}
+
+void dgram_send_handler_done (DatagramSharedSocket *o)
+{
+    ASSERT(o->send_busy)
+    DebugObject_Access(&o->d_obj);
+    
+    // set not busy
+    o->send_busy = 0;
+    
+    // send next datagram
+    send_next(o);
+}
+
+void entry_send_handler_send (DatagramSharedSocket_entry *e, uint8_t *data, int data_len)
+{
+    DatagramSharedSocket *o = e->s;
+    ASSERT(!e->send_queued)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= e->mtu)
+    DebugObject_Access(&e->d_obj);
+    
+    // drop packet if we don't know where to send it, or the socket has failed
+    if (!e->have_send_addrs || !o->have_dgram) {
+        PacketPassInterface_Done(&e->send_iface);
+        return;
+    }
+    
+    // queue entry
+    e->send_data = data;
+    e->send_data_len = data_len;
+    LinkedList1_Append(&o->send_queue, &e->send_queue_node);
+    e->send_queued = 1;
+    
+    // send if possible
+    send_next(o);
+}
+
+void entry_recv_handler_recv (DatagramSharedSocket_entry *e, uint8_t *data)
+{
+    DatagramSharedSocket *o = e->s;
+    ASSERT(!e->recv_data)
+    DebugObject_Access(&e->d_obj);
+    
+    // remember buffer
+    e->recv_data = data;
+    
+    // deliver a datagram waiting for us
+    LinkedList1Node *node = LinkedList1_GetFirst(&e->recv_queue);
+    if (node) {
+        struct DatagramSharedSocket_queued *q = UPPER_OBJECT(node, struct DatagramSharedSocket_queued, list_node);
+        entry_deliver(e, q->data, q->len, q->remote_addr, q->local_addr);
+        
+        // return buffer to the free list
+        LinkedList1_Remove(&e->recv_queue, node);
+        LinkedList1_Append(&o->recv_free_list, node);
+        e->recv_queue_len--;
+    }
+}
+
+int DatagramSharedSocket_Init (DatagramSharedSocket *o, BReactor *reactor, int family, BAddr *bind_addr, int mtu,
+                               void *user, DatagramSharedSocket_handler_error handler_error)
+{
+    ASSERT(BDatagram_AddressFamilySupported(family))
+    ASSERT(!bind_addr || bind_addr->type == family)
+    ASSERT(mtu > DATAGRAMSHAREDSOCKET_HEADER_SIZE)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->family = family;
+    o->have_bind_addr = !!bind_addr;
+    if (bind_addr) {
+        o->bind_addr = *bind_addr;
+    }
+    o->mtu = mtu;
+    o->user = user;
+    o->handler_error = handler_error;
+    
+    // init entries tree
+    BAVL_Init(&o->entries_tree, OFFSET_DIFF(DatagramSharedSocket_entry, id, tree_node), (BAVL_comparator)id_comparator, NULL);
+    
+    // init send queue
+    LinkedList1_Init(&o->send_queue);
+    
+    // allocate send buffer
+    if (!(o->send_buf = (uint8_t *)BAlloc(o->mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // allocate receive buffer
+    if (!(o->recv_buf = (uint8_t *)BAlloc(o->mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    
+    // allocate queue for datagrams waiting for entries
+    int queued_mtu = o->mtu - DATAGRAMSHAREDSOCKET_HEADER_SIZE;
+    if (!(o->recv_queued = (struct DatagramSharedSocket_queued *)BAllocArray(DATAGRAMSHAREDSOCKET_RECV_QUEUE_SIZE, sizeof(o->recv_queued[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    if (!(o->recv_queued_buf = (uint8_t *)BAllocArray(DATAGRAMSHAREDSOCKET_RECV_QUEUE_SIZE, queued_mtu))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail3;
+    }
+    LinkedList1_Init(&o->recv_free_list);
+    for (int i = 0; i < DATAGRAMSHAREDSOCKET_RECV_QUEUE_SIZE; i++) {
+        o->recv_queued[i].data = o->recv_queued_buf + (size_t)i * queued_mtu;
+        LinkedList1_Append(&o->recv_free_list, &o->recv_queued[i].list_node);
+    }
+    
+    // init dgram
+    if (!init_dgram(o)) {
+        goto fail4;
+    }
+    o->have_dgram = 1;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail4:
+    BFree(o->recv_queued_buf);
+fail3:
+    BFree(o->recv_queued);
+fail2:
+    BFree(o->recv_buf);
+fail1:
+    BFree(o->send_buf);
+fail0:
+    return 0;
+}
+
+void DatagramSharedSocket_Free (DatagramSharedSocket *o)
+{
+    ASSERT(BAVL_IsEmpty(&o->entries_tree))
+    ASSERT(LinkedList1_IsEmpty(&o->send_queue))
+    DebugObject_Free(&o->d_obj);
+    
+    // free dgram
+    if (o->have_dgram) {
+        free_dgram(o);
+    }
+    
+    // free buffers
+    BFree(o->recv_queued_buf);
+    BFree(o->recv_queued);
+    BFree(o->recv_buf);
+    BFree(o->send_buf);
+}
+
+uint64_t DatagramSharedSocket_GenerateID (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint64_t id;
+    do {
+        BRandom_randomize((uint8_t *)&id, sizeof(id));
+    } while (BAVL_LookupExact(&o->entries_tree, &id));
+    
+    return id;
+}
+
+int DatagramSharedSocket_entry_Init (DatagramSharedSocket_entry *e, DatagramSharedSocket *s, uint64_t id, int mtu)
+{
+    DebugObject_Access(&s->d_obj);
+    ASSERT(mtu >= 0)
+    ASSERT(mtu <= s->mtu - DATAGRAMSHAREDSOCKET_HEADER_SIZE)
+    
+    // init arguments
+    e->s = s;
+    e->id = id;
+    e->mtu = mtu;
+    
+    // insert to entries tree
+    if (!BAVL_Insert(&s->entries_tree, &e->tree_node, NULL)) {
+        BLog(BLOG_ERROR, "ID is already used");
+        return 0;
+    }
+    
+    // set no addresses
+    e->have_send_addrs = 0;
+    e->have_recv_addrs = 0;
+    
+    // init send interface
+    PacketPassInterface_Init(&e->send_iface, e->mtu, (PacketPassInterface_handler_send)entry_send_handler_send, e, BReactor_PendingGroup(s->reactor));
+    e->send_queued = 0;
+    
+    // init recv interface
+    PacketRecvInterface_Init(&e->recv_iface, e->mtu, (PacketRecvInterface_handler_recv)entry_recv_handler_recv, e, BReactor_PendingGroup(s->reactor));
+    e->recv_data = NULL;
+    
+    // init receive queue
+    LinkedList1_Init(&e->recv_queue);
+    e->recv_queue_len = 0;
+    e->recv_dropped = 0;
+    
+    DebugObject_Init(&e->d_obj);
+    return 1;
+}
+
+void DatagramSharedSocket_entry_Free (DatagramSharedSocket_entry *e)
+{
+    DatagramSharedSocket *s = e->s;
+    DebugObject_Free(&e->d_obj);
+    
+    // remove from send queue
+    if (e->send_queued) {
+        LinkedList1_Remove(&s->send_queue, &e->send_queue_node);
+    }
+    
+    // drop datagrams waiting for us
+    entry_free_queue(e);
+    
+    // free interfaces
+    PacketRecvInterface_Free(&e->recv_iface);
+    PacketPassInterface_Free(&e->send_iface);
+    
+    // remove from entries tree
+    BAVL_Remove(&s->entries_tree, &e->tree_node);
+}
+
+void DatagramSharedSocket_entry_SetSendAddrs (DatagramSharedSocket_entry *e, BAddr remote_addr, BIPAddr local_addr)
+{
+    DebugObject_Access(&e->d_obj);
+    ASSERT(remote_addr.type == e->s->family)
+    
+    e->have_send_addrs = 1;
+    e->send_remote_addr = remote_addr;
+    e->send_local_addr = local_addr;
+}
+
+int DatagramSharedSocket_entry_GetLastReceiveAddrs (DatagramSharedSocket_entry *e, BAddr *remote_addr, BIPAddr *local_addr)
+{
+    DebugObject_Access(&e->d_obj);
+    
+    if (!e->have_recv_addrs) {
+        return 0;
+    }
+    
+    *remote_addr = e->recv_remote_addr;
+    *local_addr = e->recv_local_addr;
+    return 1;
+}
+
+PacketPassInterface * DatagramSharedSocket_entry_GetSendIf (DatagramSharedSocket_entry *e)
+{
+    DebugObject_Access(&e->d_obj);
+    
+    return &e->send_iface;
+}
+
+PacketRecvInterface * DatagramSharedSocket_entry_GetRecvIf (DatagramSharedSocket_entry *e)
+{
+    DebugObject_Access(&e->d_obj);
+    
+    return &e->recv_iface;
+}
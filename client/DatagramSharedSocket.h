@@ -0,0 +1,244 @@
+/**
+ * @file DatagramSharedSocket.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Datagram socket shared by many peers, which identifies them based on
+ * a number prepended to every datagram.
+ */
+
+#ifndef BADVPN_CLIENT_DATAGRAMSHAREDSOCKET_H
+#define BADVPN_CLIENT_DATAGRAMSHAREDSOCKET_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/BAVL.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+#include <system/BDatagram.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/PacketRecvInterface.h>
+
+// size of the header in front of every datagram; contains the entry ID
+// as a little-endian 64-bit unsigned integer
+#define DATAGRAMSHAREDSOCKET_HEADER_SIZE 8
+
+// number of datagrams received or sent with a single system call
+#define DATAGRAMSHAREDSOCKET_BATCH_SIZE 32
+
+// number of received datagrams which can wait for entries which are not receiving
+#define DATAGRAMSHAREDSOCKET_RECV_QUEUE_SIZE 256
+
+// maximum number of received datagrams waiting for a single entry
+#define DATAGRAMSHAREDSOCKET_RECV_QUEUE_ENTRY_MAX (2 * DATAGRAMSHAREDSOCKET_BATCH_SIZE)
+
+/**
+ * Handler function called when the socket has failed and could not be
+ * recreated. Packets sent by entries are discarded from now on.
+ * The object should be freed.
+ * 
+ * @param user as in {@link DatagramSharedSocket_Init}
+ */
+typedef void (*DatagramSharedSocket_handler_error) (void *user);
+
+struct DatagramSharedSocket_entry_s;
+
+struct DatagramSharedSocket_queued {
+    LinkedList1Node list_node;
+    uint8_t *data;
+    int len;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+};
+
+/**
+ * Datagram socket shared by many peers, which identifies them based on
+ * a number prepended to every datagram.
+ * 
+ * Each peer is represented by an entry with a unique 64-bit ID. Every datagram
+ * sent or received through the socket starts with the ID of the entry, in both
+ * directions. Received datagrams are dispatched to entries by this ID,
+ * and the ID is stripped. Datagrams are received and sent in batches where
+ * supported (see {@link BDatagram_SetRecvBatch} and {@link BDatagram_SetSendBatch}).
+ * 
+ * If a received datagram belongs to an entry which is not currently receiving,
+ * it is copied to a queue of the entry, so that receiving for other entries
+ * continues. The queues of all entries share {@link DATAGRAMSHAREDSOCKET_RECV_QUEUE_SIZE}
+ * buffers, and an entry may have at most {@link DATAGRAMSHAREDSOCKET_RECV_QUEUE_ENTRY_MAX}
+ * datagrams queued. Datagrams which do not fit are dropped and counted.
+ * A packet sent by an entry is copied to the socket and the entry's send
+ * operation finishes immediately; if the socket is still sending, entries wait
+ * in a queue in the order they submitted their packets. Packets sent by entries
+ * which have no send address yet are discarded.
+ * 
+ * If the socket fails (e.g. a send fails because a destination is unreachable),
+ * it is recreated, and entries are kept. Only if this fails is the error handler
+ * called.
+ */
+typedef struct {
+    BReactor *reactor;
+    int family;
+    int have_bind_addr;
+    BAddr bind_addr;
+    int mtu;
+    void *user;
+    DatagramSharedSocket_handler_error handler_error;
+    BAVL entries_tree;
+    LinkedList1 send_queue;
+    int send_busy;
+    uint8_t *send_buf;
+    uint8_t *recv_buf;
+    struct DatagramSharedSocket_queued *recv_queued;
+    uint8_t *recv_queued_buf;
+    LinkedList1 recv_free_list;
+    int have_dgram;
+    BDatagram dgram;
+    DebugObject d_obj;
+} DatagramSharedSocket;
+
+typedef struct DatagramSharedSocket_entry_s {
+    DatagramSharedSocket *s;
+    uint64_t id;
+    int mtu;
+    BAVLNode tree_node;
+    int have_send_addrs;
+    BAddr send_remote_addr;
+    BIPAddr send_local_addr;
+    PacketPassInterface send_iface;
+    int send_queued;
+    LinkedList1Node send_queue_node;
+    const uint8_t *send_data;
+    int send_data_len;
+    int have_recv_addrs;
+    BAddr recv_remote_addr;
+    BIPAddr recv_local_addr;
+    PacketRecvInterface recv_iface;
+    uint8_t *recv_data;
+    LinkedList1 recv_queue;
+    int recv_queue_len;
+    uint64_t recv_dropped;
+    DebugObject d_obj;
+} DatagramSharedSocket_entry;
+
+/**
+ * Initializes the object.
+ * {@link BNetwork_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param family address family of the socket. Must be supported according to
+ *               {@link BDatagram_AddressFamilySupported}.
+ * @param bind_addr address to bind the socket to, or NULL to not bind it. If not NULL,
+ *                  its family must be family.
+ * @param mtu maximum datagram size, including the header. Must be >DATAGRAMSHAREDSOCKET_HEADER_SIZE.
+ * @param user value to pass to handler
+ * @param handler_error error handler
+ * @return 1 on success, 0 on failure
+ */
+int DatagramSharedSocket_Init (DatagramSharedSocket *o, BReactor *reactor, int family, BAddr *bind_addr, int mtu,
+                               void *user, DatagramSharedSocket_handler_error handler_error) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * There must be no entries.
+ * 
+ * @param o the object
+ */
+void DatagramSharedSocket_Free (DatagramSharedSocket *o);
+
+/**
+ * Returns a random ID which is not used by any entry.
+ * 
+ * @param o the object
+ * @return unused ID
+ */
+uint64_t DatagramSharedSocket_GenerateID (DatagramSharedSocket *o);
+
+/**
+ * Initializes an entry.
+ * The entry starts without a send address.
+ * 
+ * @param e the entry
+ * @param s shared socket
+ * @param id ID of the entry
+ * @param mtu maximum packet size for the entry's interfaces. Must be >=0 and
+ *            <=mtu-DATAGRAMSHAREDSOCKET_HEADER_SIZE, with mtu as in {@link DatagramSharedSocket_Init}.
+ * @return 1 on success, 0 if the ID is already used by another entry
+ */
+int DatagramSharedSocket_entry_Init (DatagramSharedSocket_entry *e, DatagramSharedSocket *s, uint64_t id, int mtu) WARN_UNUSED;
+
+/**
+ * Frees an entry.
+ * The interfaces of the entry may be busy.
+ * 
+ * @param e the entry
+ */
+void DatagramSharedSocket_entry_Free (DatagramSharedSocket_entry *e);
+
+/**
+ * Sets addresses for sending packets of the entry.
+ * 
+ * @param e the entry
+ * @param remote_addr destination address. Its family must be the family of the socket.
+ * @param local_addr local source IP address. May be an invalid address.
+ */
+void DatagramSharedSocket_entry_SetSendAddrs (DatagramSharedSocket_entry *e, BAddr remote_addr, BIPAddr local_addr);
+
+/**
+ * Returns the remote and local address of the last datagram received by the entry.
+ * Fails if and only if the entry has not received any datagrams yet.
+ * 
+ * @param e the entry
+ * @param remote_addr returns the remote source address of the datagram
+ * @param local_addr returns the local destination IP address. May be an invalid address.
+ * @return 1 on success, 0 on failure
+ */
+int DatagramSharedSocket_entry_GetLastReceiveAddrs (DatagramSharedSocket_entry *e, BAddr *remote_addr, BIPAddr *local_addr);
+
+/**
+ * Returns the interface for sending packets of the entry.
+ * Its MTU is as in {@link DatagramSharedSocket_entry_Init}.
+ * 
+ * @param e the entry
+ * @return send interface
+ */
+PacketPassInterface * DatagramSharedSocket_entry_GetSendIf (DatagramSharedSocket_entry *e);
+
+/**
+ * Returns the interface for receiving packets of the entry.
+ * Its MTU is as in {@link DatagramSharedSocket_entry_Init}.
+ * 
+ * @param e the entry
+ * @return receive interface
+ */
+PacketRecvInterface * DatagramSharedSocket_entry_GetRecvIf (DatagramSharedSocket_entry *e);
+
+#endif
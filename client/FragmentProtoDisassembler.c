@@ -33,6 +33,8 @@
 #include <misc/debug.h>
 #include <misc/byteorder.h>
 #include <misc/minmax.h>
+#include <misc/balloc.h>
+#include <misc/bsize.h>
 
 #include "client/FragmentProtoDisassembler.h"
 
@@ -161,6 +163,93 @@ static void timer_handler (FragmentProtoDisassembler *o)
     PacketRecvInterface_Done(&o->output, o->out_used);
 }
 
+static void zc_send_chunk (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->in_used < o->in_len || o->in_len == 0)
+    
+    int hdr_len = sizeof(struct fragmentproto_chunk_header);
+    
+    // calculate chunk length
+    int chunk_len = bmin_int(o->in_len - o->in_used, o->output_mtu - hdr_len);
+    if (o->chunk_mtu > 0) {
+        chunk_len = bmin_int(chunk_len, o->chunk_mtu);
+    }
+    
+    // build chunk header
+    struct fragmentproto_chunk_header header;
+    header.frame_id = htol16(o->frame_id);
+    header.chunk_start = htol16(o->in_used);
+    header.chunk_len = htol16(chunk_len);
+    header.is_last = (chunk_len == o->in_len - o->in_used);
+    
+    uint8_t *out;
+    if (o->in_used == 0 && header.is_last) {
+        // whole packet is one chunk, write header in front of it
+        out = o->in - hdr_len;
+    } else {
+        // copy chunk into buffer
+        out = o->zc_buf + o->zc_headroom;
+        memcpy(out + hdr_len, o->in + o->in_used, chunk_len);
+    }
+    memcpy(out, &header, hdr_len);
+    
+    o->in_used += chunk_len;
+    
+    // send chunk
+    PacketPassInterface_Sender_Send(o->zc_output, out, hdr_len + chunk_len);
+}
+
+static void zc_input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(o->in_len == -1)
+    DebugObject_Access(&o->d_obj);
+    
+    // set input packet
+    o->in_len = data_len;
+    o->in = data;
+    o->in_used = 0;
+    o->zc_cancel = 0;
+    
+    zc_send_chunk(o);
+}
+
+static void zc_input_handler_requestcancel (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->zc_cancel) {
+        return;
+    }
+    
+    // drop the rest of the packet once the output is done
+    o->zc_cancel = 1;
+    PacketPassInterface_Sender_RequestCancel(o->zc_output);
+}
+
+static void zc_output_handler_done (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // send next chunk if there is more
+    if (o->in_used < o->in_len && !o->zc_cancel) {
+        zc_send_chunk(o);
+        return;
+    }
+    
+    // set no input packet
+    o->in_len = -1;
+    
+    // increment frame ID
+    o->frame_id++;
+    
+    // finish input
+    PacketPassInterface_Done(&o->input);
+}
+
 void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency)
 {
     ASSERT(input_mtu >= 0)
@@ -173,6 +262,7 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     o->output_mtu = output_mtu;
     o->chunk_mtu = chunk_mtu;
     o->latency = latency;
+    o->zero_copy = 0;
     
     // init input
     PacketPassInterface_Init(&o->input, input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(reactor));
@@ -198,9 +288,62 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     DebugObject_Init(&o->d_obj);
 }
 
+int FragmentProtoDisassembler_InitZeroCopy (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, PacketPassInterface *output, int chunk_mtu, int output_headroom, int output_tailroom)
+{
+    ASSERT(input_mtu >= 0)
+    ASSERT(input_mtu <= UINT16_MAX)
+    ASSERT(PacketPassInterface_HasCancel(output))
+    ASSERT(PacketPassInterface_GetMTU(output) > sizeof(struct fragmentproto_chunk_header))
+    ASSERT(chunk_mtu > 0 || chunk_mtu < 0)
+    ASSERT(output_headroom >= 0)
+    ASSERT(output_tailroom >= 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->output_mtu = PacketPassInterface_GetMTU(output);
+    o->chunk_mtu = chunk_mtu;
+    o->zero_copy = 1;
+    o->zc_output = output;
+    o->zc_headroom = output_headroom;
+    
+    // allocate buffer for chunks of packets which don't fit into one
+    bsize_t size = bsize_add(bsize_fromint(o->zc_headroom), bsize_add(bsize_fromint(o->output_mtu), bsize_fromint(output_tailroom)));
+    if (!(o->zc_buf = (uint8_t *)BAllocSize(size))) {
+        goto fail0;
+    }
+    
+    // init input
+    PacketPassInterface_Init(&o->input, input_mtu, (PacketPassInterface_handler_send)zc_input_handler_send, o, BReactor_PendingGroup(reactor));
+    PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)zc_input_handler_requestcancel);
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->zc_output, (PacketPassInterface_handler_done)zc_output_handler_done, o);
+    
+    // have no input packet
+    o->in_len = -1;
+    
+    // start with zero frame ID
+    o->frame_id = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
 void FragmentProtoDisassembler_Free (FragmentProtoDisassembler *o)
 {
     DebugObject_Free(&o->d_obj);
+    
+    if (o->zero_copy) {
+        // free input
+        PacketPassInterface_Free(&o->input);
+        
+        // free buffer
+        BFree(o->zc_buf);
+        return;
+    }
 
     // free timer
     if (o->latency >= 0) {
@@ -223,6 +366,7 @@ PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassemb
 
 PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassembler *o)
 {
+    ASSERT(!o->zero_copy)
     DebugObject_Access(&o->d_obj);
     
     return &o->output;
@@ -49,15 +49,21 @@
  * according to FragmentProto.
  *
  * Input is with {@link PacketPassInterface}.
- * Output is with {@link PacketRecvInterface}.
+ * Output is with {@link PacketRecvInterface}, or with {@link PacketPassInterface}
+ * if initialized with {@link FragmentProtoDisassembler_InitZeroCopy}.
  */
 typedef struct {
     BReactor *reactor;
     int output_mtu;
     int chunk_mtu;
     btime_t latency;
+    int zero_copy;
     PacketPassInterface input;
     PacketRecvInterface output;
+    PacketPassInterface *zc_output;
+    int zc_headroom;
+    uint8_t *zc_buf;
+    int zc_cancel;
     BTimer timer;
     int in_len;
     uint8_t *in;
@@ -83,6 +89,32 @@ typedef struct {
  */
 void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency);
 
+/**
+ * Initializes the object to send chunks to a {@link PacketPassInterface} output,
+ * avoiding copying input packets where possible.
+ * 
+ * An input packet which fits into a single chunk is sent to the output in place,
+ * with the chunk header written directly in front of it. For this, every input packet
+ * must have sizeof(struct fragmentproto_chunk_header) + output_headroom bytes of
+ * writable space before it, and output_tailroom bytes after it. The output then sees
+ * output_headroom bytes before and output_tailroom bytes after each output packet, and
+ * may modify them until it is done with the packet.
+ * Larger input packets are copied into an internal buffer one chunk at a time.
+ * Output packets contain chunks of a single input packet, so there is no latency
+ * parameter.
+ *
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param input_mtu maximum input packet size. Must be >=0 and <=UINT16_MAX.
+ * @param output output interface. Must support cancel functionality. Its MTU must be
+ *               >sizeof(struct fragmentproto_chunk_header).
+ * @param chunk_mtu maximum chunk size. Must be >0, or <0 for no explicit limit.
+ * @param output_headroom space the output needs before each output packet. Must be >=0.
+ * @param output_tailroom space the output needs after each output packet. Must be >=0.
+ * @return 1 on success, 0 on failure
+ */
+int FragmentProtoDisassembler_InitZeroCopy (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, PacketPassInterface *output, int chunk_mtu, int output_headroom, int output_tailroom) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
@@ -100,6 +132,7 @@ PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassemb
 
 /**
  * Returns the output interface.
+ * The object must have been initialized with {@link FragmentProtoDisassembler_Init}.
  *
  * @param o the object
  * @return output interface
@@ -51,27 +51,150 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
+static size_t hash_mac (const uint8_t *mac)
 {
-    int c = memcmp(mac1, mac2, 6);
-    return B_COMPARE(c, 0);
+    uint64_t x = 0;
+    memcpy(&x, mac, 6);
+    
+    // multiplicative hashing; the high half is mixed from all bytes
+    x *= UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(x >> 32);
 }
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_impl.h>
+static size_t hash_sig (uint32_t sig)
+{
+    uint64_t x = sig * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(x >> 32);
+}
+
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_impl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_impl.h>
 
-#include "FrameDecider_multicast_tree.h"
-#include <structure/SAvl_impl.h>
+#include "FrameDecider_multicast_hash.h"
+#include <structure/CHash_impl.h>
+
+static struct _FrameDecider_mac_entry * lookup_mac (FrameDecider *d, const uint8_t *mac)
+{
+    FDMacsHash_key key = {mac, hash_mac(mac)};
+    
+    // check cache of recent lookups
+    struct _FrameDecider_mac_entry **cache_slot = &d->mac_cache[key.hash % FRAMEDECIDER_MAC_CACHE_SIZE];
+    if (*cache_slot && !memcmp((*cache_slot)->mac, mac, 6)) {
+        return *cache_slot;
+    }
+    
+    // look up in hash table
+    struct _FrameDecider_mac_entry *entry = FDMacsHash_Lookup(&d->macs_hash, 0, key).ptr;
+    
+    // remember in cache
+    if (entry) {
+        *cache_slot = entry;
+    }
+    
+    return entry;
+}
+
+static void insert_mac (FrameDecider *d, struct _FrameDecider_mac_entry *entry)
+{
+    entry->mac_hash = hash_mac(entry->mac);
+    FDMacsHashRef ref = {entry, entry};
+    int res = FDMacsHash_Insert(&d->macs_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+}
+
+static void remove_mac (FrameDecider *d, struct _FrameDecider_mac_entry *entry)
+{
+    FDMacsHashRef ref = {entry, entry};
+    FDMacsHash_Remove(&d->macs_hash, 0, ref);
+    
+    // the cache must not point to entries not in the hash table
+    struct _FrameDecider_mac_entry **cache_slot = &d->mac_cache[entry->mac_hash % FRAMEDECIDER_MAC_CACHE_SIZE];
+    if (*cache_slot == entry) {
+        *cache_slot = NULL;
+    }
+}
+
+static struct _FrameDecider_group_entry * lookup_multicast (FrameDecider *d, uint32_t sig)
+{
+    return FDMulticastHash_Lookup(&d->multicast_hash, 0, sig).ptr;
+}
+
+static void insert_multicast (FrameDecider *d, struct _FrameDecider_group_entry *master)
+{
+    FDMulticastHashRef ref = {master, master};
+    int res = FDMulticastHash_Insert(&d->multicast_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+}
+
+static void remove_multicast (FrameDecider *d, struct _FrameDecider_group_entry *master)
+{
+    FDMulticastHashRef ref = {master, master};
+    FDMulticastHash_Remove(&d->multicast_hash, 0, ref);
+}
+
+static int grow_hash (size_t *buckets, size_t needed, int *out_exp)
+{
+    // double the number of buckets until there is one for every possible entry
+    int exp = 0;
+    size_t n = *buckets;
+    while (n < needed) {
+        if (n > SIZE_MAX / 2) {
+            return 0;
+        }
+        n *= 2;
+        exp++;
+    }
+    
+    *buckets = n;
+    *out_exp = exp;
+    return 1;
+}
+
+static int reserve_peer_entries (FrameDecider *d, int num_peers)
+{
+    ASSERT(num_peers > 0)
+    
+    if (d->max_peer_macs > SIZE_MAX / num_peers || d->max_peer_groups > SIZE_MAX / num_peers) {
+        return 0;
+    }
+    
+    size_t macs_buckets = d->macs_hash_buckets;
+    size_t multicast_buckets = d->multicast_hash_buckets;
+    int macs_exp;
+    int multicast_exp;
+    
+    if (!grow_hash(&macs_buckets, (size_t)d->max_peer_macs * num_peers, &macs_exp) ||
+        !grow_hash(&multicast_buckets, (size_t)d->max_peer_groups * num_peers, &multicast_exp)
+    ) {
+        return 0;
+    }
+    
+    if (macs_exp > 0) {
+        if (!FDMacsHash_MultiplyBuckets(&d->macs_hash, 0, macs_exp)) {
+            return 0;
+        }
+        d->macs_hash_buckets = macs_buckets;
+    }
+    
+    if (multicast_exp > 0) {
+        if (!FDMulticastHash_MultiplyBuckets(&d->multicast_hash, 0, multicast_exp)) {
+            return 0;
+        }
+        d->multicast_hash_buckets = multicast_buckets;
+    }
+    
+    return 1;
+}
 
 static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
 {
     FrameDecider *d = o->d;
     
-    // locate entry in tree
-    struct _FrameDecider_mac_entry *e_entry = FDMacsTree_LookupExact(&d->macs_tree, 0, mac);
+    // locate entry in hash table
+    struct _FrameDecider_mac_entry *e_entry = lookup_mac(d, mac);
     if (e_entry) {
         if (e_entry->peer == o) {
             // this is our MAC; only move it to the end of the used list
@@ -81,7 +204,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         }
         
         // some other peer has that MAC; disassociate it
-        FDMacsTree_Remove(&d->macs_tree, 0, e_entry);
+        remove_mac(d, e_entry);
         LinkedList1_Remove(&e_entry->peer->mac_entries_used, &e_entry->list_node);
         LinkedList1_Append(&e_entry->peer->mac_entries_free, &e_entry->list_node);
     }
@@ -102,7 +225,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         ASSERT(entry->peer == o)
         
         // remove from used
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        remove_mac(d, entry);
         LinkedList1_Remove(&o->mac_entries_used, &entry->list_node);
     }
     
@@ -113,8 +236,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
     
     // add to used
     LinkedList1_Append(&o->mac_entries_used, &entry->list_node);
-    int res = FDMacsTree_Insert(&d->macs_tree, 0, entry, NULL);
-    ASSERT_EXECUTE(res)
+    insert_mac(d, entry);
 }
 
 static uint32_t compute_sig_for_group (uint32_t group)
@@ -135,7 +257,7 @@ static void add_to_multicast (FrameDecider *d, struct _FrameDecider_group_entry
     // compute sig
     uint32_t sig = compute_sig_for_group(group_entry->group);
     
-    struct _FrameDecider_group_entry *master = FDMulticastTree_LookupExact(&d->multicast_tree, 0, sig);
+    struct _FrameDecider_group_entry *master = lookup_multicast(d, sig);
     if (master) {
         // use existing master
         ASSERT(master->is_master)
@@ -154,9 +276,8 @@ static void add_to_multicast (FrameDecider *d, struct _FrameDecider_group_entry
         // set sig
         group_entry->master.sig = sig;
         
-        // insert to multicast tree
-        int res = FDMulticastTree_Insert(&d->multicast_tree, 0, group_entry, NULL);
-        ASSERT_EXECUTE(res)
+        // insert to multicast hash table
+        insert_multicast(d, group_entry);
         
         // init list node
         LinkedList3Node_InitLonely(&group_entry->sig_list_node);
@@ -169,8 +290,8 @@ static void remove_from_multicast (FrameDecider *d, struct _FrameDecider_group_e
     uint32_t sig = compute_sig_for_group(group_entry->group);
     
     if (group_entry->is_master) {
-        // remove master from multicast tree
-        FDMulticastTree_Remove(&d->multicast_tree, 0, group_entry);
+        // remove master from multicast hash table
+        remove_multicast(d, group_entry);
         
         if (!LinkedList3Node_IsLonely(&group_entry->sig_list_node)) {
             // at least one more group entry for this sig; make another entry the master
@@ -186,9 +307,8 @@ static void remove_from_multicast (FrameDecider *d, struct _FrameDecider_group_e
             // set sig
             newmaster->master.sig = sig;
             
-            // insert to multicast tree
-            int res = FDMulticastTree_Insert(&d->multicast_tree, 0, newmaster, NULL);
-            ASSERT_EXECUTE(res)
+            // insert to multicast hash table
+            insert_multicast(d, newmaster);
         }
     }
     
@@ -285,8 +405,8 @@ static void lower_group_timers_to_lmqt (FrameDecider *d, uint32_t group)
     // compute sig
     uint32_t sig = compute_sig_for_group(group);
     
-    // look up the sig in multicast tree
-    struct _FrameDecider_group_entry *master = FDMulticastTree_LookupExact(&d->multicast_tree, 0, sig);
+    // look up the sig in multicast hash table
+    struct _FrameDecider_group_entry *master = lookup_multicast(d, sig);
     if (!master) {
         return;
     }
@@ -320,7 +440,7 @@ static void group_entry_timer_handler (struct _FrameDecider_group_entry *group_e
     remove_group_entry(group_entry);
 }
 
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
 {
     ASSERT(max_peer_macs > 0)
     ASSERT(max_peer_groups > 0)
@@ -334,12 +454,26 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     
     // init peers list
     LinkedList1_Init(&o->peers_list);
+    o->num_peers = 0;
+    
+    // init MAC hash table, with buckets for one peer; more are added as peers come
+    o->macs_hash_buckets = o->max_peer_macs;
+    if (!FDMacsHash_Init(&o->macs_hash, o->macs_hash_buckets)) {
+        BLog(BLOG_ERROR, "FDMacsHash_Init failed");
+        goto fail0;
+    }
     
-    // init MAC tree
-    FDMacsTree_Init(&o->macs_tree);
+    // init multicast hash table
+    o->multicast_hash_buckets = o->max_peer_groups;
+    if (!FDMulticastHash_Init(&o->multicast_hash, o->multicast_hash_buckets)) {
+        BLog(BLOG_ERROR, "FDMulticastHash_Init failed");
+        goto fail1;
+    }
     
-    // init multicast tree
-    FDMulticastTree_Init(&o->multicast_tree);
+    // init MAC cache
+    for (int i = 0; i < FRAMEDECIDER_MAC_CACHE_SIZE; i++) {
+        o->mac_cache[i] = NULL;
+    }
     
     // init decide state
     o->decide_state = DECIDE_STATE_NONE;
@@ -348,14 +482,25 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     o->decide_flood_current = NULL;
     
     DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    FDMacsHash_Free(&o->macs_hash);
+fail0:
+    return 0;
 }
 
 void FrameDecider_Free (FrameDecider *o)
 {
-    ASSERT(FDMulticastTree_IsEmpty(&o->multicast_tree))
-    ASSERT(FDMacsTree_IsEmpty(&o->macs_tree))
     ASSERT(LinkedList1_IsEmpty(&o->peers_list))
+    ASSERT(o->num_peers == 0)
     DebugObject_Free(&o->d_obj);
+    
+    // free multicast hash table
+    FDMulticastHash_Free(&o->multicast_hash);
+    
+    // free MAC hash table
+    FDMacsHash_Free(&o->macs_hash);
 }
 
 void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int frame_len)
@@ -483,8 +628,8 @@ out:;
         // extract group's sig from destination MAC
         uint32_t sig = compute_sig_for_mac(eh.dest);
         
-        // look up the sig in multicast tree
-        struct _FrameDecider_group_entry *master = FDMulticastTree_LookupExact(&o->multicast_tree, 0, sig);
+        // look up the sig in multicast hash table
+        struct _FrameDecider_group_entry *master = lookup_multicast(o, sig);
         if (master) {
             ASSERT(master->is_master)
             
@@ -496,7 +641,7 @@ out:;
     }
     
     // look for MAC entry
-    struct _FrameDecider_mac_entry *entry = FDMacsTree_LookupExact(&o->macs_tree, 0, eh.dest);
+    struct _FrameDecider_mac_entry *entry = lookup_mac(o, eh.dest);
     if (entry) {
         o->decide_state = DECIDE_STATE_UNICAST;
         o->decide_unicast_peer = entry->peer;
@@ -574,8 +719,15 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
         goto fail1;
     }
     
+    // make space for our entries in the hash tables
+    if (!reserve_peer_entries(d, d->num_peers + 1)) {
+        PeerLog(o, BLOG_ERROR, "failed to grow hash tables");
+        goto fail2;
+    }
+    
     // insert to peers list
     LinkedList1_Append(&d->peers_list, &o->list_node);
+    d->num_peers++;
     
     // init MAC entry lists
     LinkedList1_Init(&o->mac_entries_free);
@@ -617,6 +769,8 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
     
     return 1;
     
+fail2:
+    BFree(o->group_entries);
 fail1:
     BFree(o->mac_entries);
 fail0:
@@ -647,12 +801,12 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         BReactor_RemoveTimer(d->reactor, &entry->timer);
     }
     
-    // remove used MAC entries from tree
+    // remove used MAC entries from hash table
     for (node = LinkedList1_GetFirst(&o->mac_entries_used); node; node = LinkedList1Node_Next(node)) {
         struct _FrameDecider_mac_entry *entry = UPPER_OBJECT(node, struct _FrameDecider_mac_entry, list_node);
         
-        // remove from tree
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        // remove from hash table
+        remove_mac(d, entry);
     }
     
     // remove from peers list
@@ -660,6 +814,7 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         d->decide_flood_current = LinkedList1Node_Next(d->decide_flood_current);
     }
     LinkedList1_Remove(&d->peers_list, &o->list_node);
+    d->num_peers--;
     
     // free group entries
     BFree(o->group_entries);
@@ -40,6 +40,7 @@
 #include <structure/LinkedList1.h>
 #include <structure/LinkedList3.h>
 #include <structure/SAvl.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
@@ -48,23 +49,30 @@ struct _FrameDeciderPeer;
 struct _FrameDecider_mac_entry;
 struct _FrameDecider_group_entry;
 
-typedef const uint8_t *FDMacsTree_key;
+// number of entries in the cache of recently looked up destination MACs
+#define FRAMEDECIDER_MAC_CACHE_SIZE 64
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_decl.h>
+typedef struct {
+    const uint8_t *mac;
+    size_t hash;
+} FDMacsHash_key;
+
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_decl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_decl.h>
 
-#include "FrameDecider_multicast_tree.h"
-#include <structure/SAvl_decl.h>
+#include "FrameDecider_multicast_hash.h"
+#include <structure/CHash_decl.h>
 
 struct _FrameDecider_mac_entry {
     struct _FrameDeciderPeer *peer;
     LinkedList1Node list_node; // node in FrameDeciderPeer.mac_entries_free or FrameDeciderPeer.mac_entries_used
     // defined when used:
     uint8_t mac[6];
-    FDMacsTreeNode tree_node; // node in FrameDecider.macs_tree, indexed by mac
+    size_t mac_hash;
+    struct _FrameDecider_mac_entry *hash_next; // next in FrameDecider.macs_hash bucket, indexed by mac
 };
 
 struct _FrameDecider_group_entry {
@@ -82,7 +90,7 @@ struct _FrameDecider_group_entry {
     // defined when used and we are master:
     struct {
         uint32_t sig; // last 23 bits of group address
-        FDMulticastTreeNode tree_node; // node in FrameDecider.multicast_tree, indexed by sig
+        struct _FrameDecider_group_entry *hash_next; // next in FrameDecider.multicast_hash bucket, indexed by sig
     } master;
 };
 
@@ -96,8 +104,12 @@ typedef struct {
     btime_t igmp_last_member_query_time;
     BReactor *reactor;
     LinkedList1 peers_list;
-    FDMacsTree macs_tree;
-    FDMulticastTree multicast_tree;
+    int num_peers;
+    FDMacsHash macs_hash;
+    size_t macs_hash_buckets;
+    FDMulticastHash multicast_hash;
+    size_t multicast_hash_buckets;
+    struct _FrameDecider_mac_entry *mac_cache[FRAMEDECIDER_MAC_CACHE_SIZE];
     int decide_state;
     LinkedList1Node *decide_flood_current;
     struct _FrameDeciderPeer *decide_unicast_peer;
@@ -136,8 +148,10 @@ typedef struct _FrameDeciderPeer {
  * @param igmp_last_member_query_time IGMP Last Member Query Time value. When a Group-Specific
  *        Query is detected in {@link FrameDecider_AnalyzeAndDecide}, this is how long we wait for a peer
  *        belonging to the group to send a join before we remove the group from it.
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
  */
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor);
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor) WARN_UNUSED;
 
 /**
  * Frees the object.
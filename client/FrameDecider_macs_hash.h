@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME FDMacsHash
+#define CHASH_PARAM_ENTRY struct _FrameDecider_mac_entry
+#define CHASH_PARAM_LINK struct _FrameDecider_mac_entry *
+#define CHASH_PARAM_KEY FDMacsHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct _FrameDecider_mac_entry *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->mac_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) ((key).hash)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (!memcmp((entry1).ptr->mac, (entry2).ptr->mac, 6))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (!memcmp((key1).mac, (entry2).ptr->mac, 6))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -31,6 +31,7 @@
 
 #include <misc/balign.h>
 #include <misc/byteorder.h>
+#include <misc/balloc.h>
 #include <security/BHash.h>
 
 #include "SPProtoDecoder.h"
@@ -39,15 +40,31 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static void decode_work_func (SPProtoDecoder *o)
+#define SLOT_STATE_WORKING 1
+#define SLOT_STATE_DONE 2
+
+static int check_counter (SPProtoDecoder *o, uint64_t counter)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->in_len <= o->input_mtu)
+    ASSERT(SPPROTO_HAVE_COUNTER(o->sp_params))
     
-    uint8_t *in = o->in;
-    int in_len = o->in_len;
+    // packets in our direction may have been reflected back to us
+    if ((counter & SPPROTO_COUNTER_DIRECTION_BIT) != o->counter_dir) {
+        PeerLog(o, BLOG_WARNING, "packet has wrong counter direction");
+        return 0;
+    }
     
-    o->tw_out_len = -1;
+    if (!ReplayWindow_Check(&o->replay_window, counter & ~SPPROTO_COUNTER_DIRECTION_BIT)) {
+        PeerLog(o, BLOG_WARNING, "packet is replayed or too old");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int decode (SPProtoDecoder *o, BEncryption *encryptor, uint8_t *in, int in_len, uint8_t *buf, uint16_t *out_seed_id, otp_t *out_otp, uint64_t *out_counter, uint8_t **out)
+{
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
     
     uint8_t *plaintext;
     int plaintext_len;
@@ -56,23 +73,47 @@ static void decode_work_func (SPProtoDecoder *o)
     if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         plaintext = in;
         plaintext_len = in_len;
-    } else {
+    }
+    else if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // input must have a nonce and a tag
+        if (in_len < BENCRYPTION_AEAD_NONCE_SIZE + BENCRYPTION_AEAD_TAG_SIZE) {
+            PeerLog(o, BLOG_WARNING, "packet does not have a nonce and a tag");
+            return -1;
+        }
+        
+        // check if we have encryption key
+        if (!o->have_encryption_key) {
+            PeerLog(o, BLOG_WARNING, "have no encryption key");
+            return -1;
+        }
+        
+        // decrypt and verify
+        uint8_t *ciphertext = in + BENCRYPTION_AEAD_NONCE_SIZE;
+        int ciphertext_len = in_len - BENCRYPTION_AEAD_NONCE_SIZE - BENCRYPTION_AEAD_TAG_SIZE;
+        plaintext = buf;
+        if (!BEncryption_DecryptAEAD(encryptor, in, ciphertext, plaintext, ciphertext_len, ciphertext + ciphertext_len)) {
+            PeerLog(o, BLOG_WARNING, "packet failed authentication");
+            return -1;
+        }
+        plaintext_len = ciphertext_len;
+    }
+    else {
         // input must be a multiple of blocks size
         if (in_len % o->enc_block_size != 0) {
             PeerLog(o, BLOG_WARNING, "packet size not a multiple of block size");
-            return;
+            return -1;
         }
         
         // input must have an IV block
         if (in_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have an IV");
-            return;
+            return -1;
         }
         
         // check if we have encryption key
         if (!o->have_encryption_key) {
             PeerLog(o, BLOG_WARNING, "have no encryption key");
-            return;
+            return -1;
         }
         
         // copy IV as BEncryption_Decrypt changes the IV
@@ -82,13 +123,13 @@ static void decode_work_func (SPProtoDecoder *o)
         // decrypt
         uint8_t *ciphertext = in + o->enc_block_size;
         int ciphertext_len = in_len - o->enc_block_size;
-        plaintext = o->buf;
-        BEncryption_Decrypt(&o->encryptor, ciphertext, plaintext, ciphertext_len, iv);
+        plaintext = buf;
+        BEncryption_Decrypt(encryptor, ciphertext, plaintext, ciphertext_len, iv);
         
         // read padding
         if (ciphertext_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have a padding block");
-            return;
+            return -1;
         }
         int i;
         for (i = ciphertext_len - 1; i >= ciphertext_len - o->enc_block_size; i--) {
@@ -97,12 +138,12 @@ static void decode_work_func (SPProtoDecoder *o)
             }
             if (plaintext[i] != 0) {
                 PeerLog(o, BLOG_WARNING, "packet padding wrong (nonzero byte)");
-                return;
+                return -1;
             }
         }
         if (i < ciphertext_len - o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet padding wrong (all zeroes)");
-            return;
+            return -1;
         }
         plaintext_len = i;
     }
@@ -110,14 +151,14 @@ static void decode_work_func (SPProtoDecoder *o)
     // check for header
     if (plaintext_len < SPPROTO_HEADER_LEN(o->sp_params)) {
         PeerLog(o, BLOG_WARNING, "packet has no header");
-        return;
+        return -1;
     }
     uint8_t *header = plaintext;
     
     // check data length
     if (plaintext_len - SPPROTO_HEADER_LEN(o->sp_params) > o->output_mtu) {
         PeerLog(o, BLOG_WARNING, "packet too long");
-        return;
+        return -1;
     }
     
     // check OTP
@@ -125,8 +166,15 @@ static void decode_work_func (SPProtoDecoder *o)
         // remember seed and OTP (can't check from here)
         struct spproto_otpdata header_otpd;
         memcpy(&header_otpd, header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), sizeof(header_otpd));
-        o->tw_out_seed_id = ltoh16(header_otpd.seed_id);
-        o->tw_out_otp = header_otpd.otp;
+        *out_seed_id = ltoh16(header_otpd.seed_id);
+        *out_otp = header_otpd.otp;
+    }
+    
+    // read packet counter (can't check from here)
+    if (SPPROTO_HAVE_COUNTER(o->sp_params)) {
+        struct spproto_counterdata header_counterd;
+        memcpy(&header_counterd, header + SPPROTO_HEADER_COUNTERDATA_OFF(o->sp_params), sizeof(header_counterd));
+        *out_counter = ltoh64(header_counterd.counter);
     }
     
     // check hash
@@ -145,13 +193,20 @@ static void decode_work_func (SPProtoDecoder *o)
         // compare hashes
         if (memcmp(hash, hash_calc, o->hash_size)) {
             PeerLog(o, BLOG_WARNING, "packet has wrong hash");
-            return;
+            return -1;
         }
     }
     
     // return packet
-    o->tw_out = plaintext + SPPROTO_HEADER_LEN(o->sp_params);
-    o->tw_out_len = plaintext_len - SPPROTO_HEADER_LEN(o->sp_params);
+    *out = plaintext + SPPROTO_HEADER_LEN(o->sp_params);
+    return (plaintext_len - SPPROTO_HEADER_LEN(o->sp_params));
+}
+
+static void decode_work_func (SPProtoDecoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    
+    o->tw_out_len = decode(o, &o->encryptor, o->in, o->in_len, o->buf, &o->tw_out_seed_id, &o->tw_out_otp, &o->tw_out_counter, &o->tw_out);
 }
 
 static void decode_work_handler (SPProtoDecoder *o)
@@ -172,6 +227,13 @@ static void decode_work_handler (SPProtoDecoder *o)
         }
     }
     
+    // check packet counter
+    if (SPPROTO_HAVE_COUNTER(o->sp_params) && o->tw_out_len >= 0) {
+        if (!check_counter(o, o->tw_out_counter)) {
+            o->tw_out_len = -1;
+        }
+    }
+    
     if (o->tw_out_len < 0) {
         // cannot decode, finish input packet
         PacketPassInterface_Done(&o->input);
@@ -210,8 +272,232 @@ static void output_handler_done (SPProtoDecoder *o)
     o->in_len = -1;
 }
 
+static struct SPProtoDecoder_slot * get_slot (SPProtoDecoder *o, int i)
+{
+    ASSERT(i >= 0)
+    ASSERT(i < o->pipeline_len)
+    
+    return &o->slots[(o->slots_start + i) % o->pipeline_len];
+}
+
+static void pipe_release_head (SPProtoDecoder *o)
+{
+    ASSERT(o->slots_used > 0)
+    ASSERT(!o->slots_sending)
+    
+    // free slot
+    o->slots_start = (o->slots_start + 1) % o->pipeline_len;
+    o->slots_used--;
+    
+    // accept the next input packet if we were full
+    if (o->input_blocked) {
+        o->input_blocked = 0;
+        PacketPassInterface_Done(&o->input);
+    }
+}
+
+static void pipe_maybe_output (SPProtoDecoder *o)
+{
+    // packets are output in order; wait for the oldest one
+    while (!o->slots_sending && o->slots_used > 0) {
+        struct SPProtoDecoder_slot *slot = get_slot(o, 0);
+        if (slot->state != SLOT_STATE_DONE) {
+            return;
+        }
+        
+        // check OTP
+        if (SPPROTO_HAVE_OTP(o->sp_params) && slot->out_len >= 0) {
+            if (!OTPChecker_CheckOTP(&o->otpchecker, slot->out_seed_id, slot->out_otp)) {
+                PeerLog(o, BLOG_WARNING, "packet has wrong OTP");
+                slot->out_len = -1;
+            }
+        }
+        
+        // check packet counter
+        if (SPPROTO_HAVE_COUNTER(o->sp_params) && slot->out_len >= 0) {
+            if (!check_counter(o, slot->out_counter)) {
+                slot->out_len = -1;
+            }
+        }
+        
+        if (slot->out_len < 0) {
+            // cannot decode, drop packet
+            pipe_release_head(o);
+            continue;
+        }
+        
+        // submit decoded packet to output
+        o->slots_sending = 1;
+        PacketPassInterface_Sender_Send(o->output, slot->out, slot->out_len);
+    }
+}
+
+static void pipe_work_func (struct SPProtoDecoder_slot *slot)
+{
+    SPProtoDecoder *o = slot->o;
+    ASSERT(slot->state == SLOT_STATE_WORKING)
+    
+    slot->out_len = decode(o, &slot->encryptor, slot->in, slot->in_len, slot->buf, &slot->out_seed_id, &slot->out_otp, &slot->out_counter, &slot->out);
+}
+
+static void pipe_work_handler (struct SPProtoDecoder_slot *slot)
+{
+    SPProtoDecoder *o = slot->o;
+    ASSERT(slot->state == SLOT_STATE_WORKING)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&slot->tw);
+    slot->state = SLOT_STATE_DONE;
+    
+    // output if this is the oldest packet
+    pipe_maybe_output(o);
+}
+
+static void pipe_input_handler_send (SPProtoDecoder *o, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->input_mtu)
+    ASSERT(o->slots_used < o->pipeline_len)
+    ASSERT(!o->input_blocked)
+    DebugObject_Access(&o->d_obj);
+    
+    // copy packet into the first free slot
+    struct SPProtoDecoder_slot *slot = get_slot(o, o->slots_used);
+    memcpy(slot->in, data, data_len);
+    slot->in_len = data_len;
+    slot->remote_addr = o->in_remote_addr;
+    slot->local_addr = o->in_local_addr;
+    o->slots_used++;
+    
+    // start decoding
+    slot->state = SLOT_STATE_WORKING;
+    BThreadWork_Init(&slot->tw, o->twd, (BThreadWork_handler_done)pipe_work_handler, slot, (BThreadWork_work_func)pipe_work_func, slot);
+    
+    // accept the next packet while this one is decoded, if there is space
+    if (o->slots_used < o->pipeline_len) {
+        PacketPassInterface_Done(&o->input);
+    } else {
+        o->input_blocked = 1;
+    }
+}
+
+static void pipe_output_handler_done (SPProtoDecoder *o)
+{
+    ASSERT(o->slots_sending)
+    DebugObject_Access(&o->d_obj);
+    
+    o->slots_sending = 0;
+    
+    // free slot of sent packet
+    pipe_release_head(o);
+    
+    // output further packets
+    pipe_maybe_output(o);
+}
+
+static void pipe_stop_work_and_ignore (SPProtoDecoder *o)
+{
+    // keep the packet being sent, if any
+    int keep = o->slots_sending;
+    
+    // stop work and ignore other packets
+    for (int i = keep; i < o->slots_used; i++) {
+        struct SPProtoDecoder_slot *slot = get_slot(o, i);
+        if (slot->state == SLOT_STATE_WORKING) {
+            BThreadWork_Free(&slot->tw);
+        }
+    }
+    o->slots_used = keep;
+    
+    // accept the next input packet if we were full
+    if (o->input_blocked) {
+        o->input_blocked = 0;
+        PacketPassInterface_Done(&o->input);
+    }
+}
+
+static void pipe_set_key (SPProtoDecoder *o, uint8_t *encryption_key)
+{
+    // every slot has its own encryptor, as one may not be used from several threads at once
+    for (int i = 0; i < o->pipeline_len; i++) {
+        struct SPProtoDecoder_slot *slot = &o->slots[i];
+        
+        if (o->have_encryption_key) {
+            BEncryption_Free(&slot->encryptor);
+        }
+        
+        if (encryption_key) {
+            BEncryption_Init(&slot->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
+        }
+    }
+}
+
+static int pipe_init (SPProtoDecoder *o, int buf_size)
+{
+    // allocate slots
+    if (!(o->slots = (struct SPProtoDecoder_slot *)BAllocArray(o->pipeline_len, sizeof(o->slots[0])))) {
+        goto fail0;
+    }
+    
+    int i;
+    for (i = 0; i < o->pipeline_len; i++) {
+        struct SPProtoDecoder_slot *slot = &o->slots[i];
+        slot->o = o;
+        
+        // allocate input and plaintext buffers
+        if (!(slot->in = (uint8_t *)BAlloc(o->input_mtu + buf_size))) {
+            goto fail1;
+        }
+        slot->buf = slot->in + o->input_mtu;
+    }
+    
+    // have no packets
+    o->slots_start = 0;
+    o->slots_used = 0;
+    o->slots_sending = 0;
+    o->input_blocked = 0;
+    
+    return 1;
+    
+fail1:
+    while (i-- > 0) {
+        BFree(o->slots[i].in);
+    }
+    BFree(o->slots);
+fail0:
+    return 0;
+}
+
+static void pipe_free (SPProtoDecoder *o)
+{
+    // free work
+    for (int i = 0; i < o->slots_used; i++) {
+        struct SPProtoDecoder_slot *slot = get_slot(o, i);
+        if (slot->state == SLOT_STATE_WORKING) {
+            BThreadWork_Free(&slot->tw);
+        }
+    }
+    
+    // free encryptors
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        pipe_set_key(o, NULL);
+    }
+    
+    // free slots
+    for (int i = 0; i < o->pipeline_len; i++) {
+        BFree(o->slots[i].in);
+    }
+    BFree(o->slots);
+}
+
 static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
 {
+    if (o->pipeline_len > 1) {
+        pipe_stop_work_and_ignore(o);
+        return;
+    }
+    
     ASSERT(!(o->tw_have) || o->in_len >= 0)
     
     if (o->tw_have) {
@@ -225,21 +511,23 @@ static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
     }
 }
 
-int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc)
+int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc)
 {
     spproto_assert_security_params(sp_params);
     ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketPassInterface_GetMTU(output)) >= 0)
     ASSERT(!SPPROTO_HAVE_OTP(sp_params) || num_otp_seeds >= 2)
+    ASSERT(pipeline_len > 0)
     
     // init arguments
     o->output = output;
     o->sp_params = sp_params;
+    o->pipeline_len = pipeline_len;
     o->twd = twd;
     o->user = user;
     o->logfunc = logfunc;
     
     // init output
-    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    PacketPassInterface_Sender_Init(o->output, (o->pipeline_len > 1 ? (PacketPassInterface_handler_done)pipe_output_handler_done : (PacketPassInterface_handler_done)output_handler_done), o);
     
     // remember output MTU
     o->output_mtu = PacketPassInterface_GetMTU(o->output);
@@ -251,23 +539,44 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     
     // calculate encryption block and key sizes
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
+        if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+            o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
+        }
         o->enc_key_size = BEncryption_cipher_key_size(o->sp_params.encryption_mode);
     }
     
     // calculate input MTU
     o->input_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->output_mtu);
     
-    // allocate plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
+    // have no encryption key
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
+        o->have_encryption_key = 0;
+    }
+    
+    // calculate plaintext buffer size
+    int buf_size = 0;
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        buf_size = SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu;
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
+    }
+    
+    if (o->pipeline_len > 1) {
+        // init pipeline
+        if (!pipe_init(o, buf_size)) {
+            goto fail0;
+        }
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        // allocate plaintext buffer
         if (!(o->buf = (uint8_t *)malloc(buf_size))) {
             goto fail0;
         }
     }
     
     // init input
-    PacketPassInterface_Init(&o->input, o->input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    PacketPassInterface_Init(&o->input, o->input_mtu, (o->pipeline_len > 1 ? (PacketPassInterface_handler_send)pipe_input_handler_send : (PacketPassInterface_handler_send)input_handler_send), o, pg);
     
     // init OTP checker
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
@@ -276,14 +585,19 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
         }
     }
     
-    // have no encryption key
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
-        o->have_encryption_key = 0;
+    // init replay window
+    if (SPPROTO_HAVE_COUNTER(o->sp_params)) {
+        ReplayWindow_Init(&o->replay_window);
+        o->counter_dir = 0;
     }
     
     // have no input packet
     o->in_len = -1;
     
+    // have no input addresses
+    BAddr_InitNone(&o->in_remote_addr);
+    BIPAddr_InitInvalid(&o->in_local_addr);
+    
     // have no work
     o->tw_have = 0;
     
@@ -293,7 +607,10 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     
 fail1:
     PacketPassInterface_Free(&o->input);
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (o->pipeline_len > 1) {
+        pipe_free(o);
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         free(o->buf);
     }
 fail0:
@@ -310,7 +627,7 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
     }
     
     // free encryptor
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
+    if (o->pipeline_len == 1 && SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
         BEncryption_Free(&o->encryptor);
     }
     
@@ -322,8 +639,13 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
     // free input
     PacketPassInterface_Free(&o->input);
     
+    // free pipeline
+    if (o->pipeline_len > 1) {
+        pipe_free(o);
+    }
+    
     // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         free(o->buf);
     }
 }
@@ -335,6 +657,33 @@ PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o)
     return &o->input;
 }
 
+void SPProtoDecoder_SetInputAddrs (SPProtoDecoder *o, BAddr remote_addr, BIPAddr local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->in_remote_addr = remote_addr;
+    o->in_local_addr = local_addr;
+}
+
+void SPProtoDecoder_GetOutputAddrs (SPProtoDecoder *o, BAddr *remote_addr, BIPAddr *local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->pipeline_len > 1) {
+        // the packet being output is the oldest one in the pipeline
+        ASSERT(o->slots_sending)
+        struct SPProtoDecoder_slot *slot = get_slot(o, 0);
+        *remote_addr = slot->remote_addr;
+        *local_addr = slot->local_addr;
+        return;
+    }
+    
+    // the input packet is held until it has been output
+    ASSERT(o->in_len >= 0)
+    *remote_addr = o->in_remote_addr;
+    *local_addr = o->in_local_addr;
+}
+
 void SPProtoDecoder_SetEncryptionKey (SPProtoDecoder *o, uint8_t *encryption_key)
 {
     ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
@@ -343,16 +692,26 @@ void SPProtoDecoder_SetEncryptionKey (SPProtoDecoder *o, uint8_t *encryption_key
     // stop existing work
     maybe_stop_work_and_ignore(o);
     
-    // free encryptor
-    if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+    if (o->pipeline_len > 1) {
+        // init encryptors of slots
+        pipe_set_key(o, encryption_key);
+    } else {
+        // free encryptor
+        if (o->have_encryption_key) {
+            BEncryption_Free(&o->encryptor);
+        }
+        
+        // init encryptor
+        BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
     }
     
-    // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
-    
     // have encryption key
     o->have_encryption_key = 1;
+    
+    // packets encrypted with the old key are no longer accepted, forget their counters
+    if (SPPROTO_HAVE_COUNTER(o->sp_params)) {
+        ReplayWindow_Init(&o->replay_window);
+    }
 }
 
 void SPProtoDecoder_RemoveEncryptionKey (SPProtoDecoder *o)
@@ -365,7 +724,11 @@ void SPProtoDecoder_RemoveEncryptionKey (SPProtoDecoder *o)
     
     if (o->have_encryption_key) {
         // free encryptor
-        BEncryption_Free(&o->encryptor);
+        if (o->pipeline_len > 1) {
+            pipe_set_key(o, NULL);
+        } else {
+            BEncryption_Free(&o->encryptor);
+        }
         
         // have no encryption key
         o->have_encryption_key = 0;
@@ -388,6 +751,18 @@ void SPProtoDecoder_RemoveOTPSeeds (SPProtoDecoder *o)
     OTPChecker_RemoveSeeds(&o->otpchecker);
 }
 
+void SPProtoDecoder_SetCounterDirection (SPProtoDecoder *o, int dir)
+{
+    ASSERT(SPPROTO_HAVE_COUNTER(o->sp_params))
+    ASSERT(dir == 0 || dir == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    o->counter_dir = (dir ? SPPROTO_COUNTER_DIRECTION_BIT : 0);
+    
+    // forget counters seen from the other direction
+    ReplayWindow_Init(&o->replay_window);
+}
+
 void SPProtoDecoder_SetHandlers (SPProtoDecoder *o, SPProtoDecoder_otp_handler otp_handler, void *user)
 {
     DebugObject_Access(&o->d_obj);
@@ -39,9 +39,11 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
+#include <system/BAddr.h>
 #include <protocol/spproto.h>
 #include <security/BEncryption.h>
 #include <security/OTPChecker.h>
+#include <security/ReplayWindow.h>
 #include <flow/PacketPassInterface.h>
 
 /**
@@ -51,14 +53,34 @@
  */
 typedef void (*SPProtoDecoder_otp_handler) (void *user);
 
+struct SPProtoDecoder_s;
+
+struct SPProtoDecoder_slot {
+    struct SPProtoDecoder_s *o;
+    uint8_t *in;
+    int in_len;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    uint8_t *buf;
+    int state;
+    BThreadWork tw;
+    uint16_t out_seed_id;
+    otp_t out_otp;
+    uint64_t out_counter;
+    uint8_t *out;
+    int out_len;
+    BEncryption encryptor;
+};
+
 /**
  * Object which decodes packets according to SPProto.
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketPassInterface}.
  */
-typedef struct {
+typedef struct SPProtoDecoder_s {
     PacketPassInterface *output;
     struct spproto_security_params sp_params;
+    int pipeline_len;
     BThreadWorkDispatcher *twd;
     void *user;
     BLog_logfunc logfunc;
@@ -70,16 +92,26 @@ typedef struct {
     uint8_t *buf;
     PacketPassInterface input;
     OTPChecker otpchecker;
+    ReplayWindow replay_window;
+    uint64_t counter_dir;
     int have_encryption_key;
     BEncryption encryptor;
     uint8_t *in;
     int in_len;
+    BAddr in_remote_addr;
+    BIPAddr in_local_addr;
     int tw_have;
     BThreadWork tw;
     uint16_t tw_out_seed_id;
     otp_t tw_out_otp;
+    uint64_t tw_out_counter;
     uint8_t *tw_out;
     int tw_out_len;
+    struct SPProtoDecoder_slot *slots;
+    int slots_start;
+    int slots_used;
+    int slots_sending;
+    int input_blocked;
     DebugObject d_obj;
 } SPProtoDecoder;
 
@@ -95,13 +127,19 @@ typedef struct {
  * @param encryption_key if using encryption, the encryption key
  * @param num_otp_seeds if using OTPs, how many OTP seeds to keep for checking
  *                      receiving packets. Must be >=2 if using OTPs.
+ * @param pipeline_len maximum number of packets being decoded at once. Must be >0.
+ *                     If it is 1, each input packet is decoded before the next one is
+ *                     accepted, without copying it if encryption is not used.
+ *                     If it is >1, input packets are copied and accepted immediately
+ *                     while there is space, decoded concurrently by the threads of twd,
+ *                     and sent to the output in the order they were received.
  * @param pg pending group
  * @param twd thread work dispatcher
  * @param user argument to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
  * @return 1 on success, 0 on failure
  */
-int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -120,9 +158,35 @@ void SPProtoDecoder_Free (SPProtoDecoder *o);
  */
 PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o);
 
+/**
+ * Sets the addresses associated with the next packet submitted to the input.
+ * They are carried along with the packet while it is being decoded, and
+ * can be obtained with {@link SPProtoDecoder_GetOutputAddrs} once the packet
+ * has been authenticated and is being output. Packets submitted without
+ * calling this first have the addresses of the previous packet.
+ *
+ * @param o the object
+ * @param remote_addr address the packet was received from
+ * @param local_addr local address the packet was received on
+ */
+void SPProtoDecoder_SetInputAddrs (SPProtoDecoder *o, BAddr remote_addr, BIPAddr local_addr);
+
+/**
+ * Returns the addresses associated with the packet being output, as set with
+ * {@link SPProtoDecoder_SetInputAddrs} when it was submitted to the input.
+ * Must only be called while a packet is being sent to the output, e.g. from
+ * a {@link PacketPassNotifier} handler after the output.
+ *
+ * @param o the object
+ * @param remote_addr returns the address the packet was received from
+ * @param local_addr returns the local address the packet was received on
+ */
+void SPProtoDecoder_GetOutputAddrs (SPProtoDecoder *o, BAddr *remote_addr, BIPAddr *local_addr);
+
 /**
  * Sets an encryption key for decrypting packets.
  * Encryption must be enabled.
+ * If packet counters are used, forgets which counters were seen.
  *
  * @param o the object
  * @param encryption_key key to use
@@ -159,6 +223,18 @@ void SPProtoDecoder_AddOTPSeed (SPProtoDecoder *o, uint16_t seed_id, uint8_t *ke
  */
 void SPProtoDecoder_RemoveOTPSeeds (SPProtoDecoder *o);
 
+/**
+ * Sets the direction of packet counters to accept.
+ * Packet counters must be enabled.
+ * Forgets which counters were seen.
+ *
+ * @param o the object
+ * @param dir 1 to accept packets from the peer which bound, i.e. with
+ *            {@link SPPROTO_COUNTER_DIRECTION_BIT} set in their counters,
+ *            0 to accept packets from the peer which connected
+ */
+void SPProtoDecoder_SetCounterDirection (SPProtoDecoder *o, int dir);
+
 /**
  * Sets handlers.
  *
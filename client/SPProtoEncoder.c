@@ -31,6 +31,7 @@
 #include <stdlib.h>
 
 #include <misc/balign.h>
+#include <misc/balloc.h>
 #include <misc/offset.h>
 #include <misc/byteorder.h>
 #include <security/BRandom.h>
@@ -38,6 +39,14 @@
 
 #include "SPProtoEncoder.h"
 
+#define SLOT_STATE_RECEIVED 1
+#define SLOT_STATE_WORKING 2
+#define SLOT_STATE_DONE 3
+
+static int encode (SPProtoEncoder *o, BEncryption *encryptor, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp, uint64_t counter, uint8_t *out);
+static int have_counter (SPProtoEncoder *o);
+static uint64_t next_counter (SPProtoEncoder *o);
+static int have_otp_and_key (SPProtoEncoder *o);
 static int can_encode (SPProtoEncoder *o);
 static void encode_packet (SPProtoEncoder *o);
 static void encode_work_func (SPProtoEncoder *o);
@@ -45,22 +54,59 @@ static void encode_work_handler (SPProtoEncoder *o);
 static void maybe_encode (SPProtoEncoder *o);
 static void output_handler_recv (SPProtoEncoder *o, uint8_t *data);
 static void input_handler_done (SPProtoEncoder *o, int data_len);
+static void zc_output_handler_recv (SPProtoEncoder *o, uint8_t *data);
+static void zc_input_handler_send (SPProtoEncoder *o, uint8_t *data, int data_len);
+static void zc_input_handler_requestcancel (SPProtoEncoder *o);
 static void handler_job_hander (SPProtoEncoder *o);
 static void otpgenerator_handler (SPProtoEncoder *o);
 static void maybe_stop_work (SPProtoEncoder *o);
+static struct SPProtoEncoder_slot * get_slot (SPProtoEncoder *o, int i);
+static void pipe_receive (SPProtoEncoder *o);
+static void pipe_start_encoding (SPProtoEncoder *o);
+static void pipe_work_func (struct SPProtoEncoder_slot *slot);
+static void pipe_work_handler (struct SPProtoEncoder_slot *slot);
+static void pipe_maybe_output (SPProtoEncoder *o);
+static void pipe_output_handler_recv (SPProtoEncoder *o, uint8_t *data);
+static void pipe_input_handler_done (SPProtoEncoder *o, int data_len);
+static void pipe_stop_work (SPProtoEncoder *o);
+static void pipe_set_key (SPProtoEncoder *o, uint8_t *encryption_key);
+static int pipe_init (SPProtoEncoder *o);
+static void pipe_free (SPProtoEncoder *o);
+static int init_internal (SPProtoEncoder *o, PacketRecvInterface *input, int input_mtu, struct spproto_security_params sp_params, int otp_warning_count, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd);
 
-static int can_encode (SPProtoEncoder *o)
+static int have_counter (SPProtoEncoder *o)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->out_have)
-    ASSERT(!o->tw_have)
+    // AEAD nonces are built from the counter even if it is not sent in the header
+    return (SPPROTO_HAVE_COUNTER(o->sp_params) || SPPROTO_HAVE_AEAD(o->sp_params));
+}
+
+static uint64_t next_counter (SPProtoEncoder *o)
+{
+    ASSERT(have_counter(o))
+    
+    uint64_t counter = o->counter_next;
+    o->counter_next = (o->counter_next + 1) & ~SPPROTO_COUNTER_DIRECTION_BIT;
     
+    return (o->counter_dir | counter);
+}
+
+static int have_otp_and_key (SPProtoEncoder *o)
+{
     return (
         (!SPPROTO_HAVE_OTP(o->sp_params) || OTPGenerator_GetPosition(&o->otpgen) < o->sp_params.otp_num) &&
         (!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
     );
 }
 
+static int can_encode (SPProtoEncoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->out_have)
+    ASSERT(!o->tw_have)
+    
+    return have_otp_and_key(o);
+}
+
 static void encode_packet (SPProtoEncoder *o)
 {
     ASSERT(o->in_len >= 0)
@@ -74,6 +120,11 @@ static void encode_packet (SPProtoEncoder *o)
         o->tw_otp = OTPGenerator_GetOTP(&o->otpgen);
     }
     
+    // assign packet counter
+    if (have_counter(o)) {
+        o->tw_counter = next_counter(o);
+    }
+    
     // start work
     BThreadWork_Init(&o->tw, o->twd, (BThreadWork_handler_done)encode_work_handler, o, (BThreadWork_work_func)encode_work_func, o);
     o->tw_have = 1;
@@ -84,31 +135,32 @@ static void encode_packet (SPProtoEncoder *o)
     }
 }
 
-static void encode_work_func (SPProtoEncoder *o)
+static int encode (SPProtoEncoder *o, BEncryption *encryptor, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp, uint64_t counter, uint8_t *out)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->out_have)
-    ASSERT(!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
-    
-    ASSERT(o->in_len <= o->input_mtu)
-    
-    // determine plaintext location
-    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
     
     // plaintext begins with header
     uint8_t *header = plaintext;
     
     // plaintext is header + payload
-    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + o->in_len;
+    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + in_len;
     
     // write OTP
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
         struct spproto_otpdata header_otpd;
-        header_otpd.seed_id = htol16(o->tw_seed_id);
-        header_otpd.otp = o->tw_otp;
+        header_otpd.seed_id = htol16(seed_id);
+        header_otpd.otp = otp;
         memcpy(header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), &header_otpd, sizeof(header_otpd));
     }
     
+    // write packet counter
+    if (SPPROTO_HAVE_COUNTER(o->sp_params)) {
+        struct spproto_counterdata header_counterd;
+        header_counterd.counter = htol64(counter);
+        memcpy(header + SPPROTO_HEADER_COUNTERDATA_OFF(o->sp_params), &header_counterd, sizeof(header_counterd));
+    }
+    
     // write hash
     if (SPPROTO_HAVE_HASH(o->sp_params)) {
         uint8_t *header_hash = header + SPPROTO_HEADER_HASH_OFF(o->sp_params);
@@ -123,7 +175,22 @@ static void encode_work_func (SPProtoEncoder *o)
     
     int out_len;
     
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // build nonce from the counter; the counter is unique for the key since
+        // keys are not shared between encoders and the direction bit separates
+        // the two peers using the same key
+        struct spproto_aead_nonce nonce;
+        nonce.zero = 0;
+        nonce.counter = htol64(counter);
+        memcpy(out, &nonce, sizeof(nonce));
+        
+        // encrypt header + payload, append tag
+        // (not in place, so the packet can be encoded again if the work is stopped)
+        uint8_t *ciphertext = out + BENCRYPTION_AEAD_NONCE_SIZE;
+        BEncryption_EncryptAEAD(encryptor, out, plaintext, ciphertext, plaintext_len, ciphertext + plaintext_len);
+        out_len = BENCRYPTION_AEAD_NONCE_SIZE + plaintext_len + BENCRYPTION_AEAD_TAG_SIZE;
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         // encrypting pad(header + payload)
         int cyphertext_len = balign_up((plaintext_len + 1), o->enc_block_size);
         
@@ -134,21 +201,47 @@ static void encode_work_func (SPProtoEncoder *o)
         }
         
         // generate IV
-        BRandom_randomize(o->out, o->enc_block_size);
+        BRandom_randomize(out, o->enc_block_size);
         
         // copy IV because BEncryption_Encrypt changes the IV
         uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
-        memcpy(iv, o->out, o->enc_block_size);
+        memcpy(iv, out, o->enc_block_size);
         
         // encrypt
-        BEncryption_Encrypt(&o->encryptor, plaintext, o->out + o->enc_block_size, cyphertext_len, iv);
+        BEncryption_Encrypt(encryptor, plaintext, out + o->enc_block_size, cyphertext_len, iv);
         out_len = o->enc_block_size + cyphertext_len;
     } else {
         out_len = plaintext_len;
     }
     
-    // remember length
-    o->tw_out_len = out_len;
+    return out_len;
+}
+
+static void encode_work_func (SPProtoEncoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->out_have)
+    ASSERT(!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
+    
+    if (o->zero_copy) {
+        // plaintext is the input packet with the header in front of it
+        uint8_t *plaintext = o->zc_in - SPPROTO_HEADER_LEN(o->sp_params);
+        
+        // encode, remember length
+        o->tw_out_len = encode(o, &o->encryptor, plaintext, o->in_len, o->tw_seed_id, o->tw_otp, o->tw_counter, o->out);
+        
+        // without encryption, the encoded packet is the plaintext
+        if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+            memcpy(o->out, plaintext, o->tw_out_len);
+        }
+        return;
+    }
+    
+    // determine plaintext location
+    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    
+    // encode, remember length
+    o->tw_out_len = encode(o, &o->encryptor, plaintext, o->in_len, o->tw_seed_id, o->tw_otp, o->tw_counter, o->out);
 }
 
 static void encode_work_handler (SPProtoEncoder *o)
@@ -165,10 +258,20 @@ static void encode_work_handler (SPProtoEncoder *o)
     o->in_len = -1;
     o->out_have = 0;
     PacketRecvInterface_Done(&o->output, o->tw_out_len);
+    
+    // finish input packet
+    if (o->zero_copy) {
+        PacketPassInterface_Done(&o->zc_input);
+    }
 }
 
 static void maybe_encode (SPProtoEncoder *o)
 {
+    if (o->pipeline_len > 1) {
+        pipe_start_encoding(o);
+        return;
+    }
+    
     if (o->in_len >= 0 && o->out_have && !o->tw_have && can_encode(o)) {
         encode_packet(o);
     }
@@ -210,6 +313,51 @@ static void input_handler_done (SPProtoEncoder *o, int data_len)
     }
 }
 
+static void zc_output_handler_recv (SPProtoEncoder *o, uint8_t *data)
+{
+    ASSERT(!o->out_have)
+    ASSERT(!o->tw_have)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember output packet
+    o->out_have = 1;
+    o->out = data;
+    
+    // encode if possible
+    maybe_encode(o);
+}
+
+static void zc_input_handler_send (SPProtoEncoder *o, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->input_mtu)
+    ASSERT(o->in_len == -1)
+    ASSERT(!o->tw_have)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember input packet
+    o->in_len = data_len;
+    o->zc_in = data;
+    
+    // encode if possible
+    maybe_encode(o);
+}
+
+static void zc_input_handler_requestcancel (SPProtoEncoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // a packet being encoded will be done soon
+    if (o->tw_have) {
+        return;
+    }
+    
+    // drop packet
+    o->in_len = -1;
+    PacketPassInterface_Done(&o->zc_input);
+}
+
 static void handler_job_hander (SPProtoEncoder *o)
 {
     ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
@@ -235,6 +383,11 @@ static void otpgenerator_handler (SPProtoEncoder *o)
 
 static void maybe_stop_work (SPProtoEncoder *o)
 {
+    if (o->pipeline_len > 1) {
+        pipe_stop_work(o);
+        return;
+    }
+    
     // stop existing work
     if (o->tw_have) {
         BThreadWork_Free(&o->tw);
@@ -242,10 +395,243 @@ static void maybe_stop_work (SPProtoEncoder *o)
     }
 }
 
-int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+static struct SPProtoEncoder_slot * get_slot (SPProtoEncoder *o, int i)
+{
+    ASSERT(i >= 0)
+    ASSERT(i < o->pipeline_len)
+    
+    return &o->slots[(o->slots_start + i) % o->pipeline_len];
+}
+
+static void pipe_receive (SPProtoEncoder *o)
+{
+    if (o->slots_receiving || o->slots_used == o->pipeline_len) {
+        return;
+    }
+    
+    // receive into the first free slot
+    struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_used);
+    PacketRecvInterface_Receiver_Recv(o->input, slot->buf + SPPROTO_HEADER_LEN(o->sp_params));
+    o->slots_receiving = 1;
+}
+
+static void pipe_start_encoding (SPProtoEncoder *o)
+{
+    // start encoding received packets in order, so that OTPs are used in order
+    while (o->slots_started < o->slots_used && have_otp_and_key(o)) {
+        struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_started);
+        ASSERT(slot->state == SLOT_STATE_RECEIVED)
+        
+        // generate OTP, remember seed ID
+        if (SPPROTO_HAVE_OTP(o->sp_params)) {
+            slot->seed_id = o->otpgen_seed_id;
+            slot->otp = OTPGenerator_GetOTP(&o->otpgen);
+        }
+        
+        // assign packet counter
+        if (have_counter(o)) {
+            slot->counter = next_counter(o);
+        }
+        
+        // start work
+        slot->state = SLOT_STATE_WORKING;
+        BThreadWork_Init(&slot->tw, o->twd, (BThreadWork_handler_done)pipe_work_handler, slot, (BThreadWork_work_func)pipe_work_func, slot);
+        o->slots_started++;
+        
+        // schedule OTP warning handler
+        if (SPPROTO_HAVE_OTP(o->sp_params) && OTPGenerator_GetPosition(&o->otpgen) == o->otp_warning_count) {
+            BPending_Set(&o->handler_job);
+        }
+    }
+}
+
+static void pipe_work_func (struct SPProtoEncoder_slot *slot)
+{
+    SPProtoEncoder *o = slot->o;
+    ASSERT(slot->state == SLOT_STATE_WORKING)
+    ASSERT(!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
+    
+    slot->out_len = encode(o, &slot->encryptor, slot->buf, slot->in_len, slot->seed_id, slot->otp, slot->counter, slot->out);
+}
+
+static void pipe_work_handler (struct SPProtoEncoder_slot *slot)
+{
+    SPProtoEncoder *o = slot->o;
+    ASSERT(slot->state == SLOT_STATE_WORKING)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&slot->tw);
+    slot->state = SLOT_STATE_DONE;
+    
+    // output if this is the oldest packet
+    pipe_maybe_output(o);
+}
+
+static void pipe_maybe_output (SPProtoEncoder *o)
+{
+    if (!o->out_have || o->slots_started == 0) {
+        return;
+    }
+    
+    // packets are output in order; wait for the oldest one
+    struct SPProtoEncoder_slot *slot = get_slot(o, 0);
+    if (slot->state != SLOT_STATE_DONE) {
+        return;
+    }
+    
+    // copy packet to output
+    int out_len = slot->out_len;
+    memcpy(o->out, slot->out, out_len);
+    
+    // free slot
+    o->slots_start = (o->slots_start + 1) % o->pipeline_len;
+    o->slots_used--;
+    o->slots_started--;
+    
+    // finish packet
+    o->out_have = 0;
+    PacketRecvInterface_Done(&o->output, out_len);
+    
+    // receive into the freed slot
+    pipe_receive(o);
+}
+
+static void pipe_output_handler_recv (SPProtoEncoder *o, uint8_t *data)
+{
+    ASSERT(!o->out_have)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember output packet
+    o->out_have = 1;
+    o->out = data;
+    
+    pipe_maybe_output(o);
+}
+
+static void pipe_input_handler_done (SPProtoEncoder *o, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->input_mtu)
+    ASSERT(o->slots_receiving)
+    ASSERT(o->slots_used < o->pipeline_len)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember input packet
+    struct SPProtoEncoder_slot *slot = get_slot(o, o->slots_used);
+    slot->in_len = data_len;
+    slot->state = SLOT_STATE_RECEIVED;
+    o->slots_used++;
+    o->slots_receiving = 0;
+    
+    // encode if possible
+    pipe_start_encoding(o);
+    
+    // receive the next packet while this one is encoded
+    pipe_receive(o);
+}
+
+static void pipe_stop_work (SPProtoEncoder *o)
+{
+    // stop work, and encode the packets again when possible
+    for (int i = 0; i < o->slots_started; i++) {
+        struct SPProtoEncoder_slot *slot = get_slot(o, i);
+        if (slot->state == SLOT_STATE_WORKING) {
+            BThreadWork_Free(&slot->tw);
+        }
+        slot->state = SLOT_STATE_RECEIVED;
+    }
+    
+    o->slots_started = 0;
+}
+
+static void pipe_set_key (SPProtoEncoder *o, uint8_t *encryption_key)
+{
+    ASSERT(o->slots_started == 0)
+    
+    // every slot has its own encryptor, as one may not be used from several threads at once
+    for (int i = 0; i < o->pipeline_len; i++) {
+        struct SPProtoEncoder_slot *slot = &o->slots[i];
+        
+        if (o->have_encryption_key) {
+            BEncryption_Free(&slot->encryptor);
+        }
+        
+        if (encryption_key) {
+            BEncryption_Init(&slot->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
+        }
+    }
+}
+
+static int pipe_init (SPProtoEncoder *o)
+{
+    // calculate plaintext buffer size
+    int buf_size = 0;
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        buf_size = SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu;
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
+    }
+    
+    // allocate slots
+    if (!(o->slots = (struct SPProtoEncoder_slot *)BAllocArray(o->pipeline_len, sizeof(o->slots[0])))) {
+        goto fail0;
+    }
+    
+    int i;
+    for (i = 0; i < o->pipeline_len; i++) {
+        struct SPProtoEncoder_slot *slot = &o->slots[i];
+        slot->o = o;
+        
+        // allocate plaintext and output buffers; without encryption, packets are encoded in place
+        if (!(slot->buf = (uint8_t *)BAlloc(buf_size + o->output_mtu))) {
+            goto fail1;
+        }
+        slot->out = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? slot->buf + buf_size : slot->buf);
+    }
+    
+    // have no packets
+    o->slots_start = 0;
+    o->slots_used = 0;
+    o->slots_started = 0;
+    o->slots_receiving = 0;
+    
+    return 1;
+    
+fail1:
+    while (i-- > 0) {
+        BFree(o->slots[i].buf);
+    }
+    BFree(o->slots);
+fail0:
+    return 0;
+}
+
+static void pipe_free (SPProtoEncoder *o)
+{
+    // free work
+    pipe_stop_work(o);
+    
+    // free encryptors
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        pipe_set_key(o, NULL);
+    }
+    
+    // free slots
+    for (int i = 0; i < o->pipeline_len; i++) {
+        BFree(o->slots[i].buf);
+    }
+    BFree(o->slots);
+}
+
+static int init_internal (SPProtoEncoder *o, PacketRecvInterface *input, int input_mtu, struct spproto_security_params sp_params, int otp_warning_count, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd)
 {
     spproto_assert_security_params(sp_params);
-    ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketRecvInterface_GetMTU(input)) >= 0)
+    ASSERT(input_mtu >= 0)
+    ASSERT(pipeline_len > 0)
+    ASSERT(input || pipeline_len == 1)
+    ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, input_mtu) >= 0)
     if (SPPROTO_HAVE_OTP(sp_params)) {
         ASSERT(otp_warning_count > 0)
         ASSERT(otp_warning_count <= sp_params.otp_num)
@@ -253,8 +639,10 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     
     // init arguments
     o->input = input;
+    o->zero_copy = !input;
     o->sp_params = sp_params;
     o->otp_warning_count = otp_warning_count;
+    o->pipeline_len = pipeline_len;
     o->twd = twd;
     
     // set no handlers
@@ -267,7 +655,11 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     
     // calculate encryption block and key sizes
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
+        if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+            o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
+        } else {
+            ASSERT(sizeof(struct spproto_aead_nonce) == BENCRYPTION_AEAD_NONCE_SIZE)
+        }
         o->enc_key_size = BEncryption_cipher_key_size(o->sp_params.encryption_mode);
     }
     
@@ -278,32 +670,62 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
         }
     }
     
+    // start packet counter
+    if (have_counter(o)) {
+        o->counter_next = 0;
+        o->counter_dir = 0;
+    }
+    
     // have no encryption key
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
         o->have_encryption_key = 0;
     }
     
     // remember input MTU
-    o->input_mtu = PacketRecvInterface_GetMTU(o->input);
+    o->input_mtu = input_mtu;
     
     // calculate output MTU
     o->output_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->input_mtu);
     
     // init input
-    PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
+    if (o->zero_copy) {
+        PacketPassInterface_Init(&o->zc_input, o->input_mtu, (PacketPassInterface_handler_send)zc_input_handler_send, o, pg);
+        PacketPassInterface_EnableCancel(&o->zc_input, (PacketPassInterface_handler_requestcancel)zc_input_handler_requestcancel);
+    } else {
+        PacketRecvInterface_Receiver_Init(o->input, (o->pipeline_len > 1 ? (PacketRecvInterface_handler_done)pipe_input_handler_done : (PacketRecvInterface_handler_done)input_handler_done), o);
+    }
     
     // have no input in buffer
     o->in_len = -1;
     
     // init output
-    PacketRecvInterface_Init(&o->output, o->output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    PacketRecvInterface_handler_recv output_handler = (PacketRecvInterface_handler_recv)output_handler_recv;
+    if (o->zero_copy) {
+        output_handler = (PacketRecvInterface_handler_recv)zc_output_handler_recv;
+    }
+    else if (o->pipeline_len > 1) {
+        output_handler = (PacketRecvInterface_handler_recv)pipe_output_handler_recv;
+    }
+    PacketRecvInterface_Init(&o->output, o->output_mtu, output_handler, o, pg);
     
     // have no output available
     o->out_have = 0;
     
+    // init pipeline
+    if (o->pipeline_len > 1) {
+        if (!pipe_init(o)) {
+            goto fail1;
+        }
+    }
+    
     // allocate plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
+    if (!o->zero_copy && o->pipeline_len == 1 && SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        int buf_size;
+        if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+            buf_size = SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu;
+        } else {
+            buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
+        }
         if (!(o->buf = (uint8_t *)malloc(buf_size))) {
             goto fail1;
         }
@@ -315,12 +737,20 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     // have no work
     o->tw_have = 0;
     
+    // start receiving packets into the pipeline
+    if (o->pipeline_len > 1) {
+        pipe_receive(o);
+    }
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
 fail1:
     PacketRecvInterface_Free(&o->output);
+    if (o->zero_copy) {
+        PacketPassInterface_Free(&o->zc_input);
+    }
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
         OTPGenerator_Free(&o->otpgen);
     }
@@ -328,6 +758,18 @@ fail0:
     return 0;
 }
 
+int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+{
+    ASSERT(input)
+    
+    return init_internal(o, input, PacketRecvInterface_GetMTU(input), sp_params, otp_warning_count, pipeline_len, pg, twd);
+}
+
+int SPProtoEncoder_InitZeroCopy (SPProtoEncoder *o, int input_mtu, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+{
+    return init_internal(o, NULL, input_mtu, sp_params, otp_warning_count, 1, pg, twd);
+}
+
 void SPProtoEncoder_Free (SPProtoEncoder *o)
 {
     DebugObject_Free(&o->d_obj);
@@ -341,15 +783,25 @@ void SPProtoEncoder_Free (SPProtoEncoder *o)
     BPending_Free(&o->handler_job);
     
     // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (!o->zero_copy && o->pipeline_len == 1 && SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         free(o->buf);
     }
     
+    // free pipeline
+    if (o->pipeline_len > 1) {
+        pipe_free(o);
+    }
+    
     // free output
     PacketRecvInterface_Free(&o->output);
     
+    // free input
+    if (o->zero_copy) {
+        PacketPassInterface_Free(&o->zc_input);
+    }
+    
     // free encryptor
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
+    if (o->pipeline_len == 1 && SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
         BEncryption_Free(&o->encryptor);
     }
     
@@ -366,6 +818,14 @@ PacketRecvInterface * SPProtoEncoder_GetOutput (SPProtoEncoder *o)
     return &o->output;
 }
 
+PacketPassInterface * SPProtoEncoder_GetInput (SPProtoEncoder *o)
+{
+    ASSERT(o->zero_copy)
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->zc_input;
+}
+
 void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key)
 {
     ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
@@ -374,14 +834,19 @@ void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key
     // stop existing work
     maybe_stop_work(o);
     
-    // free encryptor
-    if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+    if (o->pipeline_len > 1) {
+        // init encryptors of slots
+        pipe_set_key(o, encryption_key);
+    } else {
+        // free encryptor
+        if (o->have_encryption_key) {
+            BEncryption_Free(&o->encryptor);
+        }
+        
+        // init encryptor
+        BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
     }
     
-    // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
-    
     // have encryption key
     o->have_encryption_key = 1;
     
@@ -399,7 +864,11 @@ void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o)
     
     if (o->have_encryption_key) {
         // free encryptor
-        BEncryption_Free(&o->encryptor);
+        if (o->pipeline_len > 1) {
+            pipe_set_key(o, NULL);
+        } else {
+            BEncryption_Free(&o->encryptor);
+        }
         
         // have no encryption key
         o->have_encryption_key = 0;
@@ -427,6 +896,15 @@ void SPProtoEncoder_RemoveOTPSeed (SPProtoEncoder *o)
     OTPGenerator_Reset(&o->otpgen);
 }
 
+void SPProtoEncoder_SetCounterDirection (SPProtoEncoder *o, int dir)
+{
+    ASSERT(have_counter(o))
+    ASSERT(dir == 0 || dir == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    o->counter_dir = (dir ? SPPROTO_COUNTER_DIRECTION_BIT : 0);
+}
+
 void SPProtoEncoder_SetHandlers (SPProtoEncoder *o, SPProtoEncoder_handler handler, void *user)
 {
     DebugObject_Access(&o->d_obj);
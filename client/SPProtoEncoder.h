@@ -42,8 +42,15 @@
 #include <security/BEncryption.h>
 #include <security/OTPGenerator.h>
 #include <flow/PacketRecvInterface.h>
+#include <flow/PacketPassInterface.h>
 #include <threadwork/BThreadWork.h>
 
+/**
+ * Number of bytes after each input packet which the encoder may modify,
+ * when initialized with {@link SPProtoEncoder_InitZeroCopy}.
+ */
+#define SPPROTOENCODER_ZEROCOPY_TAILROOM BENCRYPTION_MAX_BLOCK_SIZE
+
 /**
  * Event context handler called when the remaining number of
  * OTPs equals the warning number after having encoded a packet.
@@ -52,16 +59,37 @@
  */
 typedef void (*SPProtoEncoder_handler) (void *user);
 
+struct SPProtoEncoder_s;
+
+struct SPProtoEncoder_slot {
+    struct SPProtoEncoder_s *o;
+    uint8_t *buf;
+    uint8_t *out;
+    int in_len;
+    int state;
+    BThreadWork tw;
+    uint16_t seed_id;
+    otp_t otp;
+    uint64_t counter;
+    int out_len;
+    BEncryption encryptor;
+};
+
 /**
  * Object which encodes packets according to SPProto.
  *
- * Input is with {@link PacketRecvInterface}.
+ * Input is with {@link PacketRecvInterface}, or with {@link PacketPassInterface}
+ * if initialized with {@link SPProtoEncoder_InitZeroCopy}.
  * Output is with {@link PacketRecvInterface}.
  */
-typedef struct {
+typedef struct SPProtoEncoder_s {
     PacketRecvInterface *input;
+    int zero_copy;
+    PacketPassInterface zc_input;
+    uint8_t *zc_in;
     struct spproto_security_params sp_params;
     int otp_warning_count;
+    int pipeline_len;
     SPProtoEncoder_handler handler;
     BThreadWorkDispatcher *twd;
     void *user;
@@ -71,6 +99,8 @@ typedef struct {
     OTPGenerator otpgen;
     uint16_t otpgen_seed_id;
     uint16_t otpgen_pending_seed_id;
+    uint64_t counter_next;
+    uint64_t counter_dir;
     int have_encryption_key;
     BEncryption encryptor;
     int input_mtu;
@@ -85,7 +115,13 @@ typedef struct {
     BThreadWork tw;
     uint16_t tw_seed_id;
     otp_t tw_otp;
+    uint64_t tw_counter;
     int tw_out_len;
+    struct SPProtoEncoder_slot *slots;
+    int slots_start;
+    int slots_used;
+    int slots_started;
+    int slots_receiving;
     DebugObject d_obj;
 } SPProtoEncoder;
 
@@ -101,11 +137,46 @@ typedef struct {
  * @param sp_params SPProto security parameters
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
  *                          In this case, must be >0 and <=sp_params.otp_num.
+ * @param pipeline_len maximum number of packets being encoded at once. Must be >0.
+ *                     If it is 1, each packet is received from the input only when the
+ *                     output asks for one, and is encoded directly into the output buffer.
+ *                     If it is >1, up to this many packets are received from the input
+ *                     in advance and encoded concurrently by the threads of twd, and are
+ *                     copied to the output in the order they were received.
  * @param pg pending group
  * @param twd thread work dispatcher
  * @return 1 on success, 0 on failure
  */
-int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
+int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, int pipeline_len, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
+
+/**
+ * Initializes the object to encode packets without copying them first.
+ * The object is initialized in blocked state.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if
+ * {@link BThreadWorkDispatcher_UsingThreads}(twd) = 1.
+ * 
+ * Packets are sent to the input interface returned by {@link SPProtoEncoder_GetInput}.
+ * The SPProto header is written directly in front of each packet, so every packet must
+ * have SPPROTO_HEADER_LEN(sp_params) bytes of writable space before it, and
+ * SPPROTOENCODER_ZEROCOPY_TAILROOM bytes after it (for padding). The packet is then
+ * encrypted (or copied, without encryption) into the output buffer, which is the only
+ * copy made. The header and padding are written again if the packet has to be encoded
+ * again, so the packet data itself is never modified.
+ * The memory of a packet being encoded must remain valid until the input is done with
+ * it, or until the object is freed. Note that if twd uses threads, the packet may be
+ * read from another thread until then.
+ *
+ * @param o the object
+ * @param input_mtu maximum input packet size. Must be >=0 and not too large, i.e. this must hold:
+ *                  spproto_carrier_mtu_for_payload_mtu(sp_params, input_mtu) >= 0
+ * @param sp_params SPProto security parameters
+ * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
+ *                          In this case, must be >0 and <=sp_params.otp_num.
+ * @param pg pending group
+ * @param twd thread work dispatcher
+ * @return 1 on success, 0 on failure
+ */
+int SPProtoEncoder_InitZeroCopy (SPProtoEncoder *o, int input_mtu, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -124,6 +195,17 @@ void SPProtoEncoder_Free (SPProtoEncoder *o);
  */
 PacketRecvInterface * SPProtoEncoder_GetOutput (SPProtoEncoder *o);
 
+/**
+ * Returns the input interface.
+ * The object must have been initialized with {@link SPProtoEncoder_InitZeroCopy}.
+ * The interface supports cancel functionality; a cancel request is honored
+ * unless the packet is already being encoded.
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * SPProtoEncoder_GetInput (SPProtoEncoder *o);
+
 /**
  * Sets an encryption key to use.
  * Encryption must be enabled.
@@ -160,6 +242,17 @@ void SPProtoEncoder_SetOTPSeed (SPProtoEncoder *o, uint16_t seed_id, uint8_t *ke
  */
 void SPProtoEncoder_RemoveOTPSeed (SPProtoEncoder *o);
 
+/**
+ * Sets the direction of packet counters and AEAD nonces.
+ * Packet counters or an AEAD encryption mode must be enabled.
+ * Packets sent after this have {@link SPPROTO_COUNTER_DIRECTION_BIT} set
+ * in their counters and nonces if and only if dir is 1.
+ *
+ * @param o the object
+ * @param dir 1 if we are the peer which bound, 0 otherwise
+ */
+void SPProtoEncoder_SetCounterDirection (SPProtoEncoder *o, int dir);
+
 /**
  * Sets handlers.
  *
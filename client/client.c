@@ -38,6 +38,7 @@
 #include <misc/version.h>
 #include <misc/debug.h>
 #include <misc/offset.h>
+#include <misc/balloc.h>
 #include <misc/byteorder.h>
 #include <misc/nsskey.h>
 #include <misc/loglevel.h>
@@ -94,6 +95,7 @@ struct {
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
     int threads;
+    int threads_spsc;
     int use_threads_for_ssl_handshake;
     int use_threads_for_ssl_data;
     int ssl;
@@ -112,7 +114,12 @@ struct {
     int otp_mode;
     int otp_num;
     int otp_num_warn;
+    int packet_counters;
     int fragmentation_latency;
+    int crypto_pipeline;
+    int udp_shared_socket;
+    int udp_group_key;
+    int udp_zero_copy;
     int peer_ssl;
     int peer_tcp_socket_sndbuf;
     int send_buffer_size;
@@ -143,9 +150,23 @@ struct bind_addr bind_addrs[MAX_BIND_ADDRS];
 // TCP listeners
 PasswordListener listeners[MAX_BIND_ADDRS];
 
+// UDP shared sockets for binding, one per bind address, and for connecting,
+// one per address family (UDP with --udp-shared-socket only)
+DatagramSharedSocket shared_sockets[MAX_BIND_ADDRS];
+DatagramSharedSocket shared_connect_sockets[2];
+int have_shared_connect_sockets[2];
+
 // SPProto parameters (UDP only)
 struct spproto_security_params sp_params;
 
+// encoder of frames sent to many peers, with our group key, and buffers for
+// sorting out the destinations of a frame (UDP with --udp-group-key only,
+// defined only after server_ready)
+DatagramGroupEncoder group_encoder;
+uint8_t group_key[BENCRYPTION_MAX_KEY_SIZE];
+struct peer_data **device_dest_peers;
+peerid_t *device_group_dest_ids;
+
 // server address we connect to
 BAddr server_addr;
 
@@ -177,6 +198,11 @@ DPReceiveDevice device_output_dprd;
 // data communication MTU
 int data_mtu;
 
+// space reserved around buffered data packets, for encoding them in place
+// (UDP with --udp-zero-copy only, zero otherwise)
+int data_headroom;
+int data_tailroom;
+
 // peers list
 LinkedList1 peers;
 int num_peers;
@@ -290,6 +316,7 @@ static void peer_msg_cannotbind (struct peer_data *peer, uint8_t *data, int data
 static void peer_msg_seed (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_confirmseed (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_youretry (struct peer_data *peer, uint8_t *data, int data_len);
+static void peer_msg_groupkey (struct peer_data *peer, uint8_t *data, int data_len);
 
 // handler from DatagramPeerIO when we should generate a new OTP send seed
 static void peer_udp_pio_handler_seed_warning (struct peer_data *peer);
@@ -328,6 +355,11 @@ static void peer_send_conectinfo (struct peer_data *peer, int addr_index, int po
 
 static void peer_send_confirmseed (struct peer_data *peer, uint16_t seed_id);
 
+static void peer_send_groupkey (struct peer_data *peer);
+
+// checks if group datagrams can be sent to the peer
+static int peer_can_receive_group (struct peer_data *peer);
+
 // handler for peer DataProto up state changes
 static void peer_dataproto_handler (struct peer_data *peer, int up);
 
@@ -337,9 +369,24 @@ static struct peer_data * find_peer_by_id (peerid_t id);
 // device error handler
 static void device_error_handler (void *unused);
 
+// handler for UDP shared socket errors
+static void shared_socket_error_handler (void *unused);
+
+// returns the index of the UDP shared connect socket for an address family
+static int shared_connect_socket_index (int family);
+
 // DataProtoSource handler for packets from the device
 static void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len);
 
+// initializes the group encoder and destination buffers
+static int init_group_encoder (void);
+
+// frees the group encoder and destination buffers
+static void free_group_encoder (void);
+
+// DatagramGroupEncoder handler for encoded group datagrams
+static void group_encoder_handler_datagram (void *unused, peerid_t dest_id, DatagramGroupEncoder_ref *ref);
+
 // assign relays to clients waiting for them
 static void assign_relays (void);
 
@@ -488,8 +535,8 @@ int main (int argc, char *argv[])
     }
     
     // init thread work dispatcher
-    if (!BThreadWorkDispatcher_Init(&twd, &ss, options.threads)) {
-        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+    if (!BThreadWorkDispatcher_Init2(&twd, &ss, options.threads, (options.threads_spsc ? BTHREADWORK_FLAG_SPSC : 0))) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init2 failed");
         goto fail3;
     }
     
@@ -514,10 +561,41 @@ int main (int argc, char *argv[])
         }
     }
     
+    // init UDP shared sockets
+    int num_shared_sockets = 0;
+    int num_shared_connect_sockets = 0;
+    if (options.transport_mode == TRANSPORT_MODE_UDP && options.udp_shared_socket) {
+        while (num_shared_sockets < num_bind_addrs) {
+            struct bind_addr *addr = &bind_addrs[num_shared_sockets];
+            if (!BDatagram_AddressFamilySupported(addr->addr.type)) {
+                BLog(BLOG_ERROR, "bind addr: unsupported address family");
+                goto fail8a;
+            }
+            if (!DatagramSharedSocket_Init(&shared_sockets[num_shared_sockets], &ss, addr->addr.type, &addr->addr, CLIENT_UDP_MTU, NULL, shared_socket_error_handler)) {
+                BLog(BLOG_ERROR, "DatagramSharedSocket_Init failed");
+                goto fail8a;
+            }
+            num_shared_sockets++;
+        }
+        
+        while (num_shared_connect_sockets < 2) {
+            int family = (num_shared_connect_sockets == 0 ? BADDR_TYPE_IPV4 : BADDR_TYPE_IPV6);
+            have_shared_connect_sockets[num_shared_connect_sockets] = 0;
+            if (BDatagram_AddressFamilySupported(family)) {
+                if (!DatagramSharedSocket_Init(&shared_connect_sockets[num_shared_connect_sockets], &ss, family, NULL, CLIENT_UDP_MTU, NULL, shared_socket_error_handler)) {
+                    BLog(BLOG_ERROR, "DatagramSharedSocket_Init failed");
+                    goto fail8a;
+                }
+                have_shared_connect_sockets[num_shared_connect_sockets] = 1;
+            }
+            num_shared_connect_sockets++;
+        }
+    }
+    
     // init device
     if (!BTap_Init(&device, &ss, options.tapdev, device_error_handler, NULL, 0)) {
         BLog(BLOG_ERROR, "BTap_Init failed");
-        goto fail8;
+        goto fail8a;
     }
     
     // remember device MTU
@@ -532,14 +610,22 @@ int main (int argc, char *argv[])
     }
     data_mtu = DATAPROTO_MAX_OVERHEAD + device_mtu;
     
+    // calculate space to reserve for encoding in place
+    data_headroom = 0;
+    data_tailroom = 0;
+    if (options.udp_zero_copy) {
+        data_headroom = DATAGRAMPEERIO_SEND_HEADROOM(sp_params);
+        data_tailroom = DATAGRAMPEERIO_SEND_TAILROOM;
+    }
+    
     // init device input
-    if (!DataProtoSource_Init(&device_dpsource, BTap_GetOutput(&device), device_dpsource_handler, NULL, &ss)) {
+    if (!DataProtoSource_Init(&device_dpsource, BTap_GetOutput(&device), data_headroom, data_tailroom, device_dpsource_handler, NULL, &ss)) {
         BLog(BLOG_ERROR, "DataProtoSource_Init failed");
         goto fail9;
     }
     
     // init device output
-    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)BTap_Send, &device, &ss, options.send_buffer_relay_size, PEER_RELAY_FLOW_INACTIVITY_TIME)) {
+    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)BTap_Send, &device, &ss, options.send_buffer_relay_size, PEER_RELAY_FLOW_INACTIVITY_TIME, data_headroom, data_tailroom)) {
         BLog(BLOG_ERROR, "DPReceiveDevice_Init failed");
         goto fail10;
     }
@@ -549,7 +635,10 @@ int main (int argc, char *argv[])
     num_peers = 0;
     
     // init frame decider
-    FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss);
+    if (!FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss)) {
+        BLog(BLOG_ERROR, "FrameDecider_Init failed");
+        goto fail10a;
+    }
     
     // init relays list
     LinkedList1_Init(&relays);
@@ -596,16 +685,29 @@ int main (int argc, char *argv[])
     }
     
     if (server_ready) {
+        if (options.udp_group_key) {
+            free_group_encoder();
+        }
         PacketPassFairQueue_Free(&server_queue);
     }
     ServerConnection_Free(&server);
 fail11:
     FrameDecider_Free(&frame_decider);
+fail10a:
     DPReceiveDevice_Free(&device_output_dprd);
 fail10:
     DataProtoSource_Free(&device_dpsource);
 fail9:
     BTap_Free(&device);
+fail8a:
+    while (num_shared_connect_sockets-- > 0) {
+        if (have_shared_connect_sockets[num_shared_connect_sockets]) {
+            DatagramSharedSocket_Free(&shared_connect_sockets[num_shared_connect_sockets]);
+        }
+    }
+    while (num_shared_sockets-- > 0) {
+        DatagramSharedSocket_Free(&shared_sockets[num_shared_sockets]);
+    }
 fail8:
     if (options.transport_mode == TRANSPORT_MODE_TCP) {
         while (num_listeners-- > 0) {
@@ -668,6 +770,7 @@ void print_help (const char *name)
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--threads <integer>]\n"
+        "        [--threads-spsc]\n"
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
         "        [--ssl --nssdb <string> --client-cert-name <string>]\n"
@@ -682,10 +785,15 @@ void print_help (const char *name)
         "        ] ...\n"
         "        --transport-mode <udp/tcp>\n"
         "        (transport-mode=udp?\n"
-        "            --encryption-mode <blowfish/aes/none>\n"
+        "            --encryption-mode <blowfish/aes/aes-gcm/chacha20-poly1305/none>\n"
         "            --hash-mode <md5/sha1/none>\n"
         "            [--otp <blowfish/aes> <num> <num-warn>]\n"
+        "            [--packet-counters]\n"
         "            [--fragmentation-latency <milliseconds>]\n"
+        "            [--crypto-pipeline <num>]\n"
+        "            [--udp-shared-socket]\n"
+        "            [--udp-group-key]\n"
+        "            [--udp-zero-copy]\n"
         "        )\n"
         "        (transport-mode=tcp?\n"
         "            (ssl? [--peer-ssl])\n"
@@ -727,6 +835,7 @@ int parse_arguments (int argc, char *argv[])
         options.loglevels[i] = -1;
     }
     options.threads = 0;
+    options.threads_spsc = 0;
     options.use_threads_for_ssl_handshake = 0;
     options.use_threads_for_ssl_data = 0;
     options.ssl = 0;
@@ -741,7 +850,12 @@ int parse_arguments (int argc, char *argv[])
     options.encryption_mode = -1;
     options.hash_mode = -1;
     options.otp_mode = SPPROTO_OTP_MODE_NONE;
+    options.packet_counters = 0;
     options.fragmentation_latency = PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY;
+    options.crypto_pipeline = -1;
+    options.udp_shared_socket = 0;
+    options.udp_group_key = 0;
+    options.udp_zero_copy = 0;
     options.peer_ssl = 0;
     options.peer_tcp_socket_sndbuf = -1;
     options.send_buffer_size = PEER_DEFAULT_SEND_BUFFER_SIZE;
@@ -839,6 +953,9 @@ int parse_arguments (int argc, char *argv[])
             options.threads = atoi(argv[i + 1]);
             i++;
         }
+        else if (!strcmp(arg, "--threads-spsc")) {
+            options.threads_spsc = 1;
+        }
         else if (!strcmp(arg, "--use-threads-for-ssl-handshake")) {
             options.use_threads_for_ssl_handshake = 1;
         }
@@ -986,6 +1103,12 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "aes")) {
                 options.encryption_mode = BENCRYPTION_CIPHER_AES;
             }
+            else if (!strcmp(arg2, "aes-gcm")) {
+                options.encryption_mode = BENCRYPTION_CIPHER_AES_GCM;
+            }
+            else if (!strcmp(arg2, "chacha20-poly1305")) {
+                options.encryption_mode = BENCRYPTION_CIPHER_CHACHA20_POLY1305;
+            }
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
@@ -1042,6 +1165,9 @@ int parse_arguments (int argc, char *argv[])
             }
             i += 3;
         }
+        else if (!strcmp(arg, "--packet-counters")) {
+            options.packet_counters = 1;
+        }
         else if (!strcmp(arg, "--fragmentation-latency")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1051,6 +1177,26 @@ int parse_arguments (int argc, char *argv[])
             have_fragmentation_latency = 1;
             i++;
         }
+        else if (!strcmp(arg, "--crypto-pipeline")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.crypto_pipeline = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udp-shared-socket")) {
+            options.udp_shared_socket = 1;
+        }
+        else if (!strcmp(arg, "--udp-group-key")) {
+            options.udp_group_key = 1;
+        }
+        else if (!strcmp(arg, "--udp-zero-copy")) {
+            options.udp_zero_copy = 1;
+        }
         else if (!strcmp(arg, "--peer-ssl")) {
             options.peer_ssl = 1;
         }
@@ -1185,16 +1331,69 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (options.encryption_mode >= 0 && options.encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE && BEncryption_cipher_is_aead(options.encryption_mode) && options.hash_mode != SPPROTO_HASH_MODE_NONE) {
+        fprintf(stderr, "False: --encryption-mode <aes-gcm/chacha20-poly1305> => --hash-mode none\n");
+        return 0;
+    }
+    
     if (!(!(options.otp_mode != SPPROTO_OTP_MODE_NONE) || (options.transport_mode == TRANSPORT_MODE_UDP))) {
         fprintf(stderr, "False: --otp => UDP\n");
         return 0;
     }
     
+    if (!(!options.packet_counters || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --packet-counters => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.packet_counters || options.otp_mode == SPPROTO_OTP_MODE_NONE)) {
+        fprintf(stderr, "False: --packet-counters => !--otp\n");
+        return 0;
+    }
+    
+    if (!(!options.packet_counters || (options.encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE && (BEncryption_cipher_is_aead(options.encryption_mode) || options.hash_mode != SPPROTO_HASH_MODE_NONE)))) {
+        fprintf(stderr, "False: --packet-counters => (--encryption-mode <aead> || (--encryption-mode !none && --hash-mode !none))\n");
+        return 0;
+    }
+    
     if (!(!have_fragmentation_latency || (options.transport_mode == TRANSPORT_MODE_UDP))) {
         fprintf(stderr, "False: --fragmentation-latency => UDP\n");
         return 0;
     }
     
+    if (!(options.crypto_pipeline < 0 || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --crypto-pipeline => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_shared_socket || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-shared-socket => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_group_key || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-group-key => UDP\n");
+        return 0;
+    }
+    
+    // group datagrams can be forged by any holder of the group key and are not protected
+    // against replay, so don't weaken the guarantees asked for with OTPs or packet counters
+    if (!(!options.udp_group_key || (options.otp_mode == SPPROTO_OTP_MODE_NONE && !options.packet_counters))) {
+        fprintf(stderr, "False: --udp-group-key => (!--otp && !--packet-counters)\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_zero_copy || (options.transport_mode == TRANSPORT_MODE_UDP && options.threads == 0 && options.crypto_pipeline <= 1))) {
+        fprintf(stderr, "False: --udp-zero-copy => (UDP && --threads 0 && --crypto-pipeline <= 1)\n");
+        return 0;
+    }
+    
+    // zero-copy datagrams only carry chunks of one frame, so there is nothing to wait for
+    if (!(!options.udp_zero_copy || !have_fragmentation_latency)) {
+        fprintf(stderr, "False: --udp-zero-copy => !--fragmentation-latency\n");
+        return 0;
+    }
+    
     if (!(!options.peer_ssl || (options.ssl && options.transport_mode == TRANSPORT_MODE_TCP))) {
         fprintf(stderr, "False: --peer-ssl => (--ssl && TCP)\n");
         return 0;
@@ -1297,6 +1496,7 @@ int process_arguments (void)
         if (options.otp_mode > 0) {
             sp_params.otp_num = options.otp_num;
         }
+        sp_params.counter_mode = (options.packet_counters ? SPPROTO_COUNTER_MODE_WINDOW : SPPROTO_COUNTER_MODE_NONE);
     }
     
     return 1;
@@ -1455,6 +1655,9 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     // have no link
     peer->have_link = 0;
     
+    // have no group key
+    peer->have_group_recv_key = 0;
+    
     // have no relaying
     peer->relaying_peer = NULL;
     
@@ -1615,14 +1818,32 @@ int peer_init_link (struct peer_data *peer)
     DPReceiveReceiver_Init(&peer->receive_receiver, &peer->receive_peer);
     PacketPassInterface *recv_if = DPReceiveReceiver_GetInput(&peer->receive_receiver);
     
+    // init group receive receiver
+    PacketPassInterface *group_recv_if = NULL;
+    if (options.udp_group_key) {
+        DPReceiveReceiver_Init(&peer->group_receive_receiver, &peer->receive_peer);
+        group_recv_if = DPReceiveReceiver_GetInput(&peer->group_receive_receiver);
+    }
+    
     // init transport-specific link objects
     PacketPassInterface *link_if;
+    int link_headroom = 0;
+    int link_tailroom = 0;
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        // pipeline encoding and decoding only if it can run on several threads
+        int crypto_pipeline = options.crypto_pipeline;
+        if (crypto_pipeline < 0) {
+            crypto_pipeline = (BThreadWorkDispatcher_UsingThreads(&twd) ? PEER_DEFAULT_UDP_CRYPTO_PIPELINE : 1);
+        }
+        
+        // leave space for the shared socket header
+        int socket_mtu = (options.udp_shared_socket ? CLIENT_UDP_MTU - DATAGRAMSHAREDSOCKET_HEADER_SIZE : CLIENT_UDP_MTU);
+        
         // init DatagramPeerIO
         if (!DatagramPeerIO_Init(
-            &peer->pio.udp.pio, &ss, data_mtu, CLIENT_UDP_MTU, sp_params,
+            &peer->pio.udp.pio, &ss, data_mtu, socket_mtu, sp_params,
             options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES, recv_if,
-            options.otp_num_warn, &twd, peer,
+            options.otp_num_warn, crypto_pipeline, options.udp_zero_copy, &twd, group_recv_if, options.send_buffer_size, peer,
             (BLog_logfunc)peer_logfunc,
             (DatagramPeerIO_handler_error)peer_udp_pio_handler_error,
             (DatagramPeerIO_handler_otp_warning)peer_udp_pio_handler_seed_warning,
@@ -1632,6 +1853,11 @@ int peer_init_link (struct peer_data *peer)
             goto fail1;
         }
         
+        // set group key if we already have it
+        if (options.udp_group_key && SPPROTO_HAVE_ENCRYPTION(sp_params) && peer->have_group_recv_key) {
+            DatagramPeerIO_SetGroupKey(&peer->pio.udp.pio, peer->group_recv_key);
+        }
+        
         if (SPPROTO_HAVE_OTP(sp_params)) {
             // init send seed state
             peer->pio.udp.sendseed_nextid = 0;
@@ -1642,6 +1868,8 @@ int peer_init_link (struct peer_data *peer)
         }
         
         link_if = DatagramPeerIO_GetSendInput(&peer->pio.udp.pio);
+        link_headroom = data_headroom;
+        link_tailroom = data_tailroom;
     } else {
         // init StreamPeerIO
         if (!StreamPeerIO_Init(
@@ -1662,7 +1890,7 @@ int peer_init_link (struct peer_data *peer)
     }
     
     // init sending
-    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, PEER_KEEPALIVE_INTERVAL, PEER_KEEPALIVE_RECEIVE_TIMER, (DataProtoSink_handler)peer_dataproto_handler, peer)) {
+    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, link_headroom, link_tailroom, PEER_KEEPALIVE_INTERVAL, PEER_KEEPALIVE_RECEIVE_TIMER, (DataProtoSink_handler)peer_dataproto_handler, peer)) {
         peer_log(peer, BLOG_ERROR, "DataProto_Init failed");
         goto fail2;
     }
@@ -1676,6 +1904,9 @@ int peer_init_link (struct peer_data *peer)
     // set have link
     peer->have_link = 1;
     
+    // link is not up yet
+    peer->link_up = 0;
+    
     return 1;
     
 fail2:
@@ -1688,6 +1919,9 @@ fail2:
         StreamPeerIO_Free(&peer->pio.tcp.pio);
     }
 fail1:
+    if (options.udp_group_key) {
+        DPReceiveReceiver_Free(&peer->group_receive_receiver);
+    }
     DPReceiveReceiver_Free(&peer->receive_receiver);
     return 0;
 }
@@ -1719,6 +1953,11 @@ void peer_free_link (struct peer_data *peer)
         StreamPeerIO_Free(&peer->pio.tcp.pio);
     }
     
+    // free group receive receiver
+    if (options.udp_group_key) {
+        DPReceiveReceiver_Free(&peer->group_receive_receiver);
+    }
+    
     // free receive receiver
     DPReceiveReceiver_Free(&peer->receive_receiver);
     
@@ -1992,6 +2231,9 @@ void peer_chat_handler_message (struct peer_data *peer, uint8_t *data, int data_
         case MSGID_CONFIRMSEED:
             peer_msg_confirmseed(peer, payload, payload_len);
             return;
+        case MSGID_GROUPKEY:
+            peer_msg_groupkey(peer, payload, payload_len);
+            return;
         default:
             BLog(BLOG_NOTICE, "msg: unknown type");
             return;
@@ -2067,6 +2309,13 @@ void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
                 return;
             }
         }
+        if (options.udp_shared_socket) {
+            // the password is the ID for the shared socket
+            if (!msg_youconnectParser_Getpassword(&parser, &password)) {
+                peer_log(peer, BLOG_WARNING, "msg_youconnect: no shared socket ID");
+                return;
+            }
+        }
     } else {
         if (!msg_youconnectParser_Getpassword(&parser, &password)) {
             peer_log(peer, BLOG_WARNING, "msg_youconnect: no password");
@@ -2236,6 +2485,46 @@ void peer_msg_youretry (struct peer_data *peer, uint8_t *data, int data_len)
     peer_reset(peer);
 }
 
+void peer_msg_groupkey (struct peer_data *peer, uint8_t *data, int data_len)
+{
+    msg_groupkeyParser parser;
+    if (!msg_groupkeyParser_Init(&parser, data, data_len)) {
+        peer_log(peer, BLOG_WARNING, "msg_groupkey: failed to parse");
+        return;
+    }
+    
+    // read message
+    uint8_t *key = NULL; // to remove warning
+    int key_len = 0; // to remove warning
+    ASSERT_EXECUTE(msg_groupkeyParser_Getkey(&parser, &key, &key_len))
+    
+    if (options.transport_mode != TRANSPORT_MODE_UDP || !options.udp_group_key) {
+        peer_log(peer, BLOG_WARNING, "msg_groupkey: group datagrams disabled");
+        return;
+    }
+    
+    if (!SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        peer_log(peer, BLOG_WARNING, "msg_groupkey: encryption disabled");
+        return;
+    }
+    
+    if (key_len != BEncryption_cipher_key_size(sp_params.encryption_mode)) {
+        peer_log(peer, BLOG_WARNING, "msg_groupkey: wrong key length");
+        return;
+    }
+    
+    peer_log(peer, BLOG_DEBUG, "received group key");
+    
+    // remember key, it is needed again whenever the link is initialized
+    memcpy(peer->group_recv_key, key, key_len);
+    peer->have_group_recv_key = 1;
+    
+    // set key
+    if (peer->have_link) {
+        DatagramPeerIO_SetGroupKey(&peer->pio.udp.pio, peer->group_recv_key);
+    }
+}
+
 void peer_udp_pio_handler_seed_warning (struct peer_data *peer)
 {
     ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
@@ -2358,19 +2647,26 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
         // get addr
         struct bind_addr *addr = &bind_addrs[addr_index];
         
-        // try binding to all ports in the range
-        int port_add;
-        for (port_add = 0; port_add < addr->num_ports; port_add++) {
-            BAddr tryaddr = addr->addr;
-            BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
-            if (DatagramPeerIO_Bind(&peer->pio.udp.pio, tryaddr)) {
-                break;
-            }
-        }
-        if (port_add == addr->num_ports) {
-            BLog(BLOG_NOTICE, "failed to bind to any port");
-            *cont = 1;
-            return;
+        int port_add = 0;
+        uint64_t shared_id = 0;
+        
+        if (options.udp_shared_socket) {
+            // wait for the peer on the shared socket of this address
+            shared_id = DatagramPeerIO_BindShared(&peer->pio.udp.pio, &shared_sockets[addr_index]);
+        } else {
+            // try binding to all ports in the range
+            for (port_add = 0; port_add < addr->num_ports; port_add++) {
+                BAddr tryaddr = addr->addr;
+                BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
+                if (DatagramPeerIO_Bind(&peer->pio.udp.pio, tryaddr)) {
+                    break;
+                }
+            }
+            if (port_add == addr->num_ports) {
+                BLog(BLOG_NOTICE, "failed to bind to any port");
+                *cont = 1;
+                return;
+            }
         }
         
         uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
@@ -2387,7 +2683,7 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
         }
         
         // send connectinfo
-        peer_send_conectinfo(peer, addr_index, port_add, key, 0);
+        peer_send_conectinfo(peer, addr_index, port_add, key, shared_id);
     } else {
         // order StreamPeerIO to listen
         uint64_t pass;
@@ -2413,8 +2709,24 @@ void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key,
     }
     
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        if (options.udp_shared_socket) {
+            // find shared socket for the address family
+            int sock_index = shared_connect_socket_index(addr.type);
+            if (sock_index < 0 || !have_shared_connect_sockets[sock_index]) {
+                peer_log(peer, BLOG_NOTICE, "no shared socket for address family");
+                peer_reset(peer);
+                return;
+            }
+            
+            // order DatagramPeerIO to connect through the shared socket
+            if (!DatagramPeerIO_ConnectShared(&peer->pio.udp.pio, &shared_connect_sockets[sock_index], password, addr)) {
+                peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_ConnectShared failed");
+                peer_reset(peer);
+                return;
+            }
+        }
         // order DatagramPeerIO to connect
-        if (!DatagramPeerIO_Connect(&peer->pio.udp.pio, addr)) {
+        else if (!DatagramPeerIO_Connect(&peer->pio.udp.pio, addr)) {
             peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_Connect failed");
             peer_reset(peer);
             return;
@@ -2537,8 +2849,8 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
         msg_len += msg_youconnect_SIZEkey(key_size);
     }
     
-    // password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    // password, or shared socket ID
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.udp_shared_socket) {
         msg_len += msg_youconnect_SIZEpassword;
     }
     
@@ -2593,8 +2905,8 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
         memcpy(key_dst, enckey, key_size);
     }
     
-    // write password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    // write password, or shared socket ID
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.udp_shared_socket) {
         msg_youconnectWriter_Addpassword(&writer, pass);
     }
     
@@ -2623,10 +2935,43 @@ void peer_send_confirmseed (struct peer_data *peer, uint16_t seed_id)
     peer_end_msg(peer);
 }
 
+void peer_send_groupkey (struct peer_data *peer)
+{
+    ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
+    ASSERT(options.udp_group_key)
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(sp_params))
+    
+    int key_len = BEncryption_cipher_key_size(sp_params.encryption_mode);
+    
+    // send group key
+    int msg_len = msg_groupkey_SIZEkey(key_len);
+    uint8_t *msg;
+    if (!peer_start_msg(peer, (void **)&msg, MSGID_GROUPKEY, msg_len)) {
+        return;
+    }
+    msg_groupkeyWriter writer;
+    msg_groupkeyWriter_Init(&writer, msg);
+    uint8_t *key_dst = msg_groupkeyWriter_Addkey(&writer, key_len);
+    memcpy(key_dst, group_key, key_len);
+    msg_groupkeyWriter_Finish(&writer);
+    peer_end_msg(peer);
+}
+
+int peer_can_receive_group (struct peer_data *peer)
+{
+    ASSERT(options.udp_group_key)
+    
+    // only peers we talk to directly, and which we know are listening
+    return (peer->have_link && peer->link_up);
+}
+
 void peer_dataproto_handler (struct peer_data *peer, int up)
 {
     ASSERT(peer->have_link)
     
+    // remember link state for group sending
+    peer->link_up = up;
+    
     if (up) {
         peer_log(peer, BLOG_INFO, "up");
         
@@ -2663,6 +3008,25 @@ void device_error_handler (void *unused)
     terminate();
 }
 
+void shared_socket_error_handler (void *unused)
+{
+    BLog(BLOG_ERROR, "shared socket error");
+    
+    terminate();
+}
+
+int shared_connect_socket_index (int family)
+{
+    switch (family) {
+        case BADDR_TYPE_IPV4:
+            return 0;
+        case BADDR_TYPE_IPV6:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
 void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
 {
     ASSERT(frame_len >= 0)
@@ -2671,16 +3035,109 @@ void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
     // give frame to decider
     FrameDecider_AnalyzeAndDecide(&frame_decider, frame, frame_len);
     
-    // forward frame to peers
-    FrameDeciderPeer *decider_peer = FrameDecider_NextDestination(&frame_decider);
-    while (decider_peer) {
-        FrameDeciderPeer *next = FrameDecider_NextDestination(&frame_decider);
+    if (!options.udp_group_key) {
+        // forward frame to peers
+        FrameDeciderPeer *decider_peer = FrameDecider_NextDestination(&frame_decider);
+        while (decider_peer) {
+            FrameDeciderPeer *next = FrameDecider_NextDestination(&frame_decider);
+            struct peer_data *peer = UPPER_OBJECT(decider_peer, struct peer_data, decider_peer);
+            DataProtoFlow_Route(&peer->local_dpflow, !!next);
+            decider_peer = next;
+        }
+        return;
+    }
+    
+    // collect destinations, and those which can receive group datagrams
+    int num_dests = 0;
+    int num_group_dests = 0;
+    FrameDeciderPeer *decider_peer;
+    while (decider_peer = FrameDecider_NextDestination(&frame_decider)) {
         struct peer_data *peer = UPPER_OBJECT(decider_peer, struct peer_data, decider_peer);
-        DataProtoFlow_Route(&peer->local_dpflow, !!next);
-        decider_peer = next;
+        ASSERT(num_dests < options.max_peers)
+        device_dest_peers[num_dests++] = peer;
+        if (peer_can_receive_group(peer)) {
+            device_group_dest_ids[num_group_dests++] = peer->id;
+        }
+    }
+    
+    // encode the frame once for all of them if it's going to more than one
+    int use_group = (num_group_dests > 1);
+    if (use_group) {
+        DatagramGroupEncoder_SubmitFrame(&group_encoder, frame, frame_len, device_group_dest_ids, num_group_dests);
+    }
+    
+    // forward frame to the remaining peers
+    int num_route = num_dests - (use_group ? num_group_dests : 0);
+    for (int i = 0; i < num_dests; i++) {
+        struct peer_data *peer = device_dest_peers[i];
+        if (use_group && peer_can_receive_group(peer)) {
+            continue;
+        }
+        DataProtoFlow_Route(&peer->local_dpflow, --num_route > 0);
     }
 }
 
+int init_group_encoder (void)
+{
+    ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
+    ASSERT(options.udp_group_key)
+    
+    // allocate destination buffers
+    if (!(device_dest_peers = (struct peer_data **)BAllocArray(options.max_peers, sizeof(device_dest_peers[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    if (!(device_group_dest_ids = (peerid_t *)BAllocArray(options.max_peers, sizeof(device_group_dest_ids[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    // same socket MTU as peers' DatagramPeerIO
+    int socket_mtu = (options.udp_shared_socket ? CLIENT_UDP_MTU - DATAGRAMSHAREDSOCKET_HEADER_SIZE : CLIENT_UDP_MTU);
+    
+    // init encoder
+    if (!DatagramGroupEncoder_Init(&group_encoder, &ss, my_id, device_mtu, socket_mtu, sp_params, options.send_buffer_size, options.max_peers, &twd,
+                                   NULL, group_encoder_handler_datagram
+    )) {
+        BLog(BLOG_ERROR, "DatagramGroupEncoder_Init failed");
+        goto fail2;
+    }
+    
+    // generate and set group key; it is sent to peers when they appear
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        BRandom_randomize(group_key, BEncryption_cipher_key_size(sp_params.encryption_mode));
+        DatagramGroupEncoder_SetEncryptionKey(&group_encoder, group_key);
+    }
+    
+    return 1;
+    
+fail2:
+    BFree(device_group_dest_ids);
+fail1:
+    BFree(device_dest_peers);
+fail0:
+    return 0;
+}
+
+void free_group_encoder (void)
+{
+    DatagramGroupEncoder_Free(&group_encoder);
+    BFree(device_group_dest_ids);
+    BFree(device_dest_peers);
+}
+
+void group_encoder_handler_datagram (void *unused, peerid_t dest_id, DatagramGroupEncoder_ref *ref)
+{
+    // the peer may have gone away or lost its link since the frame was submitted
+    struct peer_data *peer = find_peer_by_id(dest_id);
+    if (!peer || !peer_can_receive_group(peer)) {
+        return;
+    }
+    
+    // queue datagram to the peer
+    DatagramPeerIO_SubmitGroupDatagram(&peer->pio.udp.pio, ref);
+}
+
 void assign_relays (void)
 {
     LinkedList1Node *list_node;
@@ -2764,6 +3221,13 @@ void server_handler_ready (void *user, peerid_t param_my_id, uint32_t ext_ip)
         return;
     }
     
+    // init group encoder
+    if (options.udp_group_key && !init_group_encoder()) {
+        PacketPassFairQueue_Free(&server_queue);
+        terminate();
+        return;
+    }
+    
     // set server ready
     server_ready = 1;
     
@@ -2884,6 +3348,16 @@ void peer_job_send_seed (struct peer_data *peer)
 
 void peer_job_init (struct peer_data *peer)
 {
+    // give the peer our group key
+    if (options.udp_group_key && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        peer_send_groupkey(peer);
+        
+        // sending may have failed and reset the peer
+        if (!peer->have_chat) {
+            return;
+        }
+    }
+    
     // start setup process
     if (peer_am_master(peer)) {
         peer_start_binding(peer);
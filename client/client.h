@@ -67,6 +67,8 @@
 #define PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY 0
 // value related to how much out-of-order input we tolerate (see FragmentProtoAssembler num_frames argument)
 #define PEER_UDP_ASSEMBLER_NUM_FRAMES 4
+// how many packets per peer to encode or decode at once when threads are used (see SPProtoEncoder pipeline_len argument)
+#define PEER_DEFAULT_UDP_CRYPTO_PIPELINE 16
 // socket send buffer (SO_SNDBUF) for peer TCP connections, <=0 to not set
 #define PEER_DEFAULT_TCP_SOCKET_SNDBUF 1048576
 // keep-alive packet interval for p2p communication
@@ -148,6 +150,12 @@ struct peer_data {
     // receive receiver
     DPReceiveReceiver receive_receiver;
     
+    // receive receiver for the peer's group datagrams (UDP with --udp-group-key only)
+    DPReceiveReceiver group_receive_receiver;
+    
+    // whether the link is up, defined only if have_link
+    int link_up;
+    
     // transport-specific link objects
     union {
         struct {
@@ -176,6 +184,10 @@ struct peer_data {
     int waiting_relay;
     LinkedList1Node waiting_relay_list_node;
     
+    // key the peer encrypts its group datagrams with (UDP with --udp-group-key only)
+    int have_group_recv_key;
+    uint8_t group_recv_key[BENCRYPTION_MAX_KEY_SIZE];
+    
     // retry timer
     BTimer reset_timer;
     
@@ -42,7 +42,8 @@ static void usage (char *name)
 {
     printf(
         "Usage: %s <enc/dec> <ciper> <num_blocks> <num_ops>\n"
-        "    <cipher> is one of (blowfish, aes).\n",
+        "    <cipher> is one of (blowfish, aes, aes-gcm, chacha20-poly1305).\n"
+        "    For AEAD ciphers, a block is 16 bytes.\n",
         name
     );
     
@@ -83,6 +84,12 @@ int main (int argc, char **argv)
     else if (!strcmp(cipher_str, "aes")) {
         cipher = BENCRYPTION_CIPHER_AES;
     }
+    else if (!strcmp(cipher_str, "aes-gcm")) {
+        cipher = BENCRYPTION_CIPHER_AES_GCM;
+    }
+    else if (!strcmp(cipher_str, "chacha20-poly1305")) {
+        cipher = BENCRYPTION_CIPHER_CHACHA20_POLY1305;
+    }
     else {
         usage(argv[0]);
     }
@@ -92,13 +99,16 @@ int main (int argc, char **argv)
     }
     
     int key_size = BEncryption_cipher_key_size(cipher);
-    int block_size = BEncryption_cipher_block_size(cipher);
+    int aead = BEncryption_cipher_is_aead(cipher);
+    int block_size = (aead ? 16 : BEncryption_cipher_block_size(cipher));
     
     uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
     BRandom_randomize(key, key_size);
     
     uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
-    BRandom_randomize(iv, block_size);
+    BRandom_randomize(iv, (aead ? BENCRYPTION_AEAD_NONCE_SIZE : block_size));
+    
+    uint8_t tag[BENCRYPTION_AEAD_TAG_SIZE];
     
     if (num_blocks > INT_MAX / block_size) {
         printf("too much");
@@ -121,14 +131,33 @@ int main (int argc, char **argv)
     }
     
     BEncryption enc;
-    BEncryption_Init(&enc, mode, cipher, key);
+    BEncryption_Init(&enc, (aead ? BENCRYPTION_MODE_ENCRYPT|BENCRYPTION_MODE_DECRYPT : mode), cipher, key);
     
     uint8_t *in = buf1;
     uint8_t *out = buf2;
     BRandom_randomize(in, unit_size);
     
+    if (aead && mode == BENCRYPTION_MODE_DECRYPT) {
+        // produce a valid tag for the data, which is then decrypted repeatedly
+        BEncryption_EncryptAEAD(&enc, iv, in, in, unit_size, tag);
+    }
+    
     for (int i = 0; i < num_ops; i++) {
-        BEncryption_Encrypt(&enc, in, out, unit_size, iv);
+        if (!aead) {
+            if (mode == BENCRYPTION_MODE_ENCRYPT) {
+                BEncryption_Encrypt(&enc, in, out, unit_size, iv);
+            } else {
+                BEncryption_Decrypt(&enc, in, out, unit_size, iv);
+            }
+        }
+        else if (mode == BENCRYPTION_MODE_ENCRYPT) {
+            BEncryption_EncryptAEAD(&enc, iv, in, out, unit_size, tag);
+        }
+        else {
+            int res = BEncryption_DecryptAEAD(&enc, iv, in, out, unit_size, tag);
+            ASSERT_FORCE(res)
+            continue;
+        }
         
         uint8_t *t = in;
         in = out;
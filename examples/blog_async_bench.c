@@ -0,0 +1,188 @@
+/**
+ * @file blog_async_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compares logging through the synchronous BLog path and through the
+ * asynchronous backend (BLog_MakeAsync). Several threads each log messages
+ * with a mix of conversions into a logger which discards them, but checksums
+ * what it gets, so that the output of both paths can be checked to be the
+ * same. Reports the time spent in the logging threads and the total time
+ * including the final flush.
+ * Run with e.g. 1000000 messages and 4 threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <misc/debug.h>
+#include <system/BTime.h>
+#include <base/BLog.h>
+#include <base/BLog_async.h>
+
+#include <generated/blog_channel_BLogAsync.h>
+
+static int num_messages;
+static int num_threads;
+static pthread_mutex_t sum_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sum;
+static uint64_t count;
+
+static void null_log (int channel, int level, const char *msg)
+{
+    if (level != BLOG_INFO) {
+        printf("%s\n", msg);
+        return;
+    }
+    
+    // FNV-1a of the message; added up, so the order of messages doesn't matter
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)(channel * 8 + level);
+    for (const char *p = msg; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    }
+    
+    ASSERT_FORCE(pthread_mutex_lock(&sum_mutex) == 0)
+    sum += h;
+    count++;
+    ASSERT_FORCE(pthread_mutex_unlock(&sum_mutex) == 0)
+}
+
+static void null_free (void)
+{
+}
+
+static void * thread_func (void *arg)
+{
+    int id = (intptr_t)arg;
+    
+    for (int i = 0; i < num_messages; i++) {
+        switch (i % 4) {
+            case 0:
+                BLog(BLOG_INFO, "client %d.%d.%d.%d:%d: connected", 10, id, i >> 8 & 255, i & 255, 1024 + i % 60000);
+                break;
+            case 1:
+                BLog(BLOG_INFO, "connection %"PRIu64" (%s) received %zu bytes", (uint64_t)i, (i & 1 ? "udp" : "tcp"), (size_t)i * 3);
+                break;
+            case 2:
+                BLog(BLOG_INFO, "%-10s|%5.2f|%.*s|%08x|%c", "thread", i / 7.0, 3, "truncated", (unsigned int)i, 'a' + i % 26);
+                break;
+            case 3:
+                BLog(BLOG_INFO, "closing %p, %s", (void *)(uintptr_t)(i * 16), (char *)NULL);
+                break;
+        }
+    }
+    
+    return NULL;
+}
+
+static int run (const char *name, int async)
+{
+    BLog_Init(null_log, null_free);
+    sum = 0;
+    count = 0;
+    
+    if (async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_RING_SIZE)) {
+        printf("BLog_MakeAsync failed\n");
+        BLog_Free();
+        return 0;
+    }
+    
+    BLog_SetChannelLoglevel(BLOG_CURRENT_CHANNEL, BLOG_INFO);
+    
+    pthread_t *threads = malloc(num_threads * sizeof(threads[0]));
+    if (!threads) {
+        printf("malloc failed\n");
+        BLog_Free();
+        return 0;
+    }
+    
+    btime_t start = btime_gettime();
+    
+    for (int i = 0; i < num_threads; i++) {
+        ASSERT_FORCE(pthread_create(&threads[i], NULL, thread_func, (void *)(intptr_t)i) == 0)
+    }
+    for (int i = 0; i < num_threads; i++) {
+        ASSERT_FORCE(pthread_join(threads[i], NULL) == 0)
+    }
+    
+    btime_t logged = btime_gettime();
+    
+    BLog_Free();
+    
+    btime_t end = btime_gettime();
+    
+    free(threads);
+    
+    int total = num_messages * num_threads;
+    printf("%s:\n", name);
+    printf("  log    %6d ms  %7.1f ns/message\n", (int)(logged - start), (double)(logged - start) * 1000000.0 / total);
+    printf("  total  %6d ms  %7.1f ns/message\n", (int)(end - start), (double)(end - start) * 1000000.0 / total);
+    printf("  written %"PRIu64" (dropped %"PRIu64"), checksum %016"PRIx64"\n", count, (uint64_t)total - count, sum);
+    
+    return 1;
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <num_messages> <num_threads>\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 3) {
+        usage(argv[0]);
+    }
+    
+    num_messages = atoi(argv[1]);
+    num_threads = atoi(argv[2]);
+    
+    if (num_messages <= 0 || num_threads <= 0) {
+        usage(argv[0]);
+    }
+    
+    BTime_Init();
+    
+    if (!run("sync", 0)) {
+        return 1;
+    }
+    
+    if (!run("async", 1)) {
+        return 1;
+    }
+    
+    return 0;
+}
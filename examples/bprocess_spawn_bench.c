@@ -0,0 +1,208 @@
+/**
+ * @file bprocess_spawn_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compares starting child processes with fork() (BPROCESSMANAGER_FLAG_FORK)
+ * and with the default clone(CLONE_VM | CLONE_VFORK) path, from a process
+ * with a large resident set. Processes are started one after another, each
+ * one when the previous one has been reaped. Reports the time spent inside
+ * BProcess_Init2 and the total time.
+ * Run with e.g. 10000 processes and 1024 MB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BProcess.h>
+
+#include <generated/blog_channel_BProcess.h>
+
+static BReactor reactor;
+static BProcessManager manager;
+static BProcess process;
+static char *program;
+static int num_processes;
+static int num_started;
+static btime_t spawn_time;
+
+static void process_handler (void *user, int normally, uint8_t normally_exit_status);
+
+static int start_process (void)
+{
+    char *argv[] = {program, NULL};
+    int fds[] = {-1};
+    
+    struct BProcess_params params;
+    params.username = NULL;
+    params.fds = fds;
+    params.fds_map = NULL;
+    params.do_setsid = 0;
+    
+    btime_t start = btime_gettime();
+    int res = BProcess_Init2(&process, &manager, process_handler, NULL, program, argv, params);
+    spawn_time += btime_gettime() - start;
+    
+    if (!res) {
+        printf("BProcess_Init2 failed\n");
+        return 0;
+    }
+    
+    num_started++;
+    return 1;
+}
+
+static void process_handler (void *user, int normally, uint8_t normally_exit_status)
+{
+    BProcess_Free(&process);
+    
+    if (!normally || normally_exit_status != 0) {
+        printf("child failed\n");
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    if (num_started == num_processes) {
+        BReactor_Quit(&reactor, 1);
+        return;
+    }
+    
+    if (!start_process()) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+}
+
+static void report (const char *name, btime_t elapsed)
+{
+    printf("  %-6s %6d ms  %7.1f us/process\n", name, (int)elapsed, (double)elapsed * 1000.0 / num_processes);
+}
+
+static int run (const char *name, int flags)
+{
+    int res = 0;
+    
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (!BProcessManager_Init2(&manager, &reactor, flags)) {
+        printf("BProcessManager_Init2 failed\n");
+        goto fail1;
+    }
+    
+    printf("%s:\n", name);
+    
+    num_started = 0;
+    spawn_time = 0;
+    
+    btime_t start = btime_gettime();
+    
+    if (!start_process()) {
+        goto fail2;
+    }
+    
+    if (!BReactor_Exec(&reactor)) {
+        goto fail2;
+    }
+    
+    report("spawn", spawn_time);
+    report("total", btime_gettime() - start);
+    
+    res = 1;
+    
+fail2:
+    BProcessManager_Free(&manager);
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    return res;
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <num_processes> <rss_megabytes> [program]\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 3 && argc != 4) {
+        usage(argv[0]);
+    }
+    
+    num_processes = atoi(argv[1]);
+    int rss_mb = atoi(argv[2]);
+    program = (argc == 4 ? argv[3] : "/bin/true");
+    
+    if (num_processes <= 0 || rss_mb < 0) {
+        usage(argv[0]);
+    }
+    
+    BLog_InitStdout();
+    BLog_SetChannelLoglevel(BLOG_CURRENT_CHANNEL, BLOG_WARNING);
+    BTime_Init();
+    
+    // grow our resident set; touch every byte so the pages are really there
+    size_t rss_size = (size_t)rss_mb * 1024 * 1024;
+    char *rss = malloc(rss_size ? rss_size : 1);
+    if (!rss) {
+        printf("malloc failed\n");
+        goto fail0;
+    }
+    memset(rss, 1, rss_size);
+    
+    if (!run("fork", BPROCESSMANAGER_FLAG_FORK)) {
+        goto fail1;
+    }
+    
+    if (!run("clone", 0)) {
+        goto fail1;
+    }
+    
+    free(rss);
+    BLog_Free();
+    return 0;
+    
+fail1:
+    free(rss);
+fail0:
+    BLog_Free();
+    return 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file breactor_timers_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compares the BReactor timer backends, the balanced tree and the timer wheel
+ * (BREACTOR_INIT_FLAG_TIMER_WHEEL), with many active timers. Measures starting
+ * all timers, restarting random timers (like an inactivity timer restarted for
+ * every packet), dispatching expired timers and stopping all timers.
+ * Run with e.g. 1000000 timers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <base/BLog.h>
+
+static BReactor reactor;
+static BSmallTimer *timers;
+static int num_timers;
+static int num_expired;
+
+static uint32_t next_random (uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static void timer_handler (BSmallTimer *timer)
+{
+    num_expired++;
+    
+    if (num_expired == num_timers) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+static void report (const char *name, btime_t elapsed, int num_ops)
+{
+    printf("  %-8s %6d ms  %7.1f ns/op\n", name, (int)elapsed, (double)elapsed * 1000000.0 / num_ops);
+}
+
+static int run (const char *name, int flags, int num_resets)
+{
+    if (!BReactor_Init2(&reactor, flags)) {
+        printf("BReactor_Init2 failed\n");
+        return 0;
+    }
+    
+    printf("%s:\n", name);
+    
+    for (int i = 0; i < num_timers; i++) {
+        BSmallTimer_Init(&timers[i], timer_handler);
+    }
+    
+    uint32_t rnd = 1;
+    btime_t start;
+    
+    // start all timers, within a minute
+    start = btime_gettime();
+    for (int i = 0; i < num_timers; i++) {
+        BReactor_SetSmallTimer(&reactor, &timers[i], BTIMER_SET_RELATIVE, 1000 + next_random(&rnd) % 59000);
+    }
+    report("set", btime_gettime() - start, num_timers);
+    
+    // restart random timers
+    start = btime_gettime();
+    for (int i = 0; i < num_resets; i++) {
+        BSmallTimer *timer = &timers[next_random(&rnd) % num_timers];
+        BReactor_SetSmallTimer(&reactor, timer, BTIMER_SET_RELATIVE, 1000 + next_random(&rnd) % 59000);
+    }
+    report("reset", btime_gettime() - start, num_resets);
+    
+    // stop all timers
+    start = btime_gettime();
+    for (int i = 0; i < num_timers; i++) {
+        BReactor_RemoveSmallTimer(&reactor, &timers[i]);
+    }
+    report("remove", btime_gettime() - start, num_timers);
+    
+    // make all timers expire within the last half second, and dispatch them
+    num_expired = 0;
+    btime_t now = btime_gettime();
+    for (int i = 0; i < num_timers; i++) {
+        BReactor_SetSmallTimer(&reactor, &timers[i], BTIMER_SET_ABSOLUTE, now - 500 + next_random(&rnd) % 500);
+    }
+    start = btime_gettime();
+    BReactor_Exec(&reactor);
+    ASSERT_FORCE(num_expired == num_timers)
+    report("expire", btime_gettime() - start, num_timers);
+    
+    BReactor_Free(&reactor);
+    return 1;
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <num_timers> <num_resets>\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 3) {
+        usage(argv[0]);
+    }
+    
+    num_timers = atoi(argv[1]);
+    int num_resets = atoi(argv[2]);
+    
+    if (num_timers <= 0 || num_resets <= 0) {
+        usage(argv[0]);
+    }
+    
+    BLog_InitStdout();
+    BTime_Init();
+    
+    if (!(timers = (BSmallTimer *)BAllocArray(num_timers, sizeof(timers[0])))) {
+        printf("BAllocArray failed\n");
+        goto fail0;
+    }
+    
+    if (!run("tree", 0, num_resets)) {
+        goto fail1;
+    }
+    
+    if (!run("wheel", BREACTOR_INIT_FLAG_TIMER_WHEEL, num_resets)) {
+        goto fail1;
+    }
+    
+    BFree(timers);
+    BLog_Free();
+    return 0;
+    
+fail1:
+    BFree(timers);
+fail0:
+    BLog_Free();
+    return 1;
+}
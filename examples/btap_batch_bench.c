@@ -0,0 +1,206 @@
+/**
+ * @file btap_batch_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Measures the receive rate of {@link BTap}, with and without batching.
+ * A child process writes packets into a SOCK_SEQPACKET socket pair, which behaves
+ * like a TUN device (one packet per read), and BTap reads them from the other end
+ * via file descriptor initialization. This needs no privileges; to test with a real
+ * device, pass the file descriptor of an opened TUN queue instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <tuntap/BTap.h>
+
+static BReactor reactor;
+static BTap tap;
+static PacketRecvInterface *output;
+static uint8_t *buf;
+static int num_packets;
+static int num_received;
+
+static void usage (char *name)
+{
+    printf(
+        "Usage: %s <packet_size> <num_packets> <batch_size>\n"
+        "    <batch_size> is 0 to disable batching.\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static void tap_handler_error (void *unused)
+{
+    DEBUG("device error");
+    BReactor_Quit(&reactor, 1);
+}
+
+static void output_handler_done (void *unused, int data_len)
+{
+    if (++num_received == num_packets) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    PacketRecvInterface_Receiver_Recv(output, buf);
+}
+
+static void writer (int fd, int packet_size, int count)
+{
+    uint8_t *packet = (uint8_t *)malloc(packet_size);
+    if (!packet) {
+        _exit(1);
+    }
+    memset(packet, 0x45, packet_size);
+    
+    for (int i = 0; i < count; i++) {
+        if (write(fd, packet, packet_size) != packet_size) {
+            _exit(1);
+        }
+    }
+    
+    // wait to be killed, so the reader doesn't see a hang-up
+    while (1) {
+        pause();
+    }
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 4) {
+        usage(argv[0]);
+    }
+    
+    int packet_size = atoi(argv[1]);
+    num_packets = atoi(argv[2]);
+    int batch_size = atoi(argv[3]);
+    
+    if (packet_size <= 0 || num_packets <= 0 || batch_size < 0) {
+        usage(argv[0]);
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        DEBUG("socketpair failed");
+        goto fail0;
+    }
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        DEBUG("fork failed");
+        goto fail1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        writer(sv[1], packet_size, num_packets);
+    }
+    
+    BLog_InitStdout();
+    
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        goto fail2;
+    }
+    
+    struct BTap_init_data init_data;
+    init_data.dev_type = BTAP_DEV_TUN;
+    init_data.init_type = BTAP_INIT_FD;
+    init_data.flags = 0;
+    init_data.init.fd.fd = sv[0];
+    init_data.init.fd.mtu = packet_size;
+    
+    if (!BTap_Init2(&tap, &reactor, init_data, tap_handler_error, NULL)) {
+        DEBUG("BTap_Init2 failed");
+        goto fail3;
+    }
+    
+    if (batch_size > 0 && !BTap_SetRecvBatch(&tap, batch_size)) {
+        DEBUG("BTap_SetRecvBatch failed");
+        goto fail4;
+    }
+    
+    if (!(buf = (uint8_t *)malloc(packet_size))) {
+        DEBUG("malloc failed");
+        goto fail4;
+    }
+    
+    output = BTap_GetOutput(&tap);
+    PacketRecvInterface_Receiver_Init(output, output_handler_done, NULL);
+    
+    num_received = 0;
+    
+    btime_t start = btime_gettime();
+    PacketRecvInterface_Receiver_Recv(output, buf);
+    int res = BReactor_Exec(&reactor);
+    btime_t elapsed = btime_gettime() - start;
+    
+    if (res == 0) {
+        printf("received %d packets in %d ms", num_received, (int)elapsed);
+        if (elapsed > 0) {
+            printf(", %.0f pps", (double)num_received * 1000 / elapsed);
+        }
+        printf("\n");
+    }
+    
+    free(buf);
+fail4:
+    BTap_Free(&tap);
+fail3:
+    BReactor_Free(&reactor);
+fail2:
+    BLog_Free();
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+fail1:
+    close(sv[0]);
+    close(sv[1]);
+fail0:
+    DebugObjectGlobal_Finish();
+    return 0;
+}
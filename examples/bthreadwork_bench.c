@@ -0,0 +1,229 @@
+/**
+ * @file bthreadwork_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compares the BThreadWorkDispatcher work queues, the shared mutex-protected
+ * queue and the per-thread lock-free rings (BTHREADWORK_FLAG_SPSC). Keeps a
+ * number of small works in flight, starting a new one whenever one is done,
+ * and reports works per second. Every 16th completion also frees another
+ * work which may be queued or running, to exercise cancellation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <base/BLog.h>
+#include <threadwork/BThreadWork.h>
+
+struct slot {
+    BThreadWork tw;
+    int active;
+    uint32_t result;
+};
+
+static BReactor reactor;
+static BThreadWorkDispatcher twd;
+static struct slot *slots;
+static int num_slots;
+static int num_works;
+static int work_iters;
+static int num_started;
+static int num_done;
+static int num_cancelled;
+static int num_active;
+static uint32_t expected_result;
+
+static uint32_t compute (void)
+{
+    uint32_t x = 1;
+    for (int i = 0; i < work_iters; i++) {
+        x = x * 1103515245 + 12345;
+    }
+    return x;
+}
+
+static void work_func (struct slot *s)
+{
+    s->result = compute();
+}
+
+static void start_slot (struct slot *s);
+
+static void stop_slot (struct slot *s)
+{
+    ASSERT(s->active)
+    
+    BThreadWork_Free(&s->tw);
+    s->active = 0;
+    num_active--;
+    
+    if (num_active == 0) {
+        BReactor_Quit(&reactor, 0);
+    }
+}
+
+static void handler_done (struct slot *s)
+{
+    ASSERT(s->active)
+    ASSERT_FORCE(s->result == expected_result)
+    
+    num_done++;
+    
+    // cancel another work now and then
+    if (num_done % 16 == 0) {
+        struct slot *other = &slots[(s - slots + num_slots / 2) % num_slots];
+        if (other != s && other->active) {
+            stop_slot(other);
+            num_cancelled++;
+            start_slot(other);
+        }
+    }
+    
+    stop_slot(s);
+    start_slot(s);
+}
+
+static void start_slot (struct slot *s)
+{
+    ASSERT(!s->active)
+    
+    if (num_started == num_works) {
+        return;
+    }
+    
+    s->result = 0;
+    BThreadWork_Init(&s->tw, &twd, (BThreadWork_handler_done)handler_done, s, (BThreadWork_work_func)work_func, s);
+    s->active = 1;
+    num_active++;
+    num_started++;
+}
+
+static int run (const char *name, int num_threads, int flags)
+{
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (!BThreadWorkDispatcher_Init2(&twd, &reactor, num_threads, flags)) {
+        printf("BThreadWorkDispatcher_Init2 failed\n");
+        goto fail1;
+    }
+    
+    num_started = 0;
+    num_done = 0;
+    num_cancelled = 0;
+    num_active = 0;
+    
+    btime_t start = btime_gettime();
+    
+    for (int i = 0; i < num_slots; i++) {
+        slots[i].active = 0;
+        start_slot(&slots[i]);
+    }
+    
+    BReactor_Exec(&reactor);
+    
+    btime_t elapsed = btime_gettime() - start;
+    
+    ASSERT_FORCE(num_active == 0)
+    ASSERT_FORCE(num_started == num_works)
+    
+    printf("%-6s %6d ms  %10.0f works/s  (%d done, %d cancelled)\n", name, (int)elapsed,
+           (double)num_done * 1000.0 / (elapsed > 0 ? elapsed : 1), num_done, num_cancelled);
+    
+    BThreadWorkDispatcher_Free(&twd);
+    BReactor_Free(&reactor);
+    return 1;
+    
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    return 0;
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <num_threads> <num_works> <in_flight> <work_iters>\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 5) {
+        usage(argv[0]);
+    }
+    
+    int num_threads = atoi(argv[1]);
+    num_works = atoi(argv[2]);
+    num_slots = atoi(argv[3]);
+    work_iters = atoi(argv[4]);
+    
+    if (num_threads <= 0 || num_works <= 0 || num_slots <= 0 || work_iters < 0) {
+        usage(argv[0]);
+    }
+    
+    BLog_InitStdout();
+    BTime_Init();
+    
+    expected_result = compute();
+    
+    if (!(slots = (struct slot *)BAllocArray(num_slots, sizeof(slots[0])))) {
+        printf("BAllocArray failed\n");
+        goto fail0;
+    }
+    
+    if (!run("mutex", num_threads, 0)) {
+        goto fail1;
+    }
+    
+    if (!run("spsc", num_threads, BTHREADWORK_FLAG_SPSC)) {
+        goto fail1;
+    }
+    
+    BFree(slots);
+    BLog_Free();
+    return 0;
+    
+fail1:
+    BFree(slots);
+fail0:
+    BLog_Free();
+    return 1;
+}
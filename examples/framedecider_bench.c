@@ -0,0 +1,313 @@
+/**
+ * @file framedecider_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Measures how long FrameDecider takes to decide the destinations of a frame
+ * read from the device, with many peers each owning many MAC addresses and
+ * belonging to some multicast groups. Frames are sent to random known MACs,
+ * to a few recently used MACs, and to random multicast groups.
+ * Run with e.g. 1000 peers and 100 MACs per peer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/igmp_proto.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <base/BLog.h>
+#include <client/FrameDecider.h>
+
+#include <generated/blog_channel_FrameDecider.h>
+
+#define GROUPS_PER_PEER 4
+#define HOT_MACS 8
+#define FRAME_LEN 60
+
+static BReactor reactor;
+static FrameDecider decider;
+static FrameDeciderPeer *peers;
+static int num_peers;
+static int num_macs;
+
+static uint32_t next_random (uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static void logfunc (void *user)
+{
+}
+
+static void make_mac (uint8_t *mac, int peer, int index)
+{
+    mac[0] = 0x02;
+    mac[1] = peer >> 8;
+    mac[2] = peer;
+    mac[3] = index >> 16;
+    mac[4] = index >> 8;
+    mac[5] = index;
+}
+
+static uint32_t make_group (int peer, int index)
+{
+    // 239.x.y.z, with a different sig for every group
+    uint32_t group = ((uint32_t)239 << 24) | ((uint32_t)peer * GROUPS_PER_PEER + index);
+    return hton32(group);
+}
+
+static void make_unicast_frame (uint8_t *frame, const uint8_t *dest)
+{
+    struct ethernet_header eh;
+    memcpy(eh.dest, dest, 6);
+    memset(eh.source, 0x0e, 6);
+    eh.type = hton16(0x86DD);
+    
+    memset(frame, 0, FRAME_LEN);
+    memcpy(frame, &eh, sizeof(eh));
+}
+
+static void make_multicast_frame (uint8_t *frame, uint32_t group)
+{
+    uint8_t dest[6] = {0x01, 0x00, 0x5e};
+    uint32_t g = ntoh32(group);
+    dest[3] = (g >> 16) & 0x7F;
+    dest[4] = g >> 8;
+    dest[5] = g;
+    make_unicast_frame(frame, dest);
+}
+
+static void make_igmp_report (uint8_t *frame, int *out_len, const uint8_t *source, uint32_t group)
+{
+    struct ethernet_header eh;
+    memset(eh.dest, 0xff, 6);
+    memcpy(eh.source, source, 6);
+    eh.type = hton16(ETHERTYPE_IPV4);
+    
+    struct igmp_base ib;
+    ib.type = IGMP_TYPE_V2_MEMBERSHIP_REPORT;
+    ib.max_resp_code = 0;
+    ib.checksum = 0;
+    
+    struct igmp_v2_extra ie;
+    ie.group = group;
+    
+    struct ipv4_header ih;
+    memset(&ih, 0, sizeof(ih));
+    ih.version4_ihl4 = IPV4_MAKE_VERSION_IHL(sizeof(ih));
+    ih.total_length = hton16(sizeof(ih) + sizeof(ib) + sizeof(ie));
+    ih.ttl = 1;
+    ih.protocol = IPV4_PROTOCOL_IGMP;
+    ih.destination_address = group;
+    ih.checksum = ipv4_checksum(&ih, NULL, 0);
+    
+    int len = 0;
+    memcpy(frame + len, &eh, sizeof(eh));
+    len += sizeof(eh);
+    memcpy(frame + len, &ih, sizeof(ih));
+    len += sizeof(ih);
+    memcpy(frame + len, &ib, sizeof(ib));
+    len += sizeof(ib);
+    memcpy(frame + len, &ie, sizeof(ie));
+    len += sizeof(ie);
+    
+    *out_len = len;
+}
+
+static int decide (const uint8_t *frame)
+{
+    FrameDecider_AnalyzeAndDecide(&decider, frame, FRAME_LEN);
+    
+    int count = 0;
+    while (FrameDecider_NextDestination(&decider)) {
+        count++;
+    }
+    
+    return count;
+}
+
+static void report (const char *name, btime_t elapsed, int num_ops)
+{
+    printf("  %-10s %6d ms  %7.1f ns/frame\n", name, (int)elapsed, (double)elapsed * 1000000.0 / num_ops);
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <num_peers> <macs_per_peer> <num_frames>\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 4) {
+        usage(argv[0]);
+    }
+    
+    num_peers = atoi(argv[1]);
+    num_macs = atoi(argv[2]);
+    int num_frames = atoi(argv[3]);
+    
+    if (num_peers <= 0 || num_peers > 65536 || num_macs <= 0 || num_macs > 0xFFFFFF || num_frames <= 0) {
+        usage(argv[0]);
+    }
+    
+    BLog_InitStdout();
+    BLog_SetChannelLoglevel(BLOG_CURRENT_CHANNEL, BLOG_NOTICE);
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (!(peers = (FrameDeciderPeer *)BAllocArray(num_peers, sizeof(peers[0])))) {
+        printf("BAllocArray failed\n");
+        goto fail1;
+    }
+    
+    if (!FrameDecider_Init(&decider, num_macs, GROUPS_PER_PEER, 260000, 2000, &reactor)) {
+        printf("FrameDecider_Init failed\n");
+        goto fail2;
+    }
+    
+    uint8_t frame[128];
+    int frame_len;
+    btime_t start;
+    
+    // create peers and teach the decider their MACs and groups
+    start = btime_gettime();
+    int i;
+    for (i = 0; i < num_peers; i++) {
+        if (!FrameDeciderPeer_Init(&peers[i], &decider, NULL, logfunc)) {
+            printf("FrameDeciderPeer_Init failed\n");
+            goto fail3;
+        }
+        
+        for (int j = 0; j < num_macs; j++) {
+            uint8_t mac[6];
+            make_mac(mac, i, j);
+            make_unicast_frame(frame, mac);
+            
+            // the frame came from this MAC
+            memcpy(frame + 6, mac, 6);
+            FrameDeciderPeer_Analyze(&peers[i], frame, FRAME_LEN);
+        }
+        
+        for (int j = 0; j < GROUPS_PER_PEER; j++) {
+            uint8_t mac[6];
+            make_mac(mac, i, 0);
+            make_igmp_report(frame, &frame_len, mac, make_group(i, j));
+            FrameDeciderPeer_Analyze(&peers[i], frame, frame_len);
+        }
+    }
+    report("learn", btime_gettime() - start, num_peers * (num_macs + GROUPS_PER_PEER));
+    
+    uint32_t rnd = 1;
+    
+    // frames to random known MACs
+    start = btime_gettime();
+    for (int k = 0; k < num_frames; k++) {
+        int peer = next_random(&rnd) % num_peers;
+        uint8_t mac[6];
+        make_mac(mac, peer, next_random(&rnd) % num_macs);
+        make_unicast_frame(frame, mac);
+        
+        FrameDecider_AnalyzeAndDecide(&decider, frame, FRAME_LEN);
+        ASSERT_FORCE(FrameDecider_NextDestination(&decider) == &peers[peer])
+        ASSERT_FORCE(!FrameDecider_NextDestination(&decider))
+    }
+    report("random", btime_gettime() - start, num_frames);
+    
+    // frames to a few MACs, like a client talking to a gateway
+    uint8_t hot_frames[HOT_MACS][FRAME_LEN];
+    for (int k = 0; k < HOT_MACS; k++) {
+        uint8_t mac[6];
+        make_mac(mac, next_random(&rnd) % num_peers, next_random(&rnd) % num_macs);
+        make_unicast_frame(hot_frames[k], mac);
+    }
+    start = btime_gettime();
+    for (int k = 0; k < num_frames; k++) {
+        ASSERT_FORCE(decide(hot_frames[k % HOT_MACS]) == 1)
+    }
+    report("hot", btime_gettime() - start, num_frames);
+    
+    // frames to random multicast groups
+    start = btime_gettime();
+    for (int k = 0; k < num_frames; k++) {
+        int peer = next_random(&rnd) % num_peers;
+        make_multicast_frame(frame, make_group(peer, next_random(&rnd) % GROUPS_PER_PEER));
+        ASSERT_FORCE(decide(frame) >= 1)
+    }
+    report("multicast", btime_gettime() - start, num_frames);
+    
+    // frames to unknown MACs are flooded; only measure the lookup
+    start = btime_gettime();
+    for (int k = 0; k < num_frames; k++) {
+        uint8_t mac[6];
+        make_mac(mac, num_peers, k);
+        make_unicast_frame(frame, mac);
+        FrameDecider_AnalyzeAndDecide(&decider, frame, FRAME_LEN);
+    }
+    report("unknown", btime_gettime() - start, num_frames);
+    
+    while (i-- > 0) {
+        FrameDeciderPeer_Free(&peers[i]);
+    }
+    FrameDecider_Free(&decider);
+    BFree(peers);
+    BReactor_Free(&reactor);
+    BLog_Free();
+    return 0;
+
+fail3:
+    while (i-- > 0) {
+        FrameDeciderPeer_Free(&peers[i]);
+    }
+    FrameDecider_Free(&decider);
+fail2:
+    BFree(peers);
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    BLog_Free();
+    return 1;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file ncdrtnl_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Sets an interface up, adds an address and many routes through it using
+ * {@link NCDRtnl}, then removes them, printing how long each step took.
+ * The routes are 10.200.x.y/32 and the address is 10.199.0.1/32, so
+ * don't run this where those are in use.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <ncd/extra/NCDRtnl.h>
+
+#define STEP_UP 0
+#define STEP_ADDR_ADD 1
+#define STEP_ROUTE_ADD 2
+#define STEP_ROUTE_DEL 3
+#define STEP_ADDR_DEL 4
+#define NUM_STEPS 5
+
+static const char *step_names[NUM_STEPS] = {"up", "addr add", "route add", "route del", "addr del"};
+
+BReactor reactor;
+NCDRtnl rtnl;
+const char *ifname;
+NCDRtnlRequest *reqs;
+int num_routes;
+int step;
+int num_pending;
+int num_failed;
+btime_t start_time;
+
+static void request_handler (void *user, int error);
+static int start_step (void);
+
+int main (int argc, char **argv)
+{
+    int ret = 1;
+    
+    if (argc != 3 || (num_routes = atoi(argv[2])) <= 0 || num_routes > 65536) {
+        fprintf(stderr, "Usage: %s <interface> <num_routes>\n", (argc > 0 ? argv[0] : ""));
+        goto fail0;
+    }
+    
+    ifname = argv[1];
+    
+    BTime_Init();
+    
+    BLog_InitStdout();
+    
+    if (!BNetwork_GlobalInit()) {
+        DEBUG("BNetwork_GlobalInit failed");
+        goto fail1;
+    }
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        goto fail1;
+    }
+    
+    if (!NCDRtnl_Init(&rtnl, &reactor, 0)) {
+        DEBUG("NCDRtnl_Init failed");
+        goto fail2;
+    }
+    
+    if (!(reqs = BAllocArray(num_routes, sizeof(reqs[0])))) {
+        DEBUG("BAllocArray failed");
+        goto fail3;
+    }
+    
+    step = STEP_UP;
+    if (start_step()) {
+        ret = BReactor_Exec(&reactor);
+    }
+    
+    BFree(reqs);
+fail3:
+    NCDRtnl_Free(&rtnl);
+fail2:
+    BReactor_Free(&reactor);
+fail1:
+    BLog_Free();
+fail0:
+    DebugObjectGlobal_Finish();
+    
+    return ret;
+}
+
+void request_handler (void *user, int error)
+{
+    NCDRtnlRequest *req = user;
+    
+    NCDRtnlRequest_Free(req);
+    
+    if (error) {
+        if (num_failed == 0) {
+            printf("  request failed: %s\n", strerror(error));
+        }
+        num_failed++;
+    }
+    
+    if (--num_pending > 0) {
+        return;
+    }
+    
+    printf("%-10s %6d ms %6d failed\n", step_names[step], (int)(btime_gettime() - start_time), num_failed);
+    
+    if (num_failed > 0) {
+        BReactor_Quit(&reactor, 1);
+        return;
+    }
+    
+    if (++step == NUM_STEPS) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    if (!start_step()) {
+        BReactor_Quit(&reactor, 1);
+    }
+}
+
+int start_step (void)
+{
+    int count = (step == STEP_ROUTE_ADD || step == STEP_ROUTE_DEL) ? num_routes : 1;
+    int add = (step != STEP_ROUTE_DEL && step != STEP_ADDR_DEL);
+    
+    start_time = btime_gettime();
+    num_failed = 0;
+    
+    for (num_pending = 0; num_pending < count; num_pending++) {
+        NCDRtnlRequest *req = &reqs[num_pending];
+        
+        int res;
+        switch (step) {
+            case STEP_UP: {
+                res = NCDRtnlRequest_InitSetUp(req, &rtnl, ifname, 1, req, request_handler);
+            } break;
+            
+            case STEP_ADDR_ADD:
+            case STEP_ADDR_DEL: {
+                struct ipv4_ifaddr ifaddr = {hton32(0x0AC70001), 32};
+                res = NCDRtnlRequest_InitIPv4Addr(req, &rtnl, add, ifname, ifaddr, req, request_handler);
+            } break;
+            
+            default: {
+                struct ipv4_ifaddr dest = {hton32(0x0AC80000 + num_pending), 32};
+                res = NCDRtnlRequest_InitIPv4Route(req, &rtnl, add, dest, NULL, 0, ifname, req, request_handler);
+            } break;
+        }
+        
+        if (!res) {
+            printf("%s: request init failed\n", step_names[step]);
+            while (num_pending-- > 0) {
+                NCDRtnlRequest_Free(&reqs[num_pending]);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
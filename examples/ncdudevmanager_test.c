@@ -51,12 +51,21 @@ static void client_handler (void *unused, char *devpath, int have_map, BStringMa
 
 int main (int argc, char **argv)
 {
-    if (!(argc == 1 || (argc == 2 && !strcmp(argv[1], "--no-udev")))) {
-        fprintf(stderr, "Usage: %s [--no-udev]\n", (argc > 0 ? argv[0] : NULL));
-        goto fail0;
-    }
+    int no_udev = 0;
+    int backend = NCDUDEVMONITOR_BACKEND_NETLINK;
     
-    int no_udev = (argc == 2);
+    for (int j = 1; j < argc; j++) {
+        if (!strcmp(argv[j], "--no-udev")) {
+            no_udev = 1;
+        }
+        else if (!strcmp(argv[j], "--udevadm")) {
+            backend = NCDUDEVMONITOR_BACKEND_UDEVADM;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--no-udev] [--udevadm]\n", (argc > 0 ? argv[0] : NULL));
+            goto fail0;
+        }
+    }
     
     if (!BNetwork_GlobalInit()) {
         DEBUG("BNetwork_GlobalInit failed");
@@ -87,7 +96,7 @@ int main (int argc, char **argv)
         goto fail3;
     }
     
-    NCDUdevManager_Init(&umanager, no_udev, &reactor, &manager);
+    NCDUdevManager_Init(&umanager, no_udev, backend, &reactor, &manager);
     
     NCDUdevClient_Init(&client, &umanager, NULL, client_handler);
     
@@ -49,8 +49,10 @@ int main (int argc, char **argv)
 {
     int ret = 1;
     
-    if (argc < 2 || (strcmp(argv[1], "monitor_udev") && strcmp(argv[1], "monitor_kernel") && strcmp(argv[1], "info"))) {
-        fprintf(stderr, "Usage: %s <monitor_udev/monitor_kernel/info>\n", (argc > 0 ? argv[0] : NULL));
+    if (argc < 2 || argc > 3 || (strcmp(argv[1], "monitor_udev") && strcmp(argv[1], "monitor_kernel") && strcmp(argv[1], "info")) ||
+        (argc == 3 && strcmp(argv[2], "udevadm"))
+    ) {
+        fprintf(stderr, "Usage: %s <monitor_udev/monitor_kernel/info> [udevadm]\n", (argc > 0 ? argv[0] : NULL));
         goto fail0;
     }
     
@@ -63,6 +65,8 @@ int main (int argc, char **argv)
         mode = NCDUDEVMONITOR_MODE_INFO;
     }
     
+    int backend = (argc == 3 ? NCDUDEVMONITOR_BACKEND_UDEVADM : NCDUDEVMONITOR_BACKEND_NETLINK);
+    
     if (!BNetwork_GlobalInit()) {
         DEBUG("BNetwork_GlobalInit failed");
         goto fail0;
@@ -87,7 +91,7 @@ int main (int argc, char **argv)
         goto fail3;
     }
     
-    if (!NCDUdevMonitor_Init(&monitor, &reactor, &manager, mode, NULL,
+    if (!NCDUdevMonitor_Init(&monitor, &reactor, &manager, mode, backend, NULL,
         monitor_handler_event,
         monitor_handler_error
     )) {
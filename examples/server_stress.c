@@ -0,0 +1,521 @@
+/**
+ * @file server_stress.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Stress test for badvpn-server. Connects many fake clients to a running
+ * server, waits until every client knows all the others, then has each
+ * client keep a few request messages in flight to its peers, round-robin.
+ * Peers echo the requests back, so each round trip is two messages relayed
+ * by the server. Run it against a server started with and without
+ * --shards to compare.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <protocol/addr.h>
+#include <protocol/scproto.h>
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/nsskey.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <flow/PacketProtoEncoder.h>
+#include <flow/SinglePacketBuffer.h>
+#include <nspr_support/BSSLConnection.h>
+#include <server_connection/ServerConnection.h>
+
+#include <generated/blog_channel_ServerConnection.h>
+
+// requests in flight per client; with replies in the other direction this
+// stays below the server's per-peer flow buffer
+#define WINDOW 4
+#define TIMEOUT_MS 60000
+
+#define KIND_REQUEST 1
+#define KIND_REPLY 2
+
+B_START_PACKED
+struct stress_header {
+    uint8_t kind;
+    uint32_t seq;
+} B_PACKED;
+B_END_PACKED
+
+struct queued_msg {
+    peerid_t peer;
+    uint8_t kind;
+    uint32_t seq;
+};
+
+struct client {
+    ServerConnection server;
+    int ready;
+    peerid_t my_id;
+    PacketRecvInterface source;
+    PacketProtoEncoder encoder;
+    SinglePacketBuffer buffer;
+    int source_blocking;
+    uint8_t *source_data;
+    struct queued_msg *queue;
+    int queue_start;
+    int queue_used;
+    peerid_t *peers;
+    int num_peers;
+    int next_peer;
+    int started;
+    int sent;
+    int outstanding;
+    int completed;
+    uint8_t *replied;
+};
+
+static BReactor reactor;
+static BTimer timer;
+static struct client *clients;
+static int num_clients;
+static int round_trips;
+static int msg_size;
+static int queue_size;
+static int num_ready;
+static int num_done;
+static int failed;
+static btime_t start_time;
+
+static void fail (const char *what, struct client *c)
+{
+    if (!failed) {
+        printf("client %d: %s\n", (int)(c - clients), what);
+        failed = 1;
+        BReactor_Quit(&reactor, 1);
+    }
+}
+
+static uint8_t pattern (uint32_t seq, int i)
+{
+    return (uint8_t)(seq * 31 + i);
+}
+
+static void write_msg (uint8_t *out, struct queued_msg m)
+{
+    struct sc_header header;
+    header.type = htol8(SCID_OUTMSG);
+    memcpy(out, &header, sizeof(header));
+    
+    struct sc_client_outmsg omsg;
+    omsg.clientid = htol16(m.peer);
+    memcpy(out + sizeof(header), &omsg, sizeof(omsg));
+    
+    uint8_t *msg = out + sizeof(header) + sizeof(omsg);
+    
+    struct stress_header sh;
+    sh.kind = m.kind;
+    sh.seq = htol32(m.seq);
+    memcpy(msg, &sh, sizeof(sh));
+    
+    for (int i = sizeof(sh); i < msg_size; i++) {
+        msg[i] = pattern(m.seq, i);
+    }
+}
+
+static void source_handler_recv (void *user, uint8_t *data)
+{
+    struct client *c = user;
+    ASSERT(!c->source_blocking)
+    
+    if (c->queue_used == 0) {
+        c->source_blocking = 1;
+        c->source_data = data;
+        return;
+    }
+    
+    write_msg(data, c->queue[c->queue_start]);
+    c->queue_start = (c->queue_start + 1) % queue_size;
+    c->queue_used--;
+    
+    PacketRecvInterface_Done(&c->source, sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + msg_size);
+}
+
+static int send_msg (struct client *c, peerid_t peer, int kind, uint32_t seq)
+{
+    struct queued_msg m;
+    m.peer = peer;
+    m.kind = kind;
+    m.seq = seq;
+    
+    if (c->source_blocking) {
+        ASSERT(c->queue_used == 0)
+        c->source_blocking = 0;
+        write_msg(c->source_data, m);
+        PacketRecvInterface_Done(&c->source, sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + msg_size);
+        return 1;
+    }
+    
+    if (c->queue_used == queue_size) {
+        return 0;
+    }
+    
+    c->queue[(c->queue_start + c->queue_used) % queue_size] = m;
+    c->queue_used++;
+    
+    return 1;
+}
+
+static void fill_window (struct client *c)
+{
+    while (c->outstanding < WINDOW && c->sent < round_trips) {
+        peerid_t peer = c->peers[c->next_peer];
+        c->next_peer = (c->next_peer + 1) % c->num_peers;
+        
+        if (!send_msg(c, peer, KIND_REQUEST, c->sent)) {
+            fail("send buffer full", c);
+            return;
+        }
+        
+        c->sent++;
+        c->outstanding++;
+    }
+}
+
+static void client_ready (struct client *c)
+{
+    num_ready++;
+    
+    if (num_ready < num_clients) {
+        return;
+    }
+    
+    // everyone knows everyone, start
+    start_time = btime_gettime();
+    
+    for (int i = 0; i < num_clients; i++) {
+        clients[i].started = 1;
+        fill_window(&clients[i]);
+    }
+}
+
+static void handler_error (void *user)
+{
+    struct client *c = user;
+    
+    fail("server connection failed", c);
+}
+
+static void handler_ready (void *user, peerid_t my_id, uint32_t ext_ip)
+{
+    struct client *c = user;
+    ASSERT(!c->ready)
+    
+    int mtu = sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + msg_size;
+    PacketRecvInterface_Init(&c->source, mtu, source_handler_recv, c, BReactor_PendingGroup(&reactor));
+    PacketProtoEncoder_Init(&c->encoder, &c->source, BReactor_PendingGroup(&reactor));
+    if (!SinglePacketBuffer_Init(&c->buffer, PacketProtoEncoder_GetOutput(&c->encoder), ServerConnection_GetSendInterface(&c->server), BReactor_PendingGroup(&reactor))) {
+        PacketProtoEncoder_Free(&c->encoder);
+        PacketRecvInterface_Free(&c->source);
+        fail("SinglePacketBuffer_Init failed", c);
+        return;
+    }
+    c->source_blocking = 0;
+    
+    c->ready = 1;
+    c->my_id = my_id;
+}
+
+static void handler_newclient (void *user, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len)
+{
+    struct client *c = user;
+    ASSERT(c->ready)
+    
+    if (c->num_peers == num_clients - 1) {
+        fail("unexpected peer", c);
+        return;
+    }
+    
+    c->peers[c->num_peers++] = peer_id;
+    
+    if (c->num_peers == num_clients - 1) {
+        // ACCEPTPEER has been queued for all peers
+        client_ready(c);
+    }
+}
+
+static void handler_endclient (void *user, peerid_t peer_id)
+{
+    struct client *c = user;
+    
+    fail("peer disconnected", c);
+}
+
+static void handler_message (void *user, peerid_t peer_id, uint8_t *data, int data_len)
+{
+    struct client *c = user;
+    ASSERT(c->ready)
+    
+    struct stress_header sh;
+    if (data_len != msg_size) {
+        fail("bad message length", c);
+        return;
+    }
+    memcpy(&sh, data, sizeof(sh));
+    uint32_t seq = ltoh32(sh.seq);
+    
+    for (int i = sizeof(sh); i < msg_size; i++) {
+        if (data[i] != pattern(seq, i)) {
+            fail("bad message contents", c);
+            return;
+        }
+    }
+    
+    switch (sh.kind) {
+        case KIND_REQUEST: {
+            if (!send_msg(c, peer_id, KIND_REPLY, seq)) {
+                fail("send buffer full", c);
+                return;
+            }
+        } break;
+        
+        case KIND_REPLY: {
+            if (!c->started || seq >= c->sent || c->replied[seq]) {
+                fail("unexpected reply", c);
+                return;
+            }
+            c->replied[seq] = 1;
+            c->outstanding--;
+            c->completed++;
+            
+            if (c->completed == round_trips) {
+                num_done++;
+                if (num_done == num_clients) {
+                    BReactor_Quit(&reactor, 0);
+                }
+                return;
+            }
+            
+            fill_window(c);
+        } break;
+        
+        default:
+            fail("bad message kind", c);
+            return;
+    }
+}
+
+static void timer_handler (void *unused)
+{
+    printf("timed out: %d clients ready, %d clients done\n", num_ready, num_done);
+    failed = 1;
+    BReactor_Quit(&reactor, 1);
+}
+
+static void usage (char *name)
+{
+    printf("Usage: %s <server_addr> <num_clients> <round_trips_per_client> <msg_size> [<nssdb> <client_cert_name> <server_name>]\n", name);
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 5 && argc != 8) {
+        usage(argv[0]);
+    }
+    
+    num_clients = atoi(argv[2]);
+    round_trips = atoi(argv[3]);
+    msg_size = atoi(argv[4]);
+    int ssl = (argc == 8);
+    
+    if (num_clients < 2 || num_clients > 10000 || round_trips <= 0 ||
+        msg_size < (int)sizeof(struct stress_header) || msg_size > SC_MAX_MSGLEN
+    ) {
+        usage(argv[0]);
+    }
+    
+    // room for a reply to every request which can be in flight towards
+    // a client, plus its own requests
+    queue_size = WINDOW * num_clients;
+    
+    // keep the server connections quiet
+    BLog_InitStdout();
+    BLog_SetChannelLoglevel(BLOG_CURRENT_CHANNEL, BLOG_WARNING);
+    BTime_Init();
+    
+    int ret = 1;
+    CERTCertificate *client_cert = NULL;
+    SECKEYPrivateKey *client_key = NULL;
+    char server_name[256];
+    
+    if (!BNetwork_GlobalInit()) {
+        printf("BNetwork_GlobalInit failed\n");
+        goto fail0;
+    }
+    
+    BAddr server_addr;
+    if (!BAddr_Parse(&server_addr, argv[1], server_name, sizeof(server_name)) || !addr_supported(server_addr)) {
+        printf("bad server address\n");
+        goto fail0;
+    }
+    
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (ssl) {
+        if (strlen(argv[7]) >= sizeof(server_name)) {
+            printf("server name too long\n");
+            goto fail1;
+        }
+        strcpy(server_name, argv[7]);
+        
+        PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
+        
+        if (!BSSLConnection_GlobalInit()) {
+            printf("BSSLConnection_GlobalInit failed\n");
+            goto fail2;
+        }
+        
+        if (NSS_Init(argv[5]) != SECSuccess) {
+            printf("NSS_Init failed\n");
+            goto fail2;
+        }
+        
+        if (NSS_SetDomesticPolicy() != SECSuccess) {
+            printf("NSS_SetDomesticPolicy failed\n");
+            goto fail3;
+        }
+        
+        if (!open_nss_cert_and_key(argv[6], &client_cert, &client_key)) {
+            printf("cannot open certificate and key\n");
+            goto fail3;
+        }
+    }
+    
+    if (!(clients = (struct client *)BAllocArray(num_clients, sizeof(clients[0])))) {
+        printf("BAllocArray failed\n");
+        goto fail4;
+    }
+    
+    int i;
+    for (i = 0; i < num_clients; i++) {
+        struct client *c = &clients[i];
+        memset(c, 0, sizeof(*c));
+        
+        if (!(c->peers = (peerid_t *)BAllocArray(num_clients, sizeof(c->peers[0])))) {
+            printf("BAllocArray failed\n");
+            goto fail5;
+        }
+        
+        if (!(c->replied = (uint8_t *)BAlloc(round_trips))) {
+            printf("BAlloc failed\n");
+            BFree(c->peers);
+            goto fail5;
+        }
+        memset(c->replied, 0, round_trips);
+        
+        if (!(c->queue = (struct queued_msg *)BAllocArray(queue_size, sizeof(c->queue[0])))) {
+            printf("BAllocArray failed\n");
+            BFree(c->replied);
+            BFree(c->peers);
+            goto fail5;
+        }
+        
+        // the server is told about all peers, so the buffer must fit an
+        // ACCEPTPEER for each
+        if (!ServerConnection_Init(
+            &c->server, &reactor, NULL, server_addr, SC_KEEPALIVE_INTERVAL, num_clients + 16, ssl, 0, client_cert, client_key, server_name, c,
+            handler_error, handler_ready, handler_newclient, handler_endclient, handler_message
+        )) {
+            printf("ServerConnection_Init failed\n");
+            BFree(c->queue);
+            BFree(c->replied);
+            BFree(c->peers);
+            goto fail5;
+        }
+    }
+    
+    BTimer_Init(&timer, TIMEOUT_MS, timer_handler, NULL);
+    BReactor_SetTimer(&reactor, &timer);
+    
+    btime_t connect_time = btime_gettime();
+    
+    BReactor_Exec(&reactor);
+    
+    if (!failed) {
+        btime_t elapsed = btime_gettime() - start_time;
+        long long total = (long long)num_clients * round_trips;
+        printf("connect   %6d ms for %d clients\n", (int)(start_time - connect_time), num_clients);
+        printf("relay     %6d ms for %lld round trips, %.0f msgs/s\n", (int)elapsed, total, (elapsed > 0 ? 2.0 * total * 1000.0 / elapsed : 0.0));
+        ret = 0;
+    }
+    
+    BReactor_RemoveTimer(&reactor, &timer);
+fail5:
+    while (i-- > 0) {
+        struct client *c = &clients[i];
+        if (c->ready) {
+            ServerConnection_ReleaseBuffers(&c->server);
+            SinglePacketBuffer_Free(&c->buffer);
+            PacketProtoEncoder_Free(&c->encoder);
+            PacketRecvInterface_Free(&c->source);
+        }
+        ServerConnection_Free(&c->server);
+        BFree(c->queue);
+        BFree(c->replied);
+        BFree(c->peers);
+    }
+    BFree(clients);
+fail4:
+    if (ssl) {
+        if (client_cert) {
+            CERT_DestroyCertificate(client_cert);
+            SECKEY_DestroyPrivateKey(client_key);
+        }
+fail3:
+        SSL_ClearSessionCache();
+        ASSERT_FORCE(NSS_Shutdown() == SECSuccess)
+fail2:
+        ASSERT_FORCE(PR_Cleanup() == PR_SUCCESS)
+        PL_ArenaFinish();
+    }
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    BLog_Free();
+    return ret;
+}
@@ -0,0 +1,397 @@
+/**
+ * @file tap_udp_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Measures the rate at which the client's sending path moves frames from a
+ * {@link BTap} to UDP datagrams: DataProtoSource, DataProtoFlow, DataProtoSink and
+ * {@link DatagramPeerIO}, with or without zero-copy sending.
+ * As in btap_batch_bench, a child process writes frames into a SOCK_SEQPACKET socket
+ * pair which BTap reads as a TAP device. The datagrams are sent to a UDP socket on
+ * the loopback interface and counted. The number of frames between the device and
+ * the UDP socket is limited, so that no frame is dropped by the flow buffer or the
+ * socket.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include <misc/debug.h>
+#include <misc/nonblocking.h>
+#include <protocol/dataproto.h>
+#include <base/BLog.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <system/BNetwork.h>
+#include <system/BAddr.h>
+#include <security/BRandom.h>
+#include <threadwork/BThreadWork.h>
+#include <tuntap/BTap.h>
+#include <client/DataProto.h>
+#include <client/DatagramPeerIO.h>
+
+#define SOCKET_MTU 1472
+#define FLOW_BUFFER_SIZE 32
+#define KEEPALIVE_TIME 1000000
+
+static BReactor reactor;
+static BThreadWorkDispatcher twd;
+static BTap tap;
+static PacketRecvInterface gate_if;
+static uint8_t *gate_data;
+static int gate_credits;
+static DataProtoSource source;
+static DataProtoFlow flow;
+static DataProtoSink sink;
+static DatagramPeerIO pio;
+static PacketPassInterface recv_if;
+static int sock;
+static BFileDescriptor sock_bfd;
+static uint8_t sock_buf[SOCKET_MTU];
+static int num_packets;
+static int num_sent;
+
+static void usage (char *name)
+{
+    printf(
+        "Usage: %s <frame_size> <num_frames> <zero_copy> <none/aes/aes-gcm>\n"
+        "    <zero_copy> is 0 or 1.\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static void tap_handler_error (void *unused)
+{
+    DEBUG("device error");
+    BReactor_Quit(&reactor, 1);
+}
+
+static void gate_maybe_recv (void)
+{
+    if (!gate_data || gate_credits == 0) {
+        return;
+    }
+    
+    gate_credits--;
+    uint8_t *data = gate_data;
+    gate_data = NULL;
+    PacketRecvInterface_Receiver_Recv(BTap_GetOutput(&tap), data);
+}
+
+static void gate_handler_recv (void *unused, uint8_t *data)
+{
+    gate_data = data;
+    gate_maybe_recv();
+}
+
+static void tap_output_handler_done (void *unused, int data_len)
+{
+    PacketRecvInterface_Done(&gate_if, data_len);
+}
+
+static void source_handler (void *unused, const uint8_t *frame, int frame_len)
+{
+    DataProtoFlow_Route(&flow, 0);
+}
+
+static void sink_handler (void *unused, int up)
+{
+}
+
+static void recv_if_handler_send (void *unused, uint8_t *data, int data_len)
+{
+    PacketPassInterface_Done(&recv_if);
+}
+
+static void pio_logfunc (void *unused)
+{
+}
+
+static void pio_handler_error (void *unused)
+{
+    DEBUG("DatagramPeerIO error");
+    BReactor_Quit(&reactor, 1);
+}
+
+static void sock_handler (void *unused, int events)
+{
+    // count datagrams, returning a credit for each
+    while (recv(sock, sock_buf, sizeof(sock_buf), 0) >= 0) {
+        num_sent++;
+        gate_credits++;
+    }
+    
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        DEBUG("recv failed");
+        BReactor_Quit(&reactor, 1);
+        return;
+    }
+    
+    if (num_sent >= num_packets) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    gate_maybe_recv();
+}
+
+static void writer (int fd, int packet_size, int count)
+{
+    uint8_t *packet = (uint8_t *)malloc(packet_size);
+    if (!packet) {
+        _exit(1);
+    }
+    memset(packet, 0x45, packet_size);
+    
+    for (int i = 0; i < count; i++) {
+        if (write(fd, packet, packet_size) != packet_size) {
+            _exit(1);
+        }
+    }
+    
+    // wait to be killed, so the reader doesn't see a hang-up
+    while (1) {
+        pause();
+    }
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 5) {
+        usage(argv[0]);
+    }
+    
+    int packet_size = atoi(argv[1]);
+    num_packets = atoi(argv[2]);
+    int zero_copy = atoi(argv[3]);
+    char *crypto = argv[4];
+    
+    if (packet_size <= 0 || num_packets <= 0 || (zero_copy != 0 && zero_copy != 1)) {
+        usage(argv[0]);
+    }
+    
+    struct spproto_security_params sp_params;
+    memset(&sp_params, 0, sizeof(sp_params));
+    sp_params.otp_mode = SPPROTO_OTP_MODE_NONE;
+    if (!strcmp(crypto, "none")) {
+        sp_params.hash_mode = SPPROTO_HASH_MODE_NONE;
+        sp_params.encryption_mode = SPPROTO_ENCRYPTION_MODE_NONE;
+    }
+    else if (!strcmp(crypto, "aes")) {
+        sp_params.hash_mode = BHASH_TYPE_SHA1;
+        sp_params.encryption_mode = BENCRYPTION_CIPHER_AES;
+    }
+    else if (!strcmp(crypto, "aes-gcm")) {
+        sp_params.hash_mode = SPPROTO_HASH_MODE_NONE;
+        sp_params.encryption_mode = BENCRYPTION_CIPHER_AES_GCM;
+    }
+    else {
+        usage(argv[0]);
+    }
+    
+    // every frame must be sent in one datagram, as credits are returned per datagram
+    if (DATAPROTO_MAX_OVERHEAD + packet_size > spproto_payload_mtu_for_carrier_mtu(sp_params, SOCKET_MTU) - (int)sizeof(struct fragmentproto_chunk_header)) {
+        printf("frame size too large for one datagram\n");
+        return 1;
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        DEBUG("socketpair failed");
+        goto fail0;
+    }
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        DEBUG("fork failed");
+        goto fail1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        writer(sv[1], packet_size, num_packets);
+    }
+    
+    BLog_InitStdout();
+    
+    BTime_Init();
+    
+    if (!BNetwork_GlobalInit()) {
+        DEBUG("BNetwork_GlobalInit failed");
+        goto fail2;
+    }
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        goto fail2;
+    }
+    
+    if (!BThreadWorkDispatcher_Init(&twd, &reactor, 0)) {
+        DEBUG("BThreadWorkDispatcher_Init failed");
+        goto fail3;
+    }
+    
+    // init receiving socket
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        DEBUG("socket failed");
+        goto fail4;
+    }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = 0;
+    socklen_t sa_len = sizeof(sa);
+    if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0 || getsockname(sock, (struct sockaddr *)&sa, &sa_len) < 0 || !badvpn_set_nonblocking(sock)) {
+        DEBUG("failed to set up socket");
+        goto fail5;
+    }
+    BFileDescriptor_Init(&sock_bfd, sock, sock_handler, NULL);
+    if (!BReactor_AddFileDescriptor(&reactor, &sock_bfd)) {
+        DEBUG("BReactor_AddFileDescriptor failed");
+        goto fail5;
+    }
+    BReactor_SetFileDescriptorEvents(&reactor, &sock_bfd, BREACTOR_READ);
+    
+    // init device
+    struct BTap_init_data init_data;
+    init_data.dev_type = BTAP_DEV_TAP;
+    init_data.init_type = BTAP_INIT_FD;
+    init_data.flags = 0;
+    init_data.init.fd.fd = sv[0];
+    init_data.init.fd.mtu = packet_size;
+    if (!BTap_Init2(&tap, &reactor, init_data, tap_handler_error, NULL)) {
+        DEBUG("BTap_Init2 failed");
+        goto fail6;
+    }
+    
+    // init gate, which reads from the device only if a credit is available
+    PacketRecvInterface_Init(&gate_if, BTap_GetMTU(&tap), gate_handler_recv, NULL, BReactor_PendingGroup(&reactor));
+    PacketRecvInterface_Receiver_Init(BTap_GetOutput(&tap), tap_output_handler_done, NULL);
+    gate_data = NULL;
+    gate_credits = FLOW_BUFFER_SIZE / 2;
+    
+    int headroom = (zero_copy ? DATAGRAMPEERIO_SEND_HEADROOM(sp_params) : 0);
+    int tailroom = (zero_copy ? DATAGRAMPEERIO_SEND_TAILROOM : 0);
+    
+    // init source and flow
+    if (!DataProtoSource_Init(&source, &gate_if, headroom, tailroom, source_handler, NULL, &reactor)) {
+        DEBUG("DataProtoSource_Init failed");
+        goto fail7;
+    }
+    if (!DataProtoFlow_Init(&flow, &source, 1, 2, FLOW_BUFFER_SIZE, -1, NULL, NULL)) {
+        DEBUG("DataProtoFlow_Init failed");
+        goto fail8;
+    }
+    
+    // init DatagramPeerIO; without zero-copy, don't let the disassembler pack
+    // parts of several frames into one datagram, so that credits can be counted
+    PacketPassInterface_Init(&recv_if, DATAPROTO_MAX_OVERHEAD + packet_size, recv_if_handler_send, NULL, BReactor_PendingGroup(&reactor));
+    if (!DatagramPeerIO_Init(&pio, &reactor, DATAPROTO_MAX_OVERHEAD + packet_size, SOCKET_MTU, sp_params, -1, 2, &recv_if, 0, 1, zero_copy, &twd, NULL, 0,
+                             NULL, pio_logfunc, pio_handler_error, NULL, NULL)) {
+        DEBUG("DatagramPeerIO_Init failed");
+        goto fail9;
+    }
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+        BRandom_randomize(key, sizeof(key));
+        DatagramPeerIO_SetEncryptionKey(&pio, key);
+    }
+    BAddr addr;
+    BAddr_InitIPv4(&addr, sa.sin_addr.s_addr, sa.sin_port);
+    if (!DatagramPeerIO_Connect(&pio, addr)) {
+        DEBUG("DatagramPeerIO_Connect failed");
+        goto fail10;
+    }
+    
+    // init sink
+    if (!DataProtoSink_Init(&sink, &reactor, DatagramPeerIO_GetSendInput(&pio), headroom, tailroom, KEEPALIVE_TIME, KEEPALIVE_TIME, sink_handler, NULL)) {
+        DEBUG("DataProtoSink_Init failed");
+        goto fail10;
+    }
+    DataProtoFlow_Attach(&flow, &sink);
+    
+    num_sent = 0;
+    
+    btime_t start = btime_gettime();
+    int res = BReactor_Exec(&reactor);
+    btime_t elapsed = btime_gettime() - start;
+    
+    if (res == 0) {
+        printf("sent %d frames in %d ms", num_sent, (int)elapsed);
+        if (elapsed > 0) {
+            printf(", %.0f pps", (double)num_sent * 1000 / elapsed);
+        }
+        printf("\n");
+    }
+    
+    DataProtoFlow_Detach(&flow);
+    DataProtoSink_Free(&sink);
+fail10:
+    DatagramPeerIO_Free(&pio);
+fail9:
+    PacketPassInterface_Free(&recv_if);
+    DataProtoFlow_Free(&flow);
+fail8:
+    DataProtoSource_Free(&source);
+fail7:
+    PacketRecvInterface_Free(&gate_if);
+    BTap_Free(&tap);
+fail6:
+    BReactor_RemoveFileDescriptor(&reactor, &sock_bfd);
+fail5:
+    close(sock);
+fail4:
+    BThreadWorkDispatcher_Free(&twd);
+fail3:
+    BReactor_Free(&reactor);
+fail2:
+    BLog_Free();
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+fail1:
+    close(sv[0]);
+    close(sv[1]);
+fail0:
+    DebugObjectGlobal_Finish();
+    return 0;
+}
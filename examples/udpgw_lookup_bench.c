@@ -0,0 +1,265 @@
+/**
+ * @file udpgw_lookup_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compares BAVL and CHash for the per-packet connection lookups done by
+ * udpgw and UdpGwClient: by conid and by (local address, remote address).
+ * Run with e.g. 1024 and 65536 connections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/compare.h>
+#include <misc/hashfun.h>
+#include <structure/BAVL.h>
+#include <structure/CHash.h>
+#include <system/BAddr.h>
+#include <system/BTime.h>
+#include <base/DebugObject.h>
+
+struct conaddr {
+    BAddr local_addr;
+    BAddr remote_addr;
+};
+
+struct entry {
+    uint16_t conid;
+    struct conaddr conaddr;
+    size_t conaddr_hash;
+    BAVLNode conid_tree_node;
+    BAVLNode conaddr_tree_node;
+    struct entry *conid_hash_next;
+    struct entry *conaddr_hash_next;
+};
+
+static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+static int conaddr_comparator (void *unused, struct conaddr *v1, struct conaddr *v2);
+static size_t conaddr_hash (struct conaddr *conaddr);
+
+#include "udpgw_lookup_bench_conid_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "udpgw_lookup_bench_conaddr_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "udpgw_lookup_bench_conid_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "udpgw_lookup_bench_conaddr_hash.h"
+#include <structure/CHash_impl.h>
+
+static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
+static int conaddr_comparator (void *unused, struct conaddr *v1, struct conaddr *v2)
+{
+    int r = BAddr_CompareOrder(&v1->remote_addr, &v2->remote_addr);
+    if (r) {
+        return r;
+    }
+    return BAddr_CompareOrder(&v1->local_addr, &v2->local_addr);
+}
+
+static size_t conaddr_hash (struct conaddr *conaddr)
+{
+    uint8_t data[12];
+    memcpy(data, &conaddr->remote_addr.ipv4.ip, 4);
+    memcpy(data + 4, &conaddr->remote_addr.ipv4.port, 2);
+    memcpy(data + 6, &conaddr->local_addr.ipv4.ip, 4);
+    memcpy(data + 10, &conaddr->local_addr.ipv4.port, 2);
+    
+    return badvpn_djb2_hash_bin(data, sizeof(data));
+}
+
+static uint32_t next_random (uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static void report (const char *name, btime_t elapsed, int num_lookups, uintptr_t check)
+{
+    printf("%-16s %6d ms  %7.1f ns/lookup  (check %d)\n", name, (int)elapsed, (double)elapsed * 1000000.0 / num_lookups, (int)(check & 0xFF));
+}
+
+static void usage (char *name)
+{
+    printf(
+        "Usage: %s <num_connections> <num_lookups>\n"
+        "    <num_connections> is at most 65536, the number of udpgw conid's.\n",
+        name
+    );
+    
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc != 3) {
+        usage(argv[0]);
+    }
+    
+    int num_connections = atoi(argv[1]);
+    int num_lookups = atoi(argv[2]);
+    
+    if (num_connections <= 0 || num_connections > UINT16_MAX + 1 || num_lookups <= 0) {
+        usage(argv[0]);
+    }
+    
+    BTime_Init();
+    
+    struct entry *entries = (struct entry *)BAllocArray(num_connections, sizeof(entries[0]));
+    if (!entries) {
+        printf("BAllocArray failed\n");
+        goto fail0;
+    }
+    
+    // lookup keys in random order, so that the structures are not walked sequentially
+    int *order = (int *)BAllocArray(num_lookups, sizeof(order[0]));
+    if (!order) {
+        printf("BAllocArray failed\n");
+        goto fail1;
+    }
+    
+    BAVL conid_tree;
+    BAVL_Init(&conid_tree, OFFSET_DIFF(struct entry, conid, conid_tree_node), (BAVL_comparator)uint16_comparator, NULL);
+    
+    BAVL conaddr_tree;
+    BAVL_Init(&conaddr_tree, OFFSET_DIFF(struct entry, conaddr, conaddr_tree_node), (BAVL_comparator)conaddr_comparator, NULL);
+    
+    ConidHash conid_table;
+    if (!ConidHash_Init(&conid_table, num_connections)) {
+        printf("ConidHash_Init failed\n");
+        goto fail2;
+    }
+    
+    ConaddrHash conaddr_table;
+    if (!ConaddrHash_Init(&conaddr_table, num_connections)) {
+        printf("ConaddrHash_Init failed\n");
+        goto fail3;
+    }
+    
+    // like tun2socks: local addresses in the TUN subnet, remote addresses anywhere,
+    // conid's allocated sequentially
+    uint32_t rnd = 1;
+    for (int i = 0; i < num_connections; i++) {
+        struct entry *e = &entries[i];
+        e->conid = i;
+        
+        while (1) {
+            BAddr_InitIPv4(&e->conaddr.local_addr, hton32(0x0A000001 + (next_random(&rnd) & 0xFF)), hton16(1024 + (next_random(&rnd) % 64000)));
+            BAddr_InitIPv4(&e->conaddr.remote_addr, hton32(next_random(&rnd) ^ (next_random(&rnd) << 16)), hton16(53 + (next_random(&rnd) & 0x3)));
+            e->conaddr_hash = conaddr_hash(&e->conaddr);
+            
+            ConaddrHashRef ref = {e, e};
+            if (ConaddrHash_Insert(&conaddr_table, 0, ref, NULL)) {
+                break;
+            }
+        }
+        
+        ASSERT_EXECUTE(BAVL_Insert(&conaddr_tree, &e->conaddr_tree_node, NULL))
+        ASSERT_EXECUTE(BAVL_Insert(&conid_tree, &e->conid_tree_node, NULL))
+        
+        ConidHashRef ref = {e, e};
+        ASSERT_EXECUTE(ConidHash_Insert(&conid_table, 0, ref, NULL))
+    }
+    
+    for (int i = 0; i < num_lookups; i++) {
+        order[i] = next_random(&rnd) % num_connections;
+    }
+    
+    printf("connections %d lookups %d\n", num_connections, num_lookups);
+    
+    uintptr_t check;
+    btime_t start;
+    
+    check = 0;
+    start = btime_gettime();
+    for (int i = 0; i < num_lookups; i++) {
+        uint16_t conid = entries[order[i]].conid;
+        BAVLNode *node = BAVL_LookupExact(&conid_tree, &conid);
+        ASSERT(node)
+        check += (uintptr_t)UPPER_OBJECT(node, struct entry, conid_tree_node);
+    }
+    report("conid BAVL", btime_gettime() - start, num_lookups, check);
+    
+    check = 0;
+    start = btime_gettime();
+    for (int i = 0; i < num_lookups; i++) {
+        uint16_t conid = entries[order[i]].conid;
+        ConidHashRef ref = ConidHash_Lookup(&conid_table, 0, conid);
+        ASSERT(ref.ptr)
+        check += (uintptr_t)ref.ptr;
+    }
+    report("conid CHash", btime_gettime() - start, num_lookups, check);
+    
+    check = 0;
+    start = btime_gettime();
+    for (int i = 0; i < num_lookups; i++) {
+        struct conaddr conaddr = entries[order[i]].conaddr;
+        BAVLNode *node = BAVL_LookupExact(&conaddr_tree, &conaddr);
+        ASSERT(node)
+        check += (uintptr_t)UPPER_OBJECT(node, struct entry, conaddr_tree_node);
+    }
+    report("conaddr BAVL", btime_gettime() - start, num_lookups, check);
+    
+    check = 0;
+    start = btime_gettime();
+    for (int i = 0; i < num_lookups; i++) {
+        struct conaddr conaddr = entries[order[i]].conaddr;
+        ConaddrHashRef ref = ConaddrHash_Lookup(&conaddr_table, 0, &conaddr);
+        ASSERT(ref.ptr)
+        check += (uintptr_t)ref.ptr;
+    }
+    report("conaddr CHash", btime_gettime() - start, num_lookups, check);
+    
+    ConaddrHash_Free(&conaddr_table);
+fail3:
+    ConidHash_Free(&conid_table);
+fail2:
+    BFree(order);
+fail1:
+    BFree(entries);
+fail0:
+    DebugObjectGlobal_Finish();
+    
+    return 0;
+}
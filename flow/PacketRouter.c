@@ -52,7 +52,7 @@ static void next_job_handler (PacketRouter *o)
     PacketRecvInterface_Receiver_Recv(o->input, RouteBufferSource_Pointer(&o->rbs) + o->recv_offset);
 }
 
-int PacketRouter_Init (PacketRouter *o, int mtu, int recv_offset, PacketRecvInterface *input, PacketRouter_handler handler, void *user, BPendingGroup *pg)
+int PacketRouter_Init (PacketRouter *o, int mtu, int headroom, int tailroom, int recv_offset, PacketRecvInterface *input, PacketRouter_handler handler, void *user, BPendingGroup *pg)
 {
     ASSERT(mtu >= 0)
     ASSERT(recv_offset >= 0)
@@ -70,7 +70,7 @@ int PacketRouter_Init (PacketRouter *o, int mtu, int recv_offset, PacketRecvInte
     PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
     
     // init RouteBufferSource
-    if (!RouteBufferSource_Init(&o->rbs, mtu)) {
+    if (!RouteBufferSource_Init(&o->rbs, mtu, headroom, tailroom)) {
         goto fail0;
     }
     
@@ -104,6 +104,8 @@ int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, uint8_t *
     ASSERT(len >= 0)
     ASSERT(len <= o->mtu)
     ASSERT(RouteBuffer_GetMTU(output) == o->mtu)
+    ASSERT(RouteBuffer_GetHeadroom(output) == o->rbs.headroom)
+    ASSERT(RouteBuffer_GetTailroom(output) == o->rbs.tailroom)
     ASSERT(copy_offset >= 0)
     ASSERT(copy_offset <= o->mtu)
     ASSERT(copy_len >= 0)
@@ -76,6 +76,12 @@ typedef struct {
  * @param o the object
  * @param mtu maximum packet size. Must be >=0. It will only be possible to route packets to
  *            {@link RouteBuffer}'s with the same MTU.
+ * @param headroom space reserved before each packet, as in {@link RouteBuffer_Init}.
+ *                 Must be >=0. It will only be possible to route packets to
+ *                 {@link RouteBuffer}'s with the same headroom.
+ * @param tailroom space reserved after each packet, as in {@link RouteBuffer_Init}.
+ *                 Must be >=0. It will only be possible to route packets to
+ *                 {@link RouteBuffer}'s with the same tailroom.
  * @param recv_offset offset from the beginning for receiving input packets.
  *                    Must be >=0 and <=mtu. The leading space should be initialized
  *                    by the user before routing a packet.
@@ -85,7 +91,7 @@ typedef struct {
  * @param pg pending group
  * @return 1 on success, 0 on failure
  */
-int PacketRouter_Init (PacketRouter *o, int mtu, int recv_offset, PacketRecvInterface *input, PacketRouter_handler handler, void *user, BPendingGroup *pg) WARN_UNUSED;
+int PacketRouter_Init (PacketRouter *o, int mtu, int headroom, int tailroom, int recv_offset, PacketRecvInterface *input, PacketRouter_handler handler, void *user, BPendingGroup *pg) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -103,7 +109,7 @@ void PacketRouter_Free (PacketRouter *o);
  * @param o the object
  * @param len total packet length (e.g. recv_offset + (recv_len from handler)).
  *            Must be >=0 and <=mtu.
- * @param output buffer to route to. Its MTU must be the same as of this object.
+ * @param output buffer to route to. Its MTU, headroom and tailroom must be the same as of this object.
  * @param next_buf if not NULL, on success, will be set to the address of a new current
  *                 packet that can be routed. The pointer will be valid in the job context of
  *                 the calling handler, until this function is called successfully again
@@ -35,14 +35,17 @@
 
 #include <flow/RouteBuffer.h>
 
-static struct RouteBuffer_packet * alloc_packet (int mtu)
+static struct RouteBuffer_packet * alloc_packet (int mtu, int headroom, int tailroom)
 {
-    if (mtu > SIZE_MAX - sizeof(struct RouteBuffer_packet)) {
+    if (mtu > SIZE_MAX - sizeof(struct RouteBuffer_packet) ||
+        headroom > SIZE_MAX - sizeof(struct RouteBuffer_packet) - mtu ||
+        tailroom > SIZE_MAX - sizeof(struct RouteBuffer_packet) - mtu - headroom
+    ) {
         return NULL;
     }
     
     // allocate memory
-    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)malloc(sizeof(*p) + mtu);
+    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)malloc(sizeof(*p) + (size_t)headroom + mtu + tailroom);
     if (!p) {
         return NULL;
     }
@@ -52,7 +55,7 @@ static struct RouteBuffer_packet * alloc_packet (int mtu)
 
 static int alloc_free_packet (RouteBuffer *o)
 {
-    struct RouteBuffer_packet *p = alloc_packet(o->mtu);
+    struct RouteBuffer_packet *p = alloc_packet(o->mtu, o->headroom, o->tailroom);
     if (!p) {
         return 0;
     }
@@ -99,7 +102,7 @@ static void send_used_packet (RouteBuffer *o)
     struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
     
     // send
-    PacketPassInterface_Sender_Send(o->output, (uint8_t *)(p + 1), p->len);
+    PacketPassInterface_Sender_Send(o->output, ROUTEBUFFER_PACKET_DATA(p, o->headroom), p->len);
 }
 
 static void output_handler_done (RouteBuffer *o)
@@ -116,14 +119,18 @@ static void output_handler_done (RouteBuffer *o)
     }
 }
 
-int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int buf_size)
+int RouteBuffer_Init (RouteBuffer *o, int mtu, int headroom, int tailroom, PacketPassInterface *output, int buf_size)
 {
     ASSERT(mtu >= 0)
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     ASSERT(PacketPassInterface_GetMTU(output) >= mtu)
     ASSERT(buf_size > 0)
     
     // init arguments
     o->mtu = mtu;
+    o->headroom = headroom;
+    o->tailroom = tailroom;
     o->output = output;
     
     // init output
@@ -171,15 +178,33 @@ int RouteBuffer_GetMTU (RouteBuffer *o)
     return o->mtu;
 }
 
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu)
+int RouteBuffer_GetHeadroom (RouteBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->headroom;
+}
+
+int RouteBuffer_GetTailroom (RouteBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->tailroom;
+}
+
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int headroom, int tailroom)
 {
     ASSERT(mtu >= 0)
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     
     // init arguments
     o->mtu = mtu;
+    o->headroom = headroom;
+    o->tailroom = tailroom;
     
     // allocate current packet
-    if (!(o->current_packet = alloc_packet(o->mtu))) {
+    if (!(o->current_packet = alloc_packet(o->mtu, o->headroom, o->tailroom))) {
         goto fail0;
     }
     
@@ -203,7 +228,7 @@ uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    return (uint8_t *)(o->current_packet + 1);
+    return ROUTEBUFFER_PACKET_DATA(o->current_packet, o->headroom);
 }
 
 int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len)
@@ -211,6 +236,8 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     ASSERT(len >= 0)
     ASSERT(len <= o->mtu)
     ASSERT(b->mtu == o->mtu)
+    ASSERT(b->headroom == o->headroom)
+    ASSERT(b->tailroom == o->tailroom)
     ASSERT(copy_offset >= 0)
     ASSERT(copy_offset <= o->mtu)
     ASSERT(copy_len >= 0)
@@ -244,7 +271,7 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     
     // copy packet
     if (copy_len > 0) {
-        memcpy((uint8_t *)(np + 1) + copy_offset, (uint8_t *)(p + 1) + copy_offset, copy_len);
+        memcpy(ROUTEBUFFER_PACKET_DATA(np, o->headroom) + copy_offset, ROUTEBUFFER_PACKET_DATA(p, o->headroom) + copy_offset, copy_len);
     }
     
     // start sending if required
@@ -44,13 +44,22 @@ struct RouteBuffer_packet {
     int len;
 };
 
+#define ROUTEBUFFER_PACKET_DATA(_p, _headroom) ((uint8_t *)((_p) + 1) + (_headroom))
+
 /**
  * Packet buffer for zero-copy packet routing.
  * 
  * Packets are buffered using {@link RouteBufferSource} objects.
+ * 
+ * Each packet can be allocated with some reserved space before and after it
+ * (headroom and tailroom). Packets are sent to the output with the reserved space
+ * around them, so that the output can prepend and append its own headers without
+ * copying the packet.
  */
 typedef struct {
     int mtu;
+    int headroom;
+    int tailroom;
     PacketPassInterface *output;
     LinkedList1 packets_free;
     LinkedList1 packets_used;
@@ -65,6 +74,8 @@ typedef struct {
  */
 typedef struct {
     int mtu;
+    int headroom;
+    int tailroom;
     struct RouteBuffer_packet *current_packet;
     DebugObject d_obj;
 } RouteBufferSource;
@@ -75,11 +86,19 @@ typedef struct {
  * @param o the object
  * @param mtu maximum packet size. Must be >=0. It will only be possible to route packets to this buffer
  *            from {@link RouteBufferSource}.s with the same MTU.
+ * @param headroom number of bytes reserved before each packet. Must be >=0.
+ *                 Packets sent to the output may be modified by the output in this
+ *                 many bytes before their beginning, until it calls Done.
+ * @param tailroom number of bytes reserved after the MTU of each packet. Must be >=0.
+ *                 Packets sent to the output may be modified by the output in this
+ *                 many bytes after their end, until it calls Done.
+ *                 Both headroom and tailroom must match those of the
+ *                 {@link RouteBufferSource}'s routing to this buffer.
  * @param output output interface. Its MTU must be >=mtu.
  * @param buf_size size of the buffer in number of packet. Must be >0.
  * @return 1 on success, 0 on failure
  */
-int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int buf_size) WARN_UNUSED;
+int RouteBuffer_Init (RouteBuffer *o, int mtu, int headroom, int tailroom, PacketPassInterface *output, int buf_size) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -93,15 +112,33 @@ void RouteBuffer_Free (RouteBuffer *o);
  */
 int RouteBuffer_GetMTU (RouteBuffer *o);
 
+/**
+ * Retuns the buffer's headroom (headroom argument to {@link RouteBuffer_Init}).
+ * 
+ * @return headroom
+ */
+int RouteBuffer_GetHeadroom (RouteBuffer *o);
+
+/**
+ * Retuns the buffer's tailroom (tailroom argument to {@link RouteBuffer_Init}).
+ * 
+ * @return tailroom
+ */
+int RouteBuffer_GetTailroom (RouteBuffer *o);
+
 /**
  * Initializes the object.
  * 
  * @param o the object
  * @param mtu maximum packet size. Must be >=0. The object will only be able to route packets
  *            to {@link RouteBuffer}'s with the same MTU.
+ * @param headroom number of bytes reserved before each packet. Must be >=0.
+ *                 Must match that of the {@link RouteBuffer}'s this object routes to.
+ * @param tailroom number of bytes reserved after the MTU of each packet. Must be >=0.
+ *                 Must match that of the {@link RouteBuffer}'s this object routes to.
  * @return 1 on success, 0 on failure
  */
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu) WARN_UNUSED;
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int headroom, int tailroom) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -127,7 +164,7 @@ uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o);
  * 
  * @param o the object
  * @param len length of the packet. Must be >=0 and <=MTU.
- * @param b buffer to route to. Its MTU must equal this object's MTU.
+ * @param b buffer to route to. Its MTU, headroom and tailroom must equal this object's.
  * @param copy_offset Offset from the beginning for copying. Must be >=0 and
  *                    <=mtu.
  * @param copy_len Number of bytes to copy from the old current packet to the new one.
@@ -38,23 +38,31 @@ static void input_handler_done (SinglePacketBuffer *o, int in_len)
 {
     DebugObject_Access(&o->d_obj);
     
-    PacketPassInterface_Sender_Send(o->output, o->buf, in_len);
+    PacketPassInterface_Sender_Send(o->output, o->buf + o->headroom, in_len);
 }
 
 static void output_handler_done (SinglePacketBuffer *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    PacketRecvInterface_Receiver_Recv(o->input, o->buf);
+    PacketRecvInterface_Receiver_Recv(o->input, o->buf + o->headroom);
 }
 
 int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg) 
+{
+    return SinglePacketBuffer_Init2(o, input, output, 0, 0, pg);
+}
+
+int SinglePacketBuffer_Init2 (SinglePacketBuffer *o, PacketRecvInterface *input, PacketPassInterface *output, int headroom, int tailroom, BPendingGroup *pg)
 {
     ASSERT(PacketPassInterface_GetMTU(output) >= PacketRecvInterface_GetMTU(input))
+    ASSERT(headroom >= 0)
+    ASSERT(tailroom >= 0)
     
     // init arguments
     o->input = input;
     o->output = output;
+    o->headroom = headroom;
     
     // init input
     PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
@@ -63,12 +71,13 @@ int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input,
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
     // init buffer
-    if (!(o->buf = (uint8_t *)BAlloc(PacketRecvInterface_GetMTU(o->input)))) {
+    bsize_t size = bsize_add(bsize_fromint(headroom), bsize_add(bsize_fromint(PacketRecvInterface_GetMTU(o->input)), bsize_fromint(tailroom)));
+    if (!(o->buf = (uint8_t *)BAllocSize(size))) {
         goto fail1;
     }
     
     // schedule receive
-    PacketRecvInterface_Receiver_Recv(o->input, o->buf);
+    PacketRecvInterface_Receiver_Recv(o->input, o->buf + o->headroom);
     
     DebugObject_Init(&o->d_obj);
     
@@ -50,6 +50,7 @@ typedef struct {
     DebugObject d_obj;
     PacketRecvInterface *input;
     PacketPassInterface *output;
+    int headroom;
     uint8_t *buf;
 } SinglePacketBuffer;
 
@@ -65,6 +66,23 @@ typedef struct {
  */
 int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg) WARN_UNUSED;
 
+/**
+ * Initializes the object, reserving space around the buffered packet.
+ * Packets are sent to the output with headroom bytes of writable space before them
+ * and at least tailroom bytes after them, which the output may modify until it
+ * calls Done.
+ * Output MTU must be >= input MTU.
+ *
+ * @param o the object
+ * @param input input interface
+ * @param output output interface
+ * @param headroom space reserved before the packet. Must be >=0.
+ * @param tailroom space reserved after the input MTU. Must be >=0.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int SinglePacketBuffer_Init2 (SinglePacketBuffer *o, PacketRecvInterface *input, PacketPassInterface *output, int headroom, int tailroom, BPendingGroup *pg) WARN_UNUSED;
+
 /**
  * Frees the object
  *
@@ -37,7 +37,7 @@ static void input_handler_send (PacketPassInactivityMonitor *o, uint8_t *data, i
     PacketPassInterface_Sender_Send(o->output, data, data_len);
     
     // stop timer
-    BReactor_RemoveTimer(o->reactor, &o->timer);
+    BDeadlineTimer_Unset(&o->timer);
 }
 
 static void input_handler_requestcancel (PacketPassInactivityMonitor *o)
@@ -53,7 +53,7 @@ static void output_handler_done (PacketPassInactivityMonitor *o)
     DebugObject_Access(&o->d_obj);
     
     // output no longer busy, restart timer
-    BReactor_SetTimer(o->reactor, &o->timer);
+    BDeadlineTimer_SetRelative(&o->timer, o->interval);
     
     // call done
     PacketPassInterface_Done(&o->input);
@@ -64,7 +64,7 @@ static void timer_handler (PacketPassInactivityMonitor *o)
     DebugObject_Access(&o->d_obj);
     
     // restart timer
-    BReactor_SetTimer(o->reactor, &o->timer);
+    BDeadlineTimer_SetRelative(&o->timer, o->interval);
     
     // call handler
     if (o->handler) {
@@ -78,6 +78,7 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     // init arguments
     o->output = output;
     o->reactor = reactor;
+    o->interval = interval;
     o->handler = handler;
     o->user = user;
     
@@ -91,8 +92,8 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
     // init timer
-    BTimer_Init(&o->timer, interval, (BTimer_handler)timer_handler, o);
-    BReactor_SetTimer(o->reactor, &o->timer);
+    BDeadlineTimer_Init(&o->timer, o->reactor, (BDeadlineTimer_handler)timer_handler, o);
+    BDeadlineTimer_SetRelative(&o->timer, o->interval);
     
     DebugObject_Init(&o->d_obj);
 }
@@ -102,7 +103,7 @@ void PacketPassInactivityMonitor_Free (PacketPassInactivityMonitor *o)
     DebugObject_Free(&o->d_obj);
 
     // free timer
-    BReactor_RemoveTimer(o->reactor, &o->timer);
+    BDeadlineTimer_Free(&o->timer);
     
     // free input
     PacketPassInterface_Free(&o->input);
@@ -127,5 +128,5 @@ void PacketPassInactivityMonitor_Force (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    BReactor_SetTimerAfter(o->reactor, &o->timer, 0);
+    BDeadlineTimer_SetRelative(&o->timer, 0);
 }
@@ -36,6 +36,7 @@
 
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
+#include <system/BDeadlineTimer.h>
 #include <flow/PacketPassInterface.h>
 
 /**
@@ -72,7 +73,8 @@ typedef struct {
     PacketPassInactivityMonitor_handler handler;
     void *user;
     PacketPassInterface input;
-    BTimer timer;
+    btime_t interval;
+    BDeadlineTimer timer;
 } PacketPassInactivityMonitor;
 
 /**
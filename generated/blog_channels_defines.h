@@ -145,4 +145,11 @@
 #define BLOG_CHANNEL_ncd_load_module 144
 #define BLOG_CHANNEL_ncd_basic_functions 145
 #define BLOG_CHANNEL_ncd_objref 146
-#define BLOG_NUM_CHANNELS 147
+#define BLOG_CHANNEL_DatagramSharedSocket 147
+#define BLOG_CHANNEL_DatagramGroupEncoder 148
+#define BLOG_CHANNEL_ClientShard 149
+#define BLOG_CHANNEL_NCDRtnl 150
+#define BLOG_CHANNEL_NCDUdevNetlink 151
+#define BLOG_CHANNEL_NCDUdevSysfsScan 152
+#define BLOG_CHANNEL_BLogAsync 153
+#define BLOG_NUM_CHANNELS 154
@@ -145,3 +145,10 @@
 {"ncd_load_module", 4},
 {"ncd_basic_functions", 4},
 {"ncd_objref", 4},
+{"DatagramSharedSocket", 4},
+{"DatagramGroupEncoder", 4},
+{"ClientShard", 4},
+{"NCDRtnl", 4},
+{"NCDUdevNetlink", 4},
+{"NCDUdevSysfsScan", 4},
+{"BLogAsync", 4},
@@ -2120,3 +2120,271 @@ void msg_confirmseedParser_Forwardseed_id (msg_confirmseedParser *o)
     o->seed_id_pos = o->seed_id_span;
 }
 
+#define msg_groupkey_SIZEkey(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
+
+typedef struct {
+    uint8_t *out;
+    int used;
+    int key_count;
+} msg_groupkeyWriter;
+
+static void msg_groupkeyWriter_Init (msg_groupkeyWriter *o, uint8_t *out);
+static int msg_groupkeyWriter_Finish (msg_groupkeyWriter *o);
+static uint8_t * msg_groupkeyWriter_Addkey (msg_groupkeyWriter *o, int len);
+
+typedef struct {
+    uint8_t *buf;
+    int buf_len;
+    int key_start;
+    int key_span;
+    int key_pos;
+} msg_groupkeyParser;
+
+static int msg_groupkeyParser_Init (msg_groupkeyParser *o, uint8_t *buf, int buf_len);
+static int msg_groupkeyParser_GotEverything (msg_groupkeyParser *o);
+static int msg_groupkeyParser_Getkey (msg_groupkeyParser *o, uint8_t **data, int *data_len);
+static void msg_groupkeyParser_Resetkey (msg_groupkeyParser *o);
+static void msg_groupkeyParser_Forwardkey (msg_groupkeyParser *o);
+
+void msg_groupkeyWriter_Init (msg_groupkeyWriter *o, uint8_t *out)
+{
+    o->out = out;
+    o->used = 0;
+    o->key_count = 0;
+}
+
+int msg_groupkeyWriter_Finish (msg_groupkeyWriter *o)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->key_count == 1)
+
+    return o->used;
+}
+
+uint8_t * msg_groupkeyWriter_Addkey (msg_groupkeyWriter *o, int len)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->key_count == 0)
+    ASSERT(len >= 0 && len <= UINT32_MAX)
+
+    struct BProto_header_s header;
+    header.id = htol16(1);
+    header.type = htol16(BPROTO_TYPE_DATA);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_data_header_s data;
+    data.len = htol32(len);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_data_header_s);
+
+    uint8_t *dest = (o->out + o->used);
+    o->used += len;
+
+    o->key_count++;
+
+    return dest;
+}
+
+int msg_groupkeyParser_Init (msg_groupkeyParser *o, uint8_t *buf, int buf_len)
+{
+    ASSERT(buf_len >= 0)
+
+    o->buf = buf;
+    o->buf_len = buf_len;
+    o->key_start = o->buf_len;
+    o->key_span = 0;
+    o->key_pos = 0;
+
+    int key_count = 0;
+
+    int pos = 0;
+    int left = o->buf_len;
+
+    while (left > 0) {
+        int entry_pos = pos;
+
+        if (!(left >= sizeof(struct BProto_header_s))) {
+            return 0;
+        }
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + pos, sizeof(header));
+        pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                if (!(left >= sizeof(struct BProto_uint8_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                if (!(left >= sizeof(struct BProto_uint16_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+
+                switch (id) {
+                }
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                if (!(left >= sizeof(struct BProto_uint32_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                if (!(left >= sizeof(struct BProto_uint64_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                if (!(left >= sizeof(struct BProto_data_header_s))) {
+                    return 0;
+                }
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + pos, sizeof(val));
+                pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                if (!(left >= payload_len)) {
+                    return 0;
+                }
+                pos += payload_len;
+                left -= payload_len;
+
+                switch (id) {
+                    case 1:
+                        if (!(type == BPROTO_TYPE_DATA)) {
+                            return 0;
+                        }
+                        if (o->key_start == o->buf_len) {
+                            o->key_start = entry_pos;
+                        }
+                        o->key_span = pos - o->key_start;
+                        key_count++;
+                        break;
+                        return 0;
+                }
+            } break;
+            default:
+                return 0;
+        }
+    }
+
+    if (!(key_count == 1)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int msg_groupkeyParser_GotEverything (msg_groupkeyParser *o)
+{
+    return (
+        o->key_pos == o->key_span
+    );
+}
+
+int msg_groupkeyParser_Getkey (msg_groupkeyParser *o, uint8_t **data, int *data_len)
+{
+    ASSERT(o->key_pos >= 0)
+    ASSERT(o->key_pos <= o->key_span)
+
+    int left = o->key_span - o->key_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->key_start + o->key_pos, sizeof(header));
+        o->key_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                o->key_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->key_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->key_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->key_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->key_start + o->key_pos, sizeof(val));
+                o->key_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                uint8_t *payload = o->buf + o->key_start + o->key_pos;
+                o->key_pos += payload_len;
+                left -= payload_len;
+
+                if (type == BPROTO_TYPE_DATA && id == 1) {
+                    *data = payload;
+                    *data_len = payload_len;
+                    return 1;
+                }
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_groupkeyParser_Resetkey (msg_groupkeyParser *o)
+{
+    o->key_pos = 0;
+}
+
+void msg_groupkeyParser_Forwardkey (msg_groupkeyParser *o)
+{
+    o->key_pos = o->key_span;
+}
+
@@ -135,6 +135,47 @@ static uint16_t udp_ip6_checksum (const struct udp_header *header, const uint8_t
     return hton16(~t);
 }
 
+static uint16_t udp_checksum_fold (uint32_t t)
+{
+    while (t >> 16) {
+        t = (t & 0xFFFF) + (t >> 16);
+    }
+    
+    return t;
+}
+
+/**
+ * Computes the pseudo-header part of the UDP checksum, folded but not inverted,
+ * in network byte order. This is what goes into the checksum field of a packet
+ * whose checksum is to be completed by checksum offload.
+ */
+static uint16_t udp_checksum_pseudo (uint16_t udp_length, uint32_t source_addr, uint32_t dest_addr)
+{
+    uint32_t t = 0;
+    
+    t += udp_checksum_summer((char *)&source_addr, sizeof(source_addr));
+    t += udp_checksum_summer((char *)&dest_addr, sizeof(dest_addr));
+    t += IPV4_PROTOCOL_UDP;
+    t += udp_length;
+    
+    return hton16(udp_checksum_fold(t));
+}
+
+/**
+ * Like {@link udp_checksum_pseudo}, but for UDP over IPv6.
+ */
+static uint16_t udp_ip6_checksum_pseudo (uint16_t udp_length, const uint8_t *source_addr, const uint8_t *dest_addr)
+{
+    uint32_t t = 0;
+    
+    t += udp_checksum_summer((const char *)source_addr, 16);
+    t += udp_checksum_summer((const char *)dest_addr, 16);
+    t += IPV6_NEXT_UDP;
+    t += udp_length;
+    
+    return hton16(udp_checksum_fold(t));
+}
+
 static int udp_check (const uint8_t *data, int data_len, struct udp_header *out_header, uint8_t **out_payload, int *out_payload_len)
 {
     ASSERT(data_len >= 0)
@@ -147,6 +147,9 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
 #ifndef BADVPN_NO_RANDOM
     ASSERT(params.random2);
 #endif
+#ifndef BADVPN_NO_RTNL
+    ASSERT(params.rtnl);
+#endif
     
     // set params
     o->params = params;
@@ -181,6 +184,9 @@ int NCDInterpreter_Init (NCDInterpreter *o, NCDProgram program, struct NCDInterp
 #endif
 #ifndef BADVPN_NO_RANDOM
     o->module_iparams.random2 = params.random2;
+#endif
+#ifndef BADVPN_NO_RTNL
+    o->module_iparams.rtnl = params.rtnl;
 #endif
     o->module_iparams.string_index = &o->string_index;
     
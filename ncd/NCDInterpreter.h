@@ -53,6 +53,9 @@
 #ifndef BADVPN_NO_RANDOM
 #include <random/BRandom2.h>
 #endif
+#ifndef BADVPN_NO_RTNL
+#include <ncd/extra/NCDRtnl.h>
+#endif
 
 /**
  * Handler called when the interpreter has terminated, and {@link NCDInterpreter_Free}
@@ -84,6 +87,9 @@ struct NCDInterpreter_params {
 #ifndef BADVPN_NO_RANDOM
     BRandom2 *random2;
 #endif
+#ifndef BADVPN_NO_RTNL
+    NCDRtnl *rtnl;
+#endif
 };
 
 typedef struct {
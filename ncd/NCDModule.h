@@ -48,6 +48,9 @@
 #ifndef BADVPN_NO_RANDOM
 #include <random/BRandom2.h>
 #endif
+#ifndef BADVPN_NO_RTNL
+#include <ncd/extra/NCDRtnl.h>
+#endif
 
 #define NCDMODULE_EVENT_UP 1
 #define NCDMODULE_EVENT_DOWN 2
@@ -334,6 +337,12 @@ struct NCDModuleInst_iparams {
      * Random number generator.
      */
     BRandom2 *random2;
+#endif
+#ifndef BADVPN_NO_RTNL
+    /**
+     * Rtnetlink requester shared by the network configuration modules.
+     */
+    NCDRtnl *rtnl;
 #endif
     /**
      * String index which keeps a mapping between strings and string identifiers.
@@ -0,0 +1,582 @@
+/**
+ * @file NCDRtnl.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/byteorder.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+
+#include <ncd/extra/NCDRtnl.h>
+
+#include <generated/blog_channel_NCDRtnl.h>
+
+#define STATE_QUEUED 1
+#define STATE_SENT 2
+#define STATE_FINISHED 3
+#define STATE_DONE 4
+
+static int do_init (NCDRtnl *o);
+static void finish_request (NCDRtnl *o, NCDRtnlRequest *req, int error);
+static void fail_sent_requests (NCDRtnl *o, int error);
+static NCDRtnlRequest * find_sent_request (NCDRtnl *o, uint32_t seq);
+static void fd_handler (NCDRtnl *o, int events);
+static void send_job_handler (NCDRtnl *o);
+static void finished_job_handler (NCDRtnl *o);
+static int get_ifindex (const char *ifname, uint32_t *out_ifindex);
+static void *start_msg (NCDRtnlRequest *o, int type, int flags, int payload_len);
+static void add_attr (NCDRtnlRequest *o, int type, const void *data, int data_len);
+static void start_request (NCDRtnlRequest *o, NCDRtnl *rtnl, void *user, NCDRtnlRequest_handler handler);
+static int init_addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, int family, const void *addr, int addr_len, int prefix, int scope, void *user, NCDRtnlRequest_handler handler);
+static int init_route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, int family, const void *dest, int addr_len, int prefix, const void *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler);
+
+static int do_init (NCDRtnl *o)
+{
+    if (o->initialized) {
+        return 1;
+    }
+    
+    // init netlink fd
+    if ((o->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+        BLog(BLOG_ERROR, "socket failed");
+        goto fail0;
+    }
+    if (!badvpn_set_nonblocking(o->fd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        goto fail1;
+    }
+    
+    // bind, letting the kernel choose our port ID
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if (bind(o->fd, (void *)&sa, sizeof(sa)) < 0) {
+        BLog(BLOG_ERROR, "bind failed");
+        goto fail1;
+    }
+    
+#ifdef NETLINK_CAP_ACK
+    // don't have the requests echoed back in error acknowledgements,
+    // so that more acknowledgements fit in the socket buffer
+    int one = 1;
+    setsockopt(o->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+#endif
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail1;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    o->initialized = 1;
+    
+    return 1;
+    
+fail1:
+    close(o->fd);
+fail0:
+    return 0;
+}
+
+static void finish_request (NCDRtnl *o, NCDRtnlRequest *req, int error)
+{
+    ASSERT(req->state == STATE_SENT)
+    ASSERT(o->num_sent > 0)
+    
+    // move to finished list
+    LinkedList1_Remove(&o->sent_list, &req->list_node);
+    o->num_sent--;
+    LinkedList1_Append(&o->finished_list, &req->list_node);
+    req->state = STATE_FINISHED;
+    req->error = error;
+    
+    // report from job
+    BPending_Set(&o->finished_job);
+}
+
+static void fail_sent_requests (NCDRtnl *o, int error)
+{
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->sent_list)) {
+        NCDRtnlRequest *req = UPPER_OBJECT(node, NCDRtnlRequest, list_node);
+        finish_request(o, req, error);
+    }
+}
+
+static NCDRtnlRequest * find_sent_request (NCDRtnl *o, uint32_t seq)
+{
+    // acknowledgements come in the order requests were sent, so this
+    // normally stops at the first request
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->sent_list); node; node = LinkedList1Node_Next(node)) {
+        NCDRtnlRequest *req = UPPER_OBJECT(node, NCDRtnlRequest, list_node);
+        if (req->msg.nlh.nlmsg_seq == seq) {
+            return req;
+        }
+    }
+    
+    return NULL;
+}
+
+static void fd_handler (NCDRtnl *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    while (1) {
+        int len = recv(o->fd, o->recv_buf.buf, sizeof(o->recv_buf), 0);
+        if (len < 0) {
+            int error = errno;
+            if (error == EAGAIN || error == EWOULDBLOCK) {
+                break;
+            }
+            
+            // acknowledgements were lost (ENOBUFS), we can't tell what happened
+            // to the requests in flight
+            BLog(BLOG_ERROR, "recv failed (%d)", error);
+            fail_sent_requests(o, error);
+            break;
+        }
+        
+        struct nlmsghdr *nh = &o->recv_buf.nlh;
+        for (; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            
+            if (NLMSG_PAYLOAD(nh, 0) < sizeof(struct nlmsgerr)) {
+                BLog(BLOG_ERROR, "nlmsgerr too short");
+                continue;
+            }
+            struct nlmsgerr *err = NLMSG_DATA(nh);
+            
+            // find request, ignoring acknowledgements for freed requests
+            NCDRtnlRequest *req = find_sent_request(o, nh->nlmsg_seq);
+            if (!req) {
+                continue;
+            }
+            
+            finish_request(o, req, -err->error);
+        }
+    }
+    
+    // send more requests if there is room now
+    if (!LinkedList1_IsEmpty(&o->queued_list) && o->num_sent < NCDRTNL_MAX_INFLIGHT) {
+        BPending_Set(&o->send_job);
+    }
+}
+
+static void send_job_handler (NCDRtnl *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->num_sent < NCDRTNL_MAX_INFLIGHT)
+    
+    // gather as many queued requests as may be in flight, to be sent
+    // in a single message
+    struct iovec iov[NCDRTNL_MAX_INFLIGHT];
+    int num = 0;
+    size_t total = 0;
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->queued_list); node && o->num_sent + num < NCDRTNL_MAX_INFLIGHT; node = LinkedList1Node_Next(node)) {
+        NCDRtnlRequest *req = UPPER_OBJECT(node, NCDRtnlRequest, list_node);
+        ASSERT(req->state == STATE_QUEUED)
+        ASSERT(req->msg.nlh.nlmsg_len == NLMSG_ALIGN(req->msg.nlh.nlmsg_len))
+        
+        req->msg.nlh.nlmsg_seq = o->next_seq++;
+        iov[num].iov_base = req->msg.buf;
+        iov[num].iov_len = req->msg.nlh.nlmsg_len;
+        total += req->msg.nlh.nlmsg_len;
+        num++;
+    }
+    
+    if (num == 0) {
+        return;
+    }
+    
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sa;
+    msg.msg_namelen = sizeof(sa);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = num;
+    
+    BLog(BLOG_DEBUG, "sending %d requests", num);
+    
+    int error = 0;
+    ssize_t res = sendmsg(o->fd, &msg, 0);
+    if (res < 0) {
+        error = errno;
+        BLog(BLOG_ERROR, "sendmsg failed (%d)", error);
+    }
+    else if (res != total) {
+        error = EIO;
+        BLog(BLOG_ERROR, "sendmsg sent too little");
+    }
+    
+    for (int i = 0; i < num; i++) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->queued_list);
+        NCDRtnlRequest *req = UPPER_OBJECT(node, NCDRtnlRequest, list_node);
+        
+        LinkedList1_Remove(&o->queued_list, &req->list_node);
+        LinkedList1_Append(&o->sent_list, &req->list_node);
+        req->state = STATE_SENT;
+        o->num_sent++;
+        
+        if (error) {
+            finish_request(o, req, error);
+        }
+    }
+    
+    // if sending failed there is still room for the rest
+    if (!LinkedList1_IsEmpty(&o->queued_list) && o->num_sent < NCDRTNL_MAX_INFLIGHT) {
+        BPending_Set(&o->send_job);
+    }
+}
+
+static void finished_job_handler (NCDRtnl *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!LinkedList1_IsEmpty(&o->finished_list))
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->finished_list);
+    NCDRtnlRequest *req = UPPER_OBJECT(node, NCDRtnlRequest, list_node);
+    ASSERT(req->state == STATE_FINISHED)
+    
+    LinkedList1_Remove(&o->finished_list, &req->list_node);
+    req->state = STATE_DONE;
+    
+    // report one request per job, so that whatever the handler does
+    // is not interleaved with the other reports
+    if (!LinkedList1_IsEmpty(&o->finished_list)) {
+        BPending_Set(&o->finished_job);
+    }
+    
+    req->handler(req->user, req->error);
+}
+
+static int get_ifindex (const char *ifname, uint32_t *out_ifindex)
+{
+    if (strlen(ifname) >= IFNAMSIZ) {
+        BLog(BLOG_ERROR, "ifname too long");
+        return 0;
+    }
+    
+    unsigned int ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        BLog(BLOG_ERROR, "no such interface: %s", ifname);
+        return 0;
+    }
+    
+    *out_ifindex = ifindex;
+    return 1;
+}
+
+static void *start_msg (NCDRtnlRequest *o, int type, int flags, int payload_len)
+{
+    ASSERT(NLMSG_SPACE(payload_len) <= sizeof(o->msg))
+    
+    memset(o->msg.buf, 0, sizeof(o->msg));
+    
+    struct nlmsghdr *nlh = &o->msg.nlh;
+    nlh->nlmsg_len = NLMSG_SPACE(payload_len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|flags;
+    nlh->nlmsg_pid = 0;
+    
+    return NLMSG_DATA(nlh);
+}
+
+static void add_attr (NCDRtnlRequest *o, int type, const void *data, int data_len)
+{
+    struct nlmsghdr *nlh = &o->msg.nlh;
+    ASSERT(nlh->nlmsg_len + RTA_SPACE(data_len) <= sizeof(o->msg))
+    
+    struct rtattr *rta = (struct rtattr *)(o->msg.buf + nlh->nlmsg_len);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(data_len);
+    memcpy(RTA_DATA(rta), data, data_len);
+    
+    nlh->nlmsg_len += RTA_SPACE(data_len);
+}
+
+static void start_request (NCDRtnlRequest *o, NCDRtnl *rtnl, void *user, NCDRtnlRequest_handler handler)
+{
+    DebugObject_Access(&rtnl->d_obj);
+    ASSERT(handler)
+    
+    // init arguments
+    o->rtnl = rtnl;
+    o->user = user;
+    o->handler = handler;
+    
+    // queue request
+    LinkedList1_Append(&rtnl->queued_list, &o->list_node);
+    o->state = STATE_QUEUED;
+    
+    // send from job, together with other requests started until then
+    if (rtnl->num_sent < NCDRTNL_MAX_INFLIGHT) {
+        BPending_Set(&rtnl->send_job);
+    }
+    
+    DebugCounter_Increment(&rtnl->d_reqs_ctr);
+    DebugObject_Init(&o->d_obj);
+}
+
+static int init_addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, int family, const void *addr, int addr_len, int prefix, int scope, void *user, NCDRtnlRequest_handler handler)
+{
+    if (!do_init(rtnl)) {
+        return 0;
+    }
+    
+    uint32_t ifindex;
+    if (!get_ifindex(ifname, &ifindex)) {
+        return 0;
+    }
+    
+    struct ifaddrmsg *ifa = start_msg(o, (add ? RTM_NEWADDR : RTM_DELADDR), (add ? NLM_F_CREATE|NLM_F_EXCL : 0), sizeof(*ifa));
+    ifa->ifa_family = family;
+    ifa->ifa_prefixlen = prefix;
+    ifa->ifa_scope = (add ? scope : 0);
+    ifa->ifa_index = ifindex;
+    
+    add_attr(o, IFA_LOCAL, addr, addr_len);
+    add_attr(o, IFA_ADDRESS, addr, addr_len);
+    
+    start_request(o, rtnl, user, handler);
+    return 1;
+}
+
+static int init_route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, int family, const void *dest, int addr_len, int prefix, const void *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler)
+{
+    ASSERT(device || !gateway)
+    ASSERT(metric >= 0)
+    
+    if (!do_init(rtnl)) {
+        return 0;
+    }
+    
+    uint32_t ifindex = 0;
+    if (device && !get_ifindex(device, &ifindex)) {
+        return 0;
+    }
+    
+    struct rtmsg *rtm = start_msg(o, (add ? RTM_NEWROUTE : RTM_DELROUTE), (add ? NLM_F_CREATE|NLM_F_EXCL : 0), sizeof(*rtm));
+    rtm->rtm_family = family;
+    rtm->rtm_dst_len = prefix;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    
+    // same as "ip route add/del"; when removing, leave the protocol and type
+    // unspecified and use the widest scope so that they match anything
+    if (add) {
+        rtm->rtm_protocol = RTPROT_BOOT;
+        rtm->rtm_type = (device ? RTN_UNICAST : RTN_BLACKHOLE);
+        rtm->rtm_scope = ((device && !gateway) ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE);
+    } else {
+        rtm->rtm_protocol = RTPROT_UNSPEC;
+        rtm->rtm_type = (device ? RTN_UNSPEC : RTN_BLACKHOLE);
+        rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    
+    add_attr(o, RTA_DST, dest, addr_len);
+    
+    if (gateway) {
+        add_attr(o, RTA_GATEWAY, gateway, addr_len);
+    }
+    
+    uint32_t priority = metric;
+    add_attr(o, RTA_PRIORITY, &priority, sizeof(priority));
+    
+    if (device) {
+        add_attr(o, RTA_OIF, &ifindex, sizeof(ifindex));
+    }
+    
+    start_request(o, rtnl, user, handler);
+    return 1;
+}
+
+int NCDRtnl_Init (NCDRtnl *o, BReactor *reactor, int flags)
+{
+    ASSERT((flags & ~(NCDRTNL_INIT_LAZY)) == 0)
+    BNetwork_Assert();
+    
+    // init arguments
+    o->reactor = reactor;
+    
+    // init requests
+    o->next_seq = 1;
+    LinkedList1_Init(&o->queued_list);
+    LinkedList1_Init(&o->sent_list);
+    o->num_sent = 0;
+    LinkedList1_Init(&o->finished_list);
+    
+    // init jobs
+    BPending_Init(&o->send_job, BReactor_PendingGroup(reactor), (BPending_handler)send_job_handler, o);
+    BPending_Init(&o->finished_job, BReactor_PendingGroup(reactor), (BPending_handler)finished_job_handler, o);
+    
+    // open the socket now unless asked to wait for the first request
+    o->initialized = 0;
+    if (!(flags & NCDRTNL_INIT_LAZY) && !do_init(o)) {
+        goto fail0;
+    }
+    
+    DebugCounter_Init(&o->d_reqs_ctr);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    BPending_Free(&o->finished_job);
+    BPending_Free(&o->send_job);
+    return 0;
+}
+
+void NCDRtnl_Free (NCDRtnl *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_reqs_ctr);
+    ASSERT(LinkedList1_IsEmpty(&o->queued_list))
+    ASSERT(LinkedList1_IsEmpty(&o->sent_list))
+    ASSERT(LinkedList1_IsEmpty(&o->finished_list))
+    
+    // free jobs
+    BPending_Free(&o->finished_job);
+    BPending_Free(&o->send_job);
+    
+    if (o->initialized) {
+        // free BFileDescriptor
+        BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+        
+        // close fd
+        close(o->fd);
+    }
+}
+
+int NCDRtnlRequest_InitSetUp (NCDRtnlRequest *o, NCDRtnl *rtnl, const char *ifname, int up, void *user, NCDRtnlRequest_handler handler)
+{
+    if (!do_init(rtnl)) {
+        return 0;
+    }
+    
+    uint32_t ifindex;
+    if (!get_ifindex(ifname, &ifindex)) {
+        return 0;
+    }
+    
+    struct ifinfomsg *ifi = start_msg(o, RTM_NEWLINK, 0, sizeof(*ifi));
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    ifi->ifi_flags = (up ? IFF_UP : 0);
+    ifi->ifi_change = IFF_UP;
+    
+    start_request(o, rtnl, user, handler);
+    return 1;
+}
+
+int NCDRtnlRequest_InitIPv4Addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, struct ipv4_ifaddr ifaddr, void *user, NCDRtnlRequest_handler handler)
+{
+    ASSERT(ifaddr.prefix >= 0)
+    ASSERT(ifaddr.prefix <= 32)
+    
+    // like "ip addr add", give loopback addresses host scope
+    int scope = ((ntoh32(ifaddr.addr) >> 24) == 127 ? RT_SCOPE_HOST : RT_SCOPE_UNIVERSE);
+    
+    return init_addr(o, rtnl, add, ifname, AF_INET, &ifaddr.addr, sizeof(ifaddr.addr), ifaddr.prefix, scope, user, handler);
+}
+
+int NCDRtnlRequest_InitIPv6Addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, struct ipv6_ifaddr ifaddr, void *user, NCDRtnlRequest_handler handler)
+{
+    ASSERT(ifaddr.prefix >= 0)
+    ASSERT(ifaddr.prefix <= 128)
+    
+    return init_addr(o, rtnl, add, ifname, AF_INET6, ifaddr.addr.bytes, sizeof(ifaddr.addr.bytes), ifaddr.prefix, RT_SCOPE_UNIVERSE, user, handler);
+}
+
+int NCDRtnlRequest_InitIPv4Route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler)
+{
+    ASSERT(dest.prefix >= 0)
+    ASSERT(dest.prefix <= 32)
+    
+    return init_route(o, rtnl, add, AF_INET, &dest.addr, sizeof(dest.addr), dest.prefix, gateway, metric, device, user, handler);
+}
+
+int NCDRtnlRequest_InitIPv6Route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler)
+{
+    ASSERT(dest.prefix >= 0)
+    ASSERT(dest.prefix <= 128)
+    
+    return init_route(o, rtnl, add, AF_INET6, dest.addr.bytes, sizeof(dest.addr.bytes), dest.prefix, (gateway ? gateway->bytes : NULL), metric, device, user, handler);
+}
+
+void NCDRtnlRequest_Free (NCDRtnlRequest *o)
+{
+    NCDRtnl *rtnl = o->rtnl;
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Decrement(&rtnl->d_reqs_ctr);
+    
+    switch (o->state) {
+        case STATE_QUEUED: {
+            LinkedList1_Remove(&rtnl->queued_list, &o->list_node);
+        } break;
+        
+        case STATE_SENT: {
+            // the acknowledgement will be ignored
+            LinkedList1_Remove(&rtnl->sent_list, &o->list_node);
+            rtnl->num_sent--;
+            if (!LinkedList1_IsEmpty(&rtnl->queued_list)) {
+                BPending_Set(&rtnl->send_job);
+            }
+        } break;
+        
+        case STATE_FINISHED: {
+            LinkedList1_Remove(&rtnl->finished_list, &o->list_node);
+            if (LinkedList1_IsEmpty(&rtnl->finished_list)) {
+                BPending_Unset(&rtnl->finished_job);
+            }
+        } break;
+        
+        case STATE_DONE:
+            break;
+        
+        default: ASSERT(0);
+    }
+}
@@ -0,0 +1,197 @@
+/**
+ * @file NCDRtnl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_NCD_NCDRTNL_H
+#define BADVPN_NCD_NCDRTNL_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <misc/ipaddr.h>
+#include <misc/ipaddr6.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+
+// maximum number of requests sent to the kernel and not yet acknowledged
+#define NCDRTNL_MAX_INFLIGHT 64
+
+// maximum size of a single request message
+#define NCDRTNL_MAX_MSG 128
+
+// flags for NCDRtnl_Init
+#define NCDRTNL_INIT_LAZY (1 << 0)
+
+/**
+ * Handler called when a request has been completed.
+ * The request must be freed from within the handler.
+ * 
+ * @param user as in the request's Init call
+ * @param error 0 on success, otherwise an errno value describing the failure
+ */
+typedef void (*NCDRtnlRequest_handler) (void *user, int error);
+
+/**
+ * Performs network configuration requests (addresses, routes, link state)
+ * over a Linux rtnetlink socket, without blocking.
+ * Requests started in the same reactor iteration are sent to the kernel
+ * together in a single sendmsg call, and completion of each request is
+ * reported to its handler when the kernel's acknowledgement has been
+ * received.
+ */
+typedef struct {
+    BReactor *reactor;
+    int initialized;
+    int fd;
+    BFileDescriptor bfd;
+    uint32_t next_seq;
+    LinkedList1 queued_list;
+    LinkedList1 sent_list;
+    int num_sent;
+    LinkedList1 finished_list;
+    BPending send_job;
+    BPending finished_job;
+    union {
+        uint8_t buf[8192];
+        struct nlmsghdr nlh;
+    } recv_buf;
+    DebugCounter d_reqs_ctr;
+    DebugObject d_obj;
+} NCDRtnl;
+
+/**
+ * A request within {@link NCDRtnl}.
+ */
+typedef struct {
+    NCDRtnl *rtnl;
+    void *user;
+    NCDRtnlRequest_handler handler;
+    int state;
+    int error;
+    LinkedList1Node list_node;
+    union {
+        uint8_t buf[NCDRTNL_MAX_MSG];
+        struct nlmsghdr nlh;
+    } msg;
+    DebugObject d_obj;
+} NCDRtnlRequest;
+
+/**
+ * Initializes the object.
+ * {@link BNetwork_GlobalInit} must have been done.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param flags NCDRTNL_INIT_LAZY to open the netlink socket only when the first
+ *              request is started, in which case a failure to open it fails
+ *              that request instead of this call
+ * @return 1 on success, 0 on failure
+ */
+int NCDRtnl_Init (NCDRtnl *o, BReactor *reactor, int flags) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * There must be no requests.
+ * 
+ * @param o the object
+ */
+void NCDRtnl_Free (NCDRtnl *o);
+
+/**
+ * Starts a request to set a network interface up or down.
+ * 
+ * @param o the request
+ * @param rtnl the {@link NCDRtnl} object to send the request with
+ * @param ifname name of the interface
+ * @param up 1 to set the interface up, 0 to set it down
+ * @param user argument to handler
+ * @param handler handler called when the request is completed
+ * @return 1 on success, 0 on failure (e.g. the interface does not exist, or
+ *         the netlink socket could not be opened)
+ */
+int NCDRtnlRequest_InitSetUp (NCDRtnlRequest *o, NCDRtnl *rtnl, const char *ifname, int up, void *user, NCDRtnlRequest_handler handler) WARN_UNUSED;
+
+/**
+ * Starts a request to add or remove an IPv4 address of a network interface.
+ * 
+ * @param o the request
+ * @param rtnl the {@link NCDRtnl} object to send the request with
+ * @param add 1 to add the address, 0 to remove it
+ * @param ifname name of the interface
+ * @param ifaddr address and prefix length
+ * @param user argument to handler
+ * @param handler handler called when the request is completed
+ * @return 1 on success, 0 on failure
+ */
+int NCDRtnlRequest_InitIPv4Addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, struct ipv4_ifaddr ifaddr, void *user, NCDRtnlRequest_handler handler) WARN_UNUSED;
+
+/**
+ * Starts a request to add or remove an IPv6 address of a network interface.
+ * Arguments are as in {@link NCDRtnlRequest_InitIPv4Addr}.
+ */
+int NCDRtnlRequest_InitIPv6Addr (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, const char *ifname, struct ipv6_ifaddr ifaddr, void *user, NCDRtnlRequest_handler handler) WARN_UNUSED;
+
+/**
+ * Starts a request to add or remove an IPv4 route in the main routing table.
+ * 
+ * @param o the request
+ * @param rtnl the {@link NCDRtnl} object to send the request with
+ * @param add 1 to add the route, 0 to remove it
+ * @param dest destination network
+ * @param gateway pointer to the gateway address, or NULL for a route without a gateway
+ * @param metric route metric
+ * @param device name of the interface to route through, or NULL for a blackhole
+ *               route, in which case gateway must also be NULL
+ * @param user argument to handler
+ * @param handler handler called when the request is completed
+ * @return 1 on success, 0 on failure
+ */
+int NCDRtnlRequest_InitIPv4Route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler) WARN_UNUSED;
+
+/**
+ * Starts a request to add or remove an IPv6 route in the main routing table.
+ * Arguments are as in {@link NCDRtnlRequest_InitIPv4Route}.
+ */
+int NCDRtnlRequest_InitIPv6Route (NCDRtnlRequest *o, NCDRtnl *rtnl, int add, struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *device, void *user, NCDRtnlRequest_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the request.
+ * This may be done at any time. If the request has already been sent,
+ * the kernel may still carry it out.
+ * 
+ * @param o the request
+ */
+void NCDRtnlRequest_Free (NCDRtnlRequest *o);
+
+#endif
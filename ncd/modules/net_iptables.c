@@ -90,6 +90,19 @@
  *   deinit: ebtables -t table -X chain
  * 
  * Synopsis:
+ *   net.iptables.batch()
+ * Description:
+ *   While at least one batch statement exists, the iptables and ip6tables statements
+ *   above don't run a process each. Instead, their commands are queued, go up right away,
+ *   and all commands queued while the interpreter is busy are applied together with a
+ *   single "iptables-restore --noflush" (or ip6tables-restore) invocation. Undo commands
+ *   of statements created this way are queued in the same manner. A batch applied
+ *   by iptables-restore either succeeds or fails as a whole; if it fails, its commands
+ *   are retried one by one, and statements whose commands fail die with error.
+ *   On deinit, waits until all queued commands have been applied.
+ *   The ebtables statements are not affected.
+ * 
+ * Synopsis:
  *   net.iptables.lock()
  * Description:
  *   Use at the beginning of a block of custom iptables/ebtables commands to make sure
@@ -108,27 +121,78 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <misc/debug.h>
 #include <misc/find_program.h>
 #include <misc/balloc.h>
+#include <misc/offset.h>
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
 #include <ncd/modules/command_template.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_net_iptables.h>
 
+#define BATCH_IPTABLES 0
+#define BATCH_IP6TABLES 1
+#define NUM_BATCHES 2
+
+#define BATCH_MAX_ENTRIES 4096
+
+#define BATCH_STATE_IDLE 1
+#define BATCH_STATE_LOCKING 2
+#define BATCH_STATE_RUNNING 3
+
 static void template_free_func (void *vo, int is_error);
 
+struct global;
+struct instance;
+
+struct batch_entry {
+    struct batch *b;
+    struct instance *inst;
+    char *table;
+    char *line;
+    char *undo_line;
+    int solo;
+    int running;
+    LinkedList1Node list_node;
+};
+
+struct batch {
+    struct global *g;
+    const char *restore_prog;
+    LinkedList1 queue;
+    LinkedList1 running_list;
+    int state;
+    BEventLockJob lock_job;
+    BProcess process;
+};
+
 struct global {
     BEventLock iptables_lock;
+    BProcessManager *manager;
+    struct batch batches[NUM_BATCHES];
+    int num_batch_scopes;
+    LinkedList1 drain_waiters;
 };
 
 struct instance {
     NCDModuleInst *i;
+    struct batch *batch;
     command_template_instance cti;
+    char *table;
+    char *undo_line;
+    struct batch_entry *entry;
+};
+
+struct batch_scope_instance {
+    NCDModuleInst *i;
+    LinkedList1Node drain_waiters_node;
 };
 
 struct unlock_instance;
@@ -151,6 +215,9 @@ struct unlock_instance {
 };
 
 static void unlock_free (struct unlock_instance *o);
+static void batch_start (struct batch *b);
+static void batch_complete_entry (struct batch_entry *e, int ok);
+static void batched_instance_free (struct instance *o, int is_error);
 
 static int build_append_or_insert_cmdline (NCDModuleInst *i, NCDValRef args, const char *prog, int remove, char **exec, CmdLine *cl, const char *type)
 {
@@ -406,6 +473,472 @@ static int build_ebtables_newchain_cmdline (NCDModuleInst *i, NCDValRef args, in
     return build_newchain_cmdline(i, args, "ebtables", remove, exec, cl);
 }
 
+static int restore_arg_needs_quoting (const char *arg)
+{
+    return !!strpbrk(arg, " \t\"\\'#");
+}
+
+static int build_restore_line (char **argv, char **out_table, char **out_line)
+{
+    // commands built here are "prog -t table command chain ..."; the table goes
+    // into the section header and the rest into the line
+    ASSERT(argv[0])
+    ASSERT(argv[1] && !strcmp(argv[1], "-t"))
+    ASSERT(argv[2])
+    
+    // iptables-restore can't express these, leave them to the normal path
+    if (!*argv[2] || strpbrk(argv[2], " \t\r\n")) {
+        goto fail0;
+    }
+    
+    ExpString str;
+    if (!ExpString_Init(&str)) {
+        goto fail0;
+    }
+    
+    for (char **arg = argv + 3; *arg; arg++) {
+        if (!**arg || strpbrk(*arg, "\r\n")) {
+            goto fail1;
+        }
+        
+        if (arg != argv + 3 && !ExpString_AppendChar(&str, ' ')) {
+            goto fail1;
+        }
+        
+        if (!restore_arg_needs_quoting(*arg)) {
+            if (!ExpString_Append(&str, *arg)) {
+                goto fail1;
+            }
+            continue;
+        }
+        
+        if (!ExpString_AppendChar(&str, '"')) {
+            goto fail1;
+        }
+        for (const char *c = *arg; *c; c++) {
+            if ((*c == '"' || *c == '\\') && !ExpString_AppendChar(&str, '\\')) {
+                goto fail1;
+            }
+            if (!ExpString_AppendChar(&str, *c)) {
+                goto fail1;
+            }
+        }
+        if (!ExpString_AppendChar(&str, '"')) {
+            goto fail1;
+        }
+    }
+    
+    if (!(*out_table = strdup(argv[2]))) {
+        goto fail1;
+    }
+    
+    *out_line = ExpString_Get(&str);
+    return 1;
+    
+fail1:
+    ExpString_Free(&str);
+fail0:
+    return 0;
+}
+
+static int build_batch_lines (NCDModuleInst *i, NCDValRef args, command_template_build_cmdline build_cmdline, char **out_table, char **out_line, char **out_undo_line)
+{
+    char *exec;
+    CmdLine cl;
+    
+    // build do line
+    if (!build_cmdline(i, args, 0, &exec, &cl)) {
+        goto fail0;
+    }
+    int res = build_restore_line(CmdLine_Get(&cl), out_table, out_line);
+    free(exec);
+    CmdLine_Free(&cl);
+    if (!res) {
+        goto fail0;
+    }
+    
+    // build undo line
+    if (!build_cmdline(i, args, 1, &exec, &cl)) {
+        goto fail1;
+    }
+    char *undo_table;
+    res = build_restore_line(CmdLine_Get(&cl), &undo_table, out_undo_line);
+    free(exec);
+    CmdLine_Free(&cl);
+    if (!res) {
+        goto fail1;
+    }
+    
+    // both are in the same table
+    ASSERT(!strcmp(undo_table, *out_table))
+    free(undo_table);
+    
+    return 1;
+    
+fail1:
+    free(*out_line);
+    free(*out_table);
+fail0:
+    return 0;
+}
+
+static struct batch_entry * batch_queue (struct batch *b, const char *table, char *line, struct instance *inst)
+{
+    // allocate entry
+    struct batch_entry *e = BAlloc(sizeof(*e));
+    if (!e) {
+        goto fail0;
+    }
+    
+    // copy table
+    if (!(e->table = strdup(table))) {
+        goto fail1;
+    }
+    
+    // init entry, taking the line
+    e->b = b;
+    e->inst = inst;
+    e->line = line;
+    e->undo_line = NULL;
+    e->solo = 0;
+    e->running = 0;
+    
+    // append to queue
+    LinkedList1_Append(&b->queue, &e->list_node);
+    
+    // make sure the queue gets applied
+    batch_start(b);
+    
+    return e;
+    
+fail1:
+    BFree(e);
+fail0:
+    return NULL;
+}
+
+static void batch_free_entry (struct batch_entry *e)
+{
+    free(e->undo_line);
+    free(e->line);
+    free(e->table);
+    BFree(e);
+}
+
+static int batch_is_idle (struct batch *b)
+{
+    return (b->state == BATCH_STATE_IDLE && LinkedList1_IsEmpty(&b->queue));
+}
+
+static void check_drained (struct global *g)
+{
+    for (int j = 0; j < NUM_BATCHES; j++) {
+        if (!batch_is_idle(&g->batches[j])) {
+            return;
+        }
+    }
+    
+    // let dying batch scopes die
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&g->drain_waiters)) {
+        struct batch_scope_instance *scope = UPPER_OBJECT(node, struct batch_scope_instance, drain_waiters_node);
+        LinkedList1_Remove(&g->drain_waiters, &scope->drain_waiters_node);
+        NCDModuleInst_Backend_Dead(scope->i);
+    }
+}
+
+static void batch_start (struct batch *b)
+{
+    if (b->state != BATCH_STATE_IDLE || LinkedList1_IsEmpty(&b->queue)) {
+        return;
+    }
+    
+    // wait for lock; more commands queued until we get it will go along
+    BEventLockJob_Wait(&b->lock_job);
+    
+    // set state locking
+    b->state = BATCH_STATE_LOCKING;
+}
+
+static void batch_fail_running (struct batch *b)
+{
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&b->running_list)) {
+        struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+        batch_complete_entry(e, 0);
+    }
+}
+
+static void batch_process_handler (struct batch *b, int normally, uint8_t normally_exit_status)
+{
+    ASSERT(b->state == BATCH_STATE_RUNNING)
+    ASSERT(!LinkedList1_IsEmpty(&b->running_list))
+    
+    // release lock
+    BEventLockJob_Release(&b->lock_job);
+    
+    // free process
+    BProcess_Free(&b->process);
+    
+    // set state idle
+    b->state = BATCH_STATE_IDLE;
+    
+    if (normally && normally_exit_status == 0) {
+        // all commands were applied
+        LinkedList1Node *node;
+        while (node = LinkedList1_GetFirst(&b->running_list)) {
+            struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+            batch_complete_entry(e, 1);
+        }
+    }
+    else if (LinkedList1_GetFirst(&b->running_list) == LinkedList1_GetLast(&b->running_list)) {
+        // a single command failed
+        batch_fail_running(b);
+    }
+    else {
+        // none of the commands were applied; find out which ones fail by
+        // retrying them one by one, in the same order before anything else
+        BLog(BLOG_WARNING, "%s failed, retrying commands one by one", b->restore_prog);
+        LinkedList1Node *node;
+        while (node = LinkedList1_GetLast(&b->running_list)) {
+            struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+            LinkedList1_Remove(&b->running_list, &e->list_node);
+            LinkedList1_Prepend(&b->queue, &e->list_node);
+            e->running = 0;
+            e->solo = 1;
+        }
+    }
+    
+    // apply the rest of the queue
+    batch_start(b);
+    
+    check_drained(b->g);
+}
+
+static void batch_lock_handler (struct batch *b)
+{
+    ASSERT(b->state == BATCH_STATE_LOCKING)
+    ASSERT(LinkedList1_IsEmpty(&b->running_list))
+    
+    // the commands may have been cancelled meanwhile
+    if (LinkedList1_IsEmpty(&b->queue)) {
+        BEventLockJob_Release(&b->lock_job);
+        b->state = BATCH_STATE_IDLE;
+        check_drained(b->g);
+        return;
+    }
+    
+    // take commands in the same table from the front of the queue;
+    // a command being retried alone is taken by itself
+    struct batch_entry *first = UPPER_OBJECT(LinkedList1_GetFirst(&b->queue), struct batch_entry, list_node);
+    int count = 0;
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&b->queue)) && count < BATCH_MAX_ENTRIES) {
+        struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+        if (count > 0 && (first->solo || e->solo || strcmp(e->table, first->table))) {
+            break;
+        }
+        LinkedList1_Remove(&b->queue, &e->list_node);
+        LinkedList1_Append(&b->running_list, &e->list_node);
+        e->running = 1;
+        count++;
+    }
+    
+    BLog(BLOG_DEBUG, "applying %d commands with %s", count, b->restore_prog);
+    
+    // find program
+    char *exec = badvpn_find_program(b->restore_prog);
+    if (!exec) {
+        BLog(BLOG_ERROR, "failed to find program: %s", b->restore_prog);
+        goto fail0;
+    }
+    
+    // write script to an anonymous file, to be given to the program as stdin
+    FILE *f = tmpfile();
+    if (!f) {
+        BLog(BLOG_ERROR, "tmpfile failed");
+        goto fail1;
+    }
+    fprintf(f, "*%s\n", first->table);
+    for (node = LinkedList1_GetFirst(&b->running_list); node; node = LinkedList1Node_Next(node)) {
+        struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+        fprintf(f, "%s\n", e->line);
+    }
+    fprintf(f, "COMMIT\n");
+    if (fflush(f) != 0 || ferror(f) || fseek(f, 0, SEEK_SET) != 0) {
+        BLog(BLOG_ERROR, "failed to write script");
+        goto fail2;
+    }
+    
+    // start process
+    char *argv[] = {exec, "--noflush", NULL};
+    int fds[] = {fileno(f), -1};
+    int fds_map[] = {0};
+    struct BProcess_params params = {NULL, fds, fds_map, 0};
+    if (!BProcess_Init2(&b->process, b->g->manager, (BProcess_handler)batch_process_handler, b, exec, argv, params)) {
+        BLog(BLOG_ERROR, "BProcess_Init2 failed");
+        goto fail2;
+    }
+    
+    // the child has its own descriptor of the file
+    fclose(f);
+    free(exec);
+    
+    // set state running
+    b->state = BATCH_STATE_RUNNING;
+    return;
+    
+fail2:
+    fclose(f);
+fail1:
+    free(exec);
+fail0:
+    BEventLockJob_Release(&b->lock_job);
+    b->state = BATCH_STATE_IDLE;
+    batch_fail_running(b);
+    batch_start(b);
+    check_drained(b->g);
+}
+
+static void batch_complete_entry (struct batch_entry *e, int ok)
+{
+    struct batch *b = e->b;
+    
+    // remove from running list
+    LinkedList1_Remove(&b->running_list, &e->list_node);
+    e->running = 0;
+    
+    if (!ok) {
+        if (e->inst) {
+            ModuleLog(e->inst->i, BLOG_ERROR, "command failed");
+            e->inst->entry = NULL;
+            batched_instance_free(e->inst, 1);
+        } else {
+            BLog(BLOG_ERROR, "command failed: %s", e->line);
+        }
+        batch_free_entry(e);
+        return;
+    }
+    
+    if (e->inst) {
+        e->inst->entry = NULL;
+    }
+    
+    if (!e->undo_line) {
+        batch_free_entry(e);
+        return;
+    }
+    
+    // the statement died while this was being applied; undo it now
+    ASSERT(!e->inst)
+    free(e->line);
+    e->line = e->undo_line;
+    e->undo_line = NULL;
+    e->solo = 0;
+    LinkedList1_Append(&b->queue, &e->list_node);
+}
+
+static void batch_init (struct batch *b, struct global *g, const char *restore_prog)
+{
+    b->g = g;
+    b->restore_prog = restore_prog;
+    LinkedList1_Init(&b->queue);
+    LinkedList1_Init(&b->running_list);
+    b->state = BATCH_STATE_IDLE;
+    BEventLockJob_Init(&b->lock_job, &g->iptables_lock, (BEventLock_handler)batch_lock_handler, b);
+}
+
+static void batch_free (struct batch *b)
+{
+    // statements are gone, but undo commands may still be queued
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&b->queue)) {
+        struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+        ASSERT(!e->inst)
+        BLog(BLOG_WARNING, "dropping command: %s", e->line);
+        LinkedList1_Remove(&b->queue, &e->list_node);
+        batch_free_entry(e);
+    }
+    while (node = LinkedList1_GetFirst(&b->running_list)) {
+        struct batch_entry *e = UPPER_OBJECT(node, struct batch_entry, list_node);
+        ASSERT(!e->inst)
+        LinkedList1_Remove(&b->running_list, &e->list_node);
+        batch_free_entry(e);
+    }
+    
+    if (b->state == BATCH_STATE_RUNNING) {
+        BProcess_Free(&b->process);
+    }
+    
+    BEventLockJob_Free(&b->lock_job);
+}
+
+static int batched_new (struct instance *o, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline, struct batch *b)
+{
+    // build commands for iptables-restore
+    char *line;
+    if (!build_batch_lines(o->i, params->args, build_cmdline, &o->table, &line, &o->undo_line)) {
+        return 0;
+    }
+    
+    // queue command
+    if (!(o->entry = batch_queue(b, o->table, line, o))) {
+        free(line);
+        free(o->undo_line);
+        free(o->table);
+        return 0;
+    }
+    
+    o->batch = b;
+    
+    // signal up; failure will be reported by dying
+    NCDModuleInst_Backend_Up(o->i);
+    return 1;
+}
+
+static void batched_instance_free (struct instance *o, int is_error)
+{
+    ASSERT(o->batch)
+    ASSERT(!o->entry)
+    
+    free(o->undo_line);
+    free(o->table);
+    
+    template_free_func(o, is_error);
+}
+
+static void batched_die (struct instance *o)
+{
+    ASSERT(o->batch)
+    
+    if (o->entry) {
+        struct batch_entry *e = o->entry;
+        ASSERT(e->inst == o)
+        o->entry = NULL;
+        
+        if (e->running) {
+            // undo once it has been applied
+            e->inst = NULL;
+            e->undo_line = o->undo_line;
+            o->undo_line = NULL;
+        } else {
+            // not applied yet, just forget it
+            LinkedList1_Remove(&o->batch->queue, &e->list_node);
+            batch_free_entry(e);
+            check_drained(o->batch->g);
+        }
+    } else {
+        // queue undo
+        if (batch_queue(o->batch, o->table, o->undo_line, NULL)) {
+            o->undo_line = NULL;
+        } else {
+            ModuleLog(o->i, BLOG_ERROR, "failed to queue undo command");
+        }
+    }
+    
+    batched_instance_free(o, 0);
+}
+
 static void lock_job_handler (struct lock_instance *o)
 {
     ASSERT(o->state == LOCK_STATE_LOCKING || o->state == LOCK_STATE_RELOCKING)
@@ -447,12 +980,26 @@ static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCD
     // init iptables lock
     BEventLock_Init(&g->iptables_lock, BReactor_PendingGroup(params->reactor));
     
+    // init batches
+    g->manager = params->manager;
+    batch_init(&g->batches[BATCH_IPTABLES], g, "iptables-restore");
+    batch_init(&g->batches[BATCH_IP6TABLES], g, "ip6tables-restore");
+    g->num_batch_scopes = 0;
+    LinkedList1_Init(&g->drain_waiters);
+    
     return 1;
 }
 
 static void func_globalfree (struct NCDInterpModuleGroup *group)
 {
     struct global *g = group->group_state;
+    ASSERT(g->num_batch_scopes == 0)
+    ASSERT(LinkedList1_IsEmpty(&g->drain_waiters))
+    
+    // free batches
+    for (int j = 0; j < NUM_BATCHES; j++) {
+        batch_free(&g->batches[j]);
+    }
     
     // free iptables lock
     BEventLock_Free(&g->iptables_lock);
@@ -461,12 +1008,19 @@ static void func_globalfree (struct NCDInterpModuleGroup *group)
     BFree(g);
 }
 
-static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline)
+static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline, int batch_index)
 {
     struct global *g = ModuleGlobal(i);
     struct instance *o = vo;
     o->i = i;
     
+    // in a batch scope, queue the command if it can be applied with iptables-restore
+    if (batch_index >= 0 && g->num_batch_scopes > 0 && batched_new(o, params, build_cmdline, &g->batches[batch_index])) {
+        return;
+    }
+    
+    o->batch = NULL;
+    
     command_template_new(&o->cti, i, params, build_cmdline, template_free_func, o, BLOG_CURRENT_CHANNEL, &g->iptables_lock);
 }
 
@@ -483,71 +1037,113 @@ void template_free_func (void *vo, int is_error)
 
 static void append_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_append_cmdline);
+    func_new(vo, i, params, build_iptables_append_cmdline, BATCH_IPTABLES);
 }
 
 static void insert_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_insert_cmdline);
+    func_new(vo, i, params, build_iptables_insert_cmdline, BATCH_IPTABLES);
 }
 
 static void policy_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_policy_cmdline);
+    func_new(vo, i, params, build_iptables_policy_cmdline, BATCH_IPTABLES);
 }
 
 static void newchain_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_newchain_cmdline);
+    func_new(vo, i, params, build_iptables_newchain_cmdline, BATCH_IPTABLES);
 }
 
 static void append_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_append_cmdline);
+    func_new(vo, i, params, build_ip6tables_append_cmdline, BATCH_IP6TABLES);
 }
 
 static void insert_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_insert_cmdline);
+    func_new(vo, i, params, build_ip6tables_insert_cmdline, BATCH_IP6TABLES);
 }
 
 static void policy_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_policy_cmdline);
+    func_new(vo, i, params, build_ip6tables_policy_cmdline, BATCH_IP6TABLES);
 }
 
 static void newchain_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_newchain_cmdline);
+    func_new(vo, i, params, build_ip6tables_newchain_cmdline, BATCH_IP6TABLES);
 }
 
 static void append_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_append_cmdline);
+    func_new(vo, i, params, build_ebtables_append_cmdline, -1);
 }
 
 static void insert_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_insert_cmdline);
+    func_new(vo, i, params, build_ebtables_insert_cmdline, -1);
 }
 
 static void policy_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_policy_cmdline);
+    func_new(vo, i, params, build_ebtables_policy_cmdline, -1);
 }
 
 static void newchain_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_newchain_cmdline);
+    func_new(vo, i, params, build_ebtables_newchain_cmdline, -1);
 }
 
 static void func_die (void *vo)
 {
     struct instance *o = vo;
     
+    if (o->batch) {
+        batched_die(o);
+        return;
+    }
+    
     command_template_die(&o->cti);
 }
 
+static void batch_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct global *g = ModuleGlobal(i);
+    struct batch_scope_instance *o = vo;
+    o->i = i;
+    
+    // check arguments
+    if (!NCDVal_ListRead(params->args, 0)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    
+    // enter batch scope
+    g->num_batch_scopes++;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(i);
+    return;
+    
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void batch_func_die (void *vo)
+{
+    struct batch_scope_instance *o = vo;
+    struct global *g = ModuleGlobal(o->i);
+    ASSERT(g->num_batch_scopes > 0)
+    
+    // leave batch scope
+    g->num_batch_scopes--;
+    
+    // die once queued commands have been applied
+    LinkedList1_Append(&g->drain_waiters, &o->drain_waiters_node);
+    check_drained(g);
+}
+
 static void lock_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct global *g = ModuleGlobal(i);
@@ -716,6 +1312,11 @@ static struct NCDModule modules[] = {
         .func_new2 = newchain_ebtables_func_new,
         .func_die = func_die,
         .alloc_size = sizeof(struct instance)
+    }, {
+        .type = "net.iptables.batch",
+        .func_new2 = batch_func_new,
+        .func_die = batch_func_die,
+        .alloc_size = sizeof(struct batch_scope_instance)
     }, {
         .type = "net.iptables.lock",
         .func_new2 = lock_func_new,
@@ -47,7 +47,7 @@
 #include <limits.h>
 
 #include <misc/debug.h>
-#include <ncd/extra/NCDIfConfig.h>
+#include <ncd/extra/NCDRtnl.h>
 
 #include <ncd/module_common.h>
 
@@ -57,6 +57,10 @@
 #define TYPE_IFONLY 2
 #define TYPE_BLACKHOLE 3
 
+#define STATE_ADDING 1
+#define STATE_ADDED 2
+#define STATE_REMOVING 3
+
 struct instance {
     NCDModuleInst *i;
     struct ipv4_ifaddr dest;
@@ -64,8 +68,94 @@ struct instance {
     uint32_t gateway;
     int metric;
     NCDValNullTermString ifname_nts;
+    int state;
+    int dying;
+    NCDRtnlRequest req;
 };
 
+static void request_handler (void *vo, int error);
+
+static int start_request (struct instance *o, int add)
+{
+    NCDRtnl *rtnl = o->i->params->iparams->rtnl;
+    
+    switch (o->type) {
+        case TYPE_NORMAL:
+            return NCDRtnlRequest_InitIPv4Route(&o->req, rtnl, add, o->dest, &o->gateway, o->metric, o->ifname_nts.data, o, request_handler);
+        case TYPE_IFONLY:
+            return NCDRtnlRequest_InitIPv4Route(&o->req, rtnl, add, o->dest, NULL, o->metric, o->ifname_nts.data, o, request_handler);
+        case TYPE_BLACKHOLE:
+            return NCDRtnlRequest_InitIPv4Route(&o->req, rtnl, add, o->dest, NULL, o->metric, NULL, o, request_handler);
+        default: ASSERT(0);
+    }
+    
+    return 0;
+}
+
+static void instance_free (struct instance *o)
+{
+    // free ifname nts
+    NCDValNullTermString_Free(&o->ifname_nts);
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void remove_route (struct instance *o)
+{
+    if (!start_request(o, 0)) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to remove route");
+        instance_free(o);
+        return;
+    }
+    
+    // set state removing
+    o->state = STATE_REMOVING;
+}
+
+static void request_handler (void *vo, int error)
+{
+    struct instance *o = vo;
+    
+    NCDRtnlRequest_Free(&o->req);
+    
+    switch (o->state) {
+        case STATE_ADDING: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to add route: %s", strerror(error));
+                if (o->dying) {
+                    instance_free(o);
+                    return;
+                }
+                NCDValNullTermString_Free(&o->ifname_nts);
+                NCDModuleInst_Backend_DeadError(o->i);
+                return;
+            }
+            
+            // we were asked to die while adding, remove it right away
+            if (o->dying) {
+                remove_route(o);
+                return;
+            }
+            
+            // set state added
+            o->state = STATE_ADDED;
+            
+            // signal up
+            NCDModuleInst_Backend_Up(o->i);
+        } break;
+        
+        case STATE_REMOVING: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to remove route: %s", strerror(error));
+            }
+            
+            instance_free(o);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct instance *o = vo;
@@ -136,27 +226,15 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // add route
-    int res = 0; // to remove warning
-    switch (o->type) {
-        case TYPE_NORMAL:
-            res = NCDIfConfig_add_ipv4_route(o->dest, &o->gateway, o->metric, o->ifname_nts.data);
-            break;
-        case TYPE_IFONLY:
-            res = NCDIfConfig_add_ipv4_route(o->dest, NULL, o->metric, o->ifname_nts.data);
-            break;
-        case TYPE_BLACKHOLE:
-            res = NCDIfConfig_add_ipv4_blackhole_route(o->dest, o->metric);
-            break;
-        default: ASSERT(0);
-    }
-    if (!res) {
+    // start adding route
+    if (!start_request(o, 1)) {
         ModuleLog(o->i, BLOG_ERROR, "failed to add route");
         goto fail1;
     }
     
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
+    // set state adding
+    o->state = STATE_ADDING;
+    o->dying = 0;
     return;
     
 fail1:
@@ -169,28 +247,15 @@ static void func_die (void *vo)
 {
     struct instance *o = vo;
     
-    // remove route
-    int res = 0; // to remove warning
-    switch (o->type) {
-        case TYPE_NORMAL:
-            res = NCDIfConfig_remove_ipv4_route(o->dest, &o->gateway, o->metric, o->ifname_nts.data);
-            break;
-        case TYPE_IFONLY:
-            res = NCDIfConfig_remove_ipv4_route(o->dest, NULL, o->metric, o->ifname_nts.data);
-            break;
-        case TYPE_BLACKHOLE:
-            res = NCDIfConfig_remove_ipv4_blackhole_route(o->dest, o->metric);
-            break;
-        default: ASSERT(0);
-    }
-    if (!res) {
-        ModuleLog(o->i, BLOG_ERROR, "failed to remove route");
+    // remove the route once it has been added
+    if (o->state == STATE_ADDING) {
+        o->dying = 1;
+        return;
     }
     
-    // free ifname nts
-    NCDValNullTermString_Free(&o->ifname_nts);
+    ASSERT(o->state == STATE_ADDED)
     
-    NCDModuleInst_Backend_Dead(o->i);
+    remove_route(o);
 }
 
 static struct NCDModule modules[] = {
@@ -43,18 +43,98 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <ncd/extra/NCDIfConfig.h>
+#include <ncd/extra/NCDRtnl.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_net_ipv6_addr.h>
 
+#define STATE_ADDING 1
+#define STATE_ADDED 2
+#define STATE_REMOVING 3
+
 struct instance {
     NCDModuleInst *i;
     NCDValNullTermString ifname_nts;
     struct ipv6_ifaddr ifaddr;
+    int state;
+    int dying;
+    NCDRtnlRequest req;
 };
 
+static void request_handler (void *vo, int error);
+
+static int start_request (struct instance *o, int add)
+{
+    NCDRtnl *rtnl = o->i->params->iparams->rtnl;
+    
+    return NCDRtnlRequest_InitIPv6Addr(&o->req, rtnl, add, o->ifname_nts.data, o->ifaddr, o, request_handler);
+}
+
+static void instance_free (struct instance *o)
+{
+    // free ifname nts
+    NCDValNullTermString_Free(&o->ifname_nts);
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void remove_addr (struct instance *o)
+{
+    if (!start_request(o, 0)) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to remove IP address");
+        instance_free(o);
+        return;
+    }
+    
+    // set state removing
+    o->state = STATE_REMOVING;
+}
+
+static void request_handler (void *vo, int error)
+{
+    struct instance *o = vo;
+    
+    NCDRtnlRequest_Free(&o->req);
+    
+    switch (o->state) {
+        case STATE_ADDING: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to add IP address: %s", strerror(error));
+                if (o->dying) {
+                    instance_free(o);
+                    return;
+                }
+                NCDValNullTermString_Free(&o->ifname_nts);
+                NCDModuleInst_Backend_DeadError(o->i);
+                return;
+            }
+            
+            // we were asked to die while adding, remove it right away
+            if (o->dying) {
+                remove_addr(o);
+                return;
+            }
+            
+            // set state added
+            o->state = STATE_ADDED;
+            
+            // signal up
+            NCDModuleInst_Backend_Up(o->i);
+        } break;
+        
+        case STATE_REMOVING: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to remove IP address: %s", strerror(error));
+            }
+            
+            instance_free(o);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct instance *o = vo;
@@ -100,14 +180,15 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         }
     }
     
-    // add address
-    if (!NCDIfConfig_add_ipv6_addr(o->ifname_nts.data, o->ifaddr)) {
+    // start adding address
+    if (!start_request(o, 1)) {
         ModuleLog(o->i, BLOG_ERROR, "failed to add IP address");
         goto fail1;
     }
     
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
+    // set state adding
+    o->state = STATE_ADDING;
+    o->dying = 0;
     return;
     
 fail1:
@@ -120,15 +201,15 @@ static void func_die (void *vo)
 {
     struct instance *o = vo;
     
-    // remove address
-    if (!NCDIfConfig_remove_ipv6_addr(o->ifname_nts.data, o->ifaddr)) {
-        ModuleLog(o->i, BLOG_ERROR, "failed to remove IP address");
+    // remove the address once it has been added
+    if (o->state == STATE_ADDING) {
+        o->dying = 1;
+        return;
     }
     
-    // free ifname nts
-    NCDValNullTermString_Free(&o->ifname_nts);
+    ASSERT(o->state == STATE_ADDED)
     
-    NCDModuleInst_Backend_Dead(o->i);
+    remove_addr(o);
 }
 
 static struct NCDModule modules[] = {
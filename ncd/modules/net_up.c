@@ -36,18 +36,99 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
-#include <ncd/extra/NCDIfConfig.h>
+#include <ncd/extra/NCDRtnl.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_net_up.h>
 
+#define STATE_SETTING_UP 1
+#define STATE_UP 2
+#define STATE_SETTING_DOWN 3
+
 struct instance {
     NCDModuleInst *i;
     NCDValNullTermString ifname_nts;
+    int state;
+    int dying;
+    NCDRtnlRequest req;
 };
 
+static void request_handler (void *vo, int error);
+
+static int start_request (struct instance *o, int up)
+{
+    NCDRtnl *rtnl = o->i->params->iparams->rtnl;
+    
+    return NCDRtnlRequest_InitSetUp(&o->req, rtnl, o->ifname_nts.data, up, o, request_handler);
+}
+
+static void instance_free (struct instance *o)
+{
+    // free ifname nts
+    NCDValNullTermString_Free(&o->ifname_nts);
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void set_down (struct instance *o)
+{
+    if (!start_request(o, 0)) {
+        ModuleLog(o->i, BLOG_ERROR, "failed to set interface down");
+        instance_free(o);
+        return;
+    }
+    
+    // set state setting down
+    o->state = STATE_SETTING_DOWN;
+}
+
+static void request_handler (void *vo, int error)
+{
+    struct instance *o = vo;
+    
+    NCDRtnlRequest_Free(&o->req);
+    
+    switch (o->state) {
+        case STATE_SETTING_UP: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to set interface up: %s", strerror(error));
+                if (o->dying) {
+                    instance_free(o);
+                    return;
+                }
+                NCDValNullTermString_Free(&o->ifname_nts);
+                NCDModuleInst_Backend_DeadError(o->i);
+                return;
+            }
+            
+            // we were asked to die while setting up, set down right away
+            if (o->dying) {
+                set_down(o);
+                return;
+            }
+            
+            // set state up
+            o->state = STATE_UP;
+            
+            // signal up
+            NCDModuleInst_Backend_Up(o->i);
+        } break;
+        
+        case STATE_SETTING_DOWN: {
+            if (error) {
+                ModuleLog(o->i, BLOG_ERROR, "failed to set interface down: %s", strerror(error));
+            }
+            
+            instance_free(o);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct instance *o = vo;
@@ -70,15 +151,15 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // set interface up
-    if (!NCDIfConfig_set_up(o->ifname_nts.data)) {
+    // start setting interface up
+    if (!start_request(o, 1)) {
         ModuleLog(o->i, BLOG_ERROR, "failed to set interface up");
         goto fail1;
     }
     
-    // signal up
-    NCDModuleInst_Backend_Up(o->i);
-    
+    // set state setting up
+    o->state = STATE_SETTING_UP;
+    o->dying = 0;
     return;
     
 fail1:
@@ -91,15 +172,15 @@ static void func_die (void *vo)
 {
     struct instance *o = vo;
     
-    // set interface down
-    if (!NCDIfConfig_set_down(o->ifname_nts.data)) {
-        ModuleLog(o->i, BLOG_ERROR, "failed to set interface down");
+    // set the interface down once it has been set up
+    if (o->state == STATE_SETTING_UP) {
+        o->dying = 1;
+        return;
     }
     
-    // free ifname nts
-    NCDValNullTermString_Free(&o->ifname_nts);
+    ASSERT(o->state == STATE_UP)
     
-    NCDModuleInst_Backend_Dead(o->i);
+    set_down(o);
 }
 
 static struct NCDModule modules[] = {
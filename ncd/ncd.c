@@ -42,6 +42,7 @@
 #include <system/BProcess.h>
 #include <udevmonitor/NCDUdevManager.h>
 #include <random/BRandom2.h>
+#include <ncd/extra/NCDRtnl.h>
 #include <ncd/NCDInterpreter.h>
 #include <ncd/NCDBuildProgram.h>
 
@@ -73,6 +74,7 @@ static struct {
     int retry_time;
     int signal_exit_code;
     int no_udev;
+    int udevadm;
     char **extra_args;
     int num_extra_args;
 } options;
@@ -89,6 +91,9 @@ static NCDUdevManager umanager;
 // random number generator
 static BRandom2 random2;
 
+// rtnetlink requester
+static NCDRtnl rtnl;
+
 // interpreter
 static NCDInterpreter interpreter;
 
@@ -184,7 +189,7 @@ int main (int argc, char **argv)
     }
     
     // init udev manager
-    NCDUdevManager_Init(&umanager, options.no_udev, &reactor, &manager);
+    NCDUdevManager_Init(&umanager, options.no_udev, (options.udevadm ? NCDUDEVMONITOR_BACKEND_UDEVADM : NCDUDEVMONITOR_BACKEND_NETLINK), &reactor, &manager);
     
     // init random number generator
     if (!BRandom2_Init(&random2, BRANDOM2_INIT_LAZY)) {
@@ -192,17 +197,24 @@ int main (int argc, char **argv)
         goto fail3;
     }
     
+    // init rtnetlink requester; its socket is only opened when a
+    // statement first needs it
+    if (!NCDRtnl_Init(&rtnl, &reactor, NCDRTNL_INIT_LAZY)) {
+        BLog(BLOG_ERROR, "NCDRtnl_Init failed");
+        goto fail4;
+    }
+    
     // setup signal handler
     if (!BSignal_Init(&reactor, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
-        goto fail4;
+        goto fail5;
     }
     
     // build program
     NCDProgram program;
     if (!NCDBuildProgram_Build(options.config_file, &program)) {
         BLog(BLOG_ERROR, "failed to build program");
-        goto fail5;
+        goto fail6;
     }
     
     // setup interpreter parameters
@@ -216,16 +228,17 @@ int main (int argc, char **argv)
     params.manager = &manager;
     params.umanager = &umanager;
     params.random2 = &random2;
+    params.rtnl = &rtnl;
     
     // initialize interpreter
     if (!NCDInterpreter_Init(&interpreter, program, params)) {
-        goto fail5;
+        goto fail6;
     }
     
     // don't enter event loop if syntax check is requested
     if (options.syntax_only) {
         main_exit_code = 0;
-        goto fail6;
+        goto fail7;
     }
     
     BLog(BLOG_NOTICE, "entering event loop");
@@ -233,12 +246,15 @@ int main (int argc, char **argv)
     // enter event loop
     main_exit_code = BReactor_Exec(&reactor);
     
-fail6:
+fail7:
     // free interpreter
     NCDInterpreter_Free(&interpreter);
-fail5:
+fail6:
     // remove signal handler
     BSignal_Finish();
+fail5:
+    // free rtnetlink requester
+    NCDRtnl_Free(&rtnl);
 fail4:
     // free random number generator
     BRandom2_Free(&random2);
@@ -278,6 +294,7 @@ void print_help (const char *name)
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--retry-time <ms>]\n"
         "        [--no-udev]\n"
+        "        [--udevadm]\n"
         "        [--config-file <ncd_program_file>]\n"
         "        [--syntax-only]\n"
         "        [--signal-exit-code <number>]\n"
@@ -314,6 +331,7 @@ int parse_arguments (int argc, char *argv[])
     options.retry_time = DEFAULT_RETRY_TIME;
     options.signal_exit_code = DEFAULT_SIGNAL_EXIT_CODE;
     options.no_udev = 0;
+    options.udevadm = 0;
     options.extra_args = NULL;
     options.num_extra_args = 0;
     
@@ -431,6 +449,9 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--no-udev")) {
             options.no_udev = 1;
         }
+        else if (!strcmp(arg, "--udevadm")) {
+            options.udevadm = 1;
+        }
         else if (!strcmp(arg, "--")) {
             options.extra_args = &argv[i + 1];
             options.num_extra_args = argc - i - 1;
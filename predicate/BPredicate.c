@@ -44,6 +44,18 @@
 
 #include <generated/blog_channel_BPredicate.h>
 
+#define INSTR_CONSTANT 1
+#define INSTR_ATOM 2
+#define INSTR_ERROR 3
+#define INSTR_NOT 4
+#define INSTR_JUMP_IF_FALSE 5
+#define INSTR_JUMP_IF_TRUE 6
+
+struct program_instr {
+    int type;
+    int arg;
+};
+
 static int eval_predicate_node (BPredicate *p, struct predicate_node *root);
 
 void yyerror (YYLTYPE *yylloc, yyscan_t scanner, struct predicate_node **result, char *str)
@@ -282,3 +294,191 @@ void BPredicateFunction_Free (BPredicateFunction *o)
     // remove from tree
     BAVL_Remove(&p->functions_tree, &o->tree_node);
 }
+
+static int count_instrs (struct predicate_node *root)
+{
+    ASSERT(root)
+    
+    switch (root->type) {
+        case NODE_CONSTANT:
+        case NODE_FUNCTION:
+            return 1;
+        case NODE_NEG:
+            return count_instrs(root->neg.op) + 1;
+        case NODE_CONJUNCT:
+            return count_instrs(root->conjunct.op1) + 1 + count_instrs(root->conjunct.op2);
+        case NODE_DISJUNCT:
+            return count_instrs(root->disjunct.op1) + 1 + count_instrs(root->disjunct.op2);
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+static int compile_function (struct predicate_node *root, struct program_instr *instr, BPredicateProgram_compile_callback callback, void *user)
+{
+    ASSERT(root->type == NODE_FUNCTION)
+    
+    // collect arguments
+    char *args[PREDICATE_MAX_ARGS];
+    int num_args = 0;
+    for (struct arguments_node *arg = root->function.args; arg; arg = arg->next) {
+        if (num_args == PREDICATE_MAX_ARGS) {
+            // no function can take this many arguments
+            instr->type = INSTR_ERROR;
+            return 1;
+        }
+        args[num_args++] = (arg->arg.type == ARGUMENT_STRING ? arg->arg.string : NULL);
+    }
+    
+    int atom;
+    if (!callback(user, root->function.name, args, num_args, &atom)) {
+        return 0;
+    }
+    ASSERT(atom >= -1)
+    
+    if (atom < 0) {
+        instr->type = INSTR_ERROR;
+    } else {
+        instr->type = INSTR_ATOM;
+        instr->arg = atom;
+    }
+    
+    return 1;
+}
+
+static int compile_node (struct predicate_node *root, struct program_instr *instrs, int *pos, BPredicateProgram_compile_callback callback, void *user)
+{
+    ASSERT(root)
+    
+    switch (root->type) {
+        case NODE_CONSTANT: {
+            instrs[*pos].type = INSTR_CONSTANT;
+            instrs[*pos].arg = root->constant.val;
+            (*pos)++;
+        } break;
+        
+        case NODE_FUNCTION: {
+            if (!compile_function(root, &instrs[*pos], callback, user)) {
+                return 0;
+            }
+            (*pos)++;
+        } break;
+        
+        case NODE_NEG: {
+            if (!compile_node(root->neg.op, instrs, pos, callback, user)) {
+                return 0;
+            }
+            instrs[*pos].type = INSTR_NOT;
+            (*pos)++;
+        } break;
+        
+        case NODE_CONJUNCT:
+        case NODE_DISJUNCT: {
+            int is_conjunct = (root->type == NODE_CONJUNCT);
+            struct predicate_node *op1 = (is_conjunct ? root->conjunct.op1 : root->disjunct.op1);
+            struct predicate_node *op2 = (is_conjunct ? root->conjunct.op2 : root->disjunct.op2);
+            
+            if (!compile_node(op1, instrs, pos, callback, user)) {
+                return 0;
+            }
+            
+            // skip the second operand if the first one decides the result,
+            // leaving its value as the result
+            int jump = (*pos)++;
+            instrs[jump].type = (is_conjunct ? INSTR_JUMP_IF_FALSE : INSTR_JUMP_IF_TRUE);
+            
+            if (!compile_node(op2, instrs, pos, callback, user)) {
+                return 0;
+            }
+            instrs[jump].arg = *pos;
+        } break;
+        
+        default:
+            ASSERT(0);
+    }
+    
+    return 1;
+}
+
+int BPredicateProgram_Init (BPredicateProgram *o, BPredicate *p, BPredicateProgram_compile_callback callback, void *user)
+{
+    DebugObject_Access(&p->d_obj);
+    ASSERT(!p->in_function)
+    
+    struct predicate_node *root = (struct predicate_node *)p->root;
+    
+    // allocate instructions
+    o->num_instrs = count_instrs(root);
+    struct program_instr *instrs = (struct program_instr *)BAllocArray(o->num_instrs, sizeof(instrs[0]));
+    if (!instrs) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // compile
+    int pos = 0;
+    if (!compile_node(root, instrs, &pos, callback, user)) {
+        goto fail1;
+    }
+    ASSERT(pos == o->num_instrs)
+    
+    o->instrs = instrs;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    BFree(instrs);
+fail0:
+    return 0;
+}
+
+void BPredicateProgram_Free (BPredicateProgram *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    BFree(o->instrs);
+}
+
+int BPredicateProgram_Eval (BPredicateProgram *o, BPredicateProgram_atom_callback callback, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct program_instr *instrs = (struct program_instr *)o->instrs;
+    int value = 0;
+    
+    int i = 0;
+    while (i < o->num_instrs) {
+        struct program_instr *instr = &instrs[i++];
+        
+        switch (instr->type) {
+            case INSTR_CONSTANT:
+                value = instr->arg;
+                break;
+            case INSTR_ATOM:
+                value = callback(user, instr->arg);
+                ASSERT(value == 0 || value == 1)
+                break;
+            case INSTR_ERROR:
+                return -1;
+            case INSTR_NOT:
+                value = !value;
+                break;
+            case INSTR_JUMP_IF_FALSE:
+                if (!value) {
+                    i = instr->arg;
+                }
+                break;
+            case INSTR_JUMP_IF_TRUE:
+                if (value) {
+                    i = instr->arg;
+                }
+                break;
+            default:
+                ASSERT(0);
+        }
+    }
+    
+    return value;
+}
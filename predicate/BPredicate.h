@@ -72,6 +72,11 @@
  *     Then the handler function is called. If it returns anything other
  *     than 1 and 0, the function evaluates to error. Otherwise it evaluates
  *     to what the handler function returned.
+ * 
+ * A predicate can also be compiled into a {@link BPredicateProgram}, for
+ * when it is evaluated very often. Compilation resolves each function call
+ * to an atom number once, and evaluation then only asks the user for the
+ * values of atoms, with the same results as above.
  */
 
 #ifndef BADVPN_PREDICATE_BPREDICATE_H
@@ -98,6 +103,30 @@
  */
 typedef int (*BPredicate_callback) (void *user, void **args);
 
+/**
+ * Handler function called when compiling a function call in the predicate
+ * into a {@link BPredicateProgram}.
+ * 
+ * @param user value passed to {@link BPredicateProgram_Init}
+ * @param name name of the function
+ * @param args arguments to the function. String arguments are zero-terminated
+ *             strings, and logical arguments are NULL.
+ * @param num_args number of arguments. Will be <=PREDICATE_MAX_ARGS.
+ * @param out_atom on success, must be set to the atom number (>=0) the call
+ *                 evaluates as, or to -1 if the call always evaluates to error
+ * @return 1 on success, 0 to fail compilation
+ */
+typedef int (*BPredicateProgram_compile_callback) (void *user, char *name, char **args, int num_args, int *out_atom);
+
+/**
+ * Handler function called when evaluating an atom of a {@link BPredicateProgram}.
+ * 
+ * @param user value passed to {@link BPredicateProgram_Eval}
+ * @param atom atom number, as returned by the compile callback
+ * @return 1 for true, 0 for false
+ */
+typedef int (*BPredicateProgram_atom_callback) (void *user, int atom);
+
 /**
  * Object that parses and evaluates a logical expression.
  * Allows the user to define custom functions than can be
@@ -126,6 +155,15 @@ typedef struct {
     BAVLNode tree_node;
 } BPredicateFunction;
 
+/**
+ * A {@link BPredicate} compiled into a sequence of instructions.
+ */
+typedef struct {
+    DebugObject d_obj;
+    void *instrs;
+    int num_instrs;
+} BPredicateProgram;
+
 /**
  * Initializes the object.
  * 
@@ -174,4 +212,37 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
  */
 void BPredicateFunction_Free (BPredicateFunction *o);
 
+/**
+ * Compiles a predicate into a program.
+ * Custom functions registered for the predicate are not used; instead the
+ * compile callback is called for every function call in the expression.
+ * Must not be called from function handlers.
+ * 
+ * @param o the object
+ * @param p predicate to compile. The program does not reference it.
+ * @param callback handler called for every function call
+ * @param user value to pass to handler
+ * @return 1 on success, 0 on failure
+ */
+int BPredicateProgram_Init (BPredicateProgram *o, BPredicate *p, BPredicateProgram_compile_callback callback, void *user) WARN_UNUSED;
+
+/**
+ * Frees the program.
+ * 
+ * @param o the object
+ */
+void BPredicateProgram_Free (BPredicateProgram *o);
+
+/**
+ * Evaluates the program.
+ * Atoms are evaluated in the same order and under the same conditions as
+ * the function calls they were compiled from.
+ * 
+ * @param o the object
+ * @param callback handler called to evaluate atoms
+ * @param user value to pass to handler
+ * @return 1 for true, 0 for false, -1 for error
+ */
+int BPredicateProgram_Eval (BPredicateProgram *o, BPredicateProgram_atom_callback callback, void *user);
+
 #endif
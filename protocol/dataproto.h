@@ -49,6 +49,7 @@
 #define DATAPROTO_MAX_PEER_IDS 1
 
 #define DATAPROTO_FLAGS_RECEIVING_KEEPALIVES 1
+#define DATAPROTO_FLAGS_GROUP 2
 
 /**
  * DataProto header.
@@ -60,6 +61,10 @@ struct dataproto_header {
      *   - DATAPROTO_FLAGS_RECEIVING_KEEPALIVES
      *     Indicates that when the peer sent this packet, it has received at least
      *     one packet from the other peer in the last keep-alive tolerance time.
+     *   - DATAPROTO_FLAGS_GROUP
+     *     Indicates that the frame was encoded once for many destinations, with the
+     *     group key of the peer it originates from. There are no destination peer IDs,
+     *     and the frame is for the receiving peer.
      */
     uint8_t flags;
     
@@ -57,6 +57,9 @@
  * slave runs out of bind addresses, it not only sends "cannotbind" to the master, but
  * registers relaying to the master. And in this case, when the master receives the "cannotbind",
  * it doesn't start the binding procedure all all over, but registers relaying to the slave.
+ * 
+ * If group datagrams are enabled, each peer also sends every other peer the "groupkey"
+ * message, containing the key it encrypts frames destined to many peers with.
  */
 
 #ifndef BADVPN_PROTOCOL_MSGPROTO_H
@@ -70,6 +73,7 @@
 #define MSGID_YOURETRY 5
 #define MSGID_SEED 6
 #define MSGID_CONFIRMSEED 7
+#define MSGID_GROUPKEY 8
 
 #define MSG_MAX_PAYLOAD (SC_MAX_MSGLEN - msg_SIZEtype - msg_SIZEpayload(0))
 
@@ -31,7 +31,8 @@
  * Protocol for securing datagram communication.
  * 
  * Security features implemented:
- *   - Encryption. Encrypts packets with a block cipher.
+ *   - Encryption. Encrypts packets with a block cipher, or with an
+ *     AEAD cipher which also authenticates them.
  *     Protects against a third party from seeing the data
  *     being transmitted.
  *   - Hashes. Adds a hash of the packet into the packet.
@@ -40,18 +41,28 @@
  *   - One-time passwords. Adds a password to each packet
  *     for the receiver to recognize. Protects agains replaying
  *     packets and crafting new packets.
+ *   - Packet counters. Alternative to OTPs. Numbers each packet,
+ *     and the receiver remembers which recent numbers it has seen
+ *     in a sliding window. Protects against replaying packets.
  * 
  * A SPProto plaintext packet contains the following, in order:
  *   - if OTPs are used, a struct {@link spproto_otpdata} which contains
  *     the seed ID and the OTP,
+ *   - if packet counters are used, a struct {@link spproto_counterdata}
+ *     which contains the counter,
  *   - if hashes are used, the hash,
  *   - payload data.
  * 
- * If encryption is used:
+ * If encryption with a block cipher is used:
  *   - the plaintext is padded by appending a 0x01 byte and as many 0x00
  *     bytes as needed to align to block size,
  *   - the padded plaintext is encrypted, and
  *   - the initialization vector (IV) is prepended.
+ * 
+ * If encryption with an AEAD cipher is used, hashes are not used, and:
+ *   - the plaintext is encrypted without padding,
+ *   - the nonce, a struct {@link spproto_aead_nonce}, is prepended, and
+ *   - the authentication tag is appended.
  */
 
 #ifndef BADVPN_PROTOCOL_SPPROTO_H
@@ -70,6 +81,11 @@
 #define SPPROTO_HASH_MODE_NONE 0
 #define SPPROTO_ENCRYPTION_MODE_NONE 0
 #define SPPROTO_OTP_MODE_NONE 0
+#define SPPROTO_COUNTER_MODE_NONE 0
+#define SPPROTO_COUNTER_MODE_WINDOW 1
+
+// the most significant bit of a packet counter identifies the direction
+#define SPPROTO_COUNTER_DIRECTION_BIT ((uint64_t)1 << 63)
 
 /**
  * Stores security parameters for SPProto.
@@ -86,6 +102,8 @@ struct spproto_security_params {
      * Encryption mode.
      * Either SPPROTO_ENCRYPTION_MODE_NONE for no encryption, or a valid
      * {@link BEncryption} cipher.
+     * If the cipher is an AEAD cipher, packets are authenticated by the
+     * cipher itself, and hash_mode must be SPPROTO_HASH_MODE_NONE.
      */
     int encryption_mode;
     
@@ -101,6 +119,17 @@ struct spproto_security_params {
      * OTPs generated from a single seed.
      */
     int otp_num;
+    
+    /**
+     * Packet counter mode.
+     * Either SPPROTO_COUNTER_MODE_NONE for no packet counters, or
+     * SPPROTO_COUNTER_MODE_WINDOW to number packets and drop replayed
+     * packets using a sliding window.
+     * Packet counters cannot be used together with OTPs, and require
+     * encryption with either hashes or an AEAD cipher, so that the
+     * counter cannot be altered.
+     */
+    int counter_mode;
 };
 
 #define SPPROTO_HAVE_HASH(_params) ((_params).hash_mode != SPPROTO_HASH_MODE_NONE)
@@ -111,9 +140,12 @@ struct spproto_security_params {
 )
 
 #define SPPROTO_HAVE_ENCRYPTION(_params) ((_params).encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE)
+#define SPPROTO_HAVE_AEAD(_params) (SPPROTO_HAVE_ENCRYPTION(_params) && BEncryption_cipher_is_aead((_params).encryption_mode))
 
 #define SPPROTO_HAVE_OTP(_params) ((_params).otp_mode != SPPROTO_OTP_MODE_NONE)
 
+#define SPPROTO_HAVE_COUNTER(_params) ((_params).counter_mode != SPPROTO_COUNTER_MODE_NONE)
+
 B_START_PACKED
 struct spproto_otpdata {
     uint16_t seed_id;
@@ -121,9 +153,36 @@ struct spproto_otpdata {
 } B_PACKED;
 B_END_PACKED
 
+/**
+ * Packet counter, little endian.
+ * Counters of packets sent by the peer which bound have
+ * SPPROTO_COUNTER_DIRECTION_BIT set, so that packets cannot be reflected
+ * back to their sender, as both directions use the same key.
+ */
+B_START_PACKED
+struct spproto_counterdata {
+    uint64_t counter;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * AEAD nonce.
+ * The counter is little endian and is assigned like the packet counter
+ * (including SPPROTO_COUNTER_DIRECTION_BIT), also when packet counters
+ * are not used, so that a nonce is never reused with the same key.
+ */
+B_START_PACKED
+struct spproto_aead_nonce {
+    uint32_t zero;
+    uint64_t counter;
+} B_PACKED;
+B_END_PACKED
+
 #define SPPROTO_HEADER_OTPDATA_OFF(_params) 0
 #define SPPROTO_HEADER_OTPDATA_LEN(_params) (SPPROTO_HAVE_OTP(_params) ? sizeof(struct spproto_otpdata) : 0)
-#define SPPROTO_HEADER_HASH_OFF(_params) (SPPROTO_HEADER_OTPDATA_OFF(_params) + SPPROTO_HEADER_OTPDATA_LEN(_params))
+#define SPPROTO_HEADER_COUNTERDATA_OFF(_params) (SPPROTO_HEADER_OTPDATA_OFF(_params) + SPPROTO_HEADER_OTPDATA_LEN(_params))
+#define SPPROTO_HEADER_COUNTERDATA_LEN(_params) (SPPROTO_HAVE_COUNTER(_params) ? sizeof(struct spproto_counterdata) : 0)
+#define SPPROTO_HEADER_HASH_OFF(_params) (SPPROTO_HEADER_COUNTERDATA_OFF(_params) + SPPROTO_HEADER_COUNTERDATA_LEN(_params))
 #define SPPROTO_HEADER_HASH_LEN(_params) SPPROTO_HASH_SIZE(_params)
 #define SPPROTO_HEADER_LEN(_params) (SPPROTO_HEADER_HASH_OFF(_params) + SPPROTO_HEADER_HASH_LEN(_params))
 
@@ -136,8 +195,13 @@ static void spproto_assert_security_params (struct spproto_security_params param
 {
     ASSERT(params.hash_mode == SPPROTO_HASH_MODE_NONE || BHash_type_valid(params.hash_mode))
     ASSERT(params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE || BEncryption_cipher_valid(params.encryption_mode))
+    ASSERT(!SPPROTO_HAVE_AEAD(params) || params.hash_mode == SPPROTO_HASH_MODE_NONE)
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || BEncryption_cipher_valid(params.otp_mode))
+    ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || !BEncryption_cipher_is_aead(params.otp_mode))
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || params.otp_num > 0)
+    ASSERT(params.counter_mode == SPPROTO_COUNTER_MODE_NONE || params.counter_mode == SPPROTO_COUNTER_MODE_WINDOW)
+    ASSERT(!SPPROTO_HAVE_COUNTER(params) || !SPPROTO_HAVE_OTP(params))
+    ASSERT(!SPPROTO_HAVE_COUNTER(params) || SPPROTO_HAVE_AEAD(params) || (SPPROTO_HAVE_ENCRYPTION(params) && SPPROTO_HAVE_HASH(params)))
 }
 
 /**
@@ -156,6 +220,8 @@ static int spproto_payload_mtu_for_carrier_mtu (struct spproto_security_params p
     
     if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
         return (carrier_mtu - SPPROTO_HEADER_LEN(params));
+    } else if (SPPROTO_HAVE_AEAD(params)) {
+        return (carrier_mtu - BENCRYPTION_AEAD_NONCE_SIZE - SPPROTO_HEADER_LEN(params) - BENCRYPTION_AEAD_TAG_SIZE);
     } else {
         int block_size = BEncryption_cipher_block_size(params.encryption_mode);
         return (balign_down(carrier_mtu, block_size) - block_size - SPPROTO_HEADER_LEN(params) - 1);
@@ -181,6 +247,12 @@ static int spproto_carrier_mtu_for_payload_mtu (struct spproto_security_params p
         }
         
         return (SPPROTO_HEADER_LEN(params) + payload_mtu);
+    } else if (SPPROTO_HAVE_AEAD(params)) {
+        if (payload_mtu > INT_MAX - (BENCRYPTION_AEAD_NONCE_SIZE + SPPROTO_HEADER_LEN(params) + BENCRYPTION_AEAD_TAG_SIZE)) {
+            return -1;
+        }
+        
+        return (BENCRYPTION_AEAD_NONCE_SIZE + SPPROTO_HEADER_LEN(params) + payload_mtu + BENCRYPTION_AEAD_TAG_SIZE);
     } else {
         int block_size = BEncryption_cipher_block_size(params.encryption_mode);
         
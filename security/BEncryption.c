@@ -38,12 +38,29 @@ int BEncryption_cipher_valid (int cipher)
     switch (cipher) {
         case BENCRYPTION_CIPHER_BLOWFISH:
         case BENCRYPTION_CIPHER_AES:
+        case BENCRYPTION_CIPHER_AES_GCM:
+        case BENCRYPTION_CIPHER_CHACHA20_POLY1305:
             return 1;
         default:
             return 0;
     }
 }
 
+int BEncryption_cipher_is_aead (int cipher)
+{
+    switch (cipher) {
+        case BENCRYPTION_CIPHER_BLOWFISH:
+        case BENCRYPTION_CIPHER_AES:
+            return 0;
+        case BENCRYPTION_CIPHER_AES_GCM:
+        case BENCRYPTION_CIPHER_CHACHA20_POLY1305:
+            return 1;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
 int BEncryption_cipher_block_size (int cipher)
 {
     switch (cipher) {
@@ -64,12 +81,43 @@ int BEncryption_cipher_key_size (int cipher)
             return BENCRYPTION_CIPHER_BLOWFISH_KEY_SIZE;
         case BENCRYPTION_CIPHER_AES:
             return BENCRYPTION_CIPHER_AES_KEY_SIZE;
+        case BENCRYPTION_CIPHER_AES_GCM:
+            return BENCRYPTION_CIPHER_AES_GCM_KEY_SIZE;
+        case BENCRYPTION_CIPHER_CHACHA20_POLY1305:
+            return BENCRYPTION_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
         default:
             ASSERT(0)
             return 0;
     }
 }
 
+static const EVP_CIPHER * aead_evp_cipher (int cipher)
+{
+    switch (cipher) {
+        case BENCRYPTION_CIPHER_AES_GCM:
+            return EVP_aes_128_gcm();
+        case BENCRYPTION_CIPHER_CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+static EVP_CIPHER_CTX * aead_init_ctx (int cipher, uint8_t *key, int enc)
+{
+    // OpenSSL picks the AES-NI/PCLMULQDQ or SIMD implementation at runtime
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    ASSERT_FORCE(ctx)
+    ASSERT_FORCE(EVP_CipherInit_ex(ctx, aead_evp_cipher(cipher), NULL, NULL, NULL, enc) == 1)
+    ASSERT_FORCE(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, BENCRYPTION_AEAD_NONCE_SIZE, NULL) == 1)
+    
+    // set the key now, so that only the nonce changes for every message
+    ASSERT_FORCE(EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc) == 1)
+    
+    return ctx;
+}
+
 void BEncryption_Init (BEncryption *enc, int mode, int cipher, uint8_t *key)
 {
     ASSERT(!(mode&~(BENCRYPTION_MODE_ENCRYPT|BENCRYPTION_MODE_DECRYPT)))
@@ -139,6 +187,15 @@ fail1:
                 ASSERT_EXECUTE(res >= 0)
             }
             break;
+        case BENCRYPTION_CIPHER_AES_GCM:
+        case BENCRYPTION_CIPHER_CHACHA20_POLY1305:
+            if (enc->mode&BENCRYPTION_MODE_ENCRYPT) {
+                enc->aead.encrypt = aead_init_ctx(enc->cipher, key, 1);
+            }
+            if (enc->mode&BENCRYPTION_MODE_DECRYPT) {
+                enc->aead.decrypt = aead_init_ctx(enc->cipher, key, 0);
+            }
+            break;
         default:
             ASSERT(0)
             ;
@@ -162,15 +219,26 @@ void BEncryption_Free (BEncryption *enc)
         ASSERT_FORCE(ioctl(enc->cryptodev.cfd, CIOCFSESSION, &enc->cryptodev.ses) == 0)
         ASSERT_FORCE(close(enc->cryptodev.cfd) == 0)
         ASSERT_FORCE(close(enc->cryptodev.fd) == 0)
+        return;
     }
     
     #endif
+    
+    if (BEncryption_cipher_is_aead(enc->cipher)) {
+        if (enc->mode&BENCRYPTION_MODE_ENCRYPT) {
+            EVP_CIPHER_CTX_free(enc->aead.encrypt);
+        }
+        if (enc->mode&BENCRYPTION_MODE_DECRYPT) {
+            EVP_CIPHER_CTX_free(enc->aead.decrypt);
+        }
+    }
 }
 
 void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len, uint8_t *iv)
 {
     ASSERT(enc->mode&BENCRYPTION_MODE_ENCRYPT)
     ASSERT(len >= 0)
+    ASSERT(!BEncryption_cipher_is_aead(enc->cipher))
     ASSERT(len % BEncryption_cipher_block_size(enc->cipher) == 0)
     
     #ifdef BADVPN_USE_CRYPTODEV
@@ -207,6 +275,7 @@ void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
 {
     ASSERT(enc->mode&BENCRYPTION_MODE_DECRYPT)
     ASSERT(len >= 0)
+    ASSERT(!BEncryption_cipher_is_aead(enc->cipher))
     ASSERT(len % BEncryption_cipher_block_size(enc->cipher) == 0)
     
     #ifdef BADVPN_USE_CRYPTODEV
@@ -238,3 +307,38 @@ void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
             ASSERT(0);
     }
 }
+
+void BEncryption_EncryptAEAD (BEncryption *enc, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, uint8_t *tag)
+{
+    ASSERT(enc->mode&BENCRYPTION_MODE_ENCRYPT)
+    ASSERT(BEncryption_cipher_is_aead(enc->cipher))
+    ASSERT(len >= 0)
+    
+    EVP_CIPHER_CTX *ctx = enc->aead.encrypt;
+    int outl;
+    
+    ASSERT_FORCE(EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) == 1)
+    ASSERT_FORCE(EVP_EncryptUpdate(ctx, out, &outl, in, len) == 1)
+    ASSERT(outl == len)
+    ASSERT_FORCE(EVP_EncryptFinal_ex(ctx, out + outl, &outl) == 1)
+    ASSERT(outl == 0)
+    ASSERT_FORCE(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, BENCRYPTION_AEAD_TAG_SIZE, tag) == 1)
+}
+
+int BEncryption_DecryptAEAD (BEncryption *enc, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, const uint8_t *tag)
+{
+    ASSERT(enc->mode&BENCRYPTION_MODE_DECRYPT)
+    ASSERT(BEncryption_cipher_is_aead(enc->cipher))
+    ASSERT(len >= 0)
+    
+    EVP_CIPHER_CTX *ctx = enc->aead.decrypt;
+    int outl;
+    
+    ASSERT_FORCE(EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) == 1)
+    ASSERT_FORCE(EVP_DecryptUpdate(ctx, out, &outl, in, len) == 1)
+    ASSERT(outl == len)
+    ASSERT_FORCE(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, BENCRYPTION_AEAD_TAG_SIZE, (void *)tag) == 1)
+    
+    // fails if the tag does not match
+    return (EVP_DecryptFinal_ex(ctx, out + outl, &outl) == 1);
+}
@@ -29,6 +29,9 @@
  * @section DESCRIPTION
  * 
  * Block cipher encryption abstraction.
+ * 
+ * Besides the CBC block ciphers, AEAD ciphers are supported, which encrypt
+ * and authenticate in one pass; see {@link BEncryption_cipher_is_aead}.
  */
 
 #ifndef BADVPN_SECURITY_BENCRYPTION_H
@@ -50,6 +53,7 @@
 
 #include <openssl/blowfish.h>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -58,7 +62,7 @@
 #define BENCRYPTION_MODE_DECRYPT 2
 
 #define BENCRYPTION_MAX_BLOCK_SIZE 16
-#define BENCRYPTION_MAX_KEY_SIZE 16
+#define BENCRYPTION_MAX_KEY_SIZE 32
 
 #define BENCRYPTION_CIPHER_BLOWFISH 1
 #define BENCRYPTION_CIPHER_BLOWFISH_BLOCK_SIZE 8
@@ -68,6 +72,16 @@
 #define BENCRYPTION_CIPHER_AES_BLOCK_SIZE 16
 #define BENCRYPTION_CIPHER_AES_KEY_SIZE 16
 
+#define BENCRYPTION_CIPHER_AES_GCM 3
+#define BENCRYPTION_CIPHER_AES_GCM_KEY_SIZE 16
+
+#define BENCRYPTION_CIPHER_CHACHA20_POLY1305 4
+#define BENCRYPTION_CIPHER_CHACHA20_POLY1305_KEY_SIZE 32
+
+// nonce and tag sizes of all AEAD ciphers
+#define BENCRYPTION_AEAD_NONCE_SIZE 12
+#define BENCRYPTION_AEAD_TAG_SIZE 16
+
 // NOTE: update the maximums above when adding a cipher!
 
 /**
@@ -86,6 +100,10 @@ typedef struct {
             AES_KEY encrypt;
             AES_KEY decrypt;
         } aes;
+        struct {
+            EVP_CIPHER_CTX *encrypt;
+            EVP_CIPHER_CTX *decrypt;
+        } aead;
         #ifdef BADVPN_USE_CRYPTODEV
         struct {
             int fd;
@@ -106,9 +124,20 @@ typedef struct {
 int BEncryption_cipher_valid (int cipher);
 
 /**
- * Returns the block size of a cipher.
+ * Checks if the given cipher is an AEAD cipher.
+ * AEAD ciphers are used with {@link BEncryption_EncryptAEAD} and
+ * {@link BEncryption_DecryptAEAD} instead of {@link BEncryption_Encrypt} and
+ * {@link BEncryption_Decrypt}, and have no block size.
  * 
  * @param cipher cipher number. Must be valid.
+ * @return 1 if AEAD, 0 if not
+ */
+int BEncryption_cipher_is_aead (int cipher);
+
+/**
+ * Returns the block size of a cipher.
+ * 
+ * @param cipher cipher number. Must be valid and not AEAD.
  * @return block size in bytes
  */
 int BEncryption_cipher_block_size (int cipher);
@@ -145,7 +174,7 @@ void BEncryption_Free (BEncryption *enc);
 /**
  * Encrypts data.
  * The object must have been initialized with mode including
- * BENCRYPTION_MODE_ENCRYPT.
+ * BENCRYPTION_MODE_ENCRYPT, and with a cipher which is not AEAD.
  * 
  * @param enc the object
  * @param in data to encrypt
@@ -160,7 +189,7 @@ void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
 /**
  * Decrypts data.
  * The object must have been initialized with mode including
- * BENCRYPTION_MODE_DECRYPT.
+ * BENCRYPTION_MODE_DECRYPT, and with a cipher which is not AEAD.
  * 
  * @param enc the object
  * @param in data to decrypt
@@ -172,4 +201,35 @@ void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
  */
 void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len, uint8_t *iv);
 
+/**
+ * Encrypts and authenticates data using an AEAD cipher.
+ * The object must have been initialized with mode including
+ * BENCRYPTION_MODE_ENCRYPT, and with an AEAD cipher.
+ * 
+ * @param enc the object
+ * @param nonce nonce, BENCRYPTION_AEAD_NONCE_SIZE bytes. A nonce must never be
+ *              used twice with the same key.
+ * @param in data to encrypt
+ * @param out ciphertext output. May be the same as in.
+ * @param len number of bytes to encrypt. Must be >=0.
+ * @param tag authentication tag output, BENCRYPTION_AEAD_TAG_SIZE bytes
+ */
+void BEncryption_EncryptAEAD (BEncryption *enc, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, uint8_t *tag);
+
+/**
+ * Decrypts and verifies data using an AEAD cipher.
+ * The object must have been initialized with mode including
+ * BENCRYPTION_MODE_DECRYPT, and with an AEAD cipher.
+ * 
+ * @param enc the object
+ * @param nonce nonce, BENCRYPTION_AEAD_NONCE_SIZE bytes
+ * @param in data to decrypt
+ * @param out plaintext output. May be the same as in. Its contents are
+ *            undefined if verification fails.
+ * @param len number of bytes to decrypt. Must be >=0.
+ * @param tag authentication tag, BENCRYPTION_AEAD_TAG_SIZE bytes
+ * @return 1 if the tag matched, 0 if the data is not authentic
+ */
+int BEncryption_DecryptAEAD (BEncryption *enc, const uint8_t *nonce, uint8_t *in, uint8_t *out, int len, const uint8_t *tag) WARN_UNUSED;
+
 #endif
@@ -0,0 +1,120 @@
+/**
+ * @file ReplayWindow.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Sliding window of recently seen packet counters, for detecting
+ * replayed packets.
+ */
+
+#ifndef BADVPN_SECURITY_REPLAYWINDOW_H
+#define BADVPN_SECURITY_REPLAYWINDOW_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+// number of 64-bit words in the bitmap
+#define REPLAYWINDOW_NUM_WORDS 32
+
+/**
+ * Number of counters below the highest one seen which are still accepted.
+ * One word of the bitmap is kept spare so that advancing the window only
+ * needs to clear whole words.
+ */
+#define REPLAYWINDOW_SIZE ((REPLAYWINDOW_NUM_WORDS - 1) * 64)
+
+/**
+ * Sliding window of recently seen packet counters.
+ * Bit (counter % 64) of word ((counter / 64) % REPLAYWINDOW_NUM_WORDS)
+ * is set when a counter has been seen.
+ */
+typedef struct {
+    uint64_t last;
+    uint64_t bitmap[REPLAYWINDOW_NUM_WORDS];
+} ReplayWindow;
+
+/**
+ * Initializes the window, or resets it to not having seen any counters.
+ * 
+ * @param o the object
+ */
+static void ReplayWindow_Init (ReplayWindow *o)
+{
+    o->last = 0;
+    
+    for (int i = 0; i < REPLAYWINDOW_NUM_WORDS; i++) {
+        o->bitmap[i] = 0;
+    }
+}
+
+/**
+ * Checks if a counter was not seen before, and if so, remembers it.
+ * Counters more than {@link REPLAYWINDOW_SIZE} below the highest counter
+ * seen are rejected.
+ * Must only be called for authenticated packets, as the window advances.
+ * 
+ * @param o the object
+ * @param counter packet counter
+ * @return 1 if the counter was accepted, 0 if it is a replay or too old
+ */
+static int ReplayWindow_Check (ReplayWindow *o, uint64_t counter)
+{
+    uint64_t word = counter / 64;
+    
+    if (counter > o->last) {
+        // advance window, clearing words which are now in front of it
+        uint64_t last_word = o->last / 64;
+        uint64_t advance = word - last_word;
+        if (advance > REPLAYWINDOW_NUM_WORDS) {
+            advance = REPLAYWINDOW_NUM_WORDS;
+        }
+        for (uint64_t i = 1; i <= advance; i++) {
+            o->bitmap[(last_word + i) % REPLAYWINDOW_NUM_WORDS] = 0;
+        }
+        o->last = counter;
+    }
+    else if (o->last - counter > REPLAYWINDOW_SIZE) {
+        // too old
+        return 0;
+    }
+    
+    uint64_t *w = &o->bitmap[word % REPLAYWINDOW_NUM_WORDS];
+    uint64_t bit = (uint64_t)1 << (counter % 64);
+    
+    // seen before
+    if (*w & bit) {
+        return 0;
+    }
+    
+    *w |= bit;
+    
+    return 1;
+}
+
+#endif
@@ -0,0 +1,1116 @@
+/**
+ * @file ClientShard.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <ssl.h>
+
+#include <misc/offset.h>
+#include <misc/nonblocking.h>
+#include <system/BConnection.h>
+#include <flow/PacketProtoDecoder.h>
+#include <flow/PacketStreamSender.h>
+#include <nspr_support/BSSLConnection.h>
+#include <base/BLog.h>
+
+#include <server/ClientShard.h>
+
+#include <generated/blog_channel_ClientShard.h>
+
+// messages to the worker thread
+#define MSG_NEW 1
+#define MSG_SEND 2
+#define MSG_RECV_ACK 3
+#define MSG_CLOSE 4
+#define MSG_QUIT 5
+
+// messages to the main thread
+#define MSG_EVENT 6
+#define MSG_RECV 7
+#define MSG_SEND_ACK 8
+#define MSG_CLOSED 9
+
+struct ClientShard_msg {
+    LinkedList1Node list_node;
+    int type;
+    struct ClientShard_conn *c;
+    int arg;
+    CERTCertificate *cert;
+    int embedded;
+    uint8_t *data;
+    int data_len;
+};
+
+struct ClientShard_conn {
+    ClientShard *shard;
+    BAddr addr;
+    
+    // messages which are sent once per connection
+    struct ClientShard_msg new_msg;
+    struct ClientShard_msg close_msg;
+    struct ClientShard_msg up_msg;
+    struct ClientShard_msg end_msg;
+    struct ClientShard_msg closed_msg;
+    
+    // main thread
+    ClientShardConn *obj;
+    LinkedList1Node list_node;
+    
+    // worker thread
+    LinkedList1Node shard_list_node;
+    int have_con;
+    int have_io;
+    int finished;
+    BConnection con;
+    PRFileDesc bottom_prfd;
+    PRFileDesc *ssl_prfd;
+    BSSLConnection sslcon;
+    PacketPassInterface decoder_output;
+    PacketProtoDecoder decoder;
+    PacketStreamSender sender;
+    LinkedList1 send_msgs;
+    int send_busy;
+    int send_acks;
+    int recv_inflight;
+    int recv_blocked;
+    BPending ack_job;
+};
+
+static struct ClientShard_msg * msg_alloc (int type, struct ClientShard_conn *c, int arg, int data_len)
+{
+    struct ClientShard_msg *msg = (struct ClientShard_msg *)malloc(sizeof(*msg) + data_len);
+    if (!msg) {
+        return NULL;
+    }
+    
+    msg->type = type;
+    msg->c = c;
+    msg->arg = arg;
+    msg->cert = NULL;
+    msg->embedded = 0;
+    msg->data = (uint8_t *)(msg + 1);
+    msg->data_len = data_len;
+    
+    return msg;
+}
+
+static void msg_init_embedded (struct ClientShard_msg *msg, int type, struct ClientShard_conn *c)
+{
+    msg->type = type;
+    msg->c = c;
+    msg->arg = 0;
+    msg->cert = NULL;
+    msg->embedded = 1;
+    msg->data = NULL;
+    msg->data_len = 0;
+}
+
+static void msg_free (struct ClientShard_msg *msg)
+{
+    if (msg->cert) {
+        CERT_DestroyCertificate(msg->cert);
+        msg->cert = NULL;
+    }
+    
+    if (!msg->embedded) {
+        free(msg);
+    }
+}
+
+static void queue_fd_handler (struct ClientShard_queue *q, int events)
+{
+    // read data from pipe
+    uint8_t b[64];
+    int res = read(q->pipe[0], b, sizeof(b));
+    if (res < 0) {
+        int error = errno;
+        ASSERT_FORCE(error == EAGAIN || error == EWOULDBLOCK)
+    } else {
+        ASSERT(res > 0)
+    }
+    
+    // take all messages; the other thread will write to the pipe for
+    // any messages posted after this
+    BMutex_Lock(&q->mutex);
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&q->msgs)) {
+        LinkedList1_Remove(&q->msgs, node);
+        LinkedList1_Append(&q->taken, node);
+    }
+    q->notified = 0;
+    BMutex_Unlock(&q->mutex);
+    
+    // process them from a job
+    if (!LinkedList1_IsEmpty(&q->taken)) {
+        BPending_Set(&q->job);
+    }
+}
+
+static void queue_job_handler (struct ClientShard_queue *q)
+{
+    ASSERT(!LinkedList1_IsEmpty(&q->taken))
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&q->taken);
+    LinkedList1_Remove(&q->taken, node);
+    struct ClientShard_msg *msg = UPPER_OBJECT(node, struct ClientShard_msg, list_node);
+    
+    // handle one message per job, so that jobs it schedules (e.g. flows
+    // getting ready after the connection comes up) run before the next
+    // message is delivered
+    if (!LinkedList1_IsEmpty(&q->taken)) {
+        BPending_Set(&q->job);
+    }
+    
+    q->handler(q->shard, msg);
+}
+
+static int queue_init (struct ClientShard_queue *q, ClientShard *shard, BReactor *reactor, void (*handler) (ClientShard *o, struct ClientShard_msg *msg))
+{
+    q->shard = shard;
+    q->handler = handler;
+    q->reactor = reactor;
+    
+    // init mutex
+    if (!BMutex_Init(&q->mutex)) {
+        BLog(BLOG_ERROR, "BMutex_Init failed");
+        goto fail0;
+    }
+    
+    // init messages lists
+    LinkedList1_Init(&q->msgs);
+    LinkedList1_Init(&q->taken);
+    
+    // not notified
+    q->notified = 0;
+    
+    // init pipe
+    if (pipe(q->pipe) < 0) {
+        BLog(BLOG_ERROR, "pipe failed");
+        goto fail1;
+    }
+    
+    // set read end non-blocking
+    if (!badvpn_set_nonblocking(q->pipe[0])) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        goto fail2;
+    }
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&q->bfd, q->pipe[0], (BFileDescriptor_handler)queue_fd_handler, q);
+    if (!BReactor_AddFileDescriptor(q->reactor, &q->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail2;
+    }
+    BReactor_SetFileDescriptorEvents(q->reactor, &q->bfd, BREACTOR_READ);
+    
+    // init job
+    BPending_Init(&q->job, BReactor_PendingGroup(q->reactor), (BPending_handler)queue_job_handler, q);
+    
+    return 1;
+    
+fail2:
+    ASSERT_FORCE(close(q->pipe[0]) == 0)
+    ASSERT_FORCE(close(q->pipe[1]) == 0)
+fail1:
+    BMutex_Free(&q->mutex);
+fail0:
+    return 0;
+}
+
+static void queue_flush (struct ClientShard_queue *q)
+{
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&q->msgs)) {
+        LinkedList1_Remove(&q->msgs, node);
+        LinkedList1_Append(&q->taken, node);
+    }
+    
+    while (node = LinkedList1_GetFirst(&q->taken)) {
+        LinkedList1_Remove(&q->taken, node);
+        struct ClientShard_msg *msg = UPPER_OBJECT(node, struct ClientShard_msg, list_node);
+        q->handler(q->shard, msg);
+    }
+    
+    BPending_Unset(&q->job);
+}
+
+static void queue_free (struct ClientShard_queue *q)
+{
+    ASSERT(LinkedList1_IsEmpty(&q->msgs))
+    ASSERT(LinkedList1_IsEmpty(&q->taken))
+    
+    // free job
+    BPending_Free(&q->job);
+    
+    // free BFileDescriptor
+    BReactor_RemoveFileDescriptor(q->reactor, &q->bfd);
+    
+    // free pipe
+    ASSERT_FORCE(close(q->pipe[0]) == 0)
+    ASSERT_FORCE(close(q->pipe[1]) == 0)
+    
+    // free mutex
+    BMutex_Free(&q->mutex);
+}
+
+static void queue_post (struct ClientShard_queue *q, struct ClientShard_msg *msg)
+{
+    BMutex_Lock(&q->mutex);
+    LinkedList1_Append(&q->msgs, &msg->list_node);
+    int notify = !q->notified;
+    q->notified = 1;
+    BMutex_Unlock(&q->mutex);
+    
+    // wake up the other thread, unless it was already woken up for
+    // messages it has not taken yet
+    if (notify) {
+        uint8_t b = 0;
+        int res = write(q->pipe[1], &b, sizeof(b));
+        ASSERT_FORCE(res == sizeof(b))
+    }
+}
+
+static void conn_logfunc (struct ClientShard_conn *c)
+{
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&c->addr, addr);
+    
+    BLog_Append("connection (%s): ", addr);
+}
+
+static void conn_log (struct ClientShard_conn *c, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)conn_logfunc, c, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+// worker thread
+
+static void shard_conn_free_io (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_io)
+    
+    ClientShard *o = c->shard;
+    
+    // stop using any buffers before they get freed
+    if (o->model_prfd) {
+        BSSLConnection_ReleaseBuffers(&c->sslcon);
+    }
+    
+    // free sender
+    PacketStreamSender_Free(&c->sender);
+    
+    // free messages waiting to be sent
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&c->send_msgs)) {
+        LinkedList1_Remove(&c->send_msgs, node);
+        msg_free(UPPER_OBJECT(node, struct ClientShard_msg, list_node));
+    }
+    
+    // free decoder
+    PacketProtoDecoder_Free(&c->decoder);
+    PacketPassInterface_Free(&c->decoder_output);
+    
+    // no more acks
+    BPending_Unset(&c->ack_job);
+    
+    c->have_io = 0;
+}
+
+static void shard_conn_free_con (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_con)
+    ASSERT(!c->have_io)
+    
+    ClientShard *o = c->shard;
+    
+    // free SSL
+    if (o->model_prfd) {
+        BSSLConnection_Free(&c->sslcon);
+        ASSERT_FORCE(PR_Close(c->ssl_prfd) == PR_SUCCESS)
+    }
+    
+    // free connection, closing the socket
+    BConnection_RecvAsync_Free(&c->con);
+    BConnection_SendAsync_Free(&c->con);
+    BConnection_Free(&c->con);
+    
+    c->have_con = 0;
+}
+
+static void shard_conn_finish (struct ClientShard_conn *c, int event)
+{
+    ASSERT(!c->finished)
+    ASSERT(event == CLIENTSHARDCONN_EVENT_RECVCLOSED || event == CLIENTSHARDCONN_EVENT_ERROR)
+    
+    ClientShard *o = c->shard;
+    
+    // stop doing I/O
+    if (c->have_io) {
+        shard_conn_free_io(c);
+    }
+    if (c->have_con) {
+        shard_conn_free_con(c);
+    }
+    
+    c->finished = 1;
+    
+    // report to main thread
+    c->end_msg.arg = event;
+    queue_post(&o->to_main, &c->end_msg);
+}
+
+static void shard_conn_send_next (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_io)
+    
+    if (c->send_busy || LinkedList1_IsEmpty(&c->send_msgs)) {
+        return;
+    }
+    
+    struct ClientShard_msg *msg = UPPER_OBJECT(LinkedList1_GetFirst(&c->send_msgs), struct ClientShard_msg, list_node);
+    
+    c->send_busy = 1;
+    PacketPassInterface_Sender_Send(PacketStreamSender_GetInput(&c->sender), msg->data, msg->data_len);
+}
+
+static void shard_conn_sender_handler_done (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_io)
+    ASSERT(c->send_busy)
+    
+    // free the sent message
+    LinkedList1Node *node = LinkedList1_GetFirst(&c->send_msgs);
+    LinkedList1_Remove(&c->send_msgs, node);
+    msg_free(UPPER_OBJECT(node, struct ClientShard_msg, list_node));
+    c->send_busy = 0;
+    
+    // acknowledge it to the main thread later, together with others
+    c->send_acks++;
+    BPending_Set(&c->ack_job);
+    
+    shard_conn_send_next(c);
+}
+
+static void shard_conn_decoder_output_handler_send (struct ClientShard_conn *c, uint8_t *data, int data_len)
+{
+    ASSERT(c->have_io)
+    ASSERT(!c->recv_blocked)
+    
+    ClientShard *o = c->shard;
+    
+    // copy packet to message
+    struct ClientShard_msg *msg = msg_alloc(MSG_RECV, c, 0, data_len);
+    if (!msg) {
+        conn_log(c, BLOG_ERROR, "failed to allocate message");
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+        return;
+    }
+    memcpy(msg->data, data, data_len);
+    
+    // pass to main thread
+    queue_post(&o->to_main, msg);
+    
+    // accept the next packet unless the window is full
+    c->recv_inflight++;
+    if (c->recv_inflight < o->window) {
+        PacketPassInterface_Done(&c->decoder_output);
+    } else {
+        c->recv_blocked = 1;
+    }
+}
+
+static void shard_conn_decoder_handler_error (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_io)
+    
+    conn_log(c, BLOG_ERROR, "decoder error");
+    
+    shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+    return;
+}
+
+static void shard_conn_ack_job_handler (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_io)
+    ASSERT(c->send_acks > 0)
+    
+    ClientShard *o = c->shard;
+    
+    struct ClientShard_msg *msg = msg_alloc(MSG_SEND_ACK, c, c->send_acks, 0);
+    if (!msg) {
+        conn_log(c, BLOG_ERROR, "failed to allocate message");
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+        return;
+    }
+    
+    c->send_acks = 0;
+    
+    queue_post(&o->to_main, msg);
+}
+
+static int shard_conn_init_io (struct ClientShard_conn *c)
+{
+    ASSERT(c->have_con)
+    ASSERT(!c->have_io)
+    
+    ClientShard *o = c->shard;
+    BPendingGroup *pg = BReactor_PendingGroup(&o->shard_reactor);
+    
+    StreamPassInterface *send_if = (o->model_prfd ? BSSLConnection_GetSendIf(&c->sslcon) : BConnection_SendAsync_GetIf(&c->con));
+    StreamRecvInterface *recv_if = (o->model_prfd ? BSSLConnection_GetRecvIf(&c->sslcon) : BConnection_RecvAsync_GetIf(&c->con));
+    
+    // init decoder
+    PacketPassInterface_Init(&c->decoder_output, o->recv_mtu, (PacketPassInterface_handler_send)shard_conn_decoder_output_handler_send, c, pg);
+    if (!PacketProtoDecoder_Init(&c->decoder, recv_if, &c->decoder_output, pg, c, (PacketProtoDecoder_handler_error)shard_conn_decoder_handler_error)) {
+        conn_log(c, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        PacketPassInterface_Free(&c->decoder_output);
+        return 0;
+    }
+    
+    // init sender
+    PacketStreamSender_Init(&c->sender, send_if, o->send_mtu, pg);
+    PacketPassInterface_Sender_Init(PacketStreamSender_GetInput(&c->sender), (PacketPassInterface_handler_done)shard_conn_sender_handler_done, c);
+    
+    LinkedList1_Init(&c->send_msgs);
+    c->send_busy = 0;
+    c->send_acks = 0;
+    c->recv_inflight = 0;
+    c->recv_blocked = 0;
+    c->have_io = 1;
+    
+    return 1;
+}
+
+static void shard_conn_connection_handler (struct ClientShard_conn *c, int event)
+{
+    ASSERT(c->have_con)
+    
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        conn_log(c, BLOG_INFO, "connection closed");
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_RECVCLOSED);
+    } else {
+        conn_log(c, BLOG_INFO, "connection error");
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+    }
+}
+
+static void shard_conn_sslcon_handler (struct ClientShard_conn *c, int event)
+{
+    ASSERT(c->have_con)
+    ASSERT(!c->have_io)
+    ASSERT(event == BSSLCONNECTION_EVENT_UP || event == BSSLCONNECTION_EVENT_ERROR)
+    
+    ClientShard *o = c->shard;
+    
+    if (event == BSSLCONNECTION_EVENT_ERROR) {
+        conn_log(c, BLOG_ERROR, "SSL error");
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+        return;
+    }
+    
+    // init I/O chains
+    if (!shard_conn_init_io(c)) {
+        shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+        return;
+    }
+    
+    // report to main thread with the client certificate; checking it
+    // is left to the main thread
+    c->up_msg.cert = SSL_PeerCertificate(c->ssl_prfd);
+    queue_post(&o->to_main, &c->up_msg);
+}
+
+static void shard_process_new (ClientShard *o, struct ClientShard_conn *c, int fd)
+{
+    // add to connections list
+    LinkedList1_Append(&o->shard_conns_list, &c->shard_list_node);
+    
+    c->have_con = 0;
+    c->have_io = 0;
+    c->finished = 0;
+    BPending_Init(&c->ack_job, BReactor_PendingGroup(&o->shard_reactor), (BPending_handler)shard_conn_ack_job_handler, c);
+    
+    // init connection; this closes the socket on failure
+    if (!BConnection_Init(&c->con, BConnection_source_pipe(fd, 1), &o->shard_reactor, c, (BConnection_handler)shard_conn_connection_handler)) {
+        conn_log(c, BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    // limit socket send buffer, else the main thread's scheduling is pointless
+    if (o->sndbuf > 0) {
+        if (!BConnection_SetSendBuffer(&c->con, o->sndbuf)) {
+            conn_log(c, BLOG_WARNING, "BConnection_SetSendBuffer failed");
+        }
+    }
+    
+    // init connection interfaces
+    BConnection_SendAsync_Init(&c->con);
+    BConnection_RecvAsync_Init(&c->con);
+    
+    if (o->model_prfd) {
+        // create bottom NSPR file descriptor
+        if (!BSSLConnection_MakeBackend(&c->bottom_prfd, BConnection_SendAsync_GetIf(&c->con), BConnection_RecvAsync_GetIf(&c->con), &o->shard_twd, 0)) {
+            conn_log(c, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
+            goto fail1;
+        }
+        
+        // create SSL file descriptor from the bottom NSPR file descriptor
+        if (!(c->ssl_prfd = SSL_ImportFD(o->model_prfd, &c->bottom_prfd))) {
+            conn_log(c, BLOG_ERROR, "SSL_ImportFD failed");
+            ASSERT_FORCE(PR_Close(&c->bottom_prfd) == PR_SUCCESS)
+            goto fail1;
+        }
+        
+        // set server mode
+        if (SSL_ResetHandshake(c->ssl_prfd, PR_TRUE) != SECSuccess) {
+            conn_log(c, BLOG_ERROR, "SSL_ResetHandshake failed");
+            goto fail2;
+        }
+        
+        // set require client certificate
+        if (SSL_OptionSet(c->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            conn_log(c, BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
+            goto fail2;
+        }
+        if (SSL_OptionSet(c->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            conn_log(c, BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
+            goto fail2;
+        }
+        
+        // init SSL connection
+        BSSLConnection_Init(&c->sslcon, c->ssl_prfd, 1, BReactor_PendingGroup(&o->shard_reactor), c, (BSSLConnection_handler)shard_conn_sslcon_handler);
+        
+        c->have_con = 1;
+    } else {
+        c->have_con = 1;
+        
+        // initialize I/O
+        if (!shard_conn_init_io(c)) {
+            shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+            return;
+        }
+    }
+    
+    return;
+    
+    if (o->model_prfd) {
+fail2:
+        ASSERT_FORCE(PR_Close(c->ssl_prfd) == PR_SUCCESS)
+    }
+fail1:
+    BConnection_RecvAsync_Free(&c->con);
+    BConnection_SendAsync_Free(&c->con);
+    BConnection_Free(&c->con);
+fail0:
+    shard_conn_finish(c, CLIENTSHARDCONN_EVENT_ERROR);
+}
+
+static void shard_process_close (ClientShard *o, struct ClientShard_conn *c)
+{
+    // stop doing I/O, without reporting
+    if (c->have_io) {
+        shard_conn_free_io(c);
+    }
+    if (c->have_con) {
+        shard_conn_free_con(c);
+    }
+    
+    // free ack job
+    BPending_Free(&c->ack_job);
+    
+    // remove from connections list
+    LinkedList1_Remove(&o->shard_conns_list, &c->shard_list_node);
+    
+    // the main thread can free the connection now
+    queue_post(&o->to_main, &c->closed_msg);
+}
+
+static void shard_msg_handler (ClientShard *o, struct ClientShard_msg *msg)
+{
+    struct ClientShard_conn *c = msg->c;
+    
+    switch (msg->type) {
+        case MSG_NEW: {
+            shard_process_new(o, c, msg->arg);
+        } break;
+        
+        case MSG_SEND: {
+            if (!c->have_io) {
+                msg_free(msg);
+                return;
+            }
+            
+            LinkedList1_Append(&c->send_msgs, &msg->list_node);
+            shard_conn_send_next(c);
+        } break;
+        
+        case MSG_RECV_ACK: {
+            if (c->have_io) {
+                ASSERT(msg->arg <= c->recv_inflight)
+                c->recv_inflight -= msg->arg;
+                if (c->recv_blocked && c->recv_inflight < o->window) {
+                    c->recv_blocked = 0;
+                    PacketPassInterface_Done(&c->decoder_output);
+                }
+            }
+            msg_free(msg);
+        } break;
+        
+        case MSG_CLOSE: {
+            shard_process_close(o, c);
+        } break;
+        
+        case MSG_QUIT: {
+            ASSERT(LinkedList1_IsEmpty(&o->shard_conns_list))
+            BReactor_Quit(&o->shard_reactor, 0);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+static void * shard_thread (ClientShard *o)
+{
+    BReactor_Exec(&o->shard_reactor);
+    
+    return NULL;
+}
+
+// main thread
+
+static void conn_recv_next (ClientShardConn *o)
+{
+    ASSERT(o->have_io)
+    
+    if (o->recv_busy || LinkedList1_IsEmpty(&o->recv_msgs)) {
+        return;
+    }
+    
+    struct ClientShard_msg *msg = UPPER_OBJECT(LinkedList1_GetFirst(&o->recv_msgs), struct ClientShard_msg, list_node);
+    
+    o->recv_busy = 1;
+    PacketPassInterface_Sender_Send(o->recv_output, msg->data, msg->data_len);
+}
+
+static void conn_recv_output_handler_done (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_io)
+    ASSERT(o->recv_busy)
+    
+    // free the passed message
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->recv_msgs);
+    LinkedList1_Remove(&o->recv_msgs, node);
+    msg_free(UPPER_OBJECT(node, struct ClientShard_msg, list_node));
+    o->recv_busy = 0;
+    
+    // acknowledge it to the worker thread later, together with others
+    o->recv_acks++;
+    BPending_Set(&o->ack_job);
+    
+    conn_recv_next(o);
+}
+
+static void conn_send_input_handler_send (ClientShardConn *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_io)
+    ASSERT(!o->send_blocked)
+    
+    // copy packet to message
+    struct ClientShard_msg *msg = msg_alloc(MSG_SEND, o->c, 0, data_len);
+    if (!msg) {
+        BLog(BLOG_ERROR, "failed to allocate message");
+        BPending_Set(&o->error_job);
+        return;
+    }
+    memcpy(msg->data, data, data_len);
+    
+    // pass to worker thread
+    queue_post(&o->shard->to_shard, msg);
+    
+    // accept the next packet unless the window is full
+    o->send_inflight++;
+    if (o->send_inflight < o->shard->window) {
+        PacketPassInterface_Done(&o->send_input);
+    } else {
+        o->send_blocked = 1;
+    }
+}
+
+static void conn_ack_job_handler (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_io)
+    ASSERT(o->recv_acks > 0)
+    
+    struct ClientShard_msg *msg = msg_alloc(MSG_RECV_ACK, o->c, o->recv_acks, 0);
+    if (!msg) {
+        BLog(BLOG_ERROR, "failed to allocate message");
+        BPending_Set(&o->error_job);
+        return;
+    }
+    
+    o->recv_acks = 0;
+    
+    queue_post(&o->shard->to_shard, msg);
+}
+
+static void conn_error_job_handler (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->finished) {
+        return;
+    }
+    
+    o->finished = 1;
+    
+    o->handler(o->user, CLIENTSHARDCONN_EVENT_ERROR);
+    return;
+}
+
+static void main_msg_handler (ClientShard *s, struct ClientShard_msg *msg)
+{
+    struct ClientShard_conn *c = msg->c;
+    ClientShardConn *o = c->obj;
+    
+    if (msg->type == MSG_CLOSED) {
+        ASSERT(!o)
+        
+        // free connection
+        LinkedList1_Remove(&s->conns_list, &c->list_node);
+        free(c);
+        return;
+    }
+    
+    // drop messages for connections which have been freed
+    if (!o || o->finished) {
+        msg_free(msg);
+        return;
+    }
+    
+    switch (msg->type) {
+        case MSG_EVENT: {
+            if (msg->arg == CLIENTSHARDCONN_EVENT_UP) {
+                // take certificate
+                o->peer_cert = msg->cert;
+                msg->cert = NULL;
+            } else {
+                o->finished = 1;
+            }
+            
+            o->handler(o->user, msg->arg);
+        } break;
+        
+        case MSG_RECV: {
+            LinkedList1_Append(&o->recv_msgs, &msg->list_node);
+            if (o->have_io) {
+                conn_recv_next(o);
+            }
+        } break;
+        
+        case MSG_SEND_ACK: {
+            if (o->have_io) {
+                ASSERT(msg->arg <= o->send_inflight)
+                o->send_inflight -= msg->arg;
+                if (o->send_blocked && o->send_inflight < s->window) {
+                    o->send_blocked = 0;
+                    PacketPassInterface_Done(&o->send_input);
+                }
+            }
+            msg_free(msg);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+int ClientShard_Init (ClientShard *o, BReactor *reactor, PRFileDesc *model_prfd, int sndbuf, int recv_mtu, int send_mtu, int window)
+{
+    ASSERT(recv_mtu >= 0)
+    ASSERT(send_mtu > 0)
+    ASSERT(window > 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->model_prfd = model_prfd;
+    o->sndbuf = sndbuf;
+    o->recv_mtu = recv_mtu;
+    o->send_mtu = send_mtu;
+    o->window = window;
+    
+    // init worker reactor
+    if (!BReactor_Init(&o->shard_reactor)) {
+        BLog(BLOG_ERROR, "BReactor_Init failed");
+        goto fail0;
+    }
+    
+    // init worker thread work dispatcher; SSL connections need one, but
+    // the worker thread does all the work itself
+    if (!BThreadWorkDispatcher_Init(&o->shard_twd, &o->shard_reactor, 0)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+        goto fail1;
+    }
+    
+    // init queues
+    if (!queue_init(&o->to_shard, o, &o->shard_reactor, shard_msg_handler)) {
+        goto fail2;
+    }
+    if (!queue_init(&o->to_main, o, o->reactor, main_msg_handler)) {
+        goto fail3;
+    }
+    
+    // allocate quit message
+    if (!(o->quit_msg = msg_alloc(MSG_QUIT, NULL, 0, 0))) {
+        BLog(BLOG_ERROR, "failed to allocate message");
+        goto fail4;
+    }
+    
+    // init connections
+    o->num_conns = 0;
+    LinkedList1_Init(&o->conns_list);
+    LinkedList1_Init(&o->shard_conns_list);
+    
+    DebugCounter_Init(&o->d_conns_ctr);
+    DebugObject_Init(&o->d_obj);
+    
+    // start thread
+    if (pthread_create(&o->thread, NULL, (void * (*) (void *))shard_thread, o) != 0) {
+        BLog(BLOG_ERROR, "pthread_create failed");
+        goto fail5;
+    }
+    
+    return 1;
+    
+fail5:
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_conns_ctr);
+    msg_free(o->quit_msg);
+fail4:
+    queue_free(&o->to_main);
+fail3:
+    queue_free(&o->to_shard);
+fail2:
+    BThreadWorkDispatcher_Free(&o->shard_twd);
+fail1:
+    BReactor_Free(&o->shard_reactor);
+fail0:
+    return 0;
+}
+
+void ClientShard_Free (ClientShard *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_conns_ctr);
+    ASSERT(o->num_conns == 0)
+    
+    // stop thread; it closes connections which were freed before
+    queue_post(&o->to_shard, o->quit_msg);
+    ASSERT_FORCE(pthread_join(o->thread, NULL) == 0)
+    
+    // finish freeing connections
+    queue_flush(&o->to_main);
+    ASSERT(LinkedList1_IsEmpty(&o->conns_list))
+    ASSERT(LinkedList1_IsEmpty(&o->shard_conns_list))
+    
+    // free queues
+    queue_free(&o->to_main);
+    queue_free(&o->to_shard);
+    
+    // free worker thread work dispatcher
+    BThreadWorkDispatcher_Free(&o->shard_twd);
+    
+    // free worker reactor
+    BReactor_Free(&o->shard_reactor);
+}
+
+int ClientShard_GetNumConns (ClientShard *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_conns;
+}
+
+int ClientShardConn_Init (ClientShardConn *o, ClientShard *shard, int fd, BAddr addr, void *user, ClientShardConn_handler handler)
+{
+    DebugObject_Access(&shard->d_obj);
+    ASSERT(fd >= 0)
+    
+    // init arguments
+    o->shard = shard;
+    o->user = user;
+    o->handler = handler;
+    
+    // allocate connection
+    struct ClientShard_conn *c = (struct ClientShard_conn *)malloc(sizeof(*c));
+    if (!c) {
+        BLog(BLOG_ERROR, "failed to allocate connection");
+        if (close(fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+        return 0;
+    }
+    c->shard = shard;
+    c->addr = addr;
+    c->obj = o;
+    LinkedList1_Append(&shard->conns_list, &c->list_node);
+    o->c = c;
+    
+    // init messages
+    msg_init_embedded(&c->new_msg, MSG_NEW, c);
+    msg_init_embedded(&c->close_msg, MSG_CLOSE, c);
+    msg_init_embedded(&c->up_msg, MSG_EVENT, c);
+    c->up_msg.arg = CLIENTSHARDCONN_EVENT_UP;
+    msg_init_embedded(&c->end_msg, MSG_EVENT, c);
+    msg_init_embedded(&c->closed_msg, MSG_CLOSED, c);
+    
+    // init main thread state
+    o->peer_cert = NULL;
+    o->have_io = 0;
+    o->finished = 0;
+    LinkedList1_Init(&o->recv_msgs);
+    BPending_Init(&o->ack_job, BReactor_PendingGroup(shard->reactor), (BPending_handler)conn_ack_job_handler, o);
+    BPending_Init(&o->error_job, BReactor_PendingGroup(shard->reactor), (BPending_handler)conn_error_job_handler, o);
+    
+    // hand socket over to worker thread
+    c->new_msg.arg = fd;
+    queue_post(&shard->to_shard, &c->new_msg);
+    
+    shard->num_conns++;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&shard->d_conns_ctr);
+    return 1;
+}
+
+void ClientShardConn_Free (ClientShardConn *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Decrement(&o->shard->d_conns_ctr);
+    ASSERT(!o->have_io)
+    
+    ClientShard *s = o->shard;
+    struct ClientShard_conn *c = o->c;
+    
+    s->num_conns--;
+    
+    // free received packets which were not passed
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->recv_msgs)) {
+        LinkedList1_Remove(&o->recv_msgs, node);
+        msg_free(UPPER_OBJECT(node, struct ClientShard_msg, list_node));
+    }
+    
+    // free jobs
+    BPending_Free(&o->error_job);
+    BPending_Free(&o->ack_job);
+    
+    // release certificate
+    if (o->peer_cert) {
+        CERT_DestroyCertificate(o->peer_cert);
+    }
+    
+    // detach from connection; any more messages for it will be dropped
+    c->obj = NULL;
+    
+    // have the worker thread close the socket; the connection is freed
+    // when it confirms
+    queue_post(&s->to_shard, &c->close_msg);
+}
+
+CERTCertificate * ClientShardConn_PeerCertificate (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->peer_cert) {
+        return NULL;
+    }
+    
+    return CERT_DupCertificate(o->peer_cert);
+}
+
+void ClientShardConn_InitIO (ClientShardConn *o, PacketPassInterface *recv_output)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->have_io)
+    ASSERT(PacketPassInterface_GetMTU(recv_output) >= o->shard->recv_mtu)
+    
+    // init send input
+    PacketPassInterface_Init(&o->send_input, o->shard->send_mtu, (PacketPassInterface_handler_send)conn_send_input_handler_send, o, BReactor_PendingGroup(o->shard->reactor));
+    o->send_inflight = 0;
+    o->send_blocked = 0;
+    
+    // init receive output
+    o->recv_output = recv_output;
+    PacketPassInterface_Sender_Init(o->recv_output, (PacketPassInterface_handler_done)conn_recv_output_handler_done, o);
+    o->recv_busy = 0;
+    o->recv_acks = 0;
+    
+    o->have_io = 1;
+    
+    // pass packets which arrived already
+    conn_recv_next(o);
+}
+
+void ClientShardConn_FreeIO (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_io)
+    
+    // free send input
+    PacketPassInterface_Free(&o->send_input);
+    
+    // free received packets
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->recv_msgs)) {
+        LinkedList1_Remove(&o->recv_msgs, node);
+        msg_free(UPPER_OBJECT(node, struct ClientShard_msg, list_node));
+    }
+    
+    // no more acks
+    BPending_Unset(&o->ack_job);
+    
+    o->have_io = 0;
+}
+
+PacketPassInterface * ClientShardConn_GetSendIf (ClientShardConn *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_io)
+    
+    return &o->send_input;
+}
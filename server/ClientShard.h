@@ -0,0 +1,252 @@
+/**
+ * @file ClientShard.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Worker thread which runs the sockets, SSL and packet framing of a subset
+ * of the server's clients on its own reactor.
+ */
+
+#ifndef BADVPN_SERVER_CLIENTSHARD_H
+#define BADVPN_SERVER_CLIENTSHARD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <prio.h>
+#include <cert.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <base/BMutex.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+#include <flow/PacketPassInterface.h>
+#include <threadwork/BThreadWork.h>
+
+#define CLIENTSHARDCONN_EVENT_UP 1
+#define CLIENTSHARDCONN_EVENT_RECVCLOSED 2
+#define CLIENTSHARDCONN_EVENT_ERROR 3
+
+/**
+ * Handler function called when something happens with a connection.
+ * On CLIENTSHARDCONN_EVENT_UP, the SSL handshake has completed, and the
+ * client's certificate is available via {@link ClientShardConn_PeerCertificate}.
+ * This event is only reported when using SSL.
+ * On CLIENTSHARDCONN_EVENT_RECVCLOSED and CLIENTSHARDCONN_EVENT_ERROR, the
+ * connection is finished and should be freed; no more packets will be received.
+ * 
+ * @param user as in {@link ClientShardConn_Init}
+ * @param event one of the CLIENTSHARDCONN_EVENT_* values
+ */
+typedef void (*ClientShardConn_handler) (void *user, int event);
+
+struct ClientShard_s;
+struct ClientShard_conn;
+struct ClientShard_msg;
+
+struct ClientShard_queue {
+    struct ClientShard_s *shard;
+    void (*handler) (struct ClientShard_s *o, struct ClientShard_msg *msg);
+    BReactor *reactor;
+    BMutex mutex;
+    LinkedList1 msgs;
+    int notified;
+    int pipe[2];
+    BFileDescriptor bfd;
+    LinkedList1 taken;
+    BPending job;
+};
+
+/**
+ * Worker thread which runs the sockets, SSL and packet framing of a subset
+ * of the server's clients on its own reactor.
+ * 
+ * The thread owning the clients (the main thread) creates a {@link ClientShardConn}
+ * for every accepted socket. The socket is handed over to the worker thread,
+ * which does all system calls and SSL processing for it, and exchanges decoded
+ * packets with the main thread through a pair of message queues. The main thread
+ * only sees packet interfaces, and does no I/O for the connection.
+ * 
+ * Each direction of a connection has a window of packets which may be in transit
+ * between the threads; when it is full, the sender of the packets is blocked until
+ * the other thread reports that it has processed some, so the socket's flow control
+ * still applies to the main thread's packet queues.
+ * 
+ * The queues wake up the other thread with a pipe, which is written at most once
+ * until the other thread gets to processing the messages, so under load many
+ * messages are processed per wakeup.
+ */
+typedef struct ClientShard_s {
+    BReactor *reactor;
+    PRFileDesc *model_prfd;
+    int sndbuf;
+    int recv_mtu;
+    int send_mtu;
+    int window;
+    BReactor shard_reactor;
+    BThreadWorkDispatcher shard_twd;
+    struct ClientShard_queue to_shard;
+    struct ClientShard_queue to_main;
+    struct ClientShard_msg *quit_msg;
+    pthread_t thread;
+    int num_conns;
+    LinkedList1 conns_list;
+    LinkedList1 shard_conns_list;
+    DebugCounter d_conns_ctr;
+    DebugObject d_obj;
+} ClientShard;
+
+/**
+ * Connection of a client, whose socket is handled by a {@link ClientShard}.
+ * Lives in the main thread.
+ */
+typedef struct {
+    ClientShard *shard;
+    struct ClientShard_conn *c;
+    void *user;
+    ClientShardConn_handler handler;
+    CERTCertificate *peer_cert;
+    int have_io;
+    PacketPassInterface send_input;
+    int send_inflight;
+    int send_blocked;
+    PacketPassInterface *recv_output;
+    LinkedList1 recv_msgs;
+    int recv_busy;
+    int recv_acks;
+    BPending ack_job;
+    BPending error_job;
+    int finished;
+    DebugObject d_obj;
+} ClientShardConn;
+
+/**
+ * Initializes the object, starting the worker thread.
+ * 
+ * @param o the object
+ * @param reactor reactor of the main thread
+ * @param model_prfd if not NULL, connections use SSL in server mode, with SSL file
+ *                   descriptors created from this model, and require a client certificate.
+ *                   Must be kept alive until the object is freed.
+ * @param sndbuf if >0, SO_SNDBUF socket option for connections
+ * @param recv_mtu maximum size of packets received from clients. Must be >=0 and
+ *                 fit into a PacketProto header.
+ * @param send_mtu maximum size of data written to clients at once, as encoded by the
+ *                 main thread. Must be >0.
+ * @param window number of packets in each direction of a connection which may be in
+ *               transit between the threads. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int ClientShard_Init (ClientShard *o, BReactor *reactor, PRFileDesc *model_prfd, int sndbuf, int recv_mtu, int send_mtu, int window) WARN_UNUSED;
+
+/**
+ * Frees the object, stopping the worker thread.
+ * There must be no {@link ClientShardConn} objects.
+ * 
+ * @param o the object
+ */
+void ClientShard_Free (ClientShard *o);
+
+/**
+ * Returns the number of {@link ClientShardConn} objects using the shard.
+ * 
+ * @param o the object
+ * @return number of connections
+ */
+int ClientShard_GetNumConns (ClientShard *o);
+
+/**
+ * Initializes a connection, handing the socket over to the worker thread.
+ * If using SSL, the handshake is started.
+ * 
+ * @param o the object
+ * @param shard shard to handle the connection
+ * @param fd connected non-blocking socket. It is closed when the connection is
+ *           freed, and also if this fails.
+ * @param addr address of the client, for logging
+ * @param user value to pass to handler
+ * @param handler handler called when something happens with the connection
+ * @return 1 on success, 0 on failure
+ */
+int ClientShardConn_Init (ClientShardConn *o, ClientShard *shard, int fd, BAddr addr, void *user, ClientShardConn_handler handler) WARN_UNUSED;
+
+/**
+ * Frees the connection. The worker thread will close the socket.
+ * I/O must not be initialized.
+ * 
+ * @param o the object
+ */
+void ClientShardConn_Free (ClientShardConn *o);
+
+/**
+ * Returns the client's certificate.
+ * May only be called after the CLIENTSHARDCONN_EVENT_UP event.
+ * 
+ * @param o the object
+ * @return new reference to the certificate, to be released with
+ *         CERT_DestroyCertificate, or NULL on failure
+ */
+CERTCertificate * ClientShardConn_PeerCertificate (ClientShardConn *o);
+
+/**
+ * Initializes I/O, after which packets are received and can be sent.
+ * If using SSL, may only be called after the CLIENTSHARDCONN_EVENT_UP event.
+ * Packets which arrived before are delivered now.
+ * I/O must not have been initialized before.
+ * 
+ * @param o the object
+ * @param recv_output interface to pass received packets to. Its MTU must be
+ *                    >=recv_mtu as in {@link ClientShard_Init}.
+ */
+void ClientShardConn_InitIO (ClientShardConn *o, PacketPassInterface *recv_output);
+
+/**
+ * Frees I/O. Packets which have not been passed to the receive output yet are
+ * discarded. The receive output may be freed afterwards.
+ * I/O must be initialized.
+ * 
+ * @param o the object
+ */
+void ClientShardConn_FreeIO (ClientShardConn *o);
+
+/**
+ * Returns the interface for sending packets to the client.
+ * Data sent is written to the socket as it is; its MTU is send_mtu as in
+ * {@link ClientShard_Init}.
+ * I/O must be initialized.
+ * 
+ * @param o the object
+ * @return send interface
+ */
+PacketPassInterface * ClientShardConn_GetSendIf (ClientShardConn *o);
+
+#endif
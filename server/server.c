@@ -55,6 +55,8 @@
 #include <misc/open_standard_streams.h>
 #include <misc/compare.h>
 #include <misc/bsize.h>
+#include <misc/balloc.h>
+#include <misc/strdup.h>
 #include <predicate/BPredicate.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
@@ -99,41 +101,28 @@ struct {
     char *relay_predicate;
     int client_socket_sndbuf;
     int max_clients;
+    int shards;
 } options;
 
 // listen addresses
 BAddr listen_addrs[MAX_LISTEN_ADDRS];
 int num_listen_addrs;
 
-// communication predicate
-BPredicate comm_predicate;
+// communication predicate, compiled
+BPredicateProgram comm_program;
 
-// communication predicate functions
-BPredicateFunction comm_predicate_func_p1name;
-BPredicateFunction comm_predicate_func_p2name;
-BPredicateFunction comm_predicate_func_p1addr;
-BPredicateFunction comm_predicate_func_p2addr;
+// relay predicate, compiled
+BPredicateProgram relay_program;
 
-// variables when evaluating the predicate, adjusted before every evaluation
-const char *comm_predicate_p1name;
-const char *comm_predicate_p2name;
-BIPAddr comm_predicate_p1addr;
-BIPAddr comm_predicate_p2addr;
+// client attributes tested by the predicates
+struct predicate_atom *predicate_atoms;
+int predicate_num_atoms;
 
-// relay predicate
-BPredicate relay_predicate;
+// number of words in a bitmap of atoms
+int predicate_atoms_words;
 
-// gateway predicate functions
-BPredicateFunction relay_predicate_func_pname;
-BPredicateFunction relay_predicate_func_rname;
-BPredicateFunction relay_predicate_func_paddr;
-BPredicateFunction relay_predicate_func_raddr;
-
-// variables when evaluating the comm_predicate, adjusted before every evaluation
-const char *relay_predicate_pname;
-const char *relay_predicate_rname;
-BIPAddr relay_predicate_paddr;
-BIPAddr relay_predicate_raddr;
+// bitmap for computing the atoms of a client
+uint32_t *predicate_atoms_scratch;
 
 // i/o system
 BReactor ss;
@@ -155,6 +144,12 @@ PRFileDesc *model_prfd;
 BListener listeners[MAX_LISTEN_ADDRS];
 int num_listeners;
 
+#ifndef BADVPN_USE_WINAPI
+// client shards, if using them
+ClientShard shards[MAX_SHARDS];
+int num_shards;
+#endif
+
 // number of connected clients
 int clients_num;
 
@@ -167,6 +162,12 @@ LinkedList1 clients;
 // clients tree (by ID)
 BAVL clients_tree;
 
+// authorization classes list
+LinkedList1 classes_list;
+
+// authorization classes tree (by atoms)
+BAVL classes_tree;
+
 // prints help text to standard output
 static void print_help (const char *name);
 
@@ -187,6 +188,23 @@ static void signal_handler (void *unused);
 // listener handler, accepts new clients
 static void listener_handler (BListener *listener);
 
+// accepts a client's connection, handing it over to a shard if using shards,
+// and starts the SSL handshake if using SSL
+static int client_init_conn (struct client_data *client, BListener *listener);
+
+// frees a client's connection
+static void client_free_conn (struct client_data *client);
+
+// returns the client's certificate after the SSL handshake
+static CERTCertificate * client_conn_peer_certificate (struct client_data *client);
+
+// initializes packet decoding and sending on the client's connection,
+// returning the interface for sending encoded packets
+static int client_conn_init_io (struct client_data *client, PacketPassInterface **out_send_if);
+
+// frees packet decoding and sending on the client's connection
+static void client_conn_free_io (struct client_data *client);
+
 // frees resources used by a client
 static void client_dealloc (struct client_data *client);
 
@@ -219,6 +237,14 @@ static void client_connection_handler (struct client_data *client, int event);
 // BSSLConnection handler
 static void client_sslcon_handler (struct client_data *client, int event);
 
+#ifndef BADVPN_USE_WINAPI
+// ClientShardConn handler
+static void client_shard_handler (struct client_data *client, int event);
+#endif
+
+// checks the client certificate after the SSL handshake and initializes I/O
+static void client_handshake_complete (struct client_data *client);
+
 // decoder handler
 static void client_decoder_handler_error (struct client_data *client);
 
@@ -284,36 +310,39 @@ static peerid_t new_client_id (void);
 // finds a client by its ID
 static struct client_data * find_client_by_id (peerid_t id);
 
-// checks if two clients are allowed to communicate. May depend on the order
-// of the clients.
-static int clients_allowed (struct client_data *client1, struct client_data *client2);
+// checks if clients of two authorization classes are allowed to communicate.
+// May depend on the order of the classes.
+static int classes_allowed (struct client_class *class1, struct client_class *class2);
 
-// communication predicate function p1name
-static int comm_predicate_func_p1name_cb (void *user, void **args);
+// checks if relay is allowed for a client through another client
+static int relay_allowed (struct client_data *client, struct client_data *relay);
 
-// communication predicate function p2name
-static int comm_predicate_func_p2name_cb (void *user, void **args);
+// parses and compiles a predicate
+static int compile_predicate (BPredicateProgram *prog, char *str, int is_relay);
 
-// communication predicate function p1addr
-static int comm_predicate_func_p1addr_cb (void *user, void **args);
+// predicate compile handler, resolves function calls to atoms
+static int predicate_compile_cb (int *is_relay, char *name, char **args, int num_args, int *out_atom);
 
-// communication predicate function p2addr
-static int comm_predicate_func_p2addr_cb (void *user, void **args);
+// finds an atom, or adds it if it doesn't exist yet
+static int predicate_add_atom (int type, char *str, int *out_atom);
 
-// checks if relay is allowed for a client through another client
-static int relay_allowed (struct client_data *client, struct client_data *relay);
+// frees the atoms
+static void predicate_free_atoms (void);
+
+// predicate atom handler, tests an atom against the atoms of one of two clients
+static int predicate_atom_cb (uint32_t **atoms, int atom);
 
-// relay predicate function pname
-static int relay_predicate_func_pname_cb (void *user, void **args);
+// computes which atoms a client matches
+static void client_compute_atoms (struct client_data *client, uint32_t *atoms);
 
-// relay predicate function rname
-static int relay_predicate_func_rname_cb (void *user, void **args);
+// adds a client to the authorization class of its atoms
+static int client_join_class (struct client_data *client);
 
-// relay predicate function paddr
-static int relay_predicate_func_paddr_cb (void *user, void **args);
+// removes a client from its authorization class
+static void client_leave_class (struct client_data *client);
 
-// relay predicate function raddr
-static int relay_predicate_func_raddr_cb (void *user, void **args);
+// comparator for atom bitmaps used in AVL tree
+static int atoms_comparator (void *unused, uint32_t *a1, uint32_t *a2);
 
 // comparator for peerid_t used in AVL tree
 static int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2);
@@ -448,36 +477,29 @@ int main (int argc, char *argv[])
         goto fail1;
     }
     
+    // no predicate atoms yet
+    predicate_atoms = NULL;
+    predicate_num_atoms = 0;
+    
     // init communication predicate
     if (options.comm_predicate) {
-        // init predicate
-        if (!BPredicate_Init(&comm_predicate, options.comm_predicate)) {
-            BLog(BLOG_ERROR, "BPredicate_Init failed");
-            goto fail1;
+        if (!compile_predicate(&comm_program, options.comm_predicate, 0)) {
+            goto fail1a;
         }
-        
-        // init functions
-        int args[] = {PREDICATE_TYPE_STRING};
-        BPredicateFunction_Init(&comm_predicate_func_p1name, &comm_predicate, "p1name", args, 1, comm_predicate_func_p1name_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p2name, &comm_predicate, "p2name", args, 1, comm_predicate_func_p2name_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p1addr, &comm_predicate, "p1addr", args, 1, comm_predicate_func_p1addr_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p2addr, &comm_predicate, "p2addr", args, 1, comm_predicate_func_p2addr_cb, NULL);
     }
     
     // init relay predicate
     if (options.relay_predicate) {
-        // init predicate
-        if (!BPredicate_Init(&relay_predicate, options.relay_predicate)) {
-            BLog(BLOG_ERROR, "BPredicate_Init failed");
+        if (!compile_predicate(&relay_program, options.relay_predicate, 1)) {
             goto fail2;
         }
-        
-        // init functions
-        int args[] = {PREDICATE_TYPE_STRING};
-        BPredicateFunction_Init(&relay_predicate_func_pname, &relay_predicate, "pname", args, 1, relay_predicate_func_pname_cb, NULL);
-        BPredicateFunction_Init(&relay_predicate_func_rname, &relay_predicate, "rname", args, 1, relay_predicate_func_rname_cb, NULL);
-        BPredicateFunction_Init(&relay_predicate_func_paddr, &relay_predicate, "paddr", args, 1, relay_predicate_func_paddr_cb, NULL);
-        BPredicateFunction_Init(&relay_predicate_func_raddr, &relay_predicate, "raddr", args, 1, relay_predicate_func_raddr_cb, NULL);
+    }
+    
+    // allocate bitmap for computing the atoms of clients
+    predicate_atoms_words = (predicate_num_atoms + 31) / 32;
+    if (!(predicate_atoms_scratch = (uint32_t *)BAllocArray(predicate_atoms_words, sizeof(predicate_atoms_scratch[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2a;
     }
     
     // init time
@@ -501,6 +523,18 @@ int main (int argc, char *argv[])
         goto fail4;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // start client shards, after blocking signals so that the threads don't get them
+    num_shards = 0;
+    while (num_shards < options.shards) {
+        if (!ClientShard_Init(&shards[num_shards], &ss, (options.ssl ? model_prfd : NULL), options.client_socket_sndbuf, SC_MAX_ENC, PACKETPROTO_ENCLEN(SC_MAX_ENC), CLIENT_SHARD_WINDOW)) {
+            BLog(BLOG_ERROR, "ClientShard_Init failed");
+            goto fail5;
+        }
+        num_shards++;
+    }
+    #endif
+    
     // initialize number of clients
     clients_num = 0;
     
@@ -513,6 +547,10 @@ int main (int argc, char *argv[])
     // initialize clients tree
     BAVL_Init(&clients_tree, OFFSET_DIFF(struct client_data, id, tree_node), (BAVL_comparator)peerid_comparator, NULL);
     
+    // initialize authorization classes list and tree
+    LinkedList1_Init(&classes_list);
+    BAVL_Init(&classes_tree, OFFSET_DIFF(struct client_class, atoms, tree_node), (BAVL_comparator)atoms_comparator, NULL);
+    
     // initialize listeners
     num_listeners = 0;
     while (num_listeners < num_listen_addrs) {
@@ -562,33 +600,39 @@ int main (int argc, char *argv[])
         // deallocate client
         client_dealloc(client);
     }
+    
+    ASSERT(LinkedList1_IsEmpty(&classes_list))
 fail10:
     while (num_listeners > 0) {
         num_listeners--;
         BListener_Free(&listeners[num_listeners]);
     }
     
+    #ifndef BADVPN_USE_WINAPI
+fail5:
+    while (num_shards > 0) {
+        num_shards--;
+        ClientShard_Free(&shards[num_shards]);
+    }
+    #endif
+    
     BSignal_Finish();
 fail4:
     BThreadWorkDispatcher_Free(&twd);
 fail3a:
     BReactor_Free(&ss);
 fail3:
+    BFree(predicate_atoms_scratch);
+fail2a:
     if (options.relay_predicate) {
-        BPredicateFunction_Free(&relay_predicate_func_raddr);
-        BPredicateFunction_Free(&relay_predicate_func_paddr);
-        BPredicateFunction_Free(&relay_predicate_func_rname);
-        BPredicateFunction_Free(&relay_predicate_func_pname);
-        BPredicate_Free(&relay_predicate);
+        BPredicateProgram_Free(&relay_program);
     }
 fail2:
     if (options.comm_predicate) {
-        BPredicateFunction_Free(&comm_predicate_func_p2addr);
-        BPredicateFunction_Free(&comm_predicate_func_p1addr);
-        BPredicateFunction_Free(&comm_predicate_func_p2name);
-        BPredicateFunction_Free(&comm_predicate_func_p1name);
-        BPredicate_Free(&comm_predicate);
+        BPredicateProgram_Free(&comm_program);
     }
+fail1a:
+    predicate_free_atoms();
 fail1:
     if (options.ssl) {
 fail05:
@@ -637,6 +681,9 @@ void print_help (const char *name)
         "        [--relay-predicate <string>]\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
         "        [--max-clients <number>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--shards <number>]\n"
+        #endif
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -671,6 +718,7 @@ int parse_arguments (int argc, char *argv[])
     options.relay_predicate = NULL;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SNDBUF;
     options.max_clients = DEFAULT_MAX_CLIENTS;
+    options.shards = 0;
     
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -831,6 +879,19 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--shards")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.shards = atoi(argv[i + 1])) < 0 || options.shards > MAX_SHARDS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
         else {
             fprintf(stderr, "%s: unknown option\n", arg);
             return 0;
@@ -851,6 +912,11 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (options.shards > 0 && (options.use_threads_for_ssl_handshake || options.use_threads_for_ssl_data)) {
+        fprintf(stderr, "--shards cannot be used with --use-threads-for-ssl-*\n");
+        return 0;
+    }
+    
     return 1;
 }
 
@@ -903,10 +969,94 @@ void listener_handler (BListener *listener)
         goto fail0;
     }
     
+    // assign ID
+    client->id = new_client_id();
+    
+    // set no common name
+    client->common_name = NULL;
+    
+    // accept connection, starting the SSL handshake if using SSL
+    if (!client_init_conn(client, listener)) {
+        goto fail1;
+    }
+    
+    // now client_log() works
+    
+    if (!options.ssl) {
+        // initialize I/O
+        if (!client_init_io(client)) {
+            goto fail2;
+        }
+    }
+    
+    // start disconnect timer
+    BDeadlineTimer_Init(&client->disconnect_timer, &ss, (BDeadlineTimer_handler)client_disconnect_timer_handler, client);
+    BDeadlineTimer_SetRelative(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT);
+    
+    // link in
+    clients_num++;
+    LinkedList1_Append(&clients, &client->list_node);
+    ASSERT_EXECUTE(BAVL_Insert(&clients_tree, &client->tree_node, NULL))
+    
+    // init knowledge lists
+    LinkedList1_Init(&client->know_out_list);
+    LinkedList1_Init(&client->know_in_list);
+    
+    // initialize peer flows from us list and tree (flows for sending messages to other clients)
+    LinkedList1_Init(&client->peer_out_flows_list);
+    BAVL_Init(&client->peer_out_flows_tree, OFFSET_DIFF(struct peer_flow, dest_client_id, src_tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    
+    // init dying
+    client->dying = 0;
+    BPending_Init(&client->dying_job, BReactor_PendingGroup(&ss), (BPending_handler)client_dying_job, client);
+    
+    // set state
+    client->initstatus = (options.ssl ? INITSTATUS_HANDSHAKE : INITSTATUS_WAITHELLO);
+    
+    client_log(client, BLOG_INFO, "initialized");
+    
+    return;
+    
+fail2:
+    client_free_conn(client);
+fail1:
+    free(client);
+fail0:
+    return;
+}
+
+int client_init_conn (struct client_data *client, BListener *listener)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.shards > 0) {
+        // accept connection
+        int fd = BListener_AcceptFd(listener, &client->addr);
+        if (fd < 0) {
+            BLog(BLOG_ERROR, "BListener_AcceptFd failed");
+            return 0;
+        }
+        
+        // hand it over to the shard with the fewest clients, which also
+        // does the SSL handshake
+        ClientShard *shard = &shards[0];
+        for (int i = 1; i < num_shards; i++) {
+            if (ClientShard_GetNumConns(&shards[i]) < ClientShard_GetNumConns(shard)) {
+                shard = &shards[i];
+            }
+        }
+        if (!ClientShardConn_Init(&client->sconn, shard, fd, client->addr, client, (ClientShardConn_handler)client_shard_handler)) {
+            client_log(client, BLOG_ERROR, "ClientShardConn_Init failed");
+            return 0;
+        }
+        
+        return 1;
+    }
+    #endif
+    
     // accept connection
     if (!BConnection_Init(&client->con, BConnection_source_listener(listener, &client->addr), &ss, client, (BConnection_handler)client_connection_handler)) {
         BLog(BLOG_ERROR, "BConnection_Init failed");
-        goto fail1;
+        goto fail0;
     }
     
     // limit socket send buffer, else our scheduling is pointless
@@ -916,14 +1066,6 @@ void listener_handler (BListener *listener)
         }
     }
     
-    // assign ID
-    client->id = new_client_id();
-    
-    // set no common name
-    client->common_name = NULL;
-    
-    // now client_log() works
-    
     // init connection interfaces
     BConnection_SendAsync_Init(&client->con);
     BConnection_RecvAsync_Init(&client->con);
@@ -932,81 +1074,130 @@ void listener_handler (BListener *listener)
         // create bottom NSPR file descriptor
         if (!BSSLConnection_MakeBackend(&client->bottom_prfd, BConnection_SendAsync_GetIf(&client->con), BConnection_RecvAsync_GetIf(&client->con), &twd, ssl_flags())) {
             client_log(client, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
-            goto fail2;
+            goto fail1;
         }
         
         // create SSL file descriptor from the bottom NSPR file descriptor
         if (!(client->ssl_prfd = SSL_ImportFD(model_prfd, &client->bottom_prfd))) {
             client_log(client, BLOG_ERROR, "SSL_ImportFD failed");
             ASSERT_FORCE(PR_Close(&client->bottom_prfd) == PR_SUCCESS)
-            goto fail2;
+            goto fail1;
         }
         
         // set server mode
         if (SSL_ResetHandshake(client->ssl_prfd, PR_TRUE) != SECSuccess) {
             client_log(client, BLOG_ERROR, "SSL_ResetHandshake failed");
-            goto fail3;
+            goto fail2;
         }
         
         // set require client certificate
         if (SSL_OptionSet(client->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
             client_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
-            goto fail3;
+            goto fail2;
         }
         if (SSL_OptionSet(client->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
             client_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
-            goto fail3;
+            goto fail2;
         }
         
         // init SSL connection
         BSSLConnection_Init(&client->sslcon, client->ssl_prfd, 1, BReactor_PendingGroup(&ss), client, (BSSLConnection_handler)client_sslcon_handler);
-    } else {
-        // initialize I/O
-        if (!client_init_io(client)) {
-            goto fail2;
-        }
     }
     
-    // start disconnect timer
-    BTimer_Init(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT, (BTimer_handler)client_disconnect_timer_handler, client);
-    BReactor_SetTimer(&ss, &client->disconnect_timer);
+    return 1;
     
-    // link in
-    clients_num++;
-    LinkedList1_Append(&clients, &client->list_node);
-    ASSERT_EXECUTE(BAVL_Insert(&clients_tree, &client->tree_node, NULL))
+    if (options.ssl) {
+fail2:
+        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    }
+fail1:
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
+    BConnection_Free(&client->con);
+fail0:
+    return 0;
+}
+
+void client_free_conn (struct client_data *client)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.shards > 0) {
+        // the shard closes the connection
+        ClientShardConn_Free(&client->sconn);
+        return;
+    }
+    #endif
     
-    // init knowledge lists
-    LinkedList1_Init(&client->know_out_list);
-    LinkedList1_Init(&client->know_in_list);
+    // free SSL
+    if (options.ssl) {
+        BSSLConnection_Free(&client->sslcon);
+        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    }
     
-    // initialize peer flows from us list and tree (flows for sending messages to other clients)
-    LinkedList1_Init(&client->peer_out_flows_list);
-    BAVL_Init(&client->peer_out_flows_tree, OFFSET_DIFF(struct peer_flow, dest_client_id, src_tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    // free connection interfaces
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
     
-    // init dying
-    client->dying = 0;
-    BPending_Init(&client->dying_job, BReactor_PendingGroup(&ss), (BPending_handler)client_dying_job, client);
+    // free connection
+    BConnection_Free(&client->con);
+}
+
+CERTCertificate * client_conn_peer_certificate (struct client_data *client)
+{
+    ASSERT(options.ssl)
     
-    // set state
-    client->initstatus = (options.ssl ? INITSTATUS_HANDSHAKE : INITSTATUS_WAITHELLO);
+    #ifndef BADVPN_USE_WINAPI
+    if (options.shards > 0) {
+        return ClientShardConn_PeerCertificate(&client->sconn);
+    }
+    #endif
     
-    client_log(client, BLOG_INFO, "initialized");
+    return SSL_PeerCertificate(client->ssl_prfd);
+}
+
+int client_conn_init_io (struct client_data *client, PacketPassInterface **out_send_if)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.shards > 0) {
+        // the shard decodes packets and writes out encoded packets
+        ClientShardConn_InitIO(&client->sconn, &client->input_interface);
+        *out_send_if = ClientShardConn_GetSendIf(&client->sconn);
+        return 1;
+    }
+    #endif
     
-    return;
+    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
+    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : BConnection_RecvAsync_GetIf(&client->con));
     
-    if (options.ssl) {
-fail3:
-        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    // init decoder
+    if (!PacketProtoDecoder_Init(&client->input_decoder, recv_if, &client->input_interface, BReactor_PendingGroup(&ss), client,
+        (PacketProtoDecoder_handler_error)client_decoder_handler_error
+    )) {
+        client_log(client, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        return 0;
     }
-fail2:
-    BConnection_RecvAsync_Free(&client->con);
-    BConnection_SendAsync_Free(&client->con);
-    BConnection_Free(&client->con);
-fail1:
-    free(client);
-fail0:
-    return;
+    
+    // init sender
+    PacketStreamSender_Init(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(&ss));
+    
+    *out_send_if = PacketStreamSender_GetInput(&client->output_sender);
+    return 1;
+}
+
+void client_conn_free_io (struct client_data *client)
+{
+    #ifndef BADVPN_USE_WINAPI
+    if (options.shards > 0) {
+        ClientShardConn_FreeIO(&client->sconn);
+        return;
+    }
+    #endif
+    
+    // free sender
+    PacketStreamSender_Free(&client->output_sender);
+    
+    // free decoder
+    PacketProtoDecoder_Free(&client->input_decoder);
 }
 
 void client_dealloc (struct client_data *client)
@@ -1023,32 +1214,27 @@ void client_dealloc (struct client_data *client)
     // free dying
     BPending_Free(&client->dying_job);
     
+    // leave authorization class
+    if (client->initstatus == INITSTATUS_COMPLETE && !client->dying) {
+        client_leave_class(client);
+    }
+    
     // link out
     BAVL_Remove(&clients_tree, &client->tree_node);
     LinkedList1_Remove(&clients, &client->list_node);
     clients_num--;
     
-    // stop disconnect timer
-    BReactor_RemoveTimer(&ss, &client->disconnect_timer);
+    // free disconnect timer
+    BDeadlineTimer_Free(&client->disconnect_timer);
     
-    // free SSL
-    if (options.ssl) {
-        BSSLConnection_Free(&client->sslcon);
-        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
-    }
+    // free connection
+    client_free_conn(client);
     
     // free common name
     if (client->common_name) {
         PORT_Free(client->common_name);
     }
     
-    // free connection interfaces
-    BConnection_RecvAsync_Free(&client->con);
-    BConnection_SendAsync_Free(&client->con);
-    
-    // free connection
-    BConnection_Free(&client->con);
-    
     // free memory
     free(client);
 }
@@ -1066,29 +1252,21 @@ int client_compute_buffer_size (struct client_data *client)
 
 int client_init_io (struct client_data *client)
 {
-    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
-    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : BConnection_RecvAsync_GetIf(&client->con));
-    
     // init input
     
     // init interface
     PacketPassInterface_Init(&client->input_interface, SC_MAX_ENC, (PacketPassInterface_handler_send)client_input_handler_send, client, BReactor_PendingGroup(&ss));
     
-    // init decoder
-    if (!PacketProtoDecoder_Init(&client->input_decoder, recv_if, &client->input_interface, BReactor_PendingGroup(&ss), client,
-        (PacketProtoDecoder_handler_error)client_decoder_handler_error
-    )) {
-        client_log(client, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+    // init decoder and sender
+    PacketPassInterface *send_if;
+    if (!client_conn_init_io(client, &send_if)) {
         goto fail1;
     }
     
     // init output common
     
-    // init sender
-    PacketStreamSender_Init(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(&ss));
-    
     // init queue
-    PacketPassPriorityQueue_Init(&client->output_priorityqueue, PacketStreamSender_GetInput(&client->output_sender), BReactor_PendingGroup(&ss), 0);
+    PacketPassPriorityQueue_Init(&client->output_priorityqueue, send_if, BReactor_PendingGroup(&ss), 0);
     
     // init output control flow
     
@@ -1130,9 +1308,8 @@ fail2:
     PacketPassPriorityQueueFlow_Free(&client->output_control_qflow);
     // free output common
     PacketPassPriorityQueue_Free(&client->output_priorityqueue);
-    PacketStreamSender_Free(&client->output_sender);
-    // free input
-    PacketProtoDecoder_Free(&client->input_decoder);
+    // free decoder and sender
+    client_conn_free_io(client);
 fail1:
     PacketPassInterface_Free(&client->input_interface);
     return 0;
@@ -1141,7 +1318,7 @@ fail1:
 void client_dealloc_io (struct client_data *client)
 {
     // stop using any buffers before they get freed
-    if (options.ssl) {
+    if (options.ssl && options.shards == 0) {
         BSSLConnection_ReleaseBuffers(&client->sslcon);
     }
     
@@ -1169,10 +1346,11 @@ void client_dealloc_io (struct client_data *client)
     
     // free output common
     PacketPassPriorityQueue_Free(&client->output_priorityqueue);
-    PacketStreamSender_Free(&client->output_sender);
+    
+    // free decoder and sender
+    client_conn_free_io(client);
     
     // free input
-    PacketProtoDecoder_Free(&client->input_decoder);
     PacketPassInterface_Free(&client->input_interface);
 }
 
@@ -1182,6 +1360,11 @@ void client_remove (struct client_data *client)
     
     client_log(client, BLOG_INFO, "removing");
     
+    // leave authorization class so that new clients don't see us
+    if (client->initstatus == INITSTATUS_COMPLETE) {
+        client_leave_class(client);
+    }
+    
     // set dying to prevent sending this client anything
     client->dying = 1;
     
@@ -1292,8 +1475,45 @@ void client_sslcon_handler (struct client_data *client, int event)
         return;
     }
     
+    client_handshake_complete(client);
+    return;
+}
+
+#ifndef BADVPN_USE_WINAPI
+void client_shard_handler (struct client_data *client, int event)
+{
+    ASSERT(options.shards > 0)
+    ASSERT(!client->dying)
+    ASSERT(!(event == CLIENTSHARDCONN_EVENT_UP) || client->initstatus == INITSTATUS_HANDSHAKE)
+    
+    switch (event) {
+        case CLIENTSHARDCONN_EVENT_UP: {
+            client_handshake_complete(client);
+            return;
+        } break;
+        
+        case CLIENTSHARDCONN_EVENT_RECVCLOSED: {
+            client_log(client, BLOG_INFO, "connection closed");
+        } break;
+        
+        default: {
+            client_log(client, BLOG_INFO, "connection error");
+        } break;
+    }
+    
+    client_remove(client);
+    return;
+}
+#endif
+
+void client_handshake_complete (struct client_data *client)
+{
+    ASSERT(options.ssl)
+    ASSERT(!client->dying)
+    ASSERT(client->initstatus == INITSTATUS_HANDSHAKE)
+    
     // get client certificate
-    CERTCertificate *cert = SSL_PeerCertificate(client->ssl_prfd);
+    CERTCertificate *cert = client_conn_peer_certificate(client);
     if (!cert) {
         client_log(client, BLOG_ERROR, "SSL_PeerCertificate failed");
         goto fail0;
@@ -1493,7 +1713,7 @@ void client_input_handler_send (struct client_data *client, uint8_t *data, int d
     PacketPassInterface_Done(&client->input_interface);
     
     // restart disconnect timer
-    BReactor_SetTimer(&ss, &client->disconnect_timer);
+    BDeadlineTimer_SetRelative(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT);
     
     // parse header
     if (data_len < sizeof(struct sc_header)) {
@@ -1565,37 +1785,52 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     
     client_log(client, BLOG_INFO, "received hello");
     
+    // join authorization class
+    if (!client_join_class(client)) {
+        client_remove(client);
+        return;
+    }
+    
     // set client state to complete
     client->initstatus = INITSTATUS_COMPLETE;
     
-    // publish client
-    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&clients); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, list_node);
-        if (client2 == client || client2->initstatus != INITSTATUS_COMPLETE || client2->dying || !clients_allowed(client, client2)) {
+    // publish client to the clients of classes it may communicate with
+    for (LinkedList1Node *class_node = LinkedList1_GetFirst(&classes_list); class_node; class_node = LinkedList1Node_Next(class_node)) {
+        struct client_class *cls = UPPER_OBJECT(class_node, struct client_class, list_node);
+        if (!classes_allowed(client->cls, cls)) {
             continue;
         }
         
-        // create flow from client to client2
-        struct peer_flow *flow_to = peer_flow_create(client, client2);
-        if (!flow_to) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // create flow from client2 to client
-        struct peer_flow *flow_from = peer_flow_create(client2, client);
-        if (!flow_from) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // set opposite flow pointers
-        flow_to->opposite = flow_from;
-        flow_from->opposite = flow_to;
-        
-        // launch pair
-        if (!launch_pair(flow_to)) {
-            return;
+        for (LinkedList1Node *list_node = LinkedList1_GetFirst(&cls->clients_list); list_node; list_node = LinkedList1Node_Next(list_node)) {
+            struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, class_list_node);
+            ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
+            ASSERT(!client2->dying)
+            if (client2 == client) {
+                continue;
+            }
+            
+            // create flow from client to client2
+            struct peer_flow *flow_to = peer_flow_create(client, client2);
+            if (!flow_to) {
+                client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
+                goto fail;
+            }
+            
+            // create flow from client2 to client
+            struct peer_flow *flow_from = peer_flow_create(client2, client);
+            if (!flow_from) {
+                client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
+                goto fail;
+            }
+            
+            // set opposite flow pointers
+            flow_to->opposite = flow_from;
+            flow_from->opposite = flow_to;
+            
+            // launch pair
+            if (!launch_pair(flow_to)) {
+                return;
+            }
         }
     }
     
@@ -2097,25 +2332,15 @@ struct client_data * find_client_by_id (peerid_t id)
     return UPPER_OBJECT(node, struct client_data, tree_node);
 }
 
-int clients_allowed (struct client_data *client1, struct client_data *client2)
+int classes_allowed (struct client_class *class1, struct client_class *class2)
 {
-    ASSERT(client1->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client1->dying)
-    ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client2->dying)
-    
     if (!options.comm_predicate) {
         return 1;
     }
     
-    // set values to compare against
-    comm_predicate_p1name = (client1->common_name ? client1->common_name : "");
-    comm_predicate_p2name = (client2->common_name ? client2->common_name : "");
-    BAddr_GetIPAddr(&client1->addr, &comm_predicate_p1addr);
-    BAddr_GetIPAddr(&client2->addr, &comm_predicate_p2addr);
-    
     // evaluate predicate
-    int res = BPredicate_Eval(&comm_predicate);
+    uint32_t *atoms[] = {class1->atoms, class2->atoms};
+    int res = BPredicateProgram_Eval(&comm_program, (BPredicateProgram_atom_callback)predicate_atom_cb, atoms);
     if (res < 0) {
         return 0;
     }
@@ -2123,105 +2348,251 @@ int clients_allowed (struct client_data *client1, struct client_data *client2)
     return res;
 }
 
-int comm_predicate_func_p1name_cb (void *user, void **args)
+int relay_allowed (struct client_data *client, struct client_data *relay)
 {
-    char *arg = (char *)args[0];
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    ASSERT(relay->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!relay->dying)
+    
+    if (!options.relay_predicate) {
+        return 0;
+    }
+    
+    // evaluate predicate
+    uint32_t *atoms[] = {client->cls->atoms, relay->cls->atoms};
+    int res = BPredicateProgram_Eval(&relay_program, (BPredicateProgram_atom_callback)predicate_atom_cb, atoms);
+    if (res < 0) {
+        return 0;
+    }
     
-    return (!strcmp(arg, comm_predicate_p1name));
+    return res;
 }
 
-int comm_predicate_func_p2name_cb (void *user, void **args)
+int compile_predicate (BPredicateProgram *prog, char *str, int is_relay)
 {
-    char *arg = (char *)args[0];
+    // parse predicate
+    BPredicate predicate;
+    if (!BPredicate_Init(&predicate, str)) {
+        BLog(BLOG_ERROR, "BPredicate_Init failed");
+        goto fail0;
+    }
+    
+    // compile predicate
+    if (!BPredicateProgram_Init(prog, &predicate, (BPredicateProgram_compile_callback)predicate_compile_cb, &is_relay)) {
+        BLog(BLOG_ERROR, "BPredicateProgram_Init failed");
+        goto fail1;
+    }
     
-    return (!strcmp(arg, comm_predicate_p2name));
+    BPredicate_Free(&predicate);
+    
+    return 1;
+    
+fail1:
+    BPredicate_Free(&predicate);
+fail0:
+    return 0;
 }
 
-int comm_predicate_func_p1addr_cb (void *user, void **args)
+int predicate_compile_cb (int *is_relay, char *name, char **args, int num_args, int *out_atom)
 {
-    char *arg = (char *)args[0];
+    // functions testing the name of the first client, the second client,
+    // the address of the first client, the second client
+    static const char *comm_funcs[] = {"p1name", "p2name", "p1addr", "p2addr"};
+    static const char *relay_funcs[] = {"pname", "rname", "paddr", "raddr"};
+    const char **funcs = (*is_relay ? relay_funcs : comm_funcs);
+    
+    int func;
+    for (func = 0; func < 4; func++) {
+        if (!strcmp(name, funcs[func])) {
+            break;
+        }
+    }
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
-        return -1;
+    if (func == 4) {
+        BLog(BLOG_WARNING, "%s: unknown function, evaluates to error", name);
+        *out_atom = -1;
+        return 1;
     }
     
-    return BIPAddr_Compare(&addr, &comm_predicate_p1addr);
+    if (num_args != 1 || !args[0]) {
+        BLog(BLOG_WARNING, "%s: expecting one string argument, evaluates to error", name);
+        *out_atom = -1;
+        return 1;
+    }
+    
+    int atom;
+    if (!predicate_add_atom((func < 2 ? PREDICATE_ATOM_NAME : PREDICATE_ATOM_ADDR), args[0], &atom)) {
+        return 0;
+    }
+    
+    // low bit of the atom number selects the client
+    *out_atom = (atom < 0 ? -1 : 2 * atom + func % 2);
+    
+    return 1;
 }
 
-int comm_predicate_func_p2addr_cb (void *user, void **args)
+int predicate_add_atom (int type, char *str, int *out_atom)
 {
-    char *arg = (char *)args[0];
+    ASSERT(type == PREDICATE_ATOM_NAME || type == PREDICATE_ATOM_ADDR)
     
     BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
-        return -1;
+    if (type == PREDICATE_ATOM_ADDR && !BIPAddr_Resolve(&addr, str, 1)) {
+        BLog(BLOG_WARNING, "failed to parse address %s, evaluates to error", str);
+        *out_atom = -1;
+        return 1;
     }
     
-    return BIPAddr_Compare(&addr, &comm_predicate_p2addr);
-}
-
-int relay_allowed (struct client_data *client, struct client_data *relay)
-{
-    if (!options.relay_predicate) {
+    // find existing atom
+    for (int i = 0; i < predicate_num_atoms; i++) {
+        struct predicate_atom *a = &predicate_atoms[i];
+        if (a->type == type && (type == PREDICATE_ATOM_NAME ? !strcmp(a->name, str) : BIPAddr_Compare(&a->addr, &addr))) {
+            *out_atom = i;
+            return 1;
+        }
+    }
+    
+    // enlarge array
+    struct predicate_atom *new_atoms = (struct predicate_atom *)BReallocArray(predicate_atoms, predicate_num_atoms + 1, sizeof(predicate_atoms[0]));
+    if (!new_atoms) {
+        BLog(BLOG_ERROR, "BReallocArray failed");
         return 0;
     }
+    predicate_atoms = new_atoms;
     
-    // set values to compare against
-    relay_predicate_pname = (client->common_name ? client->common_name : "");
-    relay_predicate_rname = (relay->common_name ? relay->common_name : "");
-    BAddr_GetIPAddr(&client->addr, &relay_predicate_paddr);
-    BAddr_GetIPAddr(&relay->addr, &relay_predicate_raddr);
+    // add atom
+    struct predicate_atom *a = &predicate_atoms[predicate_num_atoms];
+    a->type = type;
+    if (type == PREDICATE_ATOM_NAME) {
+        if (!(a->name = b_strdup(str))) {
+            BLog(BLOG_ERROR, "b_strdup failed");
+            return 0;
+        }
+    } else {
+        a->addr = addr;
+    }
     
-    // evaluate predicate
-    int res = BPredicate_Eval(&relay_predicate);
-    if (res < 0) {
-        return 0;
+    *out_atom = predicate_num_atoms++;
+    
+    return 1;
+}
+
+void predicate_free_atoms (void)
+{
+    for (int i = 0; i < predicate_num_atoms; i++) {
+        if (predicate_atoms[i].type == PREDICATE_ATOM_NAME) {
+            free(predicate_atoms[i].name);
+        }
     }
     
-    return res;
+    BFree(predicate_atoms);
 }
 
-int relay_predicate_func_pname_cb (void *user, void **args)
+int predicate_atom_cb (uint32_t **atoms, int atom)
 {
-    char *arg = (char *)args[0];
+    ASSERT(atom >= 0)
+    ASSERT(atom / 2 < predicate_num_atoms)
     
-    return (!strcmp(arg, relay_predicate_pname));
+    uint32_t *client_atoms = atoms[atom % 2];
+    int i = atom / 2;
+    
+    return ((client_atoms[i / 32] >> (i % 32)) & 1);
 }
 
-int relay_predicate_func_rname_cb (void *user, void **args)
+void client_compute_atoms (struct client_data *client, uint32_t *atoms)
 {
-    char *arg = (char *)args[0];
+    const char *name = (client->common_name ? client->common_name : "");
+    BIPAddr addr;
+    BAddr_GetIPAddr(&client->addr, &addr);
+    
+    memset(atoms, 0, predicate_atoms_words * sizeof(atoms[0]));
     
-    return (!strcmp(arg, relay_predicate_rname));
+    for (int i = 0; i < predicate_num_atoms; i++) {
+        struct predicate_atom *a = &predicate_atoms[i];
+        
+        int match;
+        switch (a->type) {
+            case PREDICATE_ATOM_NAME:
+                match = !strcmp(a->name, name);
+                break;
+            case PREDICATE_ATOM_ADDR:
+                match = BIPAddr_Compare(&a->addr, &addr);
+                break;
+            default:
+                ASSERT(0)
+                match = 0;
+        }
+        
+        if (match) {
+            atoms[i / 32] |= (uint32_t)1 << (i % 32);
+        }
+    }
 }
 
-int relay_predicate_func_paddr_cb (void *user, void **args)
+int client_join_class (struct client_data *client)
 {
-    char *arg = (char *)args[0];
+    ASSERT(client->initstatus == INITSTATUS_WAITHELLO)
+    ASSERT(!client->dying)
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_ERROR, "paddr: failed to parse address");
-        return -1;
+    // compute which atoms the client matches
+    client_compute_atoms(client, predicate_atoms_scratch);
+    
+    // lookup class
+    struct client_class *cls;
+    BAVLNode *node = BAVL_LookupExact(&classes_tree, predicate_atoms_scratch);
+    if (node) {
+        cls = UPPER_OBJECT(node, struct client_class, tree_node);
+    } else {
+        // allocate class
+        bsize_t size = bsize_add(bsize_fromsize(sizeof(*cls)), bsize_mul(bsize_fromsize(predicate_atoms_words), bsize_fromsize(sizeof(cls->atoms[0]))));
+        if (!(cls = (struct client_class *)BAllocSize(size))) {
+            client_log(client, BLOG_ERROR, "failed to allocate class");
+            return 0;
+        }
+        
+        // init class
+        memcpy(cls->atoms, predicate_atoms_scratch, predicate_atoms_words * sizeof(cls->atoms[0]));
+        LinkedList1_Init(&cls->clients_list);
+        
+        // link in
+        LinkedList1_Append(&classes_list, &cls->list_node);
+        ASSERT_EXECUTE(BAVL_Insert(&classes_tree, &cls->tree_node, NULL))
     }
     
-    return BIPAddr_Compare(&addr, &relay_predicate_paddr);
+    // add client to class
+    LinkedList1_Append(&cls->clients_list, &client->class_list_node);
+    client->cls = cls;
+    
+    return 1;
 }
 
-int relay_predicate_func_raddr_cb (void *user, void **args)
+void client_leave_class (struct client_data *client)
 {
-    char *arg = (char *)args[0];
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_ERROR, "raddr: failed to parse address");
-        return -1;
+    struct client_class *cls = client->cls;
+    
+    // remove client from class
+    LinkedList1_Remove(&cls->clients_list, &client->class_list_node);
+    
+    // free class if it's empty
+    if (LinkedList1_IsEmpty(&cls->clients_list)) {
+        BAVL_Remove(&classes_tree, &cls->tree_node);
+        LinkedList1_Remove(&classes_list, &cls->list_node);
+        BFree(cls);
+    }
+}
+
+int atoms_comparator (void *unused, uint32_t *a1, uint32_t *a2)
+{
+    for (int i = 0; i < predicate_atoms_words; i++) {
+        if (a1[i] != a2[i]) {
+            return B_COMPARE(a1[i], a2[i]);
+        }
     }
     
-    return BIPAddr_Compare(&addr, &relay_predicate_raddr);
+    return 0;
 }
 
 int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2)
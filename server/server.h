@@ -38,9 +38,15 @@
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketProtoFlow.h>
 #include <system/BReactor.h>
+#include <system/BDeadlineTimer.h>
 #include <system/BConnection.h>
+#include <system/BAddr.h>
 #include <nspr_support/BSSLConnection.h>
 
+#ifndef BADVPN_USE_WINAPI
+#include <server/ClientShard.h>
+#endif
+
 // name of the program
 #define PROGRAM_NAME "server"
 
@@ -62,6 +68,12 @@
 // maxiumum listen addresses
 #define MAX_LISTEN_ADDRS 16
 
+// maximum number of client shards
+#define MAX_SHARDS 64
+// packets in each direction of a client which may be in transit between
+// the main thread and the client's shard
+#define CLIENT_SHARD_WINDOW 16
+
 //#define SIMULATE_OUT_OF_CONTROL_BUFFER 20
 //#define SIMULATE_OUT_OF_FLOW_BUFFER 100
 
@@ -75,9 +87,34 @@
 
 #define INITSTATUS_HASLINK(status) ((status) == INITSTATUS_WAITHELLO || (status) == INITSTATUS_COMPLETE)
 
+// predicate atom types
+#define PREDICATE_ATOM_NAME 1
+#define PREDICATE_ATOM_ADDR 2
+
 struct client_data;
 struct peer_know;
 
+// client attribute tested by the predicates, e.g. p1name("x") and p2name("x")
+// both test the common name against "x"
+struct predicate_atom {
+    int type;
+    char *name;
+    BIPAddr addr;
+};
+
+// set of clients which match the same predicate atoms, and so are allowed
+// to communicate with the same clients
+struct client_class {
+    // node in classes list
+    LinkedList1Node list_node;
+    // node in classes tree (by atoms)
+    BAVLNode tree_node;
+    // complete, non-dying clients in the class
+    LinkedList1 clients_list;
+    // which atoms the clients match, as a bitmap
+    uint32_t atoms[];
+};
+
 struct peer_flow {
     // source client
     struct client_data *src_client;
@@ -123,6 +160,12 @@ struct client_data {
     BConnection con;
     BAddr addr;
     
+    #ifndef BADVPN_USE_WINAPI
+    // connection handled by a shard, if using shards; instead of the socket,
+    // SSL connection, input decoder and output sender
+    ClientShardConn sconn;
+    #endif
+    
     // SSL connection, if using SSL
     PRFileDesc bottom_prfd;
     PRFileDesc *ssl_prfd;
@@ -142,11 +185,15 @@ struct client_data {
     int version;
     
     // no data timer
-    BTimer disconnect_timer;
+    BDeadlineTimer disconnect_timer;
     
     // client ID
     peerid_t id;
     
+    // authorization class, only when initstatus == INITSTATUS_COMPLETE and not dying
+    struct client_class *cls;
+    LinkedList1Node class_list_node;
+    
     // node in clients linked list
     LinkedList1Node list_node;
     // node in clients tree (by ID)
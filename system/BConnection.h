@@ -57,6 +57,7 @@ struct BLisCon_from {
     union {
         struct {
             BAddr addr;
+            int reuse_port;
         } from_addr;
 #ifndef BADVPN_USE_WINAPI
         struct {
@@ -71,9 +72,25 @@ static struct BLisCon_from BLisCon_from_addr (BAddr addr)
     struct BLisCon_from res;
     res.type = BLISCON_FROM_ADDR;
     res.u.from_addr.addr = addr;
+    res.u.from_addr.reuse_port = 0;
     return res;
 }
 
+#ifdef BADVPN_LINUX
+/**
+ * Like {@link BLisCon_from_addr}, but for {@link BListener_InitFrom} only, makes the
+ * listening socket use SO_REUSEPORT. Several listeners, typically each in its own
+ * thread, can then listen on the same address, and the kernel distributes incoming
+ * connections among them.
+ */
+static struct BLisCon_from BLisCon_from_addr_reuseport (BAddr addr)
+{
+    struct BLisCon_from res = BLisCon_from_addr(addr);
+    res.u.from_addr.reuse_port = 1;
+    return res;
+}
+#endif
+
 #ifndef BADVPN_USE_WINAPI
 static struct BLisCon_from BLisCon_from_unix (char const *socket_path)
 {
@@ -151,6 +168,20 @@ int BListener_InitUnix (BListener *o, const char *socket_path, BReactor *reactor
  */
 void BListener_Free (BListener *o);
 
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Accepts a connection ready on the listener, returning the raw socket
+ * instead of a {@link BConnection}, so that it can be handed over to another
+ * thread. Must be called from the job closure of the listener's
+ * {@link BListener_handler}, and must be the first attempt to accept there.
+ * 
+ * @param o the object
+ * @param out_addr if not NULL, the address of the client will be returned here
+ * @return non-blocking socket which the caller must close, or -1 on failure
+ */
+int BListener_AcceptFd (BListener *o, BAddr *out_addr);
+#endif
+
 
 
 struct BConnector_s;
@@ -256,6 +256,7 @@ static void connection_send (BConnection *o)
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_WRITE);
             o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -296,6 +297,7 @@ static void connection_recv (BConnection *o)
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
             o->wait_events |= BREACTOR_READ;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -519,6 +521,16 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
             BLog(BLOG_ERROR, "setsockopt(SO_REUSEADDR) failed");
         }
         
+#ifdef BADVPN_LINUX
+        // set SO_REUSEPORT
+        if (from.u.from_addr.reuse_port) {
+            if (setsockopt(o->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(SO_REUSEPORT) failed");
+                goto fail2;
+            }
+        }
+#endif
+        
         // bind
         if (bind(o->fd, &sysaddr.addr.generic, sysaddr.len) < 0) {
             BLog(BLOG_ERROR, "bind failed");
@@ -590,6 +602,40 @@ void BListener_Free (BListener *o)
     }
 }
 
+int BListener_AcceptFd (BListener *o, BAddr *out_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(BPending_IsSet(&o->default_job))
+    
+    // unset default job
+    BPending_Unset(&o->default_job);
+    
+    // accept
+    struct sys_addr sysaddr;
+    sysaddr.len = sizeof(sysaddr.addr);
+    int fd = accept(o->fd, &sysaddr.addr.generic, &sysaddr.len);
+    if (fd < 0) {
+        BLog(BLOG_ERROR, "accept failed");
+        return -1;
+    }
+    
+    // set non-blocking
+    if (!badvpn_set_nonblocking(fd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        if (close(fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+        return -1;
+    }
+    
+    // return address
+    if (out_addr) {
+        addr_sys_to_socket(out_addr, sysaddr);
+    }
+    
+    return fd;
+}
+
 int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
                          BConnector_handler handler)
 {
@@ -801,7 +847,7 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)connection_fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+    if (!BReactor_AddFileDescriptor2(o->reactor, &o->bfd, BREACTOR_FD_FLAG_EDGE)) {
         BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
         goto fail1;
     }
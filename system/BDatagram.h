@@ -200,6 +200,54 @@ void BDatagram_RecvAsync_Free (BDatagram *o);
  */
 PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o);
 
+#ifdef BADVPN_LINUX
+
+/**
+ * Enables batched sending.
+ * The send interface must be initialized and not busy, and batching must not
+ * already be enabled for it. Batching stays enabled until the send interface
+ * is freed.
+ * 
+ * Datagrams submitted to the send interface are put into an internal ring of
+ * batch_size datagrams, together with the addresses set by
+ * {@link BDatagram_SetSendAddrs} at that time. Datagrams up to 2048 bytes are
+ * copied into the ring and finished immediately; larger ones are sent from the
+ * sender's buffer and finished once sent. The ring is sent with a single
+ * sendmmsg() call once the sender stops submitting datagrams within the same
+ * round of jobs, or it becomes full; slots are reused as soon as they are sent.
+ * Datagrams still in the ring when the send interface is freed are discarded.
+ * 
+ * Available on Linux only.
+ * 
+ * @param o the object
+ * @param batch_size maximum number of datagrams sent at once. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetSendBatch (BDatagram *o, int batch_size) WARN_UNUSED;
+
+/**
+ * Enables batched receiving.
+ * The receive interface must be initialized and not busy, and batching must not
+ * already be enabled for it. Batching stays enabled until the receive interface
+ * is freed.
+ * 
+ * Datagrams are received with recvmmsg(), up to batch_size at once, into an
+ * area shared by all batched receivers of the thread, then packed into an
+ * internal buffer, and each receive request is served from it while it is not
+ * empty. The internal buffer is sized for batch_size datagrams of 2048 bytes,
+ * and only grows while larger datagrams are pending. {@link BDatagram_GetLastReceiveAddrs} returns the addresses of the
+ * datagram last delivered through the receive interface.
+ * 
+ * Available on Linux only.
+ * 
+ * @param o the object
+ * @param batch_size maximum number of datagrams received at once. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetRecvBatch (BDatagram *o, int batch_size) WARN_UNUSED;
+
+#endif
+
 #ifdef BADVPN_USE_WINAPI
 #include "BDatagram_win.h"
 #else
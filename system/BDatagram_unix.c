@@ -43,6 +43,7 @@
 #endif
 
 #include <misc/nonblocking.h>
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include "BDatagram.h"
@@ -61,13 +62,60 @@ struct sys_addr {
     } addr;
 };
 
+union pktinfo_cdata {
+#ifdef BADVPN_FREEBSD
+    char in[CMSG_SPACE(sizeof(struct in_addr))];
+#else
+    char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#endif
+    char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+};
+
+#ifdef BADVPN_LINUX
+
+// Expected datagram size. Batch buffers are sized from this rather than from the
+// MTU, which may be much larger (e.g. 65520 in udpgw).
+#define BATCH_SLOT_SIZE 2048
+
+struct BDatagram_batch_slot {
+    struct sys_addr sysaddr;
+    struct iovec iov;
+    union pktinfo_cdata cdata;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    int len;
+    size_t offset; // receive only, position in the packed buffer
+};
+
+// Area recvmmsg() receives into, shared by the batched receivers of a thread.
+// Received datagrams are packed into the object's own buffer right away, so this
+// is only used within batch_recv().
+static __thread struct {
+    uint8_t *data;
+    size_t size;
+    int refs;
+} batch_landing;
+
+#endif
+
 static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void set_pktinfo (int fd, int family);
+static void init_send_msg (struct msghdr *msg, struct sys_addr *sysaddr, struct iovec *iov, union pktinfo_cdata *cdata, BAddr remote_addr, BIPAddr local_addr);
+static void init_recv_msg (struct msghdr *msg, struct sys_addr *sysaddr, struct iovec *iov, union pktinfo_cdata *cdata);
+static void read_recv_msg (struct msghdr *msg, struct sys_addr *sysaddr, BAddr *out_remote_addr, BIPAddr *out_local_addr);
 static void report_error (BDatagram *o);
+static void start_recv (BDatagram *o);
+static int send_waiting (BDatagram *o);
 static void do_send (BDatagram *o);
 static void do_recv (BDatagram *o);
+#ifdef BADVPN_LINUX
+static void batch_send (BDatagram *o);
+static void batch_accept (BDatagram *o);
+static void batch_recv (BDatagram *o);
+static void batch_deliver (BDatagram *o);
+#endif
 static void fd_handler (BDatagram *o, int events);
 static void send_job_handler (BDatagram *o);
 static void recv_job_handler (BDatagram *o);
@@ -231,61 +279,24 @@ static void set_pktinfo (int fd, int family)
     }
 }
 
-static void report_error (BDatagram *o)
-{
-    DebugError_AssertNoError(&o->d_err);
-    
-    // report error
-    DEBUGERROR(&o->d_err, o->handler(o->user, BDATAGRAM_EVENT_ERROR));
-    return;
-}
-
-static void do_send (BDatagram *o)
+static void init_send_msg (struct msghdr *msg, struct sys_addr *sysaddr, struct iovec *iov, union pktinfo_cdata *cdata, BAddr remote_addr, BIPAddr local_addr)
 {
-    DebugError_AssertNoError(&o->d_err);
-    ASSERT(o->send.inited)
-    ASSERT(o->send.busy)
-    ASSERT(o->send.have_addrs)
-    
-    // limit
-    if (!BReactorLimit_Increment(&o->send.limit)) {
-        // wait for fd
-        o->wait_events |= BREACTOR_WRITE;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-        return;
-    }
-    
     // convert destination address
-    struct sys_addr sysaddr;
-    addr_socket_to_sys(&sysaddr, o->send.remote_addr);
+    addr_socket_to_sys(sysaddr, remote_addr);
     
-    struct iovec iov;
-    iov.iov_base = (uint8_t *)o->send.busy_data;
-    iov.iov_len = o->send.busy_data_len;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = &sysaddr->addr.generic;
+    msg->msg_namelen = sysaddr->len;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    msg->msg_control = cdata;
+    msg->msg_controllen = sizeof(*cdata);
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
-    
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sysaddr.addr.generic;
-    msg.msg_namelen = sysaddr.len;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = &cdata;
-    msg.msg_controllen = sizeof(cdata);
-    
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
     
     size_t controllen = 0;
     
-    switch (o->send.local_addr.type) {
+    switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
 #ifdef BADVPN_FREEBSD
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
@@ -293,7 +304,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_SENDSRCADDR;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
             struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            addrinfo->s_addr = o->send.local_addr.ipv4;
+            addrinfo->s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_addr));
 #else
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
@@ -301,7 +312,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
             struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            pktinfo->ipi_spec_dst.s_addr = o->send.local_addr.ipv4;
+            pktinfo->ipi_spec_dst.s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
 #endif
         } break;
@@ -312,22 +323,124 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IPV6_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
             struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            memcpy(pktinfo->ipi6_addr.s6_addr, o->send.local_addr.ipv6, 16);
+            memcpy(pktinfo->ipi6_addr.s6_addr, local_addr.ipv6, 16);
             controllen += CMSG_SPACE(sizeof(struct in6_pktinfo));
         } break;
     }
     
-    msg.msg_controllen = controllen;
+    msg->msg_controllen = controllen;
     
-    if (msg.msg_controllen == 0) {
-        msg.msg_control = NULL;
+    if (msg->msg_controllen == 0) {
+        msg->msg_control = NULL;
     }
+}
+
+static void init_recv_msg (struct msghdr *msg, struct sys_addr *sysaddr, struct iovec *iov, union pktinfo_cdata *cdata)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = &sysaddr->addr.generic;
+    msg->msg_namelen = sizeof(sysaddr->addr);
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    msg->msg_control = cdata;
+    msg->msg_controllen = sizeof(*cdata);
+}
+
+static void read_recv_msg (struct msghdr *msg, struct sys_addr *sysaddr, BAddr *out_remote_addr, BIPAddr *out_local_addr)
+{
+    // read returned address
+    sysaddr->len = msg->msg_namelen;
+    addr_sys_to_socket(out_remote_addr, *sysaddr);
+    
+    // read returned local address
+    BIPAddr_InitInvalid(out_local_addr);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef BADVPN_FREEBSD
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
+            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv4(out_local_addr, addrinfo->s_addr);
+        }
+#else
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv4(out_local_addr, pktinfo->ipi_addr.s_addr);
+        }
+#endif
+        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+            BIPAddr_InitIPv6(out_local_addr, pktinfo->ipi6_addr.s6_addr);
+        }
+    }
+}
+
+static void report_error (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    
+    // report error
+    DEBUGERROR(&o->d_err, o->handler(o->user, BDATAGRAM_EVENT_ERROR));
+    return;
+}
+
+static void start_recv (BDatagram *o)
+{
+    // if recv wasn't started yet, start it
+    if (!o->recv.started) {
+        // set recv started
+        o->recv.started = 1;
+        
+        // continue receiving
+        if (o->recv.inited && o->recv.busy) {
+            BPending_Set(&o->recv.job);
+        }
+    }
+}
+
+static int send_waiting (BDatagram *o)
+{
+    ASSERT(o->send.inited)
+    
+#ifdef BADVPN_LINUX
+    if (o->send.batch_size > 0) {
+        return (o->send.batch_used > 0);
+    }
+#endif
+    
+    return (o->send.busy && o->send.have_addrs);
+}
+
+static void do_send (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    struct sys_addr sysaddr;
+    
+    struct iovec iov;
+    iov.iov_base = (uint8_t *)o->send.busy_data;
+    iov.iov_len = o->send.busy_data_len;
+    
+    union pktinfo_cdata cdata;
+    
+    struct msghdr msg;
+    init_send_msg(&msg, &sysaddr, &iov, &cdata, o->send.remote_addr, o->send.local_addr);
     
     // send
     int bytes = sendmsg(o->fd, &msg, 0);
     if (bytes < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_WRITE);
             o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -346,15 +459,7 @@ static void do_send (BDatagram *o)
     }
     
     // if recv wasn't started yet, start it
-    if (!o->recv.started) {
-        // set recv started
-        o->recv.started = 1;
-        
-        // continue receiving
-        if (o->recv.inited && o->recv.busy) {
-            BPending_Set(&o->recv.job);
-        }
-    }
+    start_recv(o);
     
     // set not busy
     o->send.busy = 0;
@@ -384,29 +489,17 @@ static void do_recv (BDatagram *o)
     iov.iov_base = o->recv.busy_data;
     iov.iov_len = o->recv.mtu;
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
+    union pktinfo_cdata cdata;
     
     struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sysaddr.addr.generic;
-    msg.msg_namelen = sizeof(sysaddr.addr);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = &cdata;
-    msg.msg_controllen = sizeof(cdata);
+    init_recv_msg(&msg, &sysaddr, &iov, &cdata);
     
     // recv
     int bytes = recvmsg(o->fd, &msg, 0);
     if (bytes < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
             o->wait_events |= BREACTOR_READ;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -420,27 +513,281 @@ static void do_recv (BDatagram *o)
     ASSERT(bytes >= 0)
     ASSERT(bytes <= o->recv.mtu)
     
-    // read returned address
-    sysaddr.len = msg.msg_namelen;
-    addr_sys_to_socket(&o->recv.remote_addr, sysaddr);
+    // read returned addresses
+    read_recv_msg(&msg, &sysaddr, &o->recv.remote_addr, &o->recv.local_addr);
     
-    // read returned local address
-    BIPAddr_InitInvalid(&o->recv.local_addr);
-    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-#ifdef BADVPN_FREEBSD
-        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
-            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv4(&o->recv.local_addr, addrinfo->s_addr);
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+#ifdef BADVPN_LINUX
+
+static int landing_ref (size_t size)
+{
+    if (size > batch_landing.size) {
+        uint8_t *new_data = BRealloc(batch_landing.data, size);
+        if (!new_data) {
+            BLog(BLOG_ERROR, "BRealloc failed");
+            return 0;
         }
-#else
-        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
-            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv4(&o->recv.local_addr, pktinfo->ipi_addr.s_addr);
+        batch_landing.data = new_data;
+        batch_landing.size = size;
+    }
+    
+    batch_landing.refs++;
+    
+    return 1;
+}
+
+static void landing_unref (void)
+{
+    ASSERT(batch_landing.refs > 0)
+    
+    if (--batch_landing.refs == 0) {
+        BFree(batch_landing.data);
+        batch_landing.data = NULL;
+        batch_landing.size = 0;
+    }
+}
+
+static void batch_send (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch_size > 0)
+    ASSERT(o->send.batch_used > 0)
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    // build messages, in ring order
+    for (int i = 0; i < o->send.batch_used; i++) {
+        struct BDatagram_batch_slot *slot = &o->send.batch_slots[(o->send.batch_start + i) % o->send.batch_size];
+        init_send_msg(&o->send.batch_msgs[i].msg_hdr, &slot->sysaddr, &slot->iov, &slot->cdata, slot->remote_addr, slot->local_addr);
+    }
+    
+    // send
+    int num = sendmmsg(o->fd, o->send.batch_msgs, o->send.batch_used, 0);
+    if (num < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_WRITE);
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
         }
-#endif
-        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
-            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            BIPAddr_InitIPv6(&o->recv.local_addr, pktinfo->ipi6_addr.s6_addr);
+        
+        BLog(BLOG_ERROR, "sendmmsg failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(num > 0)
+    ASSERT(num <= o->send.batch_used)
+    
+    for (int i = 0; i < num; i++) {
+        if (o->send.batch_msgs[i].msg_len < (unsigned int)o->send.batch_slots[(o->send.batch_start + i) % o->send.batch_size].len) {
+            BLog(BLOG_ERROR, "send sent too little");
+        }
+    }
+    
+    // release sent datagrams; their slots can be reused right away
+    o->send.batch_start = (o->send.batch_start + num) % o->send.batch_size;
+    o->send.batch_used -= num;
+    
+    // if recv wasn't started yet, start it
+    start_recv(o);
+    
+    // send any remaining datagrams later
+    if (o->send.batch_used > 0) {
+        BPending_Set(&o->send.job);
+    }
+    
+    // a datagram sent from the sender's buffer is the last one in the ring;
+    // finish it once it's out
+    if (o->send.busy_ref) {
+        if (o->send.batch_used == 0) {
+            o->send.busy_ref = 0;
+            o->send.busy = 0;
+            PacketPassInterface_Done(&o->send.iface);
+        }
+        return;
+    }
+    
+    // accept a waiting datagram
+    if (o->send.busy) {
+        batch_accept(o);
+        return;
+    }
+}
+
+static void batch_accept (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch_size > 0)
+    ASSERT(o->send.busy)
+    ASSERT(!o->send.busy_ref)
+    
+    // wait for addresses or for space
+    if (!o->send.have_addrs || o->send.batch_used == o->send.batch_size) {
+        return;
+    }
+    
+    // add datagram to the end of the ring, with the current addresses
+    int index = (o->send.batch_start + o->send.batch_used) % o->send.batch_size;
+    struct BDatagram_batch_slot *slot = &o->send.batch_slots[index];
+    slot->len = o->send.busy_data_len;
+    slot->iov.iov_len = slot->len;
+    slot->remote_addr = o->send.remote_addr;
+    slot->local_addr = o->send.local_addr;
+    o->send.batch_used++;
+    
+    // send the batch once the sender has nothing more to give right away; the job
+    // is set before finishing the packet so that the sender's done job runs first
+    BPending_Set(&o->send.job);
+    
+    // a datagram too large for a slot is sent from the sender's buffer, and
+    // finished only after it has been sent
+    if (o->send.busy_data_len > o->send.batch_slot_size) {
+        slot->iov.iov_base = (uint8_t *)o->send.busy_data;
+        o->send.busy_ref = 1;
+        return;
+    }
+    
+    slot->iov.iov_base = o->send.batch_data + (size_t)index * o->send.batch_slot_size;
+    memcpy(slot->iov.iov_base, o->send.busy_data, o->send.busy_data_len);
+    
+    // set not busy
+    o->send.busy = 0;
+    
+    // done
+    PacketPassInterface_Done(&o->send.iface);
+}
+
+static void batch_recv (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.batch_size > 0)
+    ASSERT(o->recv.batch_used == 0)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.started)
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->recv.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_READ;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    ASSERT(batch_landing.size >= (size_t)o->recv.batch_size * o->recv.mtu)
+    
+    // build messages
+    for (int i = 0; i < o->recv.batch_size; i++) {
+        struct BDatagram_batch_slot *slot = &o->recv.batch_slots[i];
+        slot->iov.iov_base = batch_landing.data + (size_t)i * o->recv.mtu;
+        slot->iov.iov_len = o->recv.mtu;
+        init_recv_msg(&o->recv.batch_msgs[i].msg_hdr, &slot->sysaddr, &slot->iov, &slot->cdata);
+    }
+    
+    // recv
+    int num = recvmmsg(o->fd, o->recv.batch_msgs, o->recv.batch_size, 0, NULL);
+    if (num < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recvmmsg failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(num > 0)
+    ASSERT(num <= o->recv.batch_size)
+    
+    // read returned addresses and count bytes
+    size_t total = 0;
+    for (int i = 0; i < num; i++) {
+        struct BDatagram_batch_slot *slot = &o->recv.batch_slots[i];
+        slot->len = o->recv.batch_msgs[i].msg_len;
+        read_recv_msg(&o->recv.batch_msgs[i].msg_hdr, &slot->sysaddr, &slot->remote_addr, &slot->local_addr);
+        total += slot->len;
+    }
+    
+    // grow the packed buffer if these are larger than expected; it's shrunk
+    // back once they have been delivered
+    if (total > o->recv.batch_data_size) {
+        uint8_t *new_data = BRealloc(o->recv.batch_data, total);
+        if (!new_data) {
+            BLog(BLOG_ERROR, "BRealloc failed, dropping %d datagrams", num);
+            BPending_Set(&o->recv.job);
+            return;
+        }
+        o->recv.batch_data = new_data;
+        o->recv.batch_data_size = total;
+    }
+    
+    // pack datagrams into our buffer
+    size_t offset = 0;
+    for (int i = 0; i < num; i++) {
+        struct BDatagram_batch_slot *slot = &o->recv.batch_slots[i];
+        memcpy(o->recv.batch_data + offset, slot->iov.iov_base, slot->len);
+        slot->offset = offset;
+        offset += slot->len;
+    }
+    
+    o->recv.batch_start = 0;
+    o->recv.batch_used = num;
+    
+    batch_deliver(o);
+    return;
+}
+
+static void batch_deliver (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.batch_size > 0)
+    ASSERT(o->recv.batch_used > 0)
+    ASSERT(o->recv.busy)
+    
+    struct BDatagram_batch_slot *slot = &o->recv.batch_slots[o->recv.batch_start];
+    int len = slot->len;
+    
+    ASSERT(len >= 0)
+    ASSERT(len <= o->recv.mtu)
+    
+    // copy out the oldest datagram
+    memcpy(o->recv.busy_data, o->recv.batch_data + slot->offset, len);
+    o->recv.remote_addr = slot->remote_addr;
+    o->recv.local_addr = slot->local_addr;
+    
+    o->recv.batch_start++;
+    o->recv.batch_used--;
+    
+    // shrink the packed buffer back if it was grown
+    if (o->recv.batch_used == 0 && o->recv.batch_data_size > o->recv.batch_data_size_initial) {
+        uint8_t *new_data = BRealloc(o->recv.batch_data, o->recv.batch_data_size_initial);
+        if (new_data) {
+            o->recv.batch_data = new_data;
+            o->recv.batch_data_size = o->recv.batch_data_size_initial;
         }
     }
     
@@ -451,9 +798,11 @@ static void do_recv (BDatagram *o)
     o->recv.busy = 0;
     
     // done
-    PacketRecvInterface_Done(&o->recv.iface, bytes);
+    PacketRecvInterface_Done(&o->recv.iface, len);
 }
 
+#endif
+
 static void fd_handler (BDatagram *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -466,10 +815,9 @@ static void fd_handler (BDatagram *o, int events)
     int have_send = 0;
     int have_recv = 0;
     
-    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && o->send.busy && o->send.have_addrs)) {
+    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && send_waiting(o))) {
         ASSERT(o->send.inited)
-        ASSERT(o->send.busy)
-        ASSERT(o->send.have_addrs)
+        ASSERT(send_waiting(o))
         
         have_send = 1;
     }
@@ -487,11 +835,25 @@ static void fd_handler (BDatagram *o, int events)
             BPending_Set(&o->recv.job);
         }
         
+#ifdef BADVPN_LINUX
+        if (o->send.batch_size > 0) {
+            batch_send(o);
+            return;
+        }
+#endif
+        
         do_send(o);
         return;
     }
     
     if (have_recv) {
+#ifdef BADVPN_LINUX
+        if (o->recv.batch_size > 0) {
+            batch_recv(o);
+            return;
+        }
+#endif
+        
         do_recv(o);
         return;
     }
@@ -506,6 +868,24 @@ static void send_job_handler (BDatagram *o)
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->send.inited)
+    
+#ifdef BADVPN_LINUX
+    if (o->send.batch_size > 0) {
+        if (o->send.batch_used > 0) {
+            // don't send while already waiting for the fd
+            if (!(o->wait_events & BREACTOR_WRITE)) {
+                batch_send(o);
+            }
+            return;
+        }
+        
+        if (o->send.busy && !o->send.busy_ref) {
+            batch_accept(o);
+        }
+        return;
+    }
+#endif
+    
     ASSERT(o->send.busy)
     ASSERT(o->send.have_addrs)
     
@@ -521,6 +901,18 @@ static void recv_job_handler (BDatagram *o)
     ASSERT(o->recv.busy)
     ASSERT(o->recv.started)
     
+#ifdef BADVPN_LINUX
+    if (o->recv.batch_size > 0) {
+        if (o->recv.batch_used > 0) {
+            batch_deliver(o);
+            return;
+        }
+        
+        batch_recv(o);
+        return;
+    }
+#endif
+    
     do_recv(o);
     return;
 }
@@ -541,6 +933,13 @@ static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len)
     // set busy
     o->send.busy = 1;
     
+#ifdef BADVPN_LINUX
+    if (o->send.batch_size > 0) {
+        batch_accept(o);
+        return;
+    }
+#endif
+    
     // if have no addresses, wait
     if (!o->send.have_addrs) {
         return;
@@ -563,6 +962,14 @@ static void recv_if_handler_recv (BDatagram *o, uint8_t *data)
     // set busy
     o->recv.busy = 1;
     
+#ifdef BADVPN_LINUX
+    // deliver a datagram that was already received
+    if (o->recv.batch_size > 0 && o->recv.batch_used > 0) {
+        batch_deliver(o);
+        return;
+    }
+#endif
+    
     // if recv not started yet, wait
     if (!o->recv.started) {
         return;
@@ -615,7 +1022,7 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+    if (!BReactor_AddFileDescriptor2(o->reactor, &o->bfd, BREACTOR_FD_FLAG_EDGE)) {
         BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
         goto fail1;
     }
@@ -687,15 +1094,7 @@ int BDatagram_Bind (BDatagram *o, BAddr addr)
     }
     
     // if recv wasn't started yet, start it
-    if (!o->recv.started) {
-        // set recv started
-        o->recv.started = 1;
-        
-        // continue receiving
-        if (o->recv.inited && o->recv.busy) {
-            BPending_Set(&o->recv.job);
-        }
-    }
+    start_recv(o);
     
     return 1;
 }
@@ -773,6 +1172,11 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     // set not busy
     o->send.busy = 0;
     
+#ifdef BADVPN_LINUX
+    // set no batching
+    o->send.batch_size = 0;
+#endif
+    
     // set inited
     o->send.inited = 1;
 }
@@ -786,6 +1190,15 @@ void BDatagram_SendAsync_Free (BDatagram *o)
     o->wait_events &= ~BREACTOR_WRITE;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef BADVPN_LINUX
+    // free batch
+    if (o->send.batch_size > 0) {
+        BFree(o->send.batch_msgs);
+        BFree(o->send.batch_slots);
+        BFree(o->send.batch_data);
+    }
+#endif
+    
     // free job
     BPending_Free(&o->send.job);
     
@@ -823,6 +1236,11 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     // set not busy
     o->recv.busy = 0;
     
+#ifdef BADVPN_LINUX
+    // set no batching
+    o->recv.batch_size = 0;
+#endif
+    
     // set inited
     o->recv.inited = 1;
 }
@@ -836,6 +1254,16 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
     o->wait_events &= ~BREACTOR_READ;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef BADVPN_LINUX
+    // free batch
+    if (o->recv.batch_size > 0) {
+        BFree(o->recv.batch_msgs);
+        BFree(o->recv.batch_slots);
+        BFree(o->recv.batch_data);
+        landing_unref();
+    }
+#endif
+    
     // free job
     BPending_Free(&o->recv.job);
     
@@ -853,3 +1281,97 @@ PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
     
     return &o->recv.iface;
 }
+
+#ifdef BADVPN_LINUX
+
+int BDatagram_SetSendBatch (BDatagram *o, int batch_size)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(!o->send.busy)
+    ASSERT(o->send.batch_size == 0)
+    ASSERT(batch_size > 0)
+    
+    int slot_size = (o->send.mtu < BATCH_SLOT_SIZE ? o->send.mtu : BATCH_SLOT_SIZE);
+    
+    if (!(o->send.batch_data = BAllocArray2(batch_size, slot_size, 1))) {
+        BLog(BLOG_ERROR, "BAllocArray2 failed");
+        goto fail0;
+    }
+    
+    if (!(o->send.batch_slots = BAllocArray(batch_size, sizeof(o->send.batch_slots[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    if (!(o->send.batch_msgs = BAllocArray(batch_size, sizeof(o->send.batch_msgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    o->send.batch_size = batch_size;
+    o->send.batch_slot_size = slot_size;
+    o->send.batch_start = 0;
+    o->send.batch_used = 0;
+    o->send.busy_ref = 0;
+    
+    return 1;
+    
+fail2:
+    BFree(o->send.batch_slots);
+fail1:
+    BFree(o->send.batch_data);
+fail0:
+    return 0;
+}
+
+int BDatagram_SetRecvBatch (BDatagram *o, int batch_size)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(!o->recv.busy)
+    ASSERT(o->recv.batch_size == 0)
+    ASSERT(batch_size > 0)
+    
+    if (!landing_ref((size_t)batch_size * o->recv.mtu)) {
+        goto fail0;
+    }
+    
+    size_t data_size = (size_t)batch_size * (o->recv.mtu < BATCH_SLOT_SIZE ? o->recv.mtu : BATCH_SLOT_SIZE);
+    
+    if (!(o->recv.batch_data = BAlloc(data_size))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0a;
+    }
+    
+    if (!(o->recv.batch_slots = BAllocArray(batch_size, sizeof(o->recv.batch_slots[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    if (!(o->recv.batch_msgs = BAllocArray(batch_size, sizeof(o->recv.batch_msgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    o->recv.batch_size = batch_size;
+    o->recv.batch_data_size = data_size;
+    o->recv.batch_data_size_initial = data_size;
+    o->recv.batch_start = 0;
+    o->recv.batch_used = 0;
+    
+    return 1;
+    
+fail2:
+    BFree(o->recv.batch_slots);
+fail1:
+    BFree(o->recv.batch_data);
+fail0a:
+    landing_unref();
+fail0:
+    return 0;
+}
+
+#endif
@@ -33,6 +33,9 @@
 #define BDATAGRAM_SEND_LIMIT 2
 #define BDATAGRAM_RECV_LIMIT 2
 
+struct BDatagram_batch_slot;
+struct mmsghdr;
+
 struct BDatagram_s {
     BReactor *reactor;
     void *user;
@@ -52,6 +55,16 @@ struct BDatagram_s {
         int busy;
         const uint8_t *busy_data;
         int busy_data_len;
+#ifdef BADVPN_LINUX
+        int batch_size;
+        int batch_slot_size;
+        uint8_t *batch_data;
+        struct BDatagram_batch_slot *batch_slots;
+        struct mmsghdr *batch_msgs;
+        int batch_start;
+        int batch_used;
+        int busy_ref;
+#endif
     } send;
     struct {
         BReactorLimit limit;
@@ -65,6 +78,16 @@ struct BDatagram_s {
         BPending job;
         int busy;
         uint8_t *busy_data;
+#ifdef BADVPN_LINUX
+        int batch_size;
+        uint8_t *batch_data;
+        size_t batch_data_size;
+        size_t batch_data_size_initial;
+        struct BDatagram_batch_slot *batch_slots;
+        struct mmsghdr *batch_msgs;
+        int batch_start;
+        int batch_used;
+#endif
     } recv;
     DebugError d_err;
     DebugObject d_obj;
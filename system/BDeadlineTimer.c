@@ -0,0 +1,123 @@
+/**
+ * @file BDeadlineTimer.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/offset.h>
+
+#include "BDeadlineTimer.h"
+
+static void timer_handler (BSmallTimer *timer)
+{
+    BDeadlineTimer *o = UPPER_OBJECT(timer, BDeadlineTimer, timer);
+    DebugObject_Access(&o->d_obj);
+    
+    // stopped since the timer was set, nothing to do
+    if (!o->running) {
+        return;
+    }
+    
+    // deadline was moved further away, wait for it
+    if (o->deadline > o->timer_time) {
+        o->timer_time = o->deadline;
+        BReactor_SetSmallTimer(o->reactor, &o->timer, BTIMER_SET_ABSOLUTE, o->timer_time);
+        return;
+    }
+    
+    // set not running
+    o->running = 0;
+    
+    // call handler
+    o->handler(o->user);
+    return;
+}
+
+void BDeadlineTimer_Init (BDeadlineTimer *o, BReactor *reactor, BDeadlineTimer_handler handler, void *user)
+{
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->handler = handler;
+    o->user = user;
+    
+    // set not running
+    o->running = 0;
+    
+    // init timer
+    BSmallTimer_Init(&o->timer, timer_handler);
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void BDeadlineTimer_Free (BDeadlineTimer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free timer
+    BReactor_RemoveSmallTimer(o->reactor, &o->timer);
+}
+
+void BDeadlineTimer_SetAbsolute (BDeadlineTimer *o, btime_t deadline)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set deadline
+    o->running = 1;
+    o->deadline = deadline;
+    
+    // if the timer will expire no later than the deadline, leave it
+    if (BSmallTimer_IsRunning(&o->timer) && o->timer_time <= deadline) {
+        return;
+    }
+    
+    // set timer
+    o->timer_time = deadline;
+    BReactor_SetSmallTimer(o->reactor, &o->timer, BTIMER_SET_ABSOLUTE, o->timer_time);
+}
+
+void BDeadlineTimer_SetRelative (BDeadlineTimer *o, btime_t after)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BDeadlineTimer_SetAbsolute(o, btime_add(btime_gettime(), after));
+}
+
+void BDeadlineTimer_Unset (BDeadlineTimer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set not running, the timer is left to expire
+    o->running = 0;
+}
+
+int BDeadlineTimer_IsRunning (BDeadlineTimer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->running;
+}
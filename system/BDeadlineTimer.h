@@ -0,0 +1,122 @@
+/**
+ * @file BDeadlineTimer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Timer for deadlines which are frequently moved further away.
+ */
+
+#ifndef BADVPN_SYSTEM_BDEADLINETIMER_H
+#define BADVPN_SYSTEM_BDEADLINETIMER_H
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+
+/**
+ * Handler function called when the deadline is reached.
+ * The timer is not running when this is called.
+ * 
+ * @param user value given to {@link BDeadlineTimer_Init}
+ */
+typedef void (*BDeadlineTimer_handler) (void *user);
+
+/**
+ * Timer for deadlines which are frequently moved further away, like idle timeouts
+ * which are pushed forward for every packet.
+ * 
+ * Setting the deadline to a time no earlier than the time the underlying reactor
+ * timer is set for only records the new deadline; the reactor timer is left alone.
+ * When the reactor timer expires before the deadline, it is set again for the
+ * deadline. Likewise, stopping the timer only marks it as stopped. This way,
+ * pushing the deadline forward costs a store instead of removing the reactor timer
+ * and inserting it again. Setting an earlier deadline resets the reactor timer.
+ */
+typedef struct {
+    BReactor *reactor;
+    BDeadlineTimer_handler handler;
+    void *user;
+    int running;
+    btime_t deadline;
+    btime_t timer_time;
+    BSmallTimer timer;
+    DebugObject d_obj;
+} BDeadlineTimer;
+
+/**
+ * Initializes the object.
+ * The timer is not running after initialization.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param handler handler function called when the deadline is reached
+ * @param user value passed to the handler function
+ */
+void BDeadlineTimer_Init (BDeadlineTimer *o, BReactor *reactor, BDeadlineTimer_handler handler, void *user);
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void BDeadlineTimer_Free (BDeadlineTimer *o);
+
+/**
+ * Starts the timer, or changes its deadline if it is running.
+ * 
+ * @param o the object
+ * @param deadline absolute time of the deadline, as in {@link btime_gettime}
+ */
+void BDeadlineTimer_SetAbsolute (BDeadlineTimer *o, btime_t deadline);
+
+/**
+ * Starts the timer, or changes its deadline if it is running, to
+ * the given time from now.
+ * 
+ * @param o the object
+ * @param after milliseconds from now
+ */
+void BDeadlineTimer_SetRelative (BDeadlineTimer *o, btime_t after);
+
+/**
+ * Stops the timer, if it is running.
+ * 
+ * @param o the object
+ */
+void BDeadlineTimer_Unset (BDeadlineTimer *o);
+
+/**
+ * Checks if the timer is running.
+ * 
+ * @param o the object
+ * @return 1 if running, 0 if not
+ */
+int BDeadlineTimer_IsRunning (BDeadlineTimer *o);
+
+#endif
@@ -27,6 +27,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
@@ -41,6 +45,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef BADVPN_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
 #include <misc/offset.h>
 #include <misc/open_standard_streams.h>
 #include <base/BLog.h>
@@ -50,6 +59,7 @@
 #include <generated/blog_channel_BProcess.h>
 
 #define INITIAL_NUM_GROUPS 24
+#define SPAWN_STACK_SIZE 65536
 
 static void call_handler (BProcess *o, int normally, uint8_t normally_exit_status)
 {
@@ -129,9 +139,15 @@ static void signal_handler (BProcessManager *o, int signo)
 }
 
 int BProcessManager_Init (BProcessManager *o, BReactor *reactor)
+{
+    return BProcessManager_Init2(o, reactor, 0);
+}
+
+int BProcessManager_Init2 (BProcessManager *o, BReactor *reactor, int flags)
 {
     // init arguments
     o->reactor = reactor;
+    o->flags = flags;
     
     // init signal handling
     sigset_t sset;
@@ -183,6 +199,157 @@ static int fds_contains (const int *fds, int fd, size_t *pos)
     return 0;
 }
 
+struct child_args {
+    const char *file;
+    char *const *argv;
+    int max_fd;
+    int *fds;
+    const int *fds_map;
+    int do_setsid;
+    int switch_user;
+    uid_t uid;
+    gid_t gid;
+    gid_t *groups;
+    int num_groups;
+    int shared_vm;
+};
+
+static int child_setids (struct child_args *a)
+{
+#ifdef BADVPN_LINUX
+    if (a->shared_vm) {
+        // The libc wrappers would try to synchronize the credentials of all
+        // threads, which is not possible from a child sharing the parent's
+        // memory. Use the raw system calls instead; these only affect us.
+#ifdef SYS_setgroups32
+        return (syscall(SYS_setgroups32, (size_t)a->num_groups, a->groups) < 0 ||
+                syscall(SYS_setgid32, a->gid) < 0 ||
+                syscall(SYS_setuid32, a->uid) < 0) ? -1 : 0;
+#else
+        return (syscall(SYS_setgroups, (size_t)a->num_groups, a->groups) < 0 ||
+                syscall(SYS_setgid, a->gid) < 0 ||
+                syscall(SYS_setuid, a->uid) < 0) ? -1 : 0;
+#endif
+    }
+#endif
+    
+    return (setgroups(a->num_groups, a->groups) < 0 ||
+            setgid(a->gid) < 0 ||
+            setuid(a->uid) < 0) ? -1 : 0;
+}
+
+// Runs in the child; only returns on failure.
+static void child_main (struct child_args *a)
+{
+    int *fds = a->fds;
+    const int *fds_map = a->fds_map;
+    
+    // restore signal dispositions
+    for (int i = 1; i < NSIG; i++) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sa.sa_flags = 0;
+        sigaction(i, &sa, NULL);
+    }
+    
+    // unblock signals
+    sigset_t sset_none;
+    sigemptyset(&sset_none);
+    if (pthread_sigmask(SIG_SETMASK, &sset_none, NULL) != 0) {
+        return;
+    }
+    
+    // close file descriptors, except the given fds
+    for (int i = 0; i < a->max_fd; i++) {
+        if (!fds_contains(fds, i, NULL)) {
+            close(i);
+        }
+    }
+    
+    // map fds to requested fd numbers
+    while (*fds >= 0) {
+        // resolve possible conflict
+        size_t cpos;
+        if (fds_contains(fds + 1, *fds_map, &cpos)) {
+            // dup() the fd to a new number; the old one will be closed
+            // in the following dup2()
+            if ((fds[1 + cpos] = dup(fds[1 + cpos])) < 0) {
+                return;
+            }
+        }
+        
+        if (*fds != *fds_map) {
+            // dup fd
+            if (dup2(*fds, *fds_map) < 0) {
+                return;
+            }
+            
+            // close original fd
+            close(*fds);
+        }
+        
+        fds++;
+        fds_map++;
+    }
+    
+    // make sure standard streams are open
+    open_standard_streams();
+    
+    // make session leader if requested
+    if (a->do_setsid) {
+        setsid();
+    }
+    
+    // assume identity of username, if requested
+    if (a->switch_user && child_setids(a) < 0) {
+        return;
+    }
+    
+    // do the exec
+    execv(a->file, a->argv);
+}
+
+#ifdef BADVPN_LINUX
+
+static int spawn_vm_child (void *arg)
+{
+    struct child_args *a = arg;
+    
+    child_main(a);
+    
+    // Something went wrong. We share the parent's memory so abort()
+    // and exit() are off limits; just go away.
+    _exit(127);
+    return 0;
+}
+
+// Starts the child with clone(CLONE_VM | CLONE_VFORK), which is what vfork()
+// does but with a stack of its own for the child. Nothing is copied, so the
+// cost doesn't grow with our memory size. We are suspended until the child
+// execs or exits.
+static pid_t spawn_vm (struct child_args *a)
+{
+    char *stack = malloc(SPAWN_STACK_SIZE);
+    if (!stack) {
+        BLog(BLOG_ERROR, "malloc failed");
+        return -1;
+    }
+    
+    a->shared_vm = 1;
+    
+    pid_t pid = clone(spawn_vm_child, stack + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, a);
+    if (pid < 0) {
+        BLog(BLOG_ERROR, "clone failed");
+    }
+    
+    free(stack);
+    
+    return pid;
+}
+
+#endif
+
 int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, void *user, const char *file, char *const argv[], struct BProcess_params params)
 {
     int res = 0;
@@ -268,6 +435,20 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     }
     memcpy(fds2, params.fds, (num_fds + 1) * sizeof(fds2[0]));
     
+    // collect the things the child needs
+    struct child_args args;
+    args.file = file;
+    args.argv = argv;
+    args.max_fd = max_fd;
+    args.fds = fds2;
+    args.fds_map = params.fds_map;
+    args.do_setsid = params.do_setsid;
+    args.switch_user = !!params.username;
+    args.uid = (params.username ? pwd.pw_uid : 0);
+    args.gid = (params.username ? pwd.pw_gid : 0);
+    args.groups = groups;
+    args.num_groups = num_groups;
+    
     // block signals
     // needed to prevent parent's signal handlers from being called
     // in the child
@@ -279,96 +460,33 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
         goto fail3;
     }
     
-    // fork
-    pid_t pid = fork();
-    
-    if (pid == 0) {
-        // this is child
-        
-        // restore signal dispositions
-        for (int i = 1; i < NSIG; i++) {
-            struct sigaction sa;
-            memset(&sa, 0, sizeof(sa));
-            sa.sa_handler = SIG_DFL;
-            sa.sa_flags = 0;
-            sigaction(i, &sa, NULL);
-        }
+    pid_t pid;
+    
+#ifdef BADVPN_LINUX
+    if (!(m->flags & BPROCESSMANAGER_FLAG_FORK)) {
+        // start the child in our address space
+        pid = spawn_vm(&args);
+    } else
+#endif
+    {
+        // fork
+        pid = fork();
         
-        // unblock signals
-        sigset_t sset_none;
-        sigemptyset(&sset_none);
-        if (pthread_sigmask(SIG_SETMASK, &sset_none, NULL) != 0) {
-            abort();
-        }
-        
-        // close file descriptors, except the given fds
-        for (int i = 0; i < max_fd; i++) {
-            if (!fds_contains(fds2, i, NULL)) {
-                close(i);
-            }
-        }
-        
-        // map fds to requested fd numbers
-        while (*fds2 >= 0) {
-            // resolve possible conflict
-            size_t cpos;
-            if (fds_contains(fds2 + 1, *params.fds_map, &cpos)) {
-                // dup() the fd to a new number; the old one will be closed
-                // in the following dup2()
-                if ((fds2[1 + cpos] = dup(fds2[1 + cpos])) < 0) {
-                    abort();
-                }
-            }
-            
-            if (*fds2 != *params.fds_map) {
-                // dup fd
-                if (dup2(*fds2, *params.fds_map) < 0) {
-                    abort();
-                }
-                
-                // close original fd
-                close(*fds2);
-            }
-            
-            fds2++;
-            params.fds_map++;
-        }
-        
-        // make sure standard streams are open
-        open_standard_streams();
-        
-        // make session leader if requested
-        if (params.do_setsid) {
-            setsid();
-        }
-        
-        // assume identity of username, if requested
-        if (params.username) {
-            if (setgroups(num_groups, groups) < 0) {
-                abort();
-            }
-            
-            if (setgid(pwd.pw_gid) < 0) {
-                abort();
-            }
+        if (pid == 0) {
+            // this is child
+            args.shared_vm = 0;
+            child_main(&args);
             
-            if (setuid(pwd.pw_uid) < 0) {
-                abort();
-            }
+            // if we're still here, something went wrong
+            abort();
         }
-        
-        // do the exec
-        execv(file, argv);
-        
-        // if we're still here, something went wrong
-        abort();
     }
     
     // restore original signal mask
     ASSERT_FORCE(pthread_sigmask(SIG_SETMASK, &sset_old, NULL) == 0)
     
     if (pid < 0) {
-        BLog(BLOG_ERROR, "fork failed");
+        BLog(BLOG_ERROR, "failed to start child");
         goto fail3;
     }
     
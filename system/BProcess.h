@@ -40,6 +40,13 @@
 #include <system/BUnixSignal.h>
 #include <base/BPending.h>
 
+/**
+ * Flag for {@link BProcessManager_Init2}: always start processes with fork().
+ * Without it, processes are started with clone(CLONE_VM | CLONE_VFORK) on Linux,
+ * which avoids copying the page tables of the parent.
+ */
+#define BPROCESSMANAGER_FLAG_FORK 1
+
 /**
  * Manages child processes.
  * There may be at most one process manager at any given time. This restriction is not
@@ -47,6 +54,7 @@
  */
 typedef struct {
     BReactor *reactor;
+    int flags;
     BUnixSignal signal;
     LinkedList1 processes;
     BPending wait_job;
@@ -90,6 +98,17 @@ typedef struct {
  */
 int BProcessManager_Init (BProcessManager *o, BReactor *reactor) WARN_UNUSED;
 
+/**
+ * Initializes the process manager.
+ * Like {@link BProcessManager_Init}, but with flags.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param flags zero or more of BPROCESSMANAGER_FLAG_* bitwise OR'd
+ * @return 1 on success, 0 on failure
+ */
+int BProcessManager_Init2 (BProcessManager *o, BReactor *reactor, int flags) WARN_UNUSED;
+
 /**
  * Frees the process manager.
  * There must be no {@link BProcess} objects using this process manager.
@@ -111,6 +130,9 @@ struct BProcess_params {
  * function call.
  * If no file descriptor is mapped to a standard stream (file descriptors 0, 1, 2),
  * then /dev/null will be opened in the child for that standard stream.
+ * If setting up the child fails after it has been started (including exec failing),
+ * the child terminates with exit status 127 if it was started with clone(), or
+ * with SIGABRT if it was started with fork().
  * 
  * @param o the object
  * @param m process manager
@@ -57,6 +57,14 @@
 #define TIMER_STATE_INACTIVE 1
 #define TIMER_STATE_RUNNING 2
 #define TIMER_STATE_EXPIRED 3
+#define TIMER_STATE_WHEEL 4
+
+#define TIMER_WHEEL_MASK (BREACTOR_TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_WORDS (BREACTOR_TIMER_WHEEL_SLOTS / 64)
+
+#if BREACTOR_TIMER_WHEEL_SLOTS % 64 != 0 || (BREACTOR_TIMER_WHEEL_SLOTS & TIMER_WHEEL_MASK) != 0
+#error BREACTOR_TIMER_WHEEL_SLOTS must be a power of two and a multiple of 64
+#endif
 
 static int compare_timers (BSmallTimer *t1, BSmallTimer *t2)
 {
@@ -74,11 +82,185 @@ static int compare_timers (BSmallTimer *t1, BSmallTimer *t2)
 static void assert_timer (BSmallTimer *bt)
 {
     ASSERT(bt->state == TIMER_STATE_INACTIVE || bt->state == TIMER_STATE_RUNNING ||
-           bt->state == TIMER_STATE_EXPIRED)
+           bt->state == TIMER_STATE_EXPIRED || bt->state == TIMER_STATE_WHEEL)
+}
+
+static btime_t timer_wheel_tick_of (btime_t time)
+{
+    // round up, so that timers never expire early
+    return time / BREACTOR_TIMER_WHEEL_TICK + (time % BREACTOR_TIMER_WHEEL_TICK > 0);
+}
+
+static int timer_wheel_ctz (uint64_t x)
+{
+    ASSERT(x != 0)
+    
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static void timer_wheel_insert (BReactor *bsys, BSmallTimer *bt, btime_t tick)
+{
+    ASSERT(bsys->timer_wheel)
+    ASSERT(tick >= bsys->timer_wheel_tick)
+    ASSERT(tick - bsys->timer_wheel_tick < BREACTOR_TIMER_WHEEL_SLOTS)
+    ASSERT(tick == timer_wheel_tick_of(bt->absTime))
+    
+    size_t slot = tick & TIMER_WHEEL_MASK;
+    
+    LinkedList1_Append(&bsys->timer_wheel_slots[slot], &bt->u.list_node);
+    bsys->timer_wheel_bitmap[slot / 64] |= (uint64_t)1 << (slot % 64);
+    bsys->timer_wheel_count++;
+    
+    bt->state = TIMER_STATE_WHEEL;
+}
+
+static void timer_wheel_remove (BReactor *bsys, BSmallTimer *bt)
+{
+    ASSERT(bsys->timer_wheel)
+    ASSERT(bt->state == TIMER_STATE_WHEEL)
+    ASSERT(bsys->timer_wheel_count > 0)
+    
+    size_t slot = timer_wheel_tick_of(bt->absTime) & TIMER_WHEEL_MASK;
+    
+    LinkedList1_Remove(&bsys->timer_wheel_slots[slot], &bt->u.list_node);
+    if (LinkedList1_IsEmpty(&bsys->timer_wheel_slots[slot])) {
+        bsys->timer_wheel_bitmap[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    }
+    bsys->timer_wheel_count--;
+}
+
+static int timer_wheel_find_first (BReactor *bsys, btime_t *out_tick)
+{
+    ASSERT(bsys->timer_wheel)
+    
+    if (bsys->timer_wheel_count == 0) {
+        return 0;
+    }
+    
+    size_t start = bsys->timer_wheel_tick & TIMER_WHEEL_MASK;
+    size_t start_word = start / 64;
+    
+    // scan the bitmap circularly, starting at the current tick
+    for (size_t i = 0; i <= TIMER_WHEEL_WORDS; i++) {
+        size_t word_index = (start_word + i) % TIMER_WHEEL_WORDS;
+        uint64_t word = bsys->timer_wheel_bitmap[word_index];
+        if (i == 0) {
+            word &= ~(uint64_t)0 << (start % 64);
+        }
+        else if (i == TIMER_WHEEL_WORDS) {
+            word &= ~(~(uint64_t)0 << (start % 64));
+        }
+        if (word) {
+            size_t slot = word_index * 64 + timer_wheel_ctz(word);
+            *out_tick = bsys->timer_wheel_tick + ((slot - start) & TIMER_WHEEL_MASK);
+            return 1;
+        }
+    }
+    
+    ASSERT(0)
+    return 0;
+}
+
+static int get_first_timer_time (BReactor *bsys, btime_t *out_time)
+{
+    BSmallTimer *first_timer = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0).link;
+    
+    if (!bsys->timer_wheel) {
+        if (!first_timer) {
+            return 0;
+        }
+        ASSERT(first_timer->state == TIMER_STATE_RUNNING)
+        *out_time = first_timer->absTime;
+        return 1;
+    }
+    
+    // timers in the tree are further away than those in the wheel
+    btime_t tick;
+    if (timer_wheel_find_first(bsys, &tick)) {
+        ASSERT(!first_timer || timer_wheel_tick_of(first_timer->absTime) > tick)
+    } else {
+        if (!first_timer) {
+            return 0;
+        }
+        ASSERT(first_timer->state == TIMER_STATE_RUNNING)
+        tick = timer_wheel_tick_of(first_timer->absTime);
+    }
+    
+    *out_time = tick * BREACTOR_TIMER_WHEEL_TICK;
+    return 1;
+}
+
+static int move_expired_timers_wheel (BReactor *bsys, btime_t now)
+{
+    ASSERT(bsys->timer_wheel)
+    
+    int moved = 0;
+    btime_t now_tick = now / BREACTOR_TIMER_WHEEL_TICK;
+    
+    // move timers from slots which are due to the expired list
+    btime_t tick;
+    while (timer_wheel_find_first(bsys, &tick) && tick <= now_tick) {
+        size_t slot = tick & TIMER_WHEEL_MASK;
+        LinkedList1Node *node;
+        while (node = LinkedList1_GetFirst(&bsys->timer_wheel_slots[slot])) {
+            BSmallTimer *timer = UPPER_OBJECT(node, BSmallTimer, u.list_node);
+            ASSERT(timer->state == TIMER_STATE_WHEEL)
+            
+            LinkedList1_Remove(&bsys->timer_wheel_slots[slot], &timer->u.list_node);
+            bsys->timer_wheel_count--;
+            
+            LinkedList1_Append(&bsys->timers_expired_list, &timer->u.list_node);
+            timer->state = TIMER_STATE_EXPIRED;
+        }
+        bsys->timer_wheel_bitmap[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+        moved = 1;
+    }
+    
+    // advance the wheel past the current tick
+    if (now_tick >= bsys->timer_wheel_tick) {
+        bsys->timer_wheel_tick = now_tick + 1;
+    }
+    
+    // move timers from the tree which now fit into the wheel
+    BReactor__TimersTreeRef ref;
+    BSmallTimer *timer;
+    while (timer = (ref = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0)).link) {
+        ASSERT(timer->state == TIMER_STATE_RUNNING)
+        
+        btime_t timer_tick = timer_wheel_tick_of(timer->absTime);
+        if (timer_tick - bsys->timer_wheel_tick >= BREACTOR_TIMER_WHEEL_SLOTS) {
+            break;
+        }
+        
+        BReactor__TimersTree_Remove(&bsys->timers_tree, 0, ref);
+        
+        if (timer_tick < bsys->timer_wheel_tick) {
+            LinkedList1_Append(&bsys->timers_expired_list, &timer->u.list_node);
+            timer->state = TIMER_STATE_EXPIRED;
+            moved = 1;
+        } else {
+            timer_wheel_insert(bsys, timer, timer_tick);
+        }
+    }
+    
+    return moved;
 }
 
 static int move_expired_timers (BReactor *bsys, btime_t now)
 {
+    if (bsys->timer_wheel) {
+        return move_expired_timers_wheel(bsys, now);
+    }
+    
     int moved = 0;
     
     // move timed out timers to the expired list
@@ -108,6 +290,16 @@ static int move_expired_timers (BReactor *bsys, btime_t now)
 
 static void move_first_timers (BReactor *bsys)
 {
+    if (bsys->timer_wheel) {
+        // expire everything up to the tick of the first timer
+        btime_t first_time;
+        int res = get_first_timer_time(bsys, &first_time);
+        ASSERT_EXECUTE(res)
+        int moved = move_expired_timers_wheel(bsys, first_time);
+        ASSERT_EXECUTE(moved)
+        return;
+    }
+    
     BReactor__TimersTreeRef ref;
     
     // get the time of the first timer
@@ -184,6 +376,54 @@ static void set_epoll_fd_pointers (BReactor *bsys)
     }
 }
 
+static void epoll_update_ready (BReactor *bsys, BFileDescriptor *bfd)
+{
+    ASSERT(bfd->active)
+    ASSERT(bfd->epoll_edge)
+    
+    // queue if any ready events are being waited for; errors are always reported
+    int want = (bfd->epoll_ready_events & (bfd->waitEvents | BREACTOR_ERROR | BREACTOR_HUP)) != 0;
+    
+    if (want && !bfd->epoll_ready_queued) {
+        LinkedList1_Append(&bsys->epoll_ready_list, &bfd->epoll_ready_list_node);
+        bsys->epoll_ready_count++;
+        bfd->epoll_ready_queued = 1;
+    }
+    else if (!want && bfd->epoll_ready_queued) {
+        LinkedList1_Remove(&bsys->epoll_ready_list, &bfd->epoll_ready_list_node);
+        bsys->epoll_ready_count--;
+        bfd->epoll_ready_queued = 0;
+    }
+}
+
+static void epoll_grow_results (BReactor *bsys)
+{
+    ASSERT(bsys->epoll_results_num == 0)
+    
+    bsys->epoll_results_full = 0;
+    
+    if (bsys->epoll_results_size >= BSYSTEM_MAX_RESULTS_LIMIT) {
+        return;
+    }
+    
+    int new_size = bsys->epoll_results_size * 2;
+    if (new_size > BSYSTEM_MAX_RESULTS_LIMIT) {
+        new_size = BSYSTEM_MAX_RESULTS_LIMIT;
+    }
+    
+    struct epoll_event *new_results = BAllocArray(new_size, sizeof(new_results[0]));
+    if (!new_results) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return;
+    }
+    
+    BLog(BLOG_DEBUG, "epoll result batch size %d", new_size);
+    
+    BFree(bsys->epoll_results);
+    bsys->epoll_results = new_results;
+    bsys->epoll_results_size = new_size;
+}
+
 #endif
 
 #ifdef BADVPN_USE_KEVENT
@@ -292,6 +532,14 @@ static void wait_for_events (BReactor *bsys)
     #ifdef BADVPN_USE_EPOLL
     bsys->epoll_results_num = 0;
     bsys->epoll_results_pos = 0;
+    
+    // start a new round of dispatching edge-triggered fds after this
+    bsys->epoll_ready_round = -1;
+    
+    // grow the results buffer if the last wait filled it
+    if (bsys->epoll_results_full) {
+        epoll_grow_results(bsys);
+    }
     #endif
     
     // clean up kevent results
@@ -312,10 +560,8 @@ static void wait_for_events (BReactor *bsys)
     btime_t now = 0; // to remove warning
     
     // compute timeout
-    BSmallTimer *first_timer = BReactor__TimersTree_GetFirst(&bsys->timers_tree, 0).link;
-    if (first_timer) {
-        ASSERT(first_timer->state == TIMER_STATE_RUNNING)
-        
+    btime_t first_time;
+    if (get_first_timer_time(bsys, &first_time)) {
         // get current time
         now = btime_gettime();
         
@@ -326,8 +572,10 @@ static void wait_for_events (BReactor *bsys)
         }
         
         // timeout is first timer, remember absolute time
+        // (with the timer wheel, this may have changed as the wheel advanced)
         have_timeout = 1;
-        timeout_abs = first_timer->absTime;
+        int res = get_first_timer_time(bsys, &timeout_abs);
+        ASSERT_EXECUTE(res)
     }
     
     // wait until the timeout is reached or the file descriptor / handle in ready
@@ -383,9 +631,12 @@ static void wait_for_events (BReactor *bsys)
             }
         }
         
+        // if there are edge-triggered fds ready, only poll for more events
+        int poll_only = (bsys->epoll_ready_count > 0);
+        
         BLog(BLOG_DEBUG, "Calling epoll_wait");
         
-        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, BSYSTEM_MAX_RESULTS, (have_timeout ? timeout_rel_trunc : -1));
+        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, bsys->epoll_results_size, (poll_only ? 0 : have_timeout ? timeout_rel_trunc : -1));
         if (waitres < 0) {
             int error = errno;
             if (error == EINTR) {
@@ -396,14 +647,18 @@ static void wait_for_events (BReactor *bsys)
             ASSERT_FORCE(0)
         }
         
-        ASSERT_FORCE(!(waitres == 0) || have_timeout)
-        ASSERT_FORCE(waitres <= BSYSTEM_MAX_RESULTS)
+        ASSERT_FORCE(!(waitres == 0) || have_timeout || poll_only)
+        ASSERT_FORCE(waitres <= bsys->epoll_results_size)
         
-        if (waitres != 0 || timeout_rel_trunc == timeout_rel) {
+        if (waitres != 0 || poll_only || timeout_rel_trunc == timeout_rel) {
             if (waitres != 0) {
                 BLog(BLOG_DEBUG, "epoll_wait returned %d file descriptors", waitres);
                 bsys->epoll_results_num = waitres;
+                bsys->epoll_results_full = (waitres == bsys->epoll_results_size);
                 set_epoll_fd_pointers(bsys);
+            }
+            else if (poll_only) {
+                BLog(BLOG_DEBUG, "epoll_wait returned no file descriptors");
             } else {
                 BLog(BLOG_DEBUG, "epoll_wait timed out");
                 move_first_timers(bsys);
@@ -590,6 +845,11 @@ int BTimer_IsRunning (BTimer *bt)
 }
 
 int BReactor_Init (BReactor *bsys)
+{
+    return BReactor_Init2(bsys, 0);
+}
+
+int BReactor_Init2 (BReactor *bsys, int flags)
 {
     BLog(BLOG_DEBUG, "Reactor initializing");
     
@@ -603,6 +863,21 @@ int BReactor_Init (BReactor *bsys)
     BReactor__TimersTree_Init(&bsys->timers_tree);
     LinkedList1_Init(&bsys->timers_expired_list);
     
+    // init timer wheel
+    bsys->timer_wheel = !!(flags & BREACTOR_INIT_FLAG_TIMER_WHEEL);
+    if (bsys->timer_wheel) {
+        if (!(bsys->timer_wheel_slots = BAllocArray(BREACTOR_TIMER_WHEEL_SLOTS, sizeof(bsys->timer_wheel_slots[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail0;
+        }
+        for (size_t i = 0; i < BREACTOR_TIMER_WHEEL_SLOTS; i++) {
+            LinkedList1_Init(&bsys->timer_wheel_slots[i]);
+        }
+        memset(bsys->timer_wheel_bitmap, 0, sizeof(bsys->timer_wheel_bitmap));
+        bsys->timer_wheel_tick = btime_gettime() / BREACTOR_TIMER_WHEEL_TICK;
+        bsys->timer_wheel_count = 0;
+    }
+    
     // init limits
     LinkedList1_Init(&bsys->active_limits_list);
     
@@ -614,7 +889,7 @@ int BReactor_Init (BReactor *bsys)
     // init IOCP handle
     if (!(bsys->iocp_handle = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1))) {
         BLog(BLOG_ERROR, "CreateIoCompletionPort failed");
-        goto fail0;
+        goto fail1;
     }
     
     // init IOCP ready list
@@ -627,13 +902,28 @@ int BReactor_Init (BReactor *bsys)
     // create epoll fd
     if ((bsys->efd = epoll_create(10)) < 0) {
         BLog(BLOG_ERROR, "epoll_create failed");
-        goto fail0;
+        goto fail1;
+    }
+    
+    // allocate results array
+    bsys->epoll_results_size = BSYSTEM_MAX_RESULTS;
+    if (!(bsys->epoll_results = BAllocArray(bsys->epoll_results_size, sizeof(bsys->epoll_results[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        ASSERT_FORCE(close(bsys->efd) == 0)
+        goto fail1;
     }
     
     // init results array
+    bsys->epoll_results_full = 0;
     bsys->epoll_results_num = 0;
     bsys->epoll_results_pos = 0;
     
+    // init edge-triggered ready list
+    bsys->epoll_edge_triggered = !!(flags & BREACTOR_INIT_FLAG_EDGE_TRIGGERED);
+    LinkedList1_Init(&bsys->epoll_ready_list);
+    bsys->epoll_ready_count = 0;
+    bsys->epoll_ready_round = -1;
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -641,7 +931,7 @@ int BReactor_Init (BReactor *bsys)
     // create kqueue fd
     if ((bsys->kqueue_fd = kqueue()) < 0) {
         BLog(BLOG_ERROR, "kqueue failed");
-        goto fail0;
+        goto fail1;
     }
     
     // init results array
@@ -661,11 +951,11 @@ int BReactor_Init (BReactor *bsys)
     // allocate results arrays
     if (!(bsys->poll_results_pollfds = BAllocArray(BSYSTEM_MAX_POLL_FDS, sizeof(bsys->poll_results_pollfds[0])))) {
         BLog(BLOG_ERROR, "BAllocArray failed");
-        goto fail0;
+        goto fail1;
     }
     if (!(bsys->poll_results_bfds = BAllocArray(BSYSTEM_MAX_POLL_FDS, sizeof(bsys->poll_results_bfds[0])))) {
         BLog(BLOG_ERROR, "BAllocArray failed");
-        goto fail1;
+        goto fail2;
     }
     
     // init results array
@@ -686,9 +976,13 @@ int BReactor_Init (BReactor *bsys)
     return 1;
     
     #ifdef BADVPN_USE_POLL
-fail1:
+fail2:
     BFree(bsys->poll_results_pollfds);
     #endif
+fail1:
+    if (bsys->timer_wheel) {
+        BFree(bsys->timer_wheel_slots);
+    }
 fail0:
     BPendingGroup_Free(&bsys->pending_jobs);
     BLog(BLOG_ERROR, "Reactor failed to initialize");
@@ -711,6 +1005,7 @@ void BReactor_Free (BReactor *bsys)
     ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
     ASSERT(BReactor__TimersTree_IsEmpty(&bsys->timers_tree))
     ASSERT(LinkedList1_IsEmpty(&bsys->timers_expired_list))
+    ASSERT(!bsys->timer_wheel || bsys->timer_wheel_count == 0)
     ASSERT(LinkedList1_IsEmpty(&bsys->active_limits_list))
     DebugObject_Free(&bsys->d_obj);
     #ifdef BADVPN_USE_WINAPI
@@ -724,6 +1019,9 @@ void BReactor_Free (BReactor *bsys)
     DebugCounter_Free(&bsys->d_kevent_ctr);
     #endif
     DebugCounter_Free(&bsys->d_limits_ctr);
+    #ifdef BADVPN_USE_EPOLL
+    ASSERT(LinkedList1_IsEmpty(&bsys->epoll_ready_list))
+    #endif
     #ifdef BADVPN_USE_POLL
     ASSERT(bsys->poll_num_enabled_fds == 0)
     ASSERT(LinkedList1_IsEmpty(&bsys->poll_enabled_fds_list))
@@ -740,6 +1038,9 @@ void BReactor_Free (BReactor *bsys)
     
     #ifdef BADVPN_USE_EPOLL
     
+    // free results array
+    BFree(bsys->epoll_results);
+    
     // close epoll fd
     ASSERT_FORCE(close(bsys->efd) == 0)
     
@@ -760,6 +1061,11 @@ void BReactor_Free (BReactor *bsys)
     
     #endif
     
+    // free timer wheel
+    if (bsys->timer_wheel) {
+        BFree(bsys->timer_wheel_slots);
+    }
+    
     // free jobs
     BPendingGroup_Free(&bsys->pending_jobs);
 }
@@ -841,6 +1147,24 @@ int BReactor_Exec (BReactor *bsys)
             // zero pointer to the epoll entry
             bfd->epoll_returned_ptr = NULL;
             
+            // for edge-triggered fds, remember readiness and dispatch from the ready list
+            if (bfd->epoll_edge) {
+                if ((event->events&EPOLLIN)) {
+                    bfd->epoll_ready_events |= BREACTOR_READ;
+                }
+                if ((event->events&EPOLLOUT)) {
+                    bfd->epoll_ready_events |= BREACTOR_WRITE;
+                }
+                if ((event->events&EPOLLERR)) {
+                    bfd->epoll_ready_events |= BREACTOR_ERROR;
+                }
+                if ((event->events&EPOLLHUP)) {
+                    bfd->epoll_ready_events |= BREACTOR_HUP;
+                }
+                epoll_update_ready(bsys, bfd);
+                continue;
+            }
+            
             // calculate events to report
             int events = 0;
             if ((bfd->waitEvents&BREACTOR_READ) && (event->events&EPOLLIN)) {
@@ -867,6 +1191,40 @@ int BReactor_Exec (BReactor *bsys)
             continue;
         }
         
+        // dispatch edge-triggered file descriptor
+        if (bsys->epoll_ready_round < 0) {
+            bsys->epoll_ready_round = bsys->epoll_ready_count;
+        }
+        if (bsys->epoll_ready_round > 0 && bsys->epoll_ready_count > 0) {
+            bsys->epoll_ready_round--;
+            
+            // get BFileDescriptor
+            BFileDescriptor *bfd = UPPER_OBJECT(LinkedList1_GetFirst(&bsys->epoll_ready_list), BFileDescriptor, epoll_ready_list_node);
+            ASSERT(bfd->active)
+            ASSERT(bfd->epoll_edge)
+            ASSERT(bfd->epoll_ready_queued)
+            
+            int events = bfd->epoll_ready_events & (bfd->waitEvents | BREACTOR_ERROR | BREACTOR_HUP);
+            ASSERT(events)
+            
+            // errors and hangups are reported once, since the user has no way of
+            // clearing them; epoll reports them again along with any new event
+            bfd->epoll_ready_events &= ~(BREACTOR_ERROR | BREACTOR_HUP);
+            epoll_update_ready(bsys, bfd);
+            
+            // move to the end of the list, so that it is dispatched again in the next
+            // round unless the user reports that it would block
+            if (bfd->epoll_ready_queued) {
+                LinkedList1_Remove(&bsys->epoll_ready_list, &bfd->epoll_ready_list_node);
+                LinkedList1_Append(&bsys->epoll_ready_list, &bfd->epoll_ready_list_node);
+            }
+            
+            // call handler
+            BLog(BLOG_DEBUG, "Dispatching edge-triggered file descriptor");
+            bfd->handler(bfd->user, events);
+            continue;
+        }
+        
         #endif
         
         #ifdef BADVPN_USE_KEVENT
@@ -1012,6 +1370,23 @@ void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t
     // set time
     bt->absTime = time;
     
+    if (bsys->timer_wheel) {
+        btime_t tick = timer_wheel_tick_of(time);
+        
+        // if its tick has already passed, expire it right away
+        if (tick < bsys->timer_wheel_tick) {
+            LinkedList1_Append(&bsys->timers_expired_list, &bt->u.list_node);
+            bt->state = TIMER_STATE_EXPIRED;
+            return;
+        }
+        
+        // insert to the wheel if it's within its range
+        if (tick - bsys->timer_wheel_tick < BREACTOR_TIMER_WHEEL_SLOTS) {
+            timer_wheel_insert(bsys, bt, tick);
+            return;
+        }
+    }
+    
     // set running
     bt->state = TIMER_STATE_RUNNING;
     
@@ -1032,6 +1407,10 @@ void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt)
     if (bt->state == TIMER_STATE_EXPIRED) {
         // remove from expired list
         LinkedList1_Remove(&bsys->timers_expired_list, &bt->u.list_node);
+    }
+    else if (bt->state == TIMER_STATE_WHEEL) {
+        // remove from timer wheel
+        timer_wheel_remove(bsys, bt);
     } else {
         // remove from running tree
         BReactor__TimersTreeRef ref = {bt, bt};
@@ -1087,15 +1466,25 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
 #ifndef BADVPN_USE_WINAPI
 
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
+{
+    return BReactor_AddFileDescriptor2(bsys, bs, 0);
+}
+
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags)
 {
     ASSERT(!bs->active)
     
     #ifdef BADVPN_USE_EPOLL
     
-    // add epoll entry
+    // edge-triggered only if the reactor allows it
+    bs->epoll_edge = (bsys->epoll_edge_triggered && (flags & BREACTOR_FD_FLAG_EDGE));
+    bs->epoll_ready_events = 0;
+    bs->epoll_ready_queued = 0;
+    
+    // add epoll entry; edge-triggered fds are registered for all events
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.events = 0;
+    event.events = (bs->epoll_edge ? (EPOLLIN | EPOLLOUT | EPOLLET) : 0);
     event.data.ptr = bs;
     if (epoll_ctl(bsys->efd, EPOLL_CTL_ADD, bs->fd, &event) < 0) {
         int error = errno;
@@ -1160,6 +1549,12 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
         *bs->epoll_returned_ptr = NULL;
     }
     
+    // remove from ready list
+    if (bs->epoll_ready_queued) {
+        LinkedList1_Remove(&bsys->epoll_ready_list, &bs->epoll_ready_list_node);
+        bsys->epoll_ready_count--;
+    }
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -1207,6 +1602,13 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     
     #ifdef BADVPN_USE_EPOLL
     
+    // edge-triggered fds stay registered for all events
+    if (bs->epoll_edge) {
+        bs->waitEvents = events;
+        epoll_update_ready(bsys, bs);
+        return;
+    }
+    
     // calculate epoll events
     int eevents = 0;
     if ((events & BREACTOR_READ)) {
@@ -1235,6 +1637,21 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     bs->waitEvents = events;
 }
 
+void BReactor_FileDescriptorWouldBlock (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
+    
+    #ifdef BADVPN_USE_EPOLL
+    
+    if (bs->epoll_edge) {
+        bs->epoll_ready_events &= ~events;
+        epoll_update_ready(bsys, bs);
+    }
+    
+    #endif
+}
+
 #endif
 
 void BReactorLimit_Init (BReactorLimit *o, BReactor *reactor, int limit)
@@ -199,6 +199,10 @@ typedef struct BFileDescriptor_t {
     
     #ifdef BADVPN_USE_EPOLL
     struct BFileDescriptor_t **epoll_returned_ptr;
+    int epoll_edge;
+    int epoll_ready_events;
+    int epoll_ready_queued;
+    LinkedList1Node epoll_ready_list_node;
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -231,6 +235,23 @@ void BFileDescriptor_Init (BFileDescriptor *bs, int fd, BFileDescriptor_handler
 #define BSYSTEM_MAX_HANDLES 64
 #define BSYSTEM_MAX_POLL_FDS 4096
 
+// with epoll, the result batch starts at BSYSTEM_MAX_RESULTS and grows
+// up to this when full batches are returned
+#ifndef BSYSTEM_MAX_RESULTS_LIMIT
+#define BSYSTEM_MAX_RESULTS_LIMIT 1024
+#endif
+
+// flags for BReactor_Init2
+#define BREACTOR_INIT_FLAG_TIMER_WHEEL 1
+#define BREACTOR_INIT_FLAG_EDGE_TRIGGERED 2
+
+// flags for BReactor_AddFileDescriptor2
+#define BREACTOR_FD_FLAG_EDGE 1
+
+// timer wheel resolution in milliseconds, and number of slots
+#define BREACTOR_TIMER_WHEEL_TICK 16
+#define BREACTOR_TIMER_WHEEL_SLOTS 4096
+
 /**
  * Event loop that supports file desciptor (Linux) or HANDLE (Windows) events
  * and timers.
@@ -246,6 +267,13 @@ typedef struct {
     BReactor__TimersTree timers_tree;
     LinkedList1 timers_expired_list;
     
+    // timer wheel, if enabled
+    int timer_wheel;
+    LinkedList1 *timer_wheel_slots;
+    uint64_t timer_wheel_bitmap[BREACTOR_TIMER_WHEEL_SLOTS / 64];
+    btime_t timer_wheel_tick;
+    int timer_wheel_count;
+    
     // limits
     LinkedList1 active_limits_list;
     
@@ -257,9 +285,15 @@ typedef struct {
     
     #ifdef BADVPN_USE_EPOLL
     int efd; // epoll fd
-    struct epoll_event epoll_results[BSYSTEM_MAX_RESULTS]; // epoll returned events buffer
+    struct epoll_event *epoll_results; // epoll returned events buffer
+    int epoll_results_size; // size of the buffer
+    int epoll_results_full; // whether the last wait filled the buffer
     int epoll_results_num; // number of events in the array
     int epoll_results_pos; // number of events processed so far
+    int epoll_edge_triggered; // whether edge-triggered file descriptors are allowed
+    LinkedList1 epoll_ready_list; // edge-triggered fds with ready events being waited for
+    int epoll_ready_count; // number of fds in the list
+    int epoll_ready_round; // number of fds to dispatch before polling again, -1 if not started
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -299,6 +333,28 @@ typedef struct {
  */
 int BReactor_Init (BReactor *bsys) WARN_UNUSED;
 
+/**
+ * Initializes the reactor, like {@link BReactor_Init}, with options.
+ * 
+ * With BREACTOR_INIT_FLAG_TIMER_WHEEL, running timers are kept in a hashed timing
+ * wheel instead of a balanced tree, making starting and stopping a timer O(1).
+ * This helps when many timers are restarted often, e.g. an inactivity timer reset
+ * for every packet. Expiration times are rounded up to BREACTOR_TIMER_WHEEL_TICK
+ * milliseconds, so a timer may expire up to that much later than requested, and
+ * timers expiring in the same tick are dispatched in no particular order. Timers
+ * further than BREACTOR_TIMER_WHEEL_SLOTS ticks in the future are kept in the
+ * tree until they get close enough.
+ * 
+ * With BREACTOR_INIT_FLAG_EDGE_TRIGGERED, file descriptors added with
+ * BREACTOR_FD_FLAG_EDGE are monitored edge-triggered when using epoll; see
+ * {@link BReactor_AddFileDescriptor2}.
+ *
+ * @param bsys the object
+ * @param flags bitmask of BREACTOR_INIT_FLAG_* values
+ * @return 1 on success, 0 on failure
+ */
+int BReactor_Init2 (BReactor *bsys, int flags) WARN_UNUSED;
+
 /**
  * Frees the reactor.
  * Must not be called from within the event loop ({@link BReactor_Exec}).
@@ -450,6 +506,27 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
  */
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
 
+/**
+ * Starts monitoring a file descriptor, like {@link BReactor_AddFileDescriptor}, with options.
+ * 
+ * With BREACTOR_FD_FLAG_EDGE, if the reactor uses epoll and was initialized with
+ * BREACTOR_INIT_FLAG_EDGE_TRIGGERED, the file descriptor is registered for reading
+ * and writing once, edge-triggered, and {@link BReactor_SetFileDescriptorEvents}
+ * only updates the reactor's own state instead of calling epoll_ctl. The reactor
+ * remembers readiness and keeps reporting a monitored event, once per poll, until
+ * the user calls {@link BReactor_FileDescriptorWouldBlock} for it. The user must do
+ * that whenever an operation fails with EAGAIN, or otherwise stops short of
+ * exhausting the file descriptor while still monitoring the event (e.g. a read
+ * returning 0). BREACTOR_ERROR and BREACTOR_HUP are reported once per occurrence.
+ * Otherwise, the flag has no effect.
+ * 
+ * @param bsys the object
+ * @param bs file descriptor object, as in {@link BReactor_AddFileDescriptor}
+ * @param flags bitmask of BREACTOR_FD_FLAG_* values
+ * @return 1 on success, 0 on failure
+ */
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags) WARN_UNUSED;
+
 /**
  * Stops monitoring a file descriptor.
  *
@@ -472,6 +549,20 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
  */
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
 
+/**
+ * Reports that an operation on a file descriptor would block (failed with EAGAIN),
+ * so that the reactor waits for the next readiness notification before reporting
+ * the events again. This only matters for edge-triggered file descriptors
+ * (see {@link BReactor_AddFileDescriptor2}), and does nothing otherwise.
+ *
+ * @param bsys the object
+ * @param bs {@link BFileDescriptor} object. Must be in active state,
+ *           associated with this reactor.
+ * @param events events which would block. Must not have any bits other than
+ *               BREACTOR_READ and BREACTOR_WRITE.
+ */
+void BReactor_FileDescriptorWouldBlock (BReactor *bsys, BFileDescriptor *bs, int events);
+
 #endif
 
 typedef struct {
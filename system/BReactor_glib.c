@@ -417,6 +417,19 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     bs->pollfd.events = get_glib_wait_events(bs->waitEvents);
 }
 
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags)
+{
+    // file descriptors are always level-triggered
+    return BReactor_AddFileDescriptor(bsys, bs);
+}
+
+void BReactor_FileDescriptorWouldBlock (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
+}
+
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free)
 {
     ASSERT(gloop)
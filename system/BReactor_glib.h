@@ -82,6 +82,9 @@ struct BFileDescriptor_t;
 #define BREACTOR_ERROR (1 << 2)
 #define BREACTOR_HUP (1 << 3)
 
+// flags for BReactor_AddFileDescriptor2 (ignored by this backend)
+#define BREACTOR_FD_FLAG_EDGE 1
+
 typedef void (*BFileDescriptor_handler) (void *user, int events);
 
 typedef struct BFileDescriptor_t {
@@ -125,8 +128,10 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags) WARN_UNUSED;
 void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
+void BReactor_FileDescriptorWouldBlock (BReactor *bsys, BFileDescriptor *bs, int events);
 
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free);
 GMainLoop * BReactor_GetGMainLoop (BReactor *bsys);
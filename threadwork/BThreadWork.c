@@ -34,9 +34,13 @@
     #include <unistd.h>
     #include <errno.h>
     #include <fcntl.h>
+    #ifdef BADVPN_LINUX
+        #include <sys/eventfd.h>
+    #endif
 #endif
 
 #include <misc/offset.h>
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include <generated/blog_channel_BThreadWork.h>
@@ -45,6 +49,15 @@
 
 #ifdef BADVPN_THREADWORK_USE_PTHREAD
 
+static int is_spsc (BThreadWorkDispatcher *o)
+{
+    #ifdef BADVPN_LINUX
+    return o->spsc;
+    #else
+    return 0;
+    #endif
+}
+
 static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
 {
     BThreadWorkDispatcher *o = t->d;
@@ -180,6 +193,482 @@ static void stop_threads (BThreadWorkDispatcher *o)
     }
 }
 
+static int mutex_init (BThreadWorkDispatcher *o, int num_threads)
+{
+    // init pending list
+    LinkedList1_Init(&o->pending_list);
+    
+    // init finished list
+    LinkedList1_Init(&o->finished_list);
+    
+    // init mutex
+    if (pthread_mutex_init(&o->mutex, NULL) != 0) {
+        BLog(BLOG_ERROR, "pthread_mutex_init failed");
+        goto fail0;
+    }
+    
+    // init pipe
+    if (pipe(o->pipe) < 0) {
+        BLog(BLOG_ERROR, "pipe failed");
+        goto fail1;
+    }
+    
+    // set read end non-blocking
+    if (fcntl(o->pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+        BLog(BLOG_ERROR, "fcntl failed");
+        goto fail2;
+    }
+    
+    // set write end non-blocking
+    if (fcntl(o->pipe[1], F_SETFL, O_NONBLOCK) < 0) {
+        BLog(BLOG_ERROR, "fcntl failed");
+        goto fail2;
+    }
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&o->bfd, o->pipe[0], (BFileDescriptor_handler)pipe_fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail2;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    // init more job
+    BPending_Init(&o->more_job, BReactor_PendingGroup(o->reactor), (BPending_handler)more_job_handler, o);
+    
+    // set not cancelling
+    o->cancel = 0;
+    
+    // init threads
+    o->num_threads = 0;
+    for (int i = 0; i < num_threads; i++) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[i];
+        
+        // set parent pointer
+        t->d = o;
+        
+        // set no running work
+        t->running_work = NULL;
+        
+        // init condition variable
+        if (pthread_cond_init(&t->new_cond, NULL) != 0) {
+            BLog(BLOG_ERROR, "pthread_cond_init failed");
+            goto fail3;
+        }
+        
+        // init thread
+        if (pthread_create(&t->thread, NULL, (void * (*) (void *))dispatcher_thread, t) != 0) {
+            BLog(BLOG_ERROR, "pthread_create failed");
+            ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
+            goto fail3;
+        }
+    
+        o->num_threads++;
+    }
+    
+    return 1;
+    
+fail3:
+    stop_threads(o);
+    BPending_Free(&o->more_job);
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+fail2:
+    ASSERT_FORCE(close(o->pipe[0]) == 0)
+    ASSERT_FORCE(close(o->pipe[1]) == 0)
+fail1:
+    ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+fail0:
+    return 0;
+}
+
+static void mutex_free (BThreadWorkDispatcher *o)
+{
+    ASSERT(LinkedList1_IsEmpty(&o->pending_list))
+    for (int i = 0; i < o->num_threads; i++) { ASSERT(!o->threads[i].running_work) }
+    ASSERT(LinkedList1_IsEmpty(&o->finished_list))
+    
+    // stop threads
+    stop_threads(o);
+    
+    // free more job
+    BPending_Free(&o->more_job);
+    
+    // free BFileDescriptor
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    
+    // free pipe
+    ASSERT_FORCE(close(o->pipe[0]) == 0)
+    ASSERT_FORCE(close(o->pipe[1]) == 0)
+    
+    // free mutex
+    ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+}
+
+#ifdef BADVPN_LINUX
+
+#define ENTRY_STATE_PENDING 1
+#define ENTRY_STATE_RUNNING 2
+#define ENTRY_STATE_DONE 3
+#define ENTRY_STATE_CANCELLED 4
+
+static void * spsc_thread (struct BThreadWorkDispatcher_thread *t)
+{
+    BThreadWorkDispatcher *o = t->d;
+    
+    // we are the only writer of ring_done
+    unsigned int pos = t->ring_done;
+    
+    while (1) {
+        // exit if requested
+        if (__atomic_load_n(&o->cancel, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        if (pos == __atomic_load_n(&t->ring_submitted, __ATOMIC_ACQUIRE)) {
+            // announce that we are going to sleep, then check again, so that
+            // either we see the new work or the event loop sees us sleeping
+            __atomic_store_n(&t->sleeping, 1, __ATOMIC_SEQ_CST);
+            
+            if (pos == __atomic_load_n(&t->ring_submitted, __ATOMIC_SEQ_CST) && !__atomic_load_n(&o->cancel, __ATOMIC_SEQ_CST)) {
+                // wait for event
+                uint64_t v;
+                int res = read(t->wake_fd, &v, sizeof(v));
+                if (res < 0) {
+                    int error = errno;
+                    ASSERT_FORCE(error == EINTR)
+                }
+            }
+            
+            __atomic_store_n(&t->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        
+        struct BThreadWorkDispatcher_entry *e = &t->ring[pos % BTHREADWORK_SPSC_RING_SIZE];
+        
+        // grab the work, unless it was cancelled
+        int expected = ENTRY_STATE_PENDING;
+        if (__atomic_compare_exchange_n(&e->state, &expected, ENTRY_STATE_RUNNING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            BThreadWork *w = e->work;
+            
+            // do the work
+            w->work_func(w->work_func_user);
+            
+            // release the work; we must not touch it after this
+            ASSERT_FORCE(sem_post(&w->finished_sem) == 0)
+            __atomic_store_n(&e->state, ENTRY_STATE_DONE, __ATOMIC_RELEASE);
+        } else {
+            ASSERT(expected == ENTRY_STATE_CANCELLED)
+        }
+        
+        // publish the entry as done
+        pos++;
+        __atomic_store_n(&t->ring_done, pos, __ATOMIC_SEQ_CST);
+        
+        // notify the event loop, unless it was already notified and has not yet
+        // looked for finished works
+        if (!__atomic_exchange_n(&o->done_notified, 1, __ATOMIC_SEQ_CST)) {
+            uint64_t one = 1;
+            ASSERT_FORCE(write(o->done_fd, &one, sizeof(one)) == sizeof(one))
+        }
+    }
+    
+    return NULL;
+}
+
+static void spsc_push (struct BThreadWorkDispatcher_thread *t, BThreadWork *w)
+{
+    ASSERT(t->ring_submitted - t->ring_consumed < BTHREADWORK_SPSC_RING_SIZE)
+    
+    // fill in entry
+    struct BThreadWorkDispatcher_entry *e = &t->ring[t->ring_submitted % BTHREADWORK_SPSC_RING_SIZE];
+    e->work = w;
+    e->state = ENTRY_STATE_PENDING;
+    
+    // remember entry
+    w->entry = e;
+    w->state = BTHREADWORK_STATE_SUBMITTED;
+    
+    // publish entry
+    __atomic_store_n(&t->ring_submitted, t->ring_submitted + 1, __ATOMIC_SEQ_CST);
+    
+    // wake up thread if it is sleeping
+    if (__atomic_exchange_n(&t->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        ASSERT_FORCE(write(t->wake_fd, &one, sizeof(one)) == sizeof(one))
+    }
+}
+
+static struct BThreadWorkDispatcher_thread * spsc_choose_thread (BThreadWorkDispatcher *o)
+{
+    struct BThreadWorkDispatcher_thread *best = NULL;
+    unsigned int best_load = 0;
+    
+    // find the thread with the least unfinished works, starting after
+    // the previously chosen one to spread ties
+    for (int i = 0; i < o->num_threads; i++) {
+        int index = (o->next_thread + i) % o->num_threads;
+        struct BThreadWorkDispatcher_thread *t = &o->threads[index];
+        
+        if (t->ring_submitted - t->ring_consumed == BTHREADWORK_SPSC_RING_SIZE) {
+            continue;
+        }
+        
+        unsigned int load = t->ring_submitted - __atomic_load_n(&t->ring_done, __ATOMIC_ACQUIRE);
+        if (!best || load < best_load) {
+            best = t;
+            best_load = load;
+            if (load == 0) {
+                break;
+            }
+        }
+    }
+    
+    if (best) {
+        o->next_thread = (best - o->threads + 1) % o->num_threads;
+    }
+    
+    return best;
+}
+
+static void spsc_dispatch_job (BThreadWorkDispatcher *o)
+{
+    ASSERT(o->num_threads > 0)
+    ASSERT(o->spsc)
+    
+    for (int i = 0; i < o->num_threads; i++) {
+        int index = (o->next_dispatch_thread + i) % o->num_threads;
+        struct BThreadWorkDispatcher_thread *t = &o->threads[index];
+        
+        while (t->ring_consumed != __atomic_load_n(&t->ring_done, __ATOMIC_ACQUIRE)) {
+            // consume entry
+            BThreadWork *w = t->ring[t->ring_consumed % BTHREADWORK_SPSC_RING_SIZE].work;
+            t->ring_consumed++;
+            
+            // move a queued work into the freed space
+            if (!LinkedList1_IsEmpty(&o->queued_list)) {
+                BThreadWork *qw = UPPER_OBJECT(LinkedList1_GetFirst(&o->queued_list), BThreadWork, list_node);
+                ASSERT(qw->state == BTHREADWORK_STATE_PENDING)
+                LinkedList1_Remove(&o->queued_list, &qw->list_node);
+                spsc_push(t, qw);
+            }
+            
+            // skip works which were freed
+            if (!w) {
+                continue;
+            }
+            ASSERT(w->state == BTHREADWORK_STATE_SUBMITTED)
+            
+            // set state forgotten
+            w->state = BTHREADWORK_STATE_FORGOTTEN;
+            
+            // continue with the next thread next time
+            o->next_dispatch_thread = (index + 1) % o->num_threads;
+            
+            // schedule more
+            BPending_Set(&o->more_job);
+            
+            // call handler
+            w->handler_done(w->user);
+            return;
+        }
+    }
+}
+
+static void spsc_done_fd_handler (BThreadWorkDispatcher *o, int events)
+{
+    ASSERT(o->num_threads > 0)
+    ASSERT(o->spsc)
+    DebugObject_Access(&o->d_obj);
+    
+    // read eventfd
+    uint64_t v;
+    int res = read(o->done_fd, &v, sizeof(v));
+    if (res < 0) {
+        int error = errno;
+        ASSERT_FORCE(error == EAGAIN || error == EWOULDBLOCK)
+    }
+    
+    // allow threads to notify us again; this must happen before we
+    // look for finished works, so no notification is lost
+    __atomic_store_n(&o->done_notified, 0, __ATOMIC_SEQ_CST);
+    
+    spsc_dispatch_job(o);
+    return;
+}
+
+static void spsc_stop_threads (BThreadWorkDispatcher *o)
+{
+    // set cancelling
+    __atomic_store_n(&o->cancel, 1, __ATOMIC_SEQ_CST);
+    
+    while (o->num_threads > 0) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[o->num_threads - 1];
+        
+        // wake up thread
+        uint64_t one = 1;
+        ASSERT_FORCE(write(t->wake_fd, &one, sizeof(one)) == sizeof(one))
+        
+        // wait for thread to exit
+        ASSERT_FORCE(pthread_join(t->thread, NULL) == 0)
+        
+        // free ring
+        BFree(t->ring);
+        
+        // free wake eventfd
+        ASSERT_FORCE(close(t->wake_fd) == 0)
+        
+        o->num_threads--;
+    }
+}
+
+static int spsc_init (BThreadWorkDispatcher *o, int num_threads)
+{
+    // init queued list
+    LinkedList1_Init(&o->queued_list);
+    
+    // init done eventfd
+    if ((o->done_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        BLog(BLOG_ERROR, "eventfd failed");
+        goto fail0;
+    }
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&o->bfd, o->done_fd, (BFileDescriptor_handler)spsc_done_fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail1;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+    
+    // init more job
+    BPending_Init(&o->more_job, BReactor_PendingGroup(o->reactor), (BPending_handler)spsc_dispatch_job, o);
+    
+    // set not cancelling, not notified
+    o->cancel = 0;
+    o->done_notified = 0;
+    o->next_thread = 0;
+    o->next_dispatch_thread = 0;
+    
+    // init threads
+    o->num_threads = 0;
+    for (int i = 0; i < num_threads; i++) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[i];
+        
+        // set parent pointer
+        t->d = o;
+        
+        // init ring
+        if (!(t->ring = (struct BThreadWorkDispatcher_entry *)BAllocArray(BTHREADWORK_SPSC_RING_SIZE, sizeof(t->ring[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail2;
+        }
+        t->ring_submitted = 0;
+        t->ring_done = 0;
+        t->ring_consumed = 0;
+        t->sleeping = 0;
+        
+        // init wake eventfd
+        if ((t->wake_fd = eventfd(0, 0)) < 0) {
+            BLog(BLOG_ERROR, "eventfd failed");
+            BFree(t->ring);
+            goto fail2;
+        }
+        
+        // init thread
+        if (pthread_create(&t->thread, NULL, (void * (*) (void *))spsc_thread, t) != 0) {
+            BLog(BLOG_ERROR, "pthread_create failed");
+            ASSERT_FORCE(close(t->wake_fd) == 0)
+            BFree(t->ring);
+            goto fail2;
+        }
+        
+        o->num_threads++;
+    }
+    
+    return 1;
+    
+fail2:
+    spsc_stop_threads(o);
+    BPending_Free(&o->more_job);
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+fail1:
+    ASSERT_FORCE(close(o->done_fd) == 0)
+fail0:
+    return 0;
+}
+
+static void spsc_free (BThreadWorkDispatcher *o)
+{
+    ASSERT(LinkedList1_IsEmpty(&o->queued_list))
+    
+    // stop threads
+    spsc_stop_threads(o);
+    
+    // free more job
+    BPending_Free(&o->more_job);
+    
+    // free BFileDescriptor
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    
+    // free done eventfd
+    ASSERT_FORCE(close(o->done_fd) == 0)
+}
+
+static void spsc_work_init (BThreadWork *o)
+{
+    BThreadWorkDispatcher *d = o->d;
+    
+    // submit to a thread with space in its ring, or queue if there
+    // are works already waiting
+    struct BThreadWorkDispatcher_thread *t;
+    if (LinkedList1_IsEmpty(&d->queued_list) && (t = spsc_choose_thread(d))) {
+        spsc_push(t, o);
+    } else {
+        o->state = BTHREADWORK_STATE_PENDING;
+        LinkedList1_Append(&d->queued_list, &o->list_node);
+    }
+}
+
+static void spsc_work_free (BThreadWork *o)
+{
+    BThreadWorkDispatcher *d = o->d;
+    
+    switch (o->state) {
+        case BTHREADWORK_STATE_PENDING: {
+            BLog(BLOG_DEBUG, "remove queued work");
+            
+            // remove from queued list
+            LinkedList1_Remove(&d->queued_list, &o->list_node);
+        } break;
+        
+        case BTHREADWORK_STATE_SUBMITTED: {
+            struct BThreadWorkDispatcher_entry *e = o->entry;
+            ASSERT(e->work == o)
+            
+            // cancel if not yet started, else wait for the work to finish running
+            int expected = ENTRY_STATE_PENDING;
+            if (__atomic_compare_exchange_n(&e->state, &expected, ENTRY_STATE_CANCELLED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                BLog(BLOG_DEBUG, "remove pending work");
+            } else {
+                BLog(BLOG_DEBUG, "remove running or finished work");
+                ASSERT_FORCE(sem_wait(&o->finished_sem) == 0)
+            }
+            
+            // make the entry be skipped when consumed
+            e->work = NULL;
+        } break;
+        
+        case BTHREADWORK_STATE_FORGOTTEN: {
+            BLog(BLOG_DEBUG, "remove forgotten work");
+        } break;
+        
+        default:
+            ASSERT(0);
+    }
+}
+
+#endif
+
 #endif
 
 static void work_job_handler (BThreadWork *o)
@@ -198,12 +687,17 @@ static void work_job_handler (BThreadWork *o)
 }
 
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint)
+{
+    return BThreadWorkDispatcher_Init2(o, reactor, num_threads_hint, 0);
+}
+
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, int flags)
 {
     // init arguments
     o->reactor = reactor;
     
     if (num_threads_hint < 0) {
-        num_threads_hint = 2;
+        num_threads_hint = BTHREADWORK_DEFAULT_THREADS;
     }
     if (num_threads_hint > BTHREADWORK_MAX_THREADS) {
         num_threads_hint = BTHREADWORK_MAX_THREADS;
@@ -211,76 +705,28 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     
+    o->num_threads = 0;
+    #ifdef BADVPN_LINUX
+    o->spsc = !!(flags & BTHREADWORK_FLAG_SPSC);
+    #endif
+    
     if (num_threads_hint > 0) {
-        // init pending list
-        LinkedList1_Init(&o->pending_list);
-        
-        // init finished list
-        LinkedList1_Init(&o->finished_list);
-        
-        // init mutex
-        if (pthread_mutex_init(&o->mutex, NULL) != 0) {
-            BLog(BLOG_ERROR, "pthread_mutex_init failed");
+        // allocate threads
+        if (!(o->threads = (struct BThreadWorkDispatcher_thread *)BAllocArray(num_threads_hint, sizeof(o->threads[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
             goto fail0;
         }
         
-        // init pipe
-        if (pipe(o->pipe) < 0) {
-            BLog(BLOG_ERROR, "pipe failed");
-            goto fail1;
-        }
-        
-        // set read end non-blocking
-        if (fcntl(o->pipe[0], F_SETFL, O_NONBLOCK) < 0) {
-            BLog(BLOG_ERROR, "fcntl failed");
-            goto fail2;
-        }
-        
-        // set write end non-blocking
-        if (fcntl(o->pipe[1], F_SETFL, O_NONBLOCK) < 0) {
-            BLog(BLOG_ERROR, "fcntl failed");
-            goto fail2;
-        }
-        
-        // init BFileDescriptor
-        BFileDescriptor_Init(&o->bfd, o->pipe[0], (BFileDescriptor_handler)pipe_fd_handler, o);
-        if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-            BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
-            goto fail2;
-        }
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
-        
-        // init more job
-        BPending_Init(&o->more_job, BReactor_PendingGroup(o->reactor), (BPending_handler)more_job_handler, o);
-        
-        // set not cancelling
-        o->cancel = 0;
-        
-        // init threads
-        o->num_threads = 0;
-        for (int i = 0; i < num_threads_hint; i++) {
-            struct BThreadWorkDispatcher_thread *t = &o->threads[i];
-            
-            // set parent pointer
-            t->d = o;
-            
-            // set no running work
-            t->running_work = NULL;
-            
-            // init condition variable
-            if (pthread_cond_init(&t->new_cond, NULL) != 0) {
-                BLog(BLOG_ERROR, "pthread_cond_init failed");
-                goto fail3;
-            }
-            
-            // init thread
-            if (pthread_create(&t->thread, NULL, (void * (*) (void *))dispatcher_thread, t) != 0) {
-                BLog(BLOG_ERROR, "pthread_create failed");
-                ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
-                goto fail3;
+        // init queues and start threads
+        #ifdef BADVPN_LINUX
+        if (o->spsc) {
+            if (!spsc_init(o, num_threads_hint)) {
+                goto fail1;
             }
-        
-            o->num_threads++;
+        } else
+        #endif
+        if (!mutex_init(o, num_threads_hint)) {
+            goto fail1;
         }
     }
     
@@ -291,15 +737,8 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
     return 1;
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-fail3:
-    stop_threads(o);
-    BPending_Free(&o->more_job);
-    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
-fail2:
-    ASSERT_FORCE(close(o->pipe[0]) == 0)
-    ASSERT_FORCE(close(o->pipe[1]) == 0)
 fail1:
-    ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+    BFree(o->threads);
 fail0:
     return 0;
     #endif
@@ -307,34 +746,22 @@ fail0:
 
 void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
 {
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    if (o->num_threads > 0) {
-        ASSERT(LinkedList1_IsEmpty(&o->pending_list))
-        for (int i = 0; i < o->num_threads; i++) { ASSERT(!o->threads[i].running_work) }
-        ASSERT(LinkedList1_IsEmpty(&o->finished_list))
-    }
-    #endif
     DebugObject_Free(&o->d_obj);
     DebugCounter_Free(&o->d_ctr);
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     
     if (o->num_threads > 0) {
-        // stop threads
-        stop_threads(o);
-        
-        // free more job
-        BPending_Free(&o->more_job);
-        
-        // free BFileDescriptor
-        BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
-        
-        // free pipe
-        ASSERT_FORCE(close(o->pipe[0]) == 0)
-        ASSERT_FORCE(close(o->pipe[1]) == 0)
+        // free queues and stop threads
+        #ifdef BADVPN_LINUX
+        if (o->spsc) {
+            spsc_free(o);
+        } else
+        #endif
+        mutex_free(o);
         
-        // free mutex
-        ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+        // free threads
+        BFree(o->threads);
     }
     
     #endif
@@ -361,7 +788,16 @@ void BThreadWork_Init (BThreadWork *o, BThreadWorkDispatcher *d, BThreadWork_han
     o->work_func_user = work_func_user;
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    if (d->num_threads > 0) {
+    if (d->num_threads > 0 && is_spsc(d)) {
+        // init finished semaphore
+        ASSERT_FORCE(sem_init(&o->finished_sem, 0, 0) == 0)
+        
+        #ifdef BADVPN_LINUX
+        // submit or queue work
+        spsc_work_init(o);
+        #endif
+    }
+    else if (d->num_threads > 0) {
         // set state
         o->state = BTHREADWORK_STATE_PENDING;
         
@@ -398,7 +834,15 @@ void BThreadWork_Free (BThreadWork *o)
     DebugCounter_Decrement(&d->d_ctr);
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    if (d->num_threads > 0) {
+    if (d->num_threads > 0 && is_spsc(d)) {
+        #ifdef BADVPN_LINUX
+        spsc_work_free(o);
+        #endif
+        
+        // free finished semaphore
+        ASSERT_FORCE(sem_destroy(&o->finished_sem) == 0)
+    }
+    else if (d->num_threads > 0) {
         ASSERT_FORCE(pthread_mutex_lock(&d->mutex) == 0)
         
         switch (o->state) {
@@ -49,8 +49,18 @@
 #define BTHREADWORK_STATE_RUNNING 2
 #define BTHREADWORK_STATE_FINISHED 3
 #define BTHREADWORK_STATE_FORGOTTEN 4
+#define BTHREADWORK_STATE_SUBMITTED 5
 
-#define BTHREADWORK_MAX_THREADS 8
+#define BTHREADWORK_MAX_THREADS 256
+
+// number of threads chosen when num_threads_hint is <0
+#define BTHREADWORK_DEFAULT_THREADS 2
+
+// flags for BThreadWorkDispatcher_Init2
+#define BTHREADWORK_FLAG_SPSC 1
+
+// number of works each thread's ring can hold in BTHREADWORK_FLAG_SPSC mode
+#define BTHREADWORK_SPSC_RING_SIZE 64
 
 struct BThreadWork_s;
 struct BThreadWorkDispatcher_s;
@@ -71,11 +81,24 @@ typedef void (*BThreadWork_work_func) (void *user);
 typedef void (*BThreadWork_handler_done) (void *user);
 
 #ifdef BADVPN_THREADWORK_USE_PTHREAD
+struct BThreadWorkDispatcher_entry {
+    struct BThreadWork_s *work;
+    int state;
+};
+
 struct BThreadWorkDispatcher_thread {
     struct BThreadWorkDispatcher_s *d;
     struct BThreadWork_s *running_work;
     pthread_cond_t new_cond;
     pthread_t thread;
+    #ifdef BADVPN_LINUX
+    int wake_fd;
+    int sleeping;
+    struct BThreadWorkDispatcher_entry *ring;
+    unsigned int ring_submitted;
+    unsigned int ring_done;
+    unsigned int ring_consumed;
+    #endif
 };
 #endif
 
@@ -90,7 +113,15 @@ typedef struct BThreadWorkDispatcher_s {
     BPending more_job;
     int cancel;
     int num_threads;
-    struct BThreadWorkDispatcher_thread threads[BTHREADWORK_MAX_THREADS];
+    struct BThreadWorkDispatcher_thread *threads;
+    #ifdef BADVPN_LINUX
+    int spsc;
+    int done_fd;
+    int done_notified;
+    int next_thread;
+    int next_dispatch_thread;
+    LinkedList1 queued_list;
+    #endif
     #endif
     DebugObject d_obj;
     DebugCounter d_ctr;
@@ -108,6 +139,7 @@ typedef struct BThreadWork_s {
             LinkedList1Node list_node;
             int state;
             sem_t finished_sem;
+            struct BThreadWorkDispatcher_entry *entry;
         };
         #endif
         struct {
@@ -127,10 +159,34 @@ typedef struct BThreadWork_s {
  *                         <0 - A choice will be made automatically, probably based on the number of CPUs.
  *                         0 - No additional threads will be used, and computations will be performed directly
  *                             in the event loop in job handlers.
+ *                         >0 - This many threads will be used, up to BTHREADWORK_MAX_THREADS.
  * @return 1 on success, 0 on failure
  */
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint) WARN_UNUSED;
 
+/**
+ * Initializes the work dispatcher, with flags.
+ * Works may be started using {@link BThreadWork_Init}.
+ * 
+ * With BTHREADWORK_FLAG_SPSC, works are not put into a shared mutex-protected
+ * queue. Instead, each thread has a lock-free single-producer single-consumer
+ * ring of BTHREADWORK_SPSC_RING_SIZE works, which the event loop fills, and
+ * which the thread works through in order. A new work goes to the thread with
+ * the fewest works in its ring; if all rings are full, it waits in the event loop
+ * until space is available. A thread blocks on its own eventfd only when its ring
+ * is empty, and is only woken up if it is blocked. Finished works are reported
+ * to the event loop through a single eventfd, which is written only when the
+ * event loop has not been notified since it last looked for finished works.
+ * This flag is only supported on Linux; elsewhere it is ignored.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param num_threads_hint as in {@link BThreadWorkDispatcher_Init}
+ * @param flags bitmask of BTHREADWORK_FLAG_* values
+ * @return 1 on success, 0 on failure
+ */
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, int flags) WARN_UNUSED;
+
 /**
  * Frees the work dispatcher.
  * There must be no {@link BThreadWork}'s with this dispatcher.
@@ -26,12 +26,26 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
 #include <limits.h>
 
+#ifdef BADVPN_LINUX
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#endif
+
 #include <misc/version.h>
 #include <misc/loggers_string.h>
 #include <misc/loglevel.h>
@@ -42,6 +56,7 @@
 #include <misc/ipv6_proto.h>
 #include <misc/udp_proto.h>
 #include <misc/byteorder.h>
+#include <misc/read_write_int.h>
 #include <misc/balloc.h>
 #include <misc/open_standard_streams.h>
 #include <misc/read_file.h>
@@ -64,6 +79,7 @@
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <base/BLog_async.h>
 #endif
 
 #include <tun2socks/tun2socks.h>
@@ -95,10 +111,14 @@ struct {
     #ifndef BADVPN_USE_WINAPI
     char *logger_syslog_facility;
     char *logger_syslog_ident;
+    int logger_async;
     #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
     char *tundev;
+    int tun_queues;
+    int tun_recv_batch;
+    int tun_vnet_hdr;
     char *netif_ipaddr;
     char *netif_netmask;
     char *netif_ip6addr;
@@ -165,6 +185,15 @@ BReactor ss;
 // set to 1 by terminate
 int quitting;
 
+// index of the TUN queue served by this process
+int queue_index;
+
+#ifdef BADVPN_LINUX
+// queue worker processes (in the process serving queue 0)
+pid_t queue_worker_pids[TUN2SOCKS_MAX_TUN_QUEUES];
+int num_queue_workers;
+#endif
+
 // TUN device
 BTap device;
 
@@ -207,12 +236,21 @@ static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
+#ifdef BADVPN_LINUX
+static int start_queue_workers (void);
+static void stop_queue_workers (void);
+static void pin_to_cpu (int index);
+#endif
 static BAddr baddr_from_lwip (int is_ipv6, const ipX_addr_t *ipx_addr, uint16_t port_hostorder);
 static void lwip_init_job_hadler (void *unused);
 static void tcp_timer_handler (void *unused);
 static void device_error_handler (void *unused);
 static void device_read_handler_send (void *unused, uint8_t *data, int data_len);
-static int process_device_udp_packet (uint8_t *data, int data_len);
+#ifdef BADVPN_LINUX
+static int process_vnet_header (uint8_t **data, int *data_len, int *out_needs_csum, int *out_csum_ok, uint16_t *out_csum_start, uint16_t *out_csum_offset);
+static int complete_checksum (uint8_t *data, int data_len, uint16_t csum_start, uint16_t csum_offset);
+#endif
+static int process_device_udp_packet (uint8_t *data, int data_len, int checksum_ok);
 static err_t netif_init_func (struct netif *netif);
 static err_t netif_output_func (struct netif *netif, struct pbuf *p, ip_addr_t *ipaddr);
 static err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, ip6_addr_t *ipaddr);
@@ -309,11 +347,43 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    // serving queue 0 unless we fork workers
+    queue_index = 0;
+    
+    #ifdef BADVPN_LINUX
+    num_queue_workers = 0;
+    
+    // start a worker process for each additional TUN queue. Each worker has its
+    // own reactor and lwIP instance (lwIP state is global, so these can't be threads).
+    if (options.tun_queues > 1) {
+        if (!start_queue_workers()) {
+            BLog(BLOG_ERROR, "failed to start queue workers");
+            goto fail1;
+        }
+        
+        BLog(BLOG_NOTICE, "serving TUN queue %d of %d", queue_index, options.tun_queues);
+    }
+    #endif
+    
+    #ifndef BADVPN_USE_WINAPI
+    // make logging asynchronous if requested; not before forking queue
+    // workers, since the writer thread would not exist in them
+    if (options.logger_async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_RING_SIZE)) {
+        BLog(BLOG_ERROR, "BLog_MakeAsync failed");
+        goto fail1;
+    }
+    #endif
+    
     // init time
     BTime_Init();
     
     // init reactor
-    if (!BReactor_Init(&ss)) {
+#ifdef BADVPN_BREACTOR_BADVPN
+    int reactor_res = BReactor_Init2(&ss, BREACTOR_INIT_FLAG_EDGE_TRIGGERED);
+#else
+    int reactor_res = BReactor_Init(&ss);
+#endif
+    if (!reactor_res) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
@@ -328,18 +398,32 @@ int main (int argc, char **argv)
     }
     
     // init TUN device
-    if (!BTap_Init(&device, &ss, options.tundev, device_error_handler, NULL, 1)) {
-        BLog(BLOG_ERROR, "BTap_Init failed");
+    struct BTap_init_data init_data;
+    init_data.dev_type = BTAP_DEV_TUN;
+    init_data.init_type = BTAP_INIT_STRING;
+    init_data.flags = (options.tun_queues > 1 ? BTAP_INIT_FLAG_MULTI_QUEUE : 0) |
+                      (options.tun_vnet_hdr ? BTAP_INIT_FLAG_VNET_HDR : 0);
+    init_data.init.string = options.tundev;
+    if (!BTap_Init2(&device, &ss, init_data, device_error_handler, NULL)) {
+        BLog(BLOG_ERROR, "BTap_Init2 failed");
         goto fail3;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // enable batched reading
+    if (options.tun_recv_batch > 0 && !BTap_SetRecvBatch(&device, options.tun_recv_batch)) {
+        BLog(BLOG_ERROR, "BTap_SetRecvBatch failed");
+        goto fail3a;
+    }
+    #endif
+    
     // NOTE: the order of the following is important:
     // first device writing must evaluate,
     // then lwip (so it can send packets to the device),
     // then device reading (so it can pass received packets to lwip).
     
     // init device reading
-    PacketPassInterface_Init(&device_read_interface, BTap_GetMTU(&device), device_read_handler_send, NULL, BReactor_PendingGroup(&ss));
+    PacketPassInterface_Init(&device_read_interface, PacketRecvInterface_GetMTU(BTap_GetOutput(&device)), device_read_handler_send, NULL, BReactor_PendingGroup(&ss));
     if (!SinglePacketBuffer_Init(&device_read_buffer, BTap_GetOutput(&device), &device_read_interface, BReactor_PendingGroup(&ss))) {
         BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
         goto fail4;
@@ -438,12 +522,16 @@ fail4a:
     SinglePacketBuffer_Free(&device_read_buffer);
 fail4:
     PacketPassInterface_Free(&device_read_interface);
+fail3a:
     BTap_Free(&device);
 fail3:
     BSignal_Finish();
 fail2:
     BReactor_Free(&ss);
 fail1:
+    #ifdef BADVPN_LINUX
+    stop_queue_workers();
+    #endif
     BFree(password_file_contents);
     BLog(BLOG_NOTICE, "exiting");
     BLog_Free();
@@ -479,10 +567,20 @@ void print_help (const char *name)
         "            [--syslog-facility <string>]\n"
         "            [--syslog-ident <string>]\n"
         "        )\n"
+        "        [--logger-async]\n"
         #endif
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--tundev <name>]\n"
+        #ifdef BADVPN_LINUX
+        "        [--tun-queues <number>]\n"
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        "        [--tun-recv-batch <frames>]\n"
+        #endif
+        #ifdef BADVPN_LINUX
+        "        [--tun-vnet-hdr]\n"
+        #endif
         "        --netif-ipaddr <ipaddr>\n"
         "        --netif-netmask <ipnetmask>\n"
         "        --socks-server-addr <addr>\n"
@@ -517,12 +615,16 @@ int parse_arguments (int argc, char *argv[])
     #ifndef BADVPN_USE_WINAPI
     options.logger_syslog_facility = "daemon";
     options.logger_syslog_ident = argv[0];
+    options.logger_async = 0;
     #endif
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
     }
     options.tundev = NULL;
+    options.tun_queues = 1;
+    options.tun_recv_batch = 0;
+    options.tun_vnet_hdr = 0;
     options.netif_ipaddr = NULL;
     options.netif_netmask = NULL;
     options.netif_ip6addr = NULL;
@@ -582,6 +684,9 @@ int parse_arguments (int argc, char *argv[])
             options.logger_syslog_ident = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--logger-async")) {
+            options.logger_async = 1;
+        }
         #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
@@ -620,6 +725,37 @@ int parse_arguments (int argc, char *argv[])
             options.tundev = argv[i + 1];
             i++;
         }
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--tun-queues")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tun_queues = atoi(argv[i + 1])) <= 0 || options.tun_queues > TUN2SOCKS_MAX_TUN_QUEUES) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--tun-recv-batch")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tun_recv_batch = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--tun-vnet-hdr")) {
+            options.tun_vnet_hdr = 1;
+        }
+        #endif
         else if (!strcmp(arg, "--netif-ipaddr")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -737,6 +873,11 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (options.tun_queues > 1 && !options.tundev) {
+        fprintf(stderr, "--tun-queues requires --tundev\n");
+        return 0;
+    }
+    
     if (options.username) {
         if (!options.password && !options.password_file) {
             fprintf(stderr, "username given but password not given\n");
@@ -835,6 +976,87 @@ void signal_handler (void *unused)
     terminate();
 }
 
+#ifdef BADVPN_LINUX
+
+int start_queue_workers (void)
+{
+    ASSERT(options.tun_queues > 1)
+    ASSERT(queue_index == 0)
+    ASSERT(num_queue_workers == 0)
+    
+    pid_t parent_pid = getpid();
+    
+    // make sure buffered output isn't duplicated in the workers
+    fflush(stdout);
+    fflush(stderr);
+    
+    for (int i = 1; i < options.tun_queues; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            BLog(BLOG_ERROR, "fork failed");
+            stop_queue_workers();
+            return 0;
+        }
+        
+        if (pid == 0) {
+            // we're a worker now
+            queue_index = i;
+            num_queue_workers = 0;
+            
+            // get terminated along with the parent
+            if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0) {
+                BLog(BLOG_WARNING, "prctl(PR_SET_PDEATHSIG) failed");
+            }
+            if (getppid() != parent_pid) {
+                BLog(BLOG_ERROR, "parent exited before worker started");
+                return 0;
+            }
+            
+            break;
+        }
+        
+        queue_worker_pids[num_queue_workers++] = pid;
+    }
+    
+    pin_to_cpu(queue_index);
+    
+    return 1;
+}
+
+void stop_queue_workers (void)
+{
+    for (int i = 0; i < num_queue_workers; i++) {
+        kill(queue_worker_pids[i], SIGTERM);
+    }
+    
+    for (int i = 0; i < num_queue_workers; i++) {
+        while (waitpid(queue_worker_pids[i], NULL, 0) < 0 && errno == EINTR);
+    }
+    
+    num_queue_workers = 0;
+}
+
+void pin_to_cpu (int index)
+{
+    ASSERT(index >= 0)
+    
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus <= 0) {
+        BLog(BLOG_WARNING, "cannot determine number of CPUs, not pinning");
+        return;
+    }
+    
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % num_cpus, &cpus);
+    
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        BLog(BLOG_WARNING, "sched_setaffinity failed");
+    }
+}
+
+#endif
+
 BAddr baddr_from_lwip (int is_ipv6, const ipX_addr_t *ipx_addr, uint16_t port_hostorder)
 {
     BAddr addr;
@@ -981,11 +1203,32 @@ void device_read_handler_send (void *unused, uint8_t *data, int data_len)
     // accept packet
     PacketPassInterface_Done(&device_read_interface);
     
+    int checksum_ok = 0;
+    
+    #ifdef BADVPN_LINUX
+    int needs_csum = 0;
+    uint16_t csum_start = 0;
+    uint16_t csum_offset = 0;
+    
+    // strip virtio-net header
+    if (options.tun_vnet_hdr && !process_vnet_header(&data, &data_len, &needs_csum, &checksum_ok, &csum_start, &csum_offset)) {
+        return;
+    }
+    #endif
+    
     // process UDP directly
-    if (process_device_udp_packet(data, data_len)) {
+    if (process_device_udp_packet(data, data_len, checksum_ok)) {
         return;
     }
     
+    #ifdef BADVPN_LINUX
+    // lwIP verifies checksums, so fill in any checksum the kernel left to us
+    if (needs_csum && !complete_checksum(data, data_len, csum_start, csum_offset)) {
+        BLog(BLOG_WARNING, "device read: bad checksum offsets");
+        return;
+    }
+    #endif
+    
     // obtain pbuf
     if (data_len > UINT16_MAX) {
         BLog(BLOG_WARNING, "device read: packet too large");
@@ -1007,7 +1250,65 @@ void device_read_handler_send (void *unused, uint8_t *data, int data_len)
     }
 }
 
-int process_device_udp_packet (uint8_t *data, int data_len)
+#ifdef BADVPN_LINUX
+
+int process_vnet_header (uint8_t **data, int *data_len, int *out_needs_csum, int *out_csum_ok, uint16_t *out_csum_start, uint16_t *out_csum_offset)
+{
+    ASSERT(options.tun_vnet_hdr)
+    
+    if (*data_len < BTAP_VNET_HDR_LEN) {
+        BLog(BLOG_WARNING, "device read: missing virtio-net header");
+        return 0;
+    }
+    
+    struct virtio_net_hdr hdr;
+    memcpy(&hdr, *data, sizeof(hdr));
+    *data += sizeof(hdr);
+    *data_len -= sizeof(hdr);
+    
+    // We only enable TCP segmentation offload, and a TCP GSO frame is a valid
+    // (if large) TCP segment which lwIP can process as a whole.
+    
+    // NEEDS_CSUM means the packet came from the local stack with only the pseudo-header
+    // part of its transport checksum, so there is nothing to verify.
+    *out_needs_csum = !!(hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    *out_csum_ok = !!(hdr.flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM|VIRTIO_NET_HDR_F_DATA_VALID));
+    *out_csum_start = hdr.csum_start;
+    *out_csum_offset = hdr.csum_offset;
+    
+    return 1;
+}
+
+int complete_checksum (uint8_t *data, int data_len, uint16_t csum_start, uint16_t csum_offset)
+{
+    ASSERT(data_len >= 0)
+    
+    if (csum_start > data_len || csum_offset > data_len - csum_start - 2) {
+        return 0;
+    }
+    
+    // sum everything from csum_start on, including the pseudo-header sum in the checksum field
+    uint32_t t = 0;
+    int i;
+    for (i = csum_start; i + 1 < data_len; i += 2) {
+        t += badvpn_read_be16((char *)data + i);
+    }
+    if (i < data_len) {
+        t += (uint32_t)data[i] << 8;
+    }
+    
+    while (t >> 16) {
+        t = (t & 0xFFFF) + (t >> 16);
+    }
+    
+    badvpn_write_be16(~t, (char *)data + csum_start + csum_offset);
+    
+    return 1;
+}
+
+#endif
+
+int process_device_udp_packet (uint8_t *data, int data_len, int checksum_ok)
 {
     ASSERT(data_len >= 0)
     
@@ -1044,12 +1345,14 @@ int process_device_udp_packet (uint8_t *data, int data_len)
                 goto fail;
             }
             
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            // verify UDP checksum, unless the device vouches for it
+            if (!checksum_ok) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
             
             BLog(BLOG_INFO, "UDP: from device %d bytes", data_len);
@@ -1088,12 +1391,14 @@ int process_device_udp_packet (uint8_t *data, int data_len)
                 goto fail;
             }
             
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            // verify UDP checksum, unless the device vouches for it
+            if (!checksum_ok) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
             
             BLog(BLOG_INFO, "UDP/IPv6: from device %d bytes", data_len);
@@ -1781,6 +2086,7 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
     ASSERT(data_len >= 0)
     
     int packet_length = 0;
+    int header_length = 0;
     
     switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
@@ -1813,13 +2119,19 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
             udph.dest_port = local_addr.ipv4.port;
             udph.length = hton16(sizeof(udph) + data_len);
             udph.checksum = hton16(0);
-            udph.checksum = udp_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
+            if (options.tun_vnet_hdr) {
+                // leave the payload checksum to the kernel
+                udph.checksum = udp_checksum_pseudo(sizeof(udph) + data_len, iph.source_address, iph.destination_address);
+            } else {
+                udph.checksum = udp_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
+            }
             
             // write packet
             memcpy(device_write_buf, &iph, sizeof(iph));
             memcpy(device_write_buf + sizeof(iph), &udph, sizeof(udph));
             memcpy(device_write_buf + sizeof(iph) + sizeof(udph), data, data_len);
             packet_length = sizeof(iph) + sizeof(udph) + data_len;
+            header_length = sizeof(iph);
         } break;
         
         case BADDR_TYPE_IPV6: {
@@ -1854,16 +2166,37 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
             udph.dest_port = local_addr.ipv6.port;
             udph.length = hton16(sizeof(udph) + data_len);
             udph.checksum = hton16(0);
-            udph.checksum = udp_ip6_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
+            if (options.tun_vnet_hdr) {
+                // leave the payload checksum to the kernel
+                udph.checksum = udp_ip6_checksum_pseudo(sizeof(udph) + data_len, iph.source_address, iph.destination_address);
+            } else {
+                udph.checksum = udp_ip6_checksum(&udph, data, data_len, iph.source_address, iph.destination_address);
+            }
             
             // write packet
             memcpy(device_write_buf, &iph, sizeof(iph));
             memcpy(device_write_buf + sizeof(iph), &udph, sizeof(udph));
             memcpy(device_write_buf + sizeof(iph) + sizeof(udph), data, data_len);
             packet_length = sizeof(iph) + sizeof(udph) + data_len;
+            header_length = sizeof(iph);
         } break;
     }
     
+    #ifdef BADVPN_LINUX
+    if (options.tun_vnet_hdr) {
+        struct virtio_net_hdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        hdr.csum_start = header_length;
+        hdr.csum_offset = offsetof(struct udp_header, checksum);
+        
+        // submit packet
+        BTap_SendVnet(&device, &hdr, device_write_buf, packet_length);
+        return;
+    }
+    #endif
+    
     // submit packet
     BTap_Send(&device, device_write_buf, packet_length);
 }
@@ -27,6 +27,9 @@
 // name of the program
 #define PROGRAM_NAME "tun2socks"
 
+// maximum number of TUN queues (the kernel's MAX_TAP_QUEUES)
+#define TUN2SOCKS_MAX_TUN_QUEUES 256
+
 // size of temporary buffer for passing data from the SOCKS server to TCP for sending
 #define CLIENT_SOCKS_RECV_BUF_SIZE 8192
 
@@ -45,6 +45,7 @@
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <net/if.h>
     #include <net/if_arp.h>
     #ifdef BADVPN_LINUX
@@ -56,6 +57,7 @@
     #endif
 #endif
 
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include <tuntap/BTap.h>
@@ -83,7 +85,7 @@ static void recv_olap_handler (BTap *o, int event, DWORD bytes)
     }
     
     ASSERT(bytes >= 0)
-    ASSERT(bytes <= o->frame_mtu)
+    ASSERT(bytes <= o->recv_mtu)
     
     // done
     PacketRecvInterface_Done(&o->output, bytes);
@@ -91,6 +93,72 @@ static void recv_olap_handler (BTap *o, int event, DWORD bytes)
 
 #else
 
+static int batch_fill (BTap *o)
+{
+    ASSERT(o->batch_size > 0)
+    
+    // read frames until the device has no more or the ring is full
+    while (o->batch_used < o->batch_size) {
+        int index = (o->batch_start + o->batch_used) % o->batch_size;
+        
+        int bytes = read(o->fd, o->batch_frames + (size_t)index * o->recv_mtu, o->recv_mtu);
+        if (bytes <= 0) {
+            // See note about zero return in fd_handler.
+            if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
+                break;
+            }
+            // report fatal error
+            report_error(o);
+            return 0;
+        }
+        
+        ASSERT_FORCE(bytes <= o->recv_mtu)
+        
+        o->batch_lens[index] = bytes;
+        o->batch_used++;
+    }
+    
+    return 1;
+}
+
+static void batch_update_events (BTap *o)
+{
+    ASSERT(o->batch_size > 0)
+    
+    // stay registered for reading as long as there is space in the ring
+    int events = (o->batch_used < o->batch_size ? BREACTOR_READ : 0);
+    
+    if (events != o->poll_events) {
+        o->poll_events = events;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+    }
+}
+
+static void batch_deliver (BTap *o)
+{
+    ASSERT(o->batch_size > 0)
+    ASSERT(o->batch_used > 0)
+    ASSERT(o->output_packet)
+    
+    // copy the oldest frame to the receiver
+    int len = o->batch_lens[o->batch_start];
+    memcpy(o->output_packet, o->batch_frames + (size_t)o->batch_start * o->recv_mtu, len);
+    
+    // remove it from the ring
+    o->batch_start = (o->batch_start + 1) % o->batch_size;
+    o->batch_used--;
+    
+    // set no output packet
+    o->output_packet = NULL;
+    
+    // update events
+    batch_update_events(o);
+    
+    // inform receiver we finished the packet
+    PacketRecvInterface_Done(&o->output, len);
+}
+
 static void fd_handler (BTap *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -100,16 +168,29 @@ static void fd_handler (BTap *o, int events)
         BLog(BLOG_WARNING, "device fd reports error?");
     }
     
-    if (events&BREACTOR_READ) do {
+    if ((events&BREACTOR_READ) && o->batch_size > 0) {
+        // drain the device into the ring
+        if (!batch_fill(o)) {
+            return;
+        }
+        
+        if (o->output_packet && o->batch_used > 0) {
+            batch_deliver(o);
+        } else {
+            batch_update_events(o);
+        }
+    }
+    else if (events&BREACTOR_READ) do {
         ASSERT(o->output_packet)
         
         // try reading into the buffer
-        int bytes = read(o->fd, o->output_packet, o->frame_mtu);
+        int bytes = read(o->fd, o->output_packet, o->recv_mtu);
         if (bytes <= 0) {
             // Treat zero return value the same as EAGAIN.
             // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
             if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
                 // retry later
+                BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
                 break;
             }
             // report fatal error
@@ -117,7 +198,7 @@ static void fd_handler (BTap *o, int events)
             return;
         }
         
-        ASSERT_FORCE(bytes <= o->frame_mtu)
+        ASSERT_FORCE(bytes <= o->recv_mtu)
         
         // set no output packet
         o->output_packet = NULL;
@@ -150,7 +231,7 @@ void output_handler_recv (BTap *o, uint8_t *data)
     memset(&o->recv_olap.olap, 0, sizeof(o->recv_olap.olap));
     
     // read
-    BOOL res = ReadFile(o->device, data, o->frame_mtu, NULL, &o->recv_olap.olap);
+    BOOL res = ReadFile(o->device, data, o->recv_mtu, NULL, &o->recv_olap.olap);
     if (res == FALSE && GetLastError() != ERROR_IO_PENDING) {
         BLog(BLOG_ERROR, "ReadFile failed (%u)", GetLastError());
         report_error(o);
@@ -161,12 +242,31 @@ void output_handler_recv (BTap *o, uint8_t *data)
     
 #else
     
+    if (o->batch_size > 0) {
+        // remember packet
+        o->output_packet = data;
+        
+        // if the ring is empty, try to refill it
+        if (o->batch_used == 0 && !batch_fill(o)) {
+            return;
+        }
+        
+        if (o->batch_used > 0) {
+            batch_deliver(o);
+        } else {
+            // wait in fd_handler
+            batch_update_events(o);
+        }
+        return;
+    }
+    
     // attempt read
-    int bytes = read(o->fd, data, o->frame_mtu);
+    int bytes = read(o->fd, data, o->recv_mtu);
     if (bytes <= 0) {
         if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
             // See note about zero return in fd_handler.
             // retry later in fd_handler
+            BReactor_FileDescriptorWouldBlock(o->reactor, &o->bfd, BREACTOR_READ);
             // remember packet
             o->output_packet = data;
             // update events
@@ -179,7 +279,7 @@ void output_handler_recv (BTap *o, uint8_t *data)
         return;
     }
     
-    ASSERT_FORCE(bytes <= o->frame_mtu)
+    ASSERT_FORCE(bytes <= o->recv_mtu)
     
     PacketRecvInterface_Done(&o->output, bytes);
     
@@ -193,6 +293,7 @@ int BTap_Init (BTap *o, BReactor *reactor, char *devname, BTap_handler_error han
     struct BTap_init_data init_data;
     init_data.dev_type = tun ? BTAP_DEV_TUN : BTAP_DEV_TAP;
     init_data.init_type = BTAP_INIT_STRING;
+    init_data.flags = 0;
     init_data.init.string = devname;
     
     return BTap_Init2(o, reactor, init_data, handler_error, handler_error_user);
@@ -211,6 +312,11 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     
     ASSERT(init_data.init_type == BTAP_INIT_STRING)
     
+    if (init_data.flags & (BTAP_INIT_FLAG_MULTI_QUEUE|BTAP_INIT_FLAG_VNET_HDR)) {
+        BLog(BLOG_ERROR, "multi-queue and virtio-net headers not supported on Windows");
+        goto fail0;
+    }
+    
     // parse device specification
     
     if (!init_data.init.string) {
@@ -280,6 +386,7 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     } else {
         o->frame_mtu = umtu + BTAP_ETHERNET_HEADER_LENGTH;
     }
+    o->recv_mtu = o->frame_mtu;
     
     // set connected
     
@@ -328,6 +435,7 @@ fail0:
             ASSERT(init_data.init.fd.fd >= 0)
             ASSERT(init_data.init.fd.mtu >= 0)
             ASSERT(init_data.dev_type != BTAP_DEV_TAP || init_data.init.fd.mtu >= BTAP_ETHERNET_HEADER_LENGTH)
+            ASSERT(!(init_data.flags & (BTAP_INIT_FLAG_MULTI_QUEUE|BTAP_INIT_FLAG_VNET_HDR)))
             
             o->fd = init_data.init.fd.fd;
             o->frame_mtu = init_data.init.fd.mtu;
@@ -355,6 +463,17 @@ fail0:
             } else {
                 ifr.ifr_flags |= IFF_TAP;
             }
+            if (init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE) {
+                #ifdef IFF_MULTI_QUEUE
+                ifr.ifr_flags |= IFF_MULTI_QUEUE;
+                #else
+                BLog(BLOG_ERROR, "multi-queue not supported by kernel headers");
+                goto fail1;
+                #endif
+            }
+            if (init_data.flags & BTAP_INIT_FLAG_VNET_HDR) {
+                ifr.ifr_flags |= IFF_VNET_HDR;
+            }
             if (init_data.init.string) {
                 snprintf(ifr.ifr_name, IFNAMSIZ, "%s", init_data.init.string);
             }
@@ -366,6 +485,24 @@ fail0:
             
             strcpy(devname_real, ifr.ifr_name);
             
+            if (init_data.flags & BTAP_INIT_FLAG_VNET_HDR) {
+                int hdr_len = BTAP_VNET_HDR_LEN;
+                if (ioctl(o->fd, TUNSETVNETHDRSZ, &hdr_len) < 0) {
+                    BLog(BLOG_ERROR, "error setting virtio-net header size");
+                    goto fail1;
+                }
+                
+                // let the kernel give us unsegmented TCP and skip computing checksums,
+                // falling back to checksum offload only
+                if (ioctl(o->fd, TUNSETOFFLOAD, (unsigned long)(TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6)) < 0) {
+                    BLog(BLOG_WARNING, "cannot enable TSO offload, trying checksum offload only");
+                    if (ioctl(o->fd, TUNSETOFFLOAD, (unsigned long)TUN_F_CSUM) < 0) {
+                        BLog(BLOG_ERROR, "error enabling offloads");
+                        goto fail1;
+                    }
+                }
+            }
+            
             #endif
             
             #ifdef BADVPN_FREEBSD
@@ -375,6 +512,11 @@ fail0:
                 goto fail0;
             }
             
+            if (init_data.flags & (BTAP_INIT_FLAG_MULTI_QUEUE|BTAP_INIT_FLAG_VNET_HDR)) {
+                BLog(BLOG_ERROR, "multi-queue and virtio-net headers not supported on FreeBSD");
+                goto fail0;
+            }
+            
             if (!init_data.init.string) {
                 BLog(BLOG_ERROR, "no device specified");
                 goto fail0;
@@ -432,7 +574,16 @@ fail0:
         
         default: ASSERT(0);
     }
-        
+    
+    // frames we read may be preceded by a virtio-net header and be GSO frames
+    o->vnet_hdr = !!(init_data.flags & BTAP_INIT_FLAG_VNET_HDR);
+    o->recv_mtu = o->frame_mtu;
+    #ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        o->recv_mtu = BTAP_VNET_HDR_LEN + BTAP_VNET_MAX_FRAME + (init_data.dev_type == BTAP_DEV_TAP ? BTAP_ETHERNET_HEADER_LENGTH : 0);
+    }
+    #endif
+    
     // set non-blocking
     if (fcntl(o->fd, F_SETFL, O_NONBLOCK) < 0) {
         BLog(BLOG_ERROR, "cannot set non-blocking");
@@ -441,12 +592,15 @@ fail0:
     
     // init file descriptor object
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+    if (!BReactor_AddFileDescriptor2(o->reactor, &o->bfd, BREACTOR_FD_FLAG_EDGE)) {
         BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
         goto fail1;
     }
     o->poll_events = 0;
     
+    // batching is disabled by default
+    o->batch_size = 0;
+    
     goto success;
     
 fail1:
@@ -460,7 +614,7 @@ fail0:
     
 success:
     // init output
-    PacketRecvInterface_Init(&o->output, o->frame_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    PacketRecvInterface_Init(&o->output, o->recv_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
     
     // set no output packet
     o->output_packet = NULL;
@@ -500,6 +654,12 @@ void BTap_Free (BTap *o)
     
 #else
     
+    // free batch ring
+    if (o->batch_size > 0) {
+        BFree(o->batch_lens);
+        BFree(o->batch_frames);
+    }
+    
     // free BFileDescriptor
     BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
     
@@ -559,7 +719,28 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
     
 #else
     
-    int bytes = write(o->fd, data, data_len);
+    int bytes;
+    
+    #ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        // no offloads requested
+        struct virtio_net_hdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        
+        struct iovec iov[2];
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = data;
+        iov[1].iov_len = data_len;
+        
+        bytes = writev(o->fd, iov, 2);
+        if (bytes >= 0) {
+            bytes -= sizeof(hdr);
+        }
+    } else
+    #endif
+    bytes = write(o->fd, data, data_len);
     if (bytes < 0) {
         // malformed packets will cause errors, ignore them and act like
         // the packet was accepeted
@@ -572,6 +753,73 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
 #endif
 }
 
+#ifndef BADVPN_USE_WINAPI
+
+int BTap_SetRecvBatch (BTap *o, int batch_size)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->batch_size == 0)
+    ASSERT(!o->output_packet)
+    ASSERT(batch_size > 0)
+    
+    // allocate ring
+    if (!(o->batch_frames = (uint8_t *)BAllocArray(batch_size, o->recv_mtu))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    if (!(o->batch_lens = (int *)BAllocArray(batch_size, sizeof(o->batch_lens[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    o->batch_size = batch_size;
+    o->batch_start = 0;
+    o->batch_used = 0;
+    
+    // start reading into the ring
+    batch_update_events(o);
+    
+    return 1;
+    
+fail1:
+    BFree(o->batch_frames);
+fail0:
+    return 0;
+}
+
+#endif
+
+#ifdef BADVPN_LINUX
+
+void BTap_SendVnet (BTap *o, const struct virtio_net_hdr *hdr, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->vnet_hdr)
+    ASSERT(hdr)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->recv_mtu - BTAP_VNET_HDR_LEN)
+    
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = data;
+    iov[1].iov_len = data_len;
+    
+    int bytes = writev(o->fd, iov, 2);
+    if (bytes < 0) {
+        // malformed packets will cause errors, ignore them and act like
+        // the packet was accepeted
+    } else {
+        if (bytes != sizeof(*hdr) + data_len) {
+            BLog(BLOG_WARNING, "written %d expected %d", bytes, (int)sizeof(*hdr) + data_len);
+        }
+    }
+}
+
+#endif
+
 PacketRecvInterface * BTap_GetOutput (BTap *o)
 {
     DebugObject_Access(&o->d_obj);
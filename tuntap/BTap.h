@@ -45,6 +45,10 @@
 #include <net/if.h>
 #endif
 
+#ifdef BADVPN_LINUX
+#include <linux/virtio_net.h>
+#endif
+
 #include <misc/debug.h>
 #include <misc/debugerror.h>
 #include <base/DebugObject.h>
@@ -53,6 +57,17 @@
 
 #define BTAP_ETHERNET_HEADER_LENGTH 14
 
+// flags for struct BTap_init_data
+#define BTAP_INIT_FLAG_MULTI_QUEUE 1
+#define BTAP_INIT_FLAG_VNET_HDR 2
+
+#ifdef BADVPN_LINUX
+#define BTAP_VNET_HDR_LEN ((int)sizeof(struct virtio_net_hdr))
+#endif
+
+// largest IP packet a GSO frame can carry
+#define BTAP_VNET_MAX_FRAME 65535
+
 /**
  * Handler called when an error occurs on the device.
  * The object must be destroyed from the job context of this
@@ -67,6 +82,7 @@ typedef struct {
     BTap_handler_error handler_error;
     void *handler_error_user;
     int frame_mtu;
+    int recv_mtu;
     PacketRecvInterface output;
     uint8_t *output_packet;
     
@@ -76,9 +92,15 @@ typedef struct {
     BReactorIOCPOverlapped recv_olap;
 #else
     int close_fd;
+    int vnet_hdr;
     int fd;
     BFileDescriptor bfd;
     int poll_events;
+    int batch_size;
+    uint8_t *batch_frames;
+    int *batch_lens;
+    int batch_start;
+    int batch_used;
 #endif
     
     DebugError d_err;
@@ -119,6 +141,7 @@ enum BTap_init_type {
 struct BTap_init_data {
     enum BTap_dev_type dev_type;
     enum BTap_init_type init_type;
+    int flags;
     union {
         char *string;
         struct {
@@ -153,6 +176,20 @@ struct BTap_init_data {
  *                  and init_data.init.fd.mtu must be set to the largest IP packet or
  *                  Ethernet frame supported, for a TUN or TAP device, respectively.
  *                  File descriptor initialization is not supported on Windows.
+ *                  init_data.flags is a bitmask of BTAP_INIT_FLAG_* values.
+ *                  BTAP_INIT_FLAG_MULTI_QUEUE (Linux, BTAP_INIT_STRING only) opens
+ *                  the device with IFF_MULTI_QUEUE, attaching a new queue to it if it
+ *                  already exists. Every queue must be opened with this flag. The kernel
+ *                  distributes received packets among the queues by flow, so all packets
+ *                  of a TCP or UDP flow are read from the same queue.
+ *                  BTAP_INIT_FLAG_VNET_HDR (Linux, BTAP_INIT_STRING only) opens the device
+ *                  with IFF_VNET_HDR and enables checksum and TSO offloads. Every frame
+ *                  received through the output interface then starts with a
+ *                  struct virtio_net_hdr (BTAP_VNET_HDR_LEN bytes), and may be a GSO frame
+ *                  of up to BTAP_VNET_MAX_FRAME bytes (plus the Ethernet header for TAP),
+ *                  so the output interface's MTU is larger than {@link BTap_GetMTU}.
+ *                  TCP and UDP frames coming from the local stack may have only the
+ *                  pseudo-header part of their checksum filled in (VIRTIO_NET_HDR_F_NEEDS_CSUM).
  * @param handler_error error handler function
  * @param handler_error_user value passed to error handler
  * @return 1 on success, 0 on failure
@@ -184,9 +221,55 @@ int BTap_GetMTU (BTap *o);
  */
 void BTap_Send (BTap *o, uint8_t *data, int data_len);
 
+#ifndef BADVPN_USE_WINAPI
+
+/**
+ * Enables batched receiving.
+ * Must be called before the output interface is used for receiving.
+ * 
+ * Instead of reading one frame per receive request and registering for readability
+ * only while a receive request is waiting, the device stays registered for reading as
+ * long as there is space in an internal ring of batch_size frames. When the device
+ * becomes readable, it is drained into the ring until the kernel queue is empty or the
+ * ring is full, and receive requests are then served from the ring. This avoids
+ * changing the reactor's interest set for every frame and lets a single readiness
+ * event deliver many frames. It costs a copy of each frame from the ring into the
+ * receiver's buffer.
+ * 
+ * Note that writes are not batched: a TUN/TAP file descriptor accepts exactly one
+ * frame per write() or writev().
+ * 
+ * @param o the object
+ * @param batch_size number of frames in the ring. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BTap_SetRecvBatch (BTap *o, int batch_size) WARN_UNUSED;
+
+#endif
+
+#ifdef BADVPN_LINUX
+
+/**
+ * Sends a packet with the given virtio-net header to the device.
+ * The device must have been opened with BTAP_INIT_FLAG_VNET_HDR.
+ * This allows passing GSO frames for the kernel to segment, and packets
+ * whose checksum the kernel should complete (VIRTIO_NET_HDR_F_NEEDS_CSUM).
+ * Any errors will be reported via a job.
+ * 
+ * @param o the object
+ * @param hdr virtio-net header, in native byte order
+ * @param data packet to send
+ * @param data_len length of packet. Must be >=0 and <=BTAP_VNET_MAX_FRAME
+ *                 (plus the Ethernet header length for TAP devices).
+ */
+void BTap_SendVnet (BTap *o, const struct virtio_net_hdr *hdr, uint8_t *data, int data_len);
+
+#endif
+
 /**
  * Returns a {@link PacketRecvInterface} for reading packets from the device.
- * The MTU of the interface will be {@link BTap_GetMTU}.
+ * The MTU of the interface will be {@link BTap_GetMTU}, unless the device was
+ * opened with BTAP_INIT_FLAG_VNET_HDR.
  * 
  * @param o the object
  * @return output interface
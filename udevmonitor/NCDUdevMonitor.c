@@ -100,17 +100,47 @@ static void parser_handler (NCDUdevMonitor *o)
     return;
 }
 
-int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, void *user,
-                         NCDUdevMonitor_handler_event handler_event,
-                         NCDUdevMonitor_handler_error handler_error)
+static void netlink_handler_error (NCDUdevMonitor *o)
 {
-    ASSERT(mode == NCDUDEVMONITOR_MODE_MONITOR_UDEV || mode == NCDUDEVMONITOR_MODE_INFO || mode == NCDUDEVMONITOR_MODE_MONITOR_KERNEL)
+    DebugObject_Access(&o->d_obj);
     
-    // init arguments
-    o->user = user;
-    o->handler_event = handler_event;
-    o->handler_error = handler_error;
+    DEBUGERROR(&o->d_err, o->handler_error(o->user, 1));
+}
+
+static void scan_handler_finished (NCDUdevMonitor *o, int is_error)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    DEBUGERROR(&o->d_err, o->handler_error(o->user, is_error));
+}
+
+static int init_netlink (NCDUdevMonitor *o, BReactor *reactor, int mode)
+{
+    if (mode == NCDUDEVMONITOR_MODE_INFO) {
+        // init sysfs scan
+        if (!NCDUdevSysfsScan_Init(&o->scan, BReactor_PendingGroup(reactor), PARSER_MAX_PROPERTIES, o,
+                                   (NCDUdevSysfsScan_handler_event)parser_handler,
+                                   (NCDUdevSysfsScan_handler_finished)scan_handler_finished
+        )) {
+            BLog(BLOG_ERROR, "NCDUdevSysfsScan_Init failed");
+            return 0;
+        }
+    } else {
+        // init netlink receiver
+        if (!NCDUdevNetlink_Init(&o->netlink, reactor, (mode == NCDUDEVMONITOR_MODE_MONITOR_UDEV), PARSER_MAX_PROPERTIES, o,
+                                 (NCDUdevNetlink_handler_event)parser_handler,
+                                 (NCDUdevNetlink_handler_error)netlink_handler_error
+        )) {
+            BLog(BLOG_ERROR, "NCDUdevNetlink_Init failed");
+            return 0;
+        }
+    }
     
+    return 1;
+}
+
+static int init_udevadm (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode)
+{
     // find programs
     char *stdbuf_exec = badvpn_find_program("stdbuf");
     char *udevadm_exec = badvpn_find_program("udevadm");
@@ -171,9 +201,6 @@ int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *
     
     free(udevadm_exec);
     free(stdbuf_exec);
-    
-    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
-    DebugObject_Init(&o->d_obj);
     return 1;
     
 fail2:
@@ -187,11 +214,52 @@ fail0:
     return 0;
 }
 
+int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, int backend, void *user,
+                         NCDUdevMonitor_handler_event handler_event,
+                         NCDUdevMonitor_handler_error handler_error)
+{
+    ASSERT(mode == NCDUDEVMONITOR_MODE_MONITOR_UDEV || mode == NCDUDEVMONITOR_MODE_INFO || mode == NCDUDEVMONITOR_MODE_MONITOR_KERNEL)
+    ASSERT(backend == NCDUDEVMONITOR_BACKEND_UDEVADM || backend == NCDUDEVMONITOR_BACKEND_NETLINK)
+    
+    // init arguments
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_error = handler_error;
+    o->backend = backend;
+    o->mode = mode;
+    
+    // init backend
+    if (backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (!init_netlink(o, reactor, mode)) {
+            return 0;
+        }
+    } else {
+        if (!init_udevadm(o, reactor, manager, mode)) {
+            return 0;
+        }
+    }
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
 void NCDUdevMonitor_Free (NCDUdevMonitor *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
     
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            // free sysfs scan
+            NCDUdevSysfsScan_Free(&o->scan);
+        } else {
+            // free netlink receiver
+            NCDUdevNetlink_Free(&o->netlink);
+        }
+        return;
+    }
+    
     // free parser
     NCDUdevMonitorParser_Free(&o->parser);
     
@@ -211,7 +279,16 @@ void NCDUdevMonitor_Done (NCDUdevMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
+    
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            NCDUdevSysfsScan_Done(&o->scan);
+        } else {
+            NCDUdevNetlink_Done(&o->netlink);
+        }
+        return;
+    }
     
     NCDUdevMonitorParser_Done(&o->parser);
 }
@@ -220,22 +297,46 @@ int NCDUdevMonitor_IsReadyEvent (NCDUdevMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
+    
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            return 0;
+        }
+        return NCDUdevNetlink_IsReadyEvent(&o->netlink);
+    }
     
     return NCDUdevMonitorParser_IsReadyEvent(&o->parser);
 }
+
 void NCDUdevMonitor_AssertReady (NCDUdevMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            NCDUdevSysfsScan_AssertReady(&o->scan);
+        } else {
+            NCDUdevNetlink_AssertReady(&o->netlink);
+        }
+    } else {
+        NCDUdevMonitorParser_AssertReady(&o->parser);
+    }
 }
 
 int NCDUdevMonitor_GetNumProperties (NCDUdevMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
+    
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            return NCDUdevSysfsScan_GetNumProperties(&o->scan);
+        }
+        return NCDUdevNetlink_GetNumProperties(&o->netlink);
+    }
     
     return NCDUdevMonitorParser_GetNumProperties(&o->parser);
 }
@@ -244,7 +345,16 @@ void NCDUdevMonitor_GetProperty (NCDUdevMonitor *o, int index, const char **name
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
+    
+    if (o->backend == NCDUDEVMONITOR_BACKEND_NETLINK) {
+        if (o->mode == NCDUDEVMONITOR_MODE_INFO) {
+            NCDUdevSysfsScan_GetProperty(&o->scan, index, name, value);
+        } else {
+            NCDUdevNetlink_GetProperty(&o->netlink, index, name, value);
+        }
+        return;
+    }
     
     NCDUdevMonitorParser_GetProperty(&o->parser, index, name, value);
 }
@@ -35,11 +35,18 @@
 #include <flow/StreamRecvConnector.h>
 #include <system/BInputProcess.h>
 #include <udevmonitor/NCDUdevMonitorParser.h>
+#include <udevmonitor/NCDUdevNetlink.h>
+#include <udevmonitor/NCDUdevSysfsScan.h>
 
 #define NCDUDEVMONITOR_MODE_MONITOR_UDEV 0
 #define NCDUDEVMONITOR_MODE_INFO 1
 #define NCDUDEVMONITOR_MODE_MONITOR_KERNEL 2
 
+// run udevadm and parse its output
+#define NCDUDEVMONITOR_BACKEND_UDEVADM 0
+// receive events from netlink and scan sysfs for the info mode
+#define NCDUDEVMONITOR_BACKEND_NETLINK 1
+
 typedef void (*NCDUdevMonitor_handler_event) (void *user);
 typedef void (*NCDUdevMonitor_handler_error) (void *user, int is_error);
 
@@ -47,6 +54,10 @@ typedef struct {
     void *user;
     NCDUdevMonitor_handler_event handler_event;
     NCDUdevMonitor_handler_error handler_error;
+    int backend;
+    int mode;
+    NCDUdevNetlink netlink;
+    NCDUdevSysfsScan scan;
     BInputProcess process;
     int process_running;
     int process_was_error;
@@ -58,7 +69,7 @@ typedef struct {
     DebugError d_err;
 } NCDUdevMonitor;
 
-int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, void *user,
+int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, int backend, void *user,
                          NCDUdevMonitor_handler_event handler_event,
                          NCDUdevMonitor_handler_error handler_error) WARN_UNUSED;
 void NCDUdevMonitor_Free (NCDUdevMonitor *o);
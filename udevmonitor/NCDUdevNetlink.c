@@ -0,0 +1,429 @@
+/**
+ * @file NCDUdevNetlink.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/netlink.h>
+
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+
+#include <udevmonitor/NCDUdevNetlink.h>
+
+#include <generated/blog_channel_NCDUdevNetlink.h>
+
+#define BUF_SIZE 16384
+#define RCVBUF_SIZE (128 * 1024 * 1024)
+
+#define GROUP_KERNEL 1
+#define GROUP_UDEV 2
+
+#define UDEV_MAGIC 0xfeedcafe
+
+// header of events rebroadcast by udev, as in libudev; magic is
+// in network byte order, the other fields are in host byte order
+struct udev_header {
+    char prefix[8];
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t properties_off;
+    uint32_t properties_len;
+    uint32_t filter_subsystem_hash;
+    uint32_t filter_devtype_hash;
+    uint32_t filter_tag_bloom_hi;
+    uint32_t filter_tag_bloom_lo;
+};
+
+static int check_sender (NCDUdevNetlink *o, struct sockaddr_nl *sa, struct msghdr *msg)
+{
+    // kernel events come from the kernel, udev events from udevd
+    if (o->is_udev ? (sa->nl_groups != GROUP_UDEV || sa->nl_pid == 0) : (sa->nl_groups != GROUP_KERNEL || sa->nl_pid != 0)) {
+        return 0;
+    }
+    
+    // only accept events sent by root
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS || cmsg->cmsg_len < CMSG_LEN(sizeof(struct ucred))) {
+        BLog(BLOG_WARNING, "event without credentials");
+        return 0;
+    }
+    struct ucred cred;
+    memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+    if (cred.uid != 0) {
+        BLog(BLOG_WARNING, "event from non-root sender");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int parse_event (NCDUdevNetlink *o, size_t len)
+{
+    ASSERT(len < BUF_SIZE)
+    ASSERT(o->buf[len] == '\0')
+    
+    char *data;
+    char *end;
+    
+    if (o->is_udev) {
+        // check header
+        struct udev_header hdr;
+        if (len < sizeof(hdr)) {
+            BLog(BLOG_ERROR, "event too short");
+            return 0;
+        }
+        memcpy(&hdr, o->buf, sizeof(hdr));
+        if (memcmp(hdr.prefix, "libudev", 8) || ntoh32(hdr.magic) != UDEV_MAGIC) {
+            BLog(BLOG_ERROR, "wrong udev header");
+            return 0;
+        }
+        if (hdr.properties_off > len || hdr.properties_len > len - hdr.properties_off) {
+            BLog(BLOG_ERROR, "wrong udev properties location");
+            return 0;
+        }
+        
+        data = o->buf + hdr.properties_off;
+        end = data + hdr.properties_len;
+    } else {
+        // skip action@devpath head, the same information is in the properties
+        size_t head_len = strlen(o->buf);
+        if (head_len == len || !memchr(o->buf, '@', head_len)) {
+            BLog(BLOG_ERROR, "failed to parse head");
+            return 0;
+        }
+        
+        data = o->buf + head_len + 1;
+        end = o->buf + len;
+    }
+    
+    // init properties
+    o->ready_num_properties = 0;
+    
+    // properties are zero terminated name=value strings; the buffer is
+    // zero terminated after the data so the last one is too
+    while (data < end) {
+        char *prop = data;
+        data += strlen(prop) + 1;
+        
+        if (!*prop) {
+            continue;
+        }
+        
+        char *eq = strchr(prop, '=');
+        if (!eq || eq == prop) {
+            BLog(BLOG_ERROR, "failed to parse property");
+            return 0;
+        }
+        
+        if (o->ready_num_properties == o->max_properties) {
+            BLog(BLOG_ERROR, "too many properties");
+            return 0;
+        }
+        
+        // split name and value in place
+        *eq = '\0';
+        o->ready_properties[o->ready_num_properties].name = prop;
+        o->ready_properties[o->ready_num_properties].value = eq + 1;
+        o->ready_num_properties++;
+    }
+    
+    return 1;
+}
+
+static void recv_job_handler (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set not ready, the previous event was accepted
+    o->is_ready = 0;
+    
+    // keep receiving until we get a good event or the socket is empty
+    while (1) {
+        struct sockaddr_nl sa;
+        struct iovec iov;
+        iov.iov_base = o->buf;
+        iov.iov_len = BUF_SIZE - 1;
+        union {
+            char buf[CMSG_SPACE(sizeof(struct ucred))];
+            struct cmsghdr align;
+        } cbuf;
+        
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &sa;
+        msg.msg_namelen = sizeof(sa);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf.buf;
+        msg.msg_controllen = sizeof(cbuf.buf);
+        
+        ssize_t len = recvmsg(o->fd, &msg, 0);
+        if (len < 0) {
+            int error = errno;
+            if (error == EAGAIN || error == EWOULDBLOCK) {
+                // wait for more events
+                BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+                return;
+            }
+            if (error == EINTR) {
+                continue;
+            }
+            
+            // ENOBUFS means events were lost; let the user rescan
+            BLog(BLOG_ERROR, "recvmsg failed (%d)", error);
+            DEBUGERROR(&o->d_err, o->handler_error(o->user));
+            return;
+        }
+        
+        if ((msg.msg_flags & MSG_TRUNC)) {
+            BLog(BLOG_ERROR, "event truncated");
+            continue;
+        }
+        
+        if (msg.msg_namelen != sizeof(sa) || !check_sender(o, &sa, &msg)) {
+            continue;
+        }
+        
+        // zero terminate data
+        o->buf[len] = '\0';
+        
+        if (parse_event(o, len)) {
+            break;
+        }
+    }
+    
+    // set ready
+    o->is_ready = 1;
+    o->ready_is_ready_event = 0;
+    
+    // call handler
+    o->handler_event(o->user);
+    return;
+}
+
+static void ready_job_handler (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->is_ready)
+    
+    // set ready
+    o->is_ready = 1;
+    o->ready_is_ready_event = 1;
+    o->ready_num_properties = 0;
+    
+    // call handler
+    o->handler_event(o->user);
+    return;
+}
+
+static void fd_handler (NCDUdevNetlink *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->is_ready)
+    
+    // stop waiting until we've gone through what's queued
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    
+    // receive events
+    recv_job_handler(o);
+    return;
+}
+
+int NCDUdevNetlink_Init (NCDUdevNetlink *o, BReactor *reactor, int is_udev, int max_properties, void *user,
+                         NCDUdevNetlink_handler_event handler_event,
+                         NCDUdevNetlink_handler_error handler_error)
+{
+    ASSERT(is_udev == 0 || is_udev == 1)
+    ASSERT(max_properties >= 0)
+    
+    // init arguments
+    o->is_udev = is_udev;
+    o->max_properties = max_properties;
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_error = handler_error;
+    
+    // init socket
+    if ((o->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_KOBJECT_UEVENT)) < 0) {
+        BLog(BLOG_ERROR, "socket failed");
+        goto fail0;
+    }
+    if (!badvpn_set_nonblocking(o->fd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        goto fail1;
+    }
+    
+    // make the receive buffer big enough to absorb device storms,
+    // bypassing the rmem_max limit if we can
+    int rcvbuf = RCVBUF_SIZE;
+    if (setsockopt(o->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        setsockopt(o->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    
+    // receive sender credentials
+    int one = 1;
+    if (setsockopt(o->fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_PASSCRED) failed");
+        goto fail1;
+    }
+    
+    // subscribe to events
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = (is_udev ? GROUP_UDEV : GROUP_KERNEL);
+    if (bind(o->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        BLog(BLOG_ERROR, "bind failed");
+        goto fail1;
+    }
+    
+    // allocate buffer
+    if (!(o->buf = malloc(BUF_SIZE))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail1;
+    }
+    
+    // allocate properties
+    if (!(o->ready_properties = BAllocArray(max_properties, sizeof(o->ready_properties[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    // init BFileDescriptor, not waiting for events until the ready event is accepted
+    BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
+    if (!BReactor_AddFileDescriptor(reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail3;
+    }
+    
+    // init recv job
+    BPending_Init(&o->recv_job, BReactor_PendingGroup(reactor), (BPending_handler)recv_job_handler, o);
+    
+    // we are listening, so report the ready event
+    BPending_Init(&o->ready_job, BReactor_PendingGroup(reactor), (BPending_handler)ready_job_handler, o);
+    BPending_Set(&o->ready_job);
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail3:
+    BFree(o->ready_properties);
+fail2:
+    free(o->buf);
+fail1:
+    close(o->fd);
+fail0:
+    return 0;
+}
+
+void NCDUdevNetlink_Free (NCDUdevNetlink *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free jobs
+    BPending_Free(&o->ready_job);
+    BPending_Free(&o->recv_job);
+    
+    // free BFileDescriptor
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    
+    // free properties
+    BFree(o->ready_properties);
+    
+    // free buffer
+    free(o->buf);
+    
+    // close socket
+    close(o->fd);
+}
+
+void NCDUdevNetlink_AssertReady (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+}
+
+void NCDUdevNetlink_Done (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    // receive next event
+    BPending_Set(&o->recv_job);
+}
+
+int NCDUdevNetlink_IsReadyEvent (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_is_ready_event;
+}
+
+int NCDUdevNetlink_GetNumProperties (NCDUdevNetlink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_num_properties;
+}
+
+void NCDUdevNetlink_GetProperty (NCDUdevNetlink *o, int index, const char **name, const char **value)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    ASSERT(index >= 0)
+    ASSERT(index < o->ready_num_properties)
+    
+    *name = o->ready_properties[index].name;
+    *value = o->ready_properties[index].value;
+}
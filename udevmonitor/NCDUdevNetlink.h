@@ -0,0 +1,105 @@
+/**
+ * @file NCDUdevNetlink.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_UDEVMONITOR_NCDUDEVNETLINK_H
+#define BADVPN_UDEVMONITOR_NCDUDEVNETLINK_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+
+typedef void (*NCDUdevNetlink_handler_event) (void *user);
+typedef void (*NCDUdevNetlink_handler_error) (void *user);
+
+struct NCDUdevNetlink_property {
+    char *name;
+    char *value;
+};
+
+/**
+ * Receives device events directly from a NETLINK_KOBJECT_UEVENT socket,
+ * either as sent by the kernel or as rebroadcast by udev after it has
+ * processed them, and parses their properties in place.
+ * 
+ * Like the udevadm monitor, the first reported event is a ready event,
+ * reported once the socket is listening. Events are received one at a
+ * time; the next one is read when the current one is accepted with
+ * {@link NCDUdevNetlink_Done}, without going through the reactor as long
+ * as the socket has more events queued.
+ */
+typedef struct {
+    int is_udev;
+    int max_properties;
+    BReactor *reactor;
+    void *user;
+    NCDUdevNetlink_handler_event handler_event;
+    NCDUdevNetlink_handler_error handler_error;
+    int fd;
+    BFileDescriptor bfd;
+    BPending recv_job;
+    BPending ready_job;
+    char *buf;
+    int is_ready;
+    int ready_is_ready_event;
+    struct NCDUdevNetlink_property *ready_properties;
+    int ready_num_properties;
+    DebugObject d_obj;
+    DebugError d_err;
+} NCDUdevNetlink;
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param is_udev 1 to receive events processed by udev, 0 to receive events
+ *                from the kernel
+ * @param max_properties maximum number of properties in an event; events
+ *                       with more are dropped
+ * @param user argument to handlers
+ * @param handler_event handler called when an event is ready
+ * @param handler_error handler called when receiving fails and events may
+ *                      have been lost
+ * @return 1 on success, 0 on failure
+ */
+int NCDUdevNetlink_Init (NCDUdevNetlink *o, BReactor *reactor, int is_udev, int max_properties, void *user,
+                         NCDUdevNetlink_handler_event handler_event,
+                         NCDUdevNetlink_handler_error handler_error) WARN_UNUSED;
+void NCDUdevNetlink_Free (NCDUdevNetlink *o);
+void NCDUdevNetlink_AssertReady (NCDUdevNetlink *o);
+void NCDUdevNetlink_Done (NCDUdevNetlink *o);
+int NCDUdevNetlink_IsReadyEvent (NCDUdevNetlink *o);
+int NCDUdevNetlink_GetNumProperties (NCDUdevNetlink *o);
+void NCDUdevNetlink_GetProperty (NCDUdevNetlink *o, int index, const char **name, const char **value);
+
+#endif
@@ -0,0 +1,425 @@
+/**
+ * @file NCDUdevSysfsScan.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include <udevmonitor/NCDUdevSysfsScan.h>
+
+#include <generated/blog_channel_NCDUdevSysfsScan.h>
+
+#define SYSFS_DIR "/sys"
+#define DEVICES_DIR SYSFS_DIR "/devices"
+#define UDEV_DATA_DIR "/run/udev/data"
+
+#define FILE_BUF_SIZE 16384
+#define BUF_SIZE 16384
+
+static int read_small_file (NCDUdevSysfsScan *o, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    size_t len = 0;
+    while (len < FILE_BUF_SIZE - 1) {
+        ssize_t res = read(fd, o->file_buf + len, FILE_BUF_SIZE - 1 - len);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        if (res == 0) {
+            break;
+        }
+        len += res;
+    }
+    
+    close(fd);
+    
+    o->file_buf[len] = '\0';
+    return len;
+}
+
+static int add_property (NCDUdevSysfsScan *o, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    if (o->ready_num_properties == o->max_properties) {
+        BLog(BLOG_ERROR, "too many properties");
+        return 0;
+    }
+    
+    if (name_len + value_len + 2 > BUF_SIZE - o->buf_used) {
+        BLog(BLOG_ERROR, "out of buffer");
+        return 0;
+    }
+    
+    struct NCDUdevSysfsScan_property *prop = &o->ready_properties[o->ready_num_properties];
+    
+    prop->name = o->buf + o->buf_used;
+    memcpy(prop->name, name, name_len);
+    prop->name[name_len] = '\0';
+    o->buf_used += name_len + 1;
+    
+    prop->value = o->buf + o->buf_used;
+    memcpy(prop->value, value, value_len);
+    prop->value[value_len] = '\0';
+    o->buf_used += value_len + 1;
+    
+    o->ready_num_properties++;
+    
+    return 1;
+}
+
+static int add_file_properties (NCDUdevSysfsScan *o, const char *prefix)
+{
+    size_t prefix_len = strlen(prefix);
+    char *line = o->file_buf;
+    
+    // only complete lines are used, in case the file didn't fit
+    char *line_end;
+    while (line_end = strchr(line, '\n')) {
+        *line_end = '\0';
+        
+        if (!strncmp(line, prefix, prefix_len)) {
+            char *name = line + prefix_len;
+            char *eq = strchr(name, '=');
+            if (eq && eq != name) {
+                if (!add_property(o, name, eq - name, eq + 1, line_end - (eq + 1))) {
+                    return 0;
+                }
+            }
+        }
+        
+        line = line_end + 1;
+    }
+    
+    return 1;
+}
+
+static const char * find_property (NCDUdevSysfsScan *o, const char *name)
+{
+    for (int i = 0; i < o->ready_num_properties; i++) {
+        if (!strcmp(o->ready_properties[i].name, name)) {
+            return o->ready_properties[i].value;
+        }
+    }
+    
+    return NULL;
+}
+
+static int read_device (NCDUdevSysfsScan *o)
+{
+    char file_path[PATH_MAX];
+    
+    // read uevent file, directories without one aren't devices
+    if (snprintf(file_path, sizeof(file_path), "%s/uevent", o->path) >= sizeof(file_path)) {
+        return 0;
+    }
+    if (read_small_file(o, file_path) < 0) {
+        return 0;
+    }
+    
+    // get subsystem; like udev, ignore devices without one
+    char link[PATH_MAX];
+    if (snprintf(file_path, sizeof(file_path), "%s/subsystem", o->path) >= sizeof(file_path)) {
+        return 0;
+    }
+    ssize_t link_len = readlink(file_path, link, sizeof(link) - 1);
+    if (link_len < 0) {
+        return 0;
+    }
+    link[link_len] = '\0';
+    const char *subsystem = strrchr(link, '/');
+    subsystem = (subsystem ? subsystem + 1 : link);
+    
+    // init properties
+    o->buf_used = 0;
+    o->ready_num_properties = 0;
+    
+    const char *devpath = o->path + strlen(SYSFS_DIR);
+    if (!add_property(o, "DEVPATH", strlen("DEVPATH"), devpath, strlen(devpath)) ||
+        !add_property(o, "SUBSYSTEM", strlen("SUBSYSTEM"), subsystem, strlen(subsystem)) ||
+        !add_file_properties(o, "")
+    ) {
+        goto fail;
+    }
+    
+    // build udev database ID, as udev does
+    const char *major = find_property(o, "MAJOR");
+    const char *minor = find_property(o, "MINOR");
+    const char *ifindex = find_property(o, "IFINDEX");
+    const char *sysname = strrchr(o->path, '/') + 1;
+    int res;
+    if (major && minor && strcmp(major, "0")) {
+        res = snprintf(file_path, sizeof(file_path), "%s/%c%s:%s", UDEV_DATA_DIR, (!strcmp(subsystem, "block") ? 'b' : 'c'), major, minor);
+    } else if (ifindex) {
+        res = snprintf(file_path, sizeof(file_path), "%s/n%s", UDEV_DATA_DIR, ifindex);
+    } else {
+        res = snprintf(file_path, sizeof(file_path), "%s/+%s:%s", UDEV_DATA_DIR, subsystem, sysname);
+    }
+    
+    // add properties from udev database; devices udev hasn't seen don't have any
+    if (res < sizeof(file_path) && read_small_file(o, file_path) >= 0) {
+        if (!add_file_properties(o, "E:")) {
+            goto fail;
+        }
+    }
+    
+    return 1;
+    
+fail:
+    BLog(BLOG_ERROR, "skipping device %s", devpath);
+    return 0;
+}
+
+static int is_directory (NCDUdevSysfsScan *o, struct dirent *ent)
+{
+    if (ent->d_type != DT_UNKNOWN) {
+        return (ent->d_type == DT_DIR);
+    }
+    
+    struct stat st;
+    if (lstat(o->path, &st) < 0) {
+        return 0;
+    }
+    
+    return S_ISDIR(st.st_mode);
+}
+
+static void next_job_handler (NCDUdevSysfsScan *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set not ready, the previous event was accepted
+    o->is_ready = 0;
+    
+    while (o->depth > 0) {
+        DIR *dir = o->dirs[o->depth - 1];
+        size_t dir_path_len = o->dir_path_lens[o->depth - 1];
+        
+        // restore path of the current directory
+        o->path[dir_path_len] = '\0';
+        
+        struct dirent *ent = readdir(dir);
+        if (!ent) {
+            // leave directory
+            closedir(dir);
+            o->depth--;
+            continue;
+        }
+        
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        
+        // build path of entry
+        size_t name_len = strlen(ent->d_name);
+        if (name_len + 2 > PATH_MAX - dir_path_len) {
+            BLog(BLOG_WARNING, "path too long");
+            continue;
+        }
+        o->path[dir_path_len] = '/';
+        memcpy(o->path + dir_path_len + 1, ent->d_name, name_len + 1);
+        
+        // descend into directories only; this skips the subsystem links and such
+        if (!is_directory(o, ent)) {
+            continue;
+        }
+        
+        if (o->depth == NCDUDEVSYSFSSCAN_MAX_DEPTH) {
+            BLog(BLOG_WARNING, "too deep, skipping %s", o->path);
+            continue;
+        }
+        
+        DIR *subdir = opendir(o->path);
+        if (!subdir) {
+            continue;
+        }
+        
+        // enter directory
+        o->dirs[o->depth] = subdir;
+        o->dir_path_lens[o->depth] = dir_path_len + 1 + name_len;
+        o->depth++;
+        
+        if (read_device(o)) {
+            // set ready
+            o->is_ready = 1;
+            
+            // call handler
+            o->handler_event(o->user);
+            return;
+        }
+    }
+    
+    BLog(BLOG_INFO, "scan finished");
+    
+    DEBUGERROR(&o->d_err, o->handler_finished(o->user, 0));
+    return;
+}
+
+int NCDUdevSysfsScan_Init (NCDUdevSysfsScan *o, BPendingGroup *pg, int max_properties, void *user,
+                           NCDUdevSysfsScan_handler_event handler_event,
+                           NCDUdevSysfsScan_handler_finished handler_finished)
+{
+    ASSERT(max_properties >= 0)
+    
+    // init arguments
+    o->max_properties = max_properties;
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_finished = handler_finished;
+    
+    // allocate path
+    if (!(o->path = malloc(PATH_MAX))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // allocate file buffer
+    if (!(o->file_buf = malloc(FILE_BUF_SIZE))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail1;
+    }
+    
+    // allocate properties buffer
+    if (!(o->buf = malloc(BUF_SIZE))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail2;
+    }
+    
+    // allocate properties
+    if (!(o->ready_properties = BAllocArray(max_properties, sizeof(o->ready_properties[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail3;
+    }
+    
+    // open top directory
+    strcpy(o->path, DEVICES_DIR);
+    if (!(o->dirs[0] = opendir(o->path))) {
+        BLog(BLOG_ERROR, "opendir(%s) failed", o->path);
+        goto fail4;
+    }
+    o->dir_path_lens[0] = strlen(o->path);
+    o->depth = 1;
+    
+    // init next job, starting the scan
+    BPending_Init(&o->next_job, pg, (BPending_handler)next_job_handler, o);
+    BPending_Set(&o->next_job);
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    DebugError_Init(&o->d_err, pg);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail4:
+    BFree(o->ready_properties);
+fail3:
+    free(o->buf);
+fail2:
+    free(o->file_buf);
+fail1:
+    free(o->path);
+fail0:
+    return 0;
+}
+
+void NCDUdevSysfsScan_Free (NCDUdevSysfsScan *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free next job
+    BPending_Free(&o->next_job);
+    
+    // close directories
+    while (o->depth > 0) {
+        closedir(o->dirs[--o->depth]);
+    }
+    
+    // free properties
+    BFree(o->ready_properties);
+    
+    // free buffers
+    free(o->buf);
+    free(o->file_buf);
+    free(o->path);
+}
+
+void NCDUdevSysfsScan_AssertReady (NCDUdevSysfsScan *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+}
+
+void NCDUdevSysfsScan_Done (NCDUdevSysfsScan *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    // continue scanning
+    BPending_Set(&o->next_job);
+}
+
+int NCDUdevSysfsScan_GetNumProperties (NCDUdevSysfsScan *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_num_properties;
+}
+
+void NCDUdevSysfsScan_GetProperty (NCDUdevSysfsScan *o, int index, const char **name, const char **value)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    ASSERT(index >= 0)
+    ASSERT(index < o->ready_num_properties)
+    
+    *name = o->ready_properties[index].name;
+    *value = o->ready_properties[index].value;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file NCDUdevSysfsScan.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_UDEVMONITOR_NCDUDEVSYSFSSCAN_H
+#define BADVPN_UDEVMONITOR_NCDUDEVSYSFSSCAN_H
+
+#include <stddef.h>
+#include <dirent.h>
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+
+#define NCDUDEVSYSFSSCAN_MAX_DEPTH 32
+
+typedef void (*NCDUdevSysfsScan_handler_event) (void *user);
+typedef void (*NCDUdevSysfsScan_handler_finished) (void *user, int is_error);
+
+struct NCDUdevSysfsScan_property {
+    char *name;
+    char *value;
+};
+
+/**
+ * Enumerates existing devices by walking /sys/devices, reporting one
+ * event per device with the properties from its uevent file, together with
+ * the properties udev stored for it in its database, if there are any.
+ * This gives the same information as "udevadm info --export-db", but
+ * the walk proceeds one device at a time as the events are accepted with
+ * {@link NCDUdevSysfsScan_Done}, so it never holds up the reactor for long.
+ */
+typedef struct {
+    int max_properties;
+    void *user;
+    NCDUdevSysfsScan_handler_event handler_event;
+    NCDUdevSysfsScan_handler_finished handler_finished;
+    BPending next_job;
+    char *path;
+    DIR *dirs[NCDUDEVSYSFSSCAN_MAX_DEPTH];
+    size_t dir_path_lens[NCDUDEVSYSFSSCAN_MAX_DEPTH];
+    int depth;
+    char *file_buf;
+    char *buf;
+    size_t buf_used;
+    int is_ready;
+    struct NCDUdevSysfsScan_property *ready_properties;
+    int ready_num_properties;
+    DebugObject d_obj;
+    DebugError d_err;
+} NCDUdevSysfsScan;
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param pg pending group
+ * @param max_properties maximum number of properties of a device; devices
+ *                       with more are skipped
+ * @param user argument to handlers
+ * @param handler_event handler called when a device event is ready
+ * @param handler_finished handler called when all devices have been reported
+ *                         (is_error=0), or when the scan failed (is_error=1)
+ * @return 1 on success, 0 on failure
+ */
+int NCDUdevSysfsScan_Init (NCDUdevSysfsScan *o, BPendingGroup *pg, int max_properties, void *user,
+                           NCDUdevSysfsScan_handler_event handler_event,
+                           NCDUdevSysfsScan_handler_finished handler_finished) WARN_UNUSED;
+void NCDUdevSysfsScan_Free (NCDUdevSysfsScan *o);
+void NCDUdevSysfsScan_AssertReady (NCDUdevSysfsScan *o);
+void NCDUdevSysfsScan_Done (NCDUdevSysfsScan *o);
+int NCDUdevSysfsScan_GetNumProperties (NCDUdevSysfsScan *o);
+void NCDUdevSysfsScan_GetProperty (NCDUdevSysfsScan *o, int index, const char **name, const char **value);
+
+#endif
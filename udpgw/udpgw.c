@@ -46,8 +46,11 @@
 #include <misc/print_macros.h>
 #include <structure/LinkedList1.h>
 #include <structure/BAVL.h>
+#include <structure/SAvl.h>
+#include <structure/CHash.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
+#include <system/BDeadlineTimer.h>
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BDatagram.h>
@@ -60,10 +63,19 @@
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <base/BLog_async.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
 #endif
 
+#ifdef BADVPN_LINUX
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <system/BUnixSignal.h>
+#include <system/BThreadSignal.h>
+#endif
+
 #include <udpgw/udpgw.h>
 
 #include <generated/blog_channel_udpgw.h>
@@ -73,21 +85,50 @@
 
 #define DNS_UPDATE_TIME 2000
 
+// state owned by a worker; with --threads, each worker thread has its own copy
+#ifdef BADVPN_LINUX
+#define WORKER_LOCAL __thread
+#else
+#define WORKER_LOCAL
+#endif
+
+struct connection;
+
+#include "udpgw_ports_tree.h"
+#include <structure/SAvl_decl.h>
+
+#ifdef BADVPN_UDPGW_USE_HASH
+#include "udpgw_connections_hash.h"
+#include <structure/CHash_decl.h>
+#endif
+
 struct client {
     BConnection con;
     BAddr addr;
-    BTimer disconnect_timer;
+    BDeadlineTimer disconnect_timer;
     PacketProtoDecoder recv_decoder;
     PacketPassInterface recv_if;
     PacketPassFairQueue send_queue;
     PacketStreamSender send_sender;
+#ifdef BADVPN_UDPGW_USE_HASH
+    UdpgwConnectionsHash connections_hash;
+#else
     BAVL connections_tree;
+#endif
     LinkedList1 connections_list;
     int num_connections;
     LinkedList1 closing_connections_list;
     LinkedList1Node clients_list_node;
 };
 
+// connections bound to a local port, for one remote address
+struct remote_ports {
+    BAddr addr; // remote address, with port zero if options.unique_local_ports
+    BAVLNode tree_node; // node in remote_ports_tree
+    UdpgwPortsTree ports_tree; // connections by local port index
+    LinkedList1 lru_list; // connections, least recently used first
+};
+
 struct connection {
     struct client *client;
     uint16_t conid;
@@ -105,11 +146,18 @@ struct connection {
         struct {
             BDatagram udp_dgram;
             int local_port_index;
+            struct remote_ports *remote_ports; // if local_port_index>=0
+            UdpgwPortsTreeNode ports_tree_node;
+            LinkedList1Node lru_list_node;
             BufferWriter udp_send_writer;
             PacketBuffer udp_send_buffer;
             SinglePacketBuffer udp_recv_buffer;
             PacketPassInterface udp_recv_if;
+#ifdef BADVPN_UDPGW_USE_HASH
+            struct connection *connections_hash_next;
+#else
             BAVLNode connections_tree_node;
+#endif
             LinkedList1Node connections_list_node;
         };
         struct {
@@ -126,6 +174,7 @@ struct {
     #ifndef BADVPN_USE_WINAPI
     char *logger_syslog_facility;
     char *logger_syslog_ident;
+    int logger_async;
     #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
@@ -140,6 +189,10 @@ struct {
     int local_udp_ip6_num_ports;
     char *local_udp_ip6_addr;
     int unique_local_ports;
+    #ifdef BADVPN_LINUX
+    int udp_batch;
+    #endif
+    int threads;
 } options;
 
 // MTUs
@@ -156,26 +209,77 @@ BAddr local_udp_addr;
 // local UDP/IPv6 port range, if options.local_udp_ip6_num_ports>=0
 BAddr local_udp_ip6_addr;
 
+// connection buffer sizes, in packets
+int connection_client_buffer_size;
+int connection_udp_buffer_size;
+
+#ifdef BADVPN_LINUX
+
+// worker thread other than the main thread
+struct worker {
+    int index;
+    int started;
+    sem_t started_sem;
+    pthread_t thread;
+    BThreadSignal quit_signal;
+    BThreadSignal report_signal;
+};
+
+// report request signal (SIGUSR1)
+BUnixSignal report_signal;
+
+// worker threads, if options.threads>1
+struct worker *workers;
+int num_workers;
+
+#endif
+
+// index of this worker, 0 for the main thread
+WORKER_LOCAL int worker_index;
+
+// remote addresses of connections bound to local ports, indexed by address
+WORKER_LOCAL BAVL remote_ports_tree;
+
 // DNS forwarding
-BAddr dns_addr;
-btime_t last_dns_update_time;
+WORKER_LOCAL BAddr dns_addr;
+WORKER_LOCAL btime_t last_dns_update_time;
 
 // reactor
-BReactor ss;
+WORKER_LOCAL BReactor ss;
 
 // listeners
-BListener listeners[MAX_LISTEN_ADDRS];
-int num_listeners;
+WORKER_LOCAL BListener listeners[MAX_LISTEN_ADDRS];
+WORKER_LOCAL int num_listeners;
 
 // clients
-LinkedList1 clients_list;
-int num_clients;
+WORKER_LOCAL LinkedList1 clients_list;
+WORKER_LOCAL int num_clients;
+
+#include "udpgw_ports_tree.h"
+#include <structure/SAvl_impl.h>
+
+#ifdef BADVPN_UDPGW_USE_HASH
+#include "udpgw_connections_hash.h"
+#include <structure/CHash_impl.h>
+#endif
 
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
+static int init_reactor (BReactor *reactor);
+static int worker_start (void);
+static void worker_stop (void);
+#ifdef BADVPN_LINUX
+static void report_counts (void);
+static void report_signal_handler (void *unused, int signo);
+static int worker_thread_start (struct worker *w, int index);
+static void worker_thread_stop (struct worker *w);
+static void * worker_thread (struct worker *w);
+static void worker_quit_signal_handler (BThreadSignal *thread_signal);
+static void worker_report_signal_handler (BThreadSignal *thread_signal);
+#endif
 static void listener_handler (BListener *listener);
 static void client_free (struct client *client);
 static void client_logfunc (struct client *client);
@@ -184,14 +288,21 @@ static void client_disconnect_timer_handler (struct client *client);
 static void client_connection_handler (struct client *client, int event);
 static void client_decoder_handler_error (struct client *client);
 static void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static int local_ports_part_start (int num_ports, int index);
 static int get_local_num_ports (int addr_type);
 static BAddr get_local_addr (int addr_type);
-static uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con);
+static BAddr remote_ports_key (BAddr remote_addr);
+static struct remote_ports * remote_ports_find (BAddr remote_addr);
+static struct remote_ports * remote_ports_get (BAddr remote_addr);
+static int remote_ports_find_free (struct remote_ports *rp, int start, int local_num_ports);
+static struct connection * remote_ports_find_idle (struct remote_ports *rp);
 static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len);
 static void connection_free (struct connection *con);
 static void connection_logfunc (struct connection *con);
 static void connection_log (struct connection *con, int level, const char *fmt, ...);
 static void connection_free_udp (struct connection *con);
+static void connection_free_port (struct connection *con);
+static void connection_touch (struct connection *con);
 static void connection_first_job_handler (struct connection *con);
 static void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len);
 static int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len);
@@ -200,7 +311,10 @@ static void connection_send_qflow_busy_handler (struct connection *con);
 static void connection_dgram_handler_event (struct connection *con, int event);
 static void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len);
 static struct connection * find_connection (struct client *client, uint16_t conid);
+#ifndef BADVPN_UDPGW_USE_HASH
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+#endif
+static int baddr_comparator (void *unused, BAddr *v1, BAddr *v2);
 static void maybe_update_dns (void);
 
 int main (int argc, char **argv)
@@ -257,6 +371,14 @@ int main (int argc, char **argv)
         }
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // make logging asynchronous if requested
+    if (options.logger_async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_RING_SIZE)) {
+        BLog(BLOG_ERROR, "BLog_MakeAsync failed");
+        goto fail1;
+    }
+    #endif
+    
     BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
     
     // initialize network
@@ -281,13 +403,8 @@ int main (int argc, char **argv)
     // init time
     BTime_Init();
     
-    // init DNS forwarding
-    BAddr_InitNone(&dns_addr);
-    last_dns_update_time = INT64_MIN;
-    maybe_update_dns();
-    
     // init reactor
-    if (!BReactor_Init(&ss)) {
+    if (!init_reactor(&ss)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
@@ -298,35 +415,64 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
-    // initialize listeners
-    num_listeners = 0;
-    while (num_listeners < num_listen_addrs) {
-        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
-            BLog(BLOG_ERROR, "Listener_Init failed");
-            goto fail3;
-        }
-        num_listeners++;
+    #ifdef BADVPN_LINUX
+    // setup report signal handler; this is done before starting the worker
+    // threads so that they inherit the signal mask
+    sigset_t sset;
+    ASSERT_FORCE(sigemptyset(&sset) == 0)
+    ASSERT_FORCE(sigaddset(&sset, SIGUSR1) == 0)
+    if (!BUnixSignal_Init(&report_signal, &ss, sset, report_signal_handler, NULL)) {
+        BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+        goto fail3;
     }
+    #endif
     
-    // init clients list
-    LinkedList1_Init(&clients_list);
-    num_clients = 0;
+    // serve clients in this thread, as worker 0
+    worker_index = 0;
+    if (!worker_start()) {
+        goto fail4;
+    }
+    
+    #ifdef BADVPN_LINUX
+    // start the other workers
+    workers = NULL;
+    num_workers = 0;
+    if (options.threads > 1) {
+        if (!(workers = (struct worker *)BAllocArray(options.threads - 1, sizeof(workers[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail5;
+        }
+        while (num_workers < options.threads - 1) {
+            if (!worker_thread_start(&workers[num_workers], num_workers + 1)) {
+                goto fail6;
+            }
+            num_workers++;
+        }
+    }
+    #endif
     
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
-    // free clients
-    while (!LinkedList1_IsEmpty(&clients_list)) {
-        struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
-        client_free(client);
+    #ifdef BADVPN_LINUX
+fail6:
+    // stop the other workers
+    while (num_workers > 0) {
+        num_workers--;
+        worker_thread_stop(&workers[num_workers]);
     }
+    BFree(workers);
+fail5:
+    #endif
+    // free clients and listeners
+    worker_stop();
+fail4:
+    #ifdef BADVPN_LINUX
+    // finish report signal handling
+    BUnixSignal_Free(&report_signal, 1);
 fail3:
-    // free listeners
-    while (num_listeners > 0) {
-        num_listeners--;
-        BListener_Free(&listeners[num_listeners]);
-    }
+    #endif
     // finish signal handling
     BSignal_Finish();
 fail2:
@@ -356,6 +502,7 @@ void print_help (const char *name)
         "            [--syslog-facility <string>]\n"
         "            [--syslog-ident <string>]\n"
         "        )\n"
+        "        [--logger-async]\n"
         #endif
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
@@ -367,6 +514,10 @@ void print_help (const char *name)
         "        [--local-udp-addrs <addr> <num_ports>]\n"
         "        [--local-udp-ip6-addrs <addr> <num_ports>]\n"
         "        [--unique-local-ports]\n"
+        #ifdef BADVPN_LINUX
+        "        [--udp-batch <packets>]\n"
+        "        [--threads <number>]\n"
+        #endif
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -389,6 +540,7 @@ int parse_arguments (int argc, char *argv[])
     #ifndef BADVPN_USE_WINAPI
     options.logger_syslog_facility = "daemon";
     options.logger_syslog_ident = argv[0];
+    options.logger_async = 0;
     #endif
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
@@ -402,6 +554,10 @@ int parse_arguments (int argc, char *argv[])
     options.local_udp_num_ports = -1;
     options.local_udp_ip6_num_ports = -1;
     options.unique_local_ports = 0;
+    #ifdef BADVPN_LINUX
+    options.udp_batch = 0;
+    #endif
+    options.threads = 1;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -449,6 +605,9 @@ int parse_arguments (int argc, char *argv[])
             options.logger_syslog_ident = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--logger-async")) {
+            options.logger_async = 1;
+        }
         #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
@@ -563,6 +722,30 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--unique-local-ports")) {
             options.unique_local_ports = 1;
         }
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--udp-batch")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_batch = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.threads = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
@@ -612,6 +795,19 @@ int process_arguments (void)
         }
     }
     
+    // compute connection buffer sizes
+    connection_client_buffer_size = CONNECTION_CLIENT_BUFFER_SIZE;
+    connection_udp_buffer_size = CONNECTION_UDP_BUFFER_SIZE;
+    #ifdef BADVPN_LINUX
+    // with batching, packets arrive and leave a whole batch at a time, so a batch must fit
+    if (options.udp_batch > connection_client_buffer_size) {
+        connection_client_buffer_size = options.udp_batch;
+    }
+    if (options.udp_batch > connection_udp_buffer_size) {
+        connection_udp_buffer_size = options.udp_batch;
+    }
+    #endif
+    
     return 1;
 }
 
@@ -623,6 +819,202 @@ void signal_handler (void *unused)
     BReactor_Quit(&ss, 1);
 }
 
+int init_reactor (BReactor *reactor)
+{
+#ifdef BADVPN_BREACTOR_BADVPN
+    // client disconnect timers are restarted for every packet, use the timer wheel;
+    // with many sockets, avoid changing epoll registrations on every send and receive
+    return BReactor_Init2(reactor, BREACTOR_INIT_FLAG_TIMER_WHEEL | BREACTOR_INIT_FLAG_EDGE_TRIGGERED);
+#else
+    return BReactor_Init(reactor);
+#endif
+}
+
+int worker_start (void)
+{
+    // init DNS forwarding
+    BAddr_InitNone(&dns_addr);
+    last_dns_update_time = INT64_MIN;
+    maybe_update_dns();
+    
+    // initialize listeners
+    num_listeners = 0;
+    while (num_listeners < num_listen_addrs) {
+        struct BLisCon_from from = BLisCon_from_addr(listen_addrs[num_listeners]);
+        #ifdef BADVPN_LINUX
+        // let every worker listen on the same address, with the kernel distributing clients
+        if (options.threads > 1) {
+            from = BLisCon_from_addr_reuseport(listen_addrs[num_listeners]);
+        }
+        #endif
+        if (!BListener_InitFrom(&listeners[num_listeners], from, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "Listener_Init failed");
+            goto fail0;
+        }
+        num_listeners++;
+    }
+    
+    // init clients list
+    LinkedList1_Init(&clients_list);
+    num_clients = 0;
+    
+    // init remote ports tree
+    BAVL_Init(&remote_ports_tree, OFFSET_DIFF(struct remote_ports, addr, tree_node), (BAVL_comparator)baddr_comparator, NULL);
+    
+    return 1;
+    
+fail0:
+    while (num_listeners > 0) {
+        num_listeners--;
+        BListener_Free(&listeners[num_listeners]);
+    }
+    return 0;
+}
+
+void worker_stop (void)
+{
+    // free clients
+    while (!LinkedList1_IsEmpty(&clients_list)) {
+        struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
+        client_free(client);
+    }
+    
+    // free listeners
+    while (num_listeners > 0) {
+        num_listeners--;
+        BListener_Free(&listeners[num_listeners]);
+    }
+}
+
+#ifdef BADVPN_LINUX
+
+void report_counts (void)
+{
+    int num_connections = 0;
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&clients_list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct client *client = UPPER_OBJECT(ln, struct client, clients_list_node);
+        num_connections += client->num_connections;
+    }
+    
+    BLog(BLOG_NOTICE, "worker %d: %d clients, %d connections", worker_index, num_clients, num_connections);
+}
+
+void report_signal_handler (void *unused, int signo)
+{
+    ASSERT(signo == SIGUSR1)
+    
+    report_counts();
+    
+    // each worker reports its own counts, from its own thread
+    for (int i = 0; i < num_workers; i++) {
+        BThreadSignal_Thread_Signal(&workers[i].report_signal);
+    }
+}
+
+int worker_thread_start (struct worker *w, int index)
+{
+    w->index = index;
+    
+    if (sem_init(&w->started_sem, 0, 0) < 0) {
+        BLog(BLOG_ERROR, "sem_init failed");
+        goto fail0;
+    }
+    
+    if (pthread_create(&w->thread, NULL, (void * (*) (void *))worker_thread, w) != 0) {
+        BLog(BLOG_ERROR, "pthread_create failed");
+        goto fail1;
+    }
+    
+    // wait for the worker to initialize
+    ASSERT_FORCE(sem_wait(&w->started_sem) == 0)
+    
+    if (!w->started) {
+        ASSERT_FORCE(pthread_join(w->thread, NULL) == 0)
+        goto fail1;
+    }
+    
+    return 1;
+    
+fail1:
+    ASSERT_FORCE(sem_destroy(&w->started_sem) == 0)
+fail0:
+    return 0;
+}
+
+void worker_thread_stop (struct worker *w)
+{
+    ASSERT(w->started)
+    
+    // make the worker exit its event loop, and wait for it to clean up
+    BThreadSignal_Thread_Signal(&w->quit_signal);
+    ASSERT_FORCE(pthread_join(w->thread, NULL) == 0)
+    
+    ASSERT_FORCE(sem_destroy(&w->started_sem) == 0)
+}
+
+void * worker_thread (struct worker *w)
+{
+    worker_index = w->index;
+    
+    // init reactor
+    if (!init_reactor(&ss)) {
+        BLog(BLOG_ERROR, "worker %d: BReactor_Init failed", worker_index);
+        goto fail0;
+    }
+    
+    // init quit signal
+    if (!BThreadSignal_Init(&w->quit_signal, &ss, worker_quit_signal_handler)) {
+        BLog(BLOG_ERROR, "worker %d: BThreadSignal_Init failed", worker_index);
+        goto fail1;
+    }
+    
+    // init report signal
+    if (!BThreadSignal_Init(&w->report_signal, &ss, worker_report_signal_handler)) {
+        BLog(BLOG_ERROR, "worker %d: BThreadSignal_Init failed", worker_index);
+        goto fail2;
+    }
+    
+    // init listeners
+    if (!worker_start()) {
+        goto fail3;
+    }
+    
+    // report success to the main thread
+    w->started = 1;
+    ASSERT_FORCE(sem_post(&w->started_sem) == 0)
+    
+    BReactor_Exec(&ss);
+    
+    worker_stop();
+    BThreadSignal_Free(&w->report_signal);
+    BThreadSignal_Free(&w->quit_signal);
+    BReactor_Free(&ss);
+    return NULL;
+    
+fail3:
+    BThreadSignal_Free(&w->report_signal);
+fail2:
+    BThreadSignal_Free(&w->quit_signal);
+fail1:
+    BReactor_Free(&ss);
+fail0:
+    w->started = 0;
+    ASSERT_FORCE(sem_post(&w->started_sem) == 0)
+    return NULL;
+}
+
+void worker_quit_signal_handler (BThreadSignal *thread_signal)
+{
+    BReactor_Quit(&ss, 0);
+}
+
+void worker_report_signal_handler (BThreadSignal *thread_signal)
+{
+    report_counts();
+}
+
+#endif
+
 void listener_handler (BListener *listener)
 {
     if (num_clients == options.max_clients) {
@@ -655,8 +1047,8 @@ void listener_handler (BListener *listener)
     BConnection_RecvAsync_Init(&client->con);
     
     // init disconnect timer
-    BTimer_Init(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT, (BTimer_handler)client_disconnect_timer_handler, client);
-    BReactor_SetTimer(&ss, &client->disconnect_timer);
+    BDeadlineTimer_Init(&client->disconnect_timer, &ss, (BDeadlineTimer_handler)client_disconnect_timer_handler, client);
+    BDeadlineTimer_SetRelative(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT);
     
     // init recv interface
     PacketPassInterface_Init(&client->recv_if, udpgw_mtu, (PacketPassInterface_handler_send)client_recv_if_handler_send, client, BReactor_PendingGroup(&ss));
@@ -678,8 +1070,16 @@ void listener_handler (BListener *listener)
         goto fail3;
     }
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // init connections hash
+    if (!UdpgwConnectionsHash_Init(&client->connections_hash, options.max_connections_for_client)) {
+        BLog(BLOG_ERROR, "UdpgwConnectionsHash_Init failed");
+        goto fail4;
+    }
+#else
     // init connections tree
     BAVL_Init(&client->connections_tree, OFFSET_DIFF(struct connection, conid, connections_tree_node), (BAVL_comparator)uint16_comparator, NULL);
+#endif
     
     // init connections list
     LinkedList1_Init(&client->connections_list);
@@ -698,12 +1098,16 @@ void listener_handler (BListener *listener)
     
     return;
     
+#ifdef BADVPN_UDPGW_USE_HASH
+fail4:
+    PacketPassFairQueue_Free(&client->send_queue);
+#endif
 fail3:
     PacketStreamSender_Free(&client->send_sender);
     PacketProtoDecoder_Free(&client->recv_decoder);
 fail2:
     PacketPassInterface_Free(&client->recv_if);
-    BReactor_RemoveTimer(&ss, &client->disconnect_timer);
+    BDeadlineTimer_Free(&client->disconnect_timer);
     BConnection_RecvAsync_Free(&client->con);
     BConnection_SendAsync_Free(&client->con);
     BConnection_Free(&client->con);
@@ -734,6 +1138,11 @@ void client_free (struct client *client)
     LinkedList1_Remove(&clients_list, &client->clients_list_node);
     num_clients--;
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // free connections hash
+    UdpgwConnectionsHash_Free(&client->connections_hash);
+#endif
+    
     // free send queue
     PacketPassFairQueue_Free(&client->send_queue);
     
@@ -747,7 +1156,7 @@ void client_free (struct client *client)
     PacketPassInterface_Free(&client->recv_if);
     
     // free disconnect timer
-    BReactor_RemoveTimer(&ss, &client->disconnect_timer);
+    BDeadlineTimer_Free(&client->disconnect_timer);
     
     // free connection interfaces
     BConnection_RecvAsync_Free(&client->con);
@@ -825,7 +1234,7 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     uint16_t conid = ltoh16(header.conid);
     
     // reset disconnect timer
-    BReactor_SetTimer(&ss, &client->disconnect_timer);
+    BDeadlineTimer_SetRelative(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT);
     
     // if this is keepalive, ignore any payload
     if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
@@ -903,84 +1312,152 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     }
 }
 
+int local_ports_part_start (int num_ports, int index)
+{
+    ASSERT(num_ports >= 0)
+    ASSERT(index >= 0)
+    ASSERT(index <= options.threads)
+    
+    // the local port range is split among the workers, so that they never bind
+    // the same port
+    return (int)((int64_t)num_ports * index / options.threads);
+}
+
 int get_local_num_ports (int addr_type)
 {
+    int num_ports;
     switch (addr_type) {
-        case BADDR_TYPE_IPV4: return options.local_udp_num_ports;
-        case BADDR_TYPE_IPV6: return options.local_udp_ip6_num_ports;
+        case BADDR_TYPE_IPV4: num_ports = options.local_udp_num_ports; break;
+        case BADDR_TYPE_IPV6: num_ports = options.local_udp_ip6_num_ports; break;
         default: ASSERT(0); return 0;
     }
+    
+    if (num_ports < 0) {
+        return num_ports;
+    }
+    
+    return local_ports_part_start(num_ports, worker_index + 1) - local_ports_part_start(num_ports, worker_index);
 }
 
 BAddr get_local_addr (int addr_type)
 {
     ASSERT(get_local_num_ports(addr_type) >= 0)
     
+    BAddr addr;
+    int num_ports;
     switch (addr_type) {
-        case BADDR_TYPE_IPV4: return local_udp_addr;
-        case BADDR_TYPE_IPV6: return local_udp_ip6_addr;
+        case BADDR_TYPE_IPV4: addr = local_udp_addr; num_ports = options.local_udp_num_ports; break;
+        case BADDR_TYPE_IPV6: addr = local_udp_ip6_addr; num_ports = options.local_udp_ip6_num_ports; break;
         default: ASSERT(0); return BAddr_MakeNone();
     }
+    
+    // start at this worker's part of the range
+    BAddr_SetPort(&addr, hton16(ntoh16(BAddr_GetPort(&addr)) + (uint16_t)local_ports_part_start(num_ports, worker_index)));
+    
+    return addr;
 }
 
-uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con)
+BAddr remote_ports_key (BAddr remote_addr)
 {
-    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
-    ASSERT(get_local_num_ports(remote_addr.type) >= 0)
+    // with unique local ports, connections to any port of the same host conflict
+    if (options.unique_local_ports) {
+        BAddr_SetPort(&remote_addr, 0);
+    }
     
-    int local_num_ports = get_local_num_ports(remote_addr.type);
+    return remote_addr;
+}
+
+struct remote_ports * remote_ports_find (BAddr remote_addr)
+{
+    BAddr key = remote_ports_key(remote_addr);
     
-    // allocate port usage array
-    uint8_t *port_usage = (uint8_t *)BAllocSize(bsize_fromint(local_num_ports));
-    if (!port_usage) {
+    BAVLNode *tree_node = BAVL_LookupExact(&remote_ports_tree, &key);
+    if (!tree_node) {
         return NULL;
     }
     
-    // zero array
-    memset(port_usage, 0, local_num_ports);
+    return UPPER_OBJECT(tree_node, struct remote_ports, tree_node);
+}
+
+struct remote_ports * remote_ports_get (BAddr remote_addr)
+{
+    struct remote_ports *rp = remote_ports_find(remote_addr);
+    if (rp) {
+        return rp;
+    }
     
-    struct connection *least_con = NULL;
+    // allocate structure
+    rp = (struct remote_ports *)malloc(sizeof(*rp));
+    if (!rp) {
+        return NULL;
+    }
     
-    // flag inappropriate ports (those with the same remote address)
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&clients_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct client *client = UPPER_OBJECT(ln, struct client, clients_list_node);
+    // init arguments
+    rp->addr = remote_ports_key(remote_addr);
+    
+    // init ports tree
+    UdpgwPortsTree_Init(&rp->ports_tree);
+    
+    // init LRU list
+    LinkedList1_Init(&rp->lru_list);
+    
+    // insert to remote ports tree
+    ASSERT_EXECUTE(BAVL_Insert(&remote_ports_tree, &rp->tree_node, NULL))
+    
+    return rp;
+}
+
+int remote_ports_find_free (struct remote_ports *rp, int start, int local_num_ports)
+{
+    ASSERT(start >= 0)
+    ASSERT(local_num_ports >= 0)
+    
+    int port = start;
+    
+    if (rp) {
+        // The used ports are distinct, so the used ports >= start, in tree order from
+        // position base, are start, start+1, ... up to the first free port. Find where
+        // this sequence breaks with a binary search.
+        int count = UdpgwPortsTree_Count(&rp->ports_tree, 0);
+        struct connection *first = UdpgwPortsTree_GetFirstGreaterEqual(&rp->ports_tree, 0, start);
+        int base = (first ? UdpgwPortsTree_IndexOf(&rp->ports_tree, 0, first) : count);
+        int low = base;
+        int high = count;
         
-        for (LinkedList1Node *ln2 = LinkedList1_GetFirst(&client->connections_list); ln2; ln2 = LinkedList1Node_Next(ln2)) {
-            struct connection *con = UPPER_OBJECT(ln2, struct connection, connections_list_node);
-            ASSERT(con->client == client)
-            ASSERT(!con->closing)
-            
-            if (con->addr.type != remote_addr.type || con->local_port_index < 0) {
-                continue;
-            }
-            ASSERT(con->local_port_index < local_num_ports)
-            
-            if (options.unique_local_ports) {
-                BIPAddr ip1;
-                BIPAddr ip2;
-                BAddr_GetIPAddr(&con->addr, &ip1);
-                BAddr_GetIPAddr(&remote_addr, &ip2);
-                if (!BIPAddr_Compare(&ip1, &ip2)) {
-                    continue;
-                }
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+            struct connection *con = UdpgwPortsTree_GetAt(&rp->ports_tree, 0, mid);
+            if (con->local_port_index == start + (mid - base)) {
+                low = mid + 1;
             } else {
-                if (!BAddr_Compare(&con->addr, &remote_addr)) {
-                    continue;
-                }
-            }
-            
-            port_usage[con->local_port_index] = 1;
-            
-            if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
-                if (!least_con || con->last_use_time < least_con->last_use_time) {
-                    least_con = con;
-                }
+                high = mid;
             }
         }
+        
+        port = start + (low - base);
     }
     
-    *out_con = least_con;
-    return port_usage;
+    return (port < local_num_ports ? port : -1);
+}
+
+struct connection * remote_ports_find_idle (struct remote_ports *rp)
+{
+    if (!rp) {
+        return NULL;
+    }
+    
+    // find the least recently used connection which is not sending anything;
+    // this is almost always the first one
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&rp->lru_list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct connection *con = UPPER_OBJECT(ln, struct connection, lru_list_node);
+        ASSERT(con->remote_ports == rp)
+        
+        if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
+            return con;
+        }
+    }
+    
+    return NULL;
 }
 
 void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len)
@@ -1022,7 +1499,7 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     PacketPassFairQueueFlow_Init(&con->send_qflow, &client->send_queue);
     
     // init send PacketProtoFlow
-    if (!PacketProtoFlow_Init(&con->send_ppflow, udpgw_mtu, CONNECTION_CLIENT_BUFFER_SIZE, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(&ss))) {
+    if (!PacketProtoFlow_Init(&con->send_ppflow, udpgw_mtu, connection_client_buffer_size, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(&ss))) {
         client_log(client, BLOG_ERROR, "PacketProtoFlow_Init failed");
         goto fail1;
     }
@@ -1039,14 +1516,6 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     int local_num_ports = get_local_num_ports(addr.type);
     
     if (local_num_ports >= 0) {
-        // build port usage array, find least used connection
-        struct connection *least_con;
-        uint8_t *port_usage = build_port_usage_array_and_find_least_used_connection(addr, &least_con);
-        if (!port_usage) {
-            client_log(client, BLOG_ERROR, "build_port_usage_array failed");
-            goto failed;
-        }
-        
         // set SO_REUSEADDR
         if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
             client_log(client, BLOG_ERROR, "set SO_REUSEADDR failed");
@@ -1056,23 +1525,22 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
         // get starting local address
         BAddr local_addr = get_local_addr(addr.type);
         
-        // try different ports
-        for (int i = 0; i < local_num_ports; i++) {
-            // skip inappropriate ports
-            if (port_usage[i]) {
-                continue;
-            }
-            
+        // find connections with the same remote addr
+        struct remote_ports *rp = remote_ports_find(addr);
+        
+        int i;
+        
+        // try different ports, skipping those used with the same remote addr
+        for (i = remote_ports_find_free(rp, 0, local_num_ports); i >= 0; i = remote_ports_find_free(rp, i + 1, local_num_ports)) {
             BAddr bind_addr = local_addr;
             BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
             if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-                // remember which port we're using
-                con->local_port_index = i;
-                goto cont;
+                goto bound;
             }
         }
         
         // try closing an unused connection with the same remote addr
+        struct connection *least_con = remote_ports_find_idle(rp);
         if (!least_con) {
             goto failed;
         }
@@ -1082,26 +1550,40 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
         ASSERT(least_con->local_port_index < local_num_ports)
         ASSERT(!PacketPassFairQueueFlow_IsBusy(&least_con->send_qflow))
         
-        int i = least_con->local_port_index;
+        i = least_con->local_port_index;
         
         BLog(BLOG_INFO, "closing connection for its remote address");
         
-        // close the offending connection
+        // close the offending connection; this may free rp
         connection_close(least_con);
         
         // try binding to its port
         BAddr bind_addr = local_addr;
         BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
         if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-            // remember which port we're using
-            con->local_port_index = i;
-            goto cont;
+            goto bound;
         }
         
     failed:
         client_log(client, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
+        goto cont;
+        
+    bound:
+        // get entry for the remote addr
+        if (!(con->remote_ports = remote_ports_get(addr))) {
+            client_log(client, BLOG_ERROR, "remote_ports_get failed");
+            goto fail3;
+        }
+        
+        // remember which port we're using
+        con->local_port_index = i;
+        
+        // insert to remote's ports tree
+        ASSERT_EXECUTE(UdpgwPortsTree_Insert(&con->remote_ports->ports_tree, 0, con, NULL))
+        
+        // insert to remote's LRU list
+        LinkedList1_Append(&con->remote_ports->lru_list, &con->lru_list_node);
     cont:;
-        BFree(port_usage);
     }
     
     // set UDP dgram send address
@@ -1113,13 +1595,25 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     BDatagram_SendAsync_Init(&con->udp_dgram, options.udp_mtu);
     BDatagram_RecvAsync_Init(&con->udp_dgram, options.udp_mtu);
     
+    #ifdef BADVPN_LINUX
+    // send and receive datagrams in batches
+    if (options.udp_batch > 0) {
+        if (!BDatagram_SetSendBatch(&con->udp_dgram, options.udp_batch) ||
+            !BDatagram_SetRecvBatch(&con->udp_dgram, options.udp_batch)
+        ) {
+            client_log(client, BLOG_ERROR, "failed to enable UDP batching");
+            goto fail4;
+        }
+    }
+    #endif
+    
     // init UDP writer
     BufferWriter_Init(&con->udp_send_writer, options.udp_mtu, BReactor_PendingGroup(&ss));
     
     // init UDP buffer
-    if (!PacketBuffer_Init(&con->udp_send_buffer, BufferWriter_GetOutput(&con->udp_send_writer), BDatagram_SendAsync_GetIf(&con->udp_dgram), CONNECTION_UDP_BUFFER_SIZE, BReactor_PendingGroup(&ss))) {
+    if (!PacketBuffer_Init(&con->udp_send_buffer, BufferWriter_GetOutput(&con->udp_send_writer), BDatagram_SendAsync_GetIf(&con->udp_dgram), connection_udp_buffer_size, BReactor_PendingGroup(&ss))) {
         client_log(client, BLOG_ERROR, "PacketBuffer_Init failed");
-        goto fail4;
+        goto fail5;
     }
     
     // init UDP recv interface
@@ -1128,11 +1622,17 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     // init UDP recv buffer
     if (!SinglePacketBuffer_Init(&con->udp_recv_buffer, BDatagram_RecvAsync_GetIf(&con->udp_dgram), &con->udp_recv_if, BReactor_PendingGroup(&ss))) {
         client_log(client, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail5;
+        goto fail6;
     }
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // insert to client's connections hash
+    UdpgwConnectionsHashRef ref = {con, con};
+    ASSERT_EXECUTE(UdpgwConnectionsHash_Insert(&client->connections_hash, 0, ref, NULL))
+#else
     // insert to client's connections tree
     ASSERT_EXECUTE(BAVL_Insert(&client->connections_tree, &con->connections_tree_node, NULL))
+#endif
     
     // insert to client's connections list
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
@@ -1144,13 +1644,20 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     
     return;
     
-fail5:
+fail6:
     PacketPassInterface_Free(&con->udp_recv_if);
     PacketBuffer_Free(&con->udp_send_buffer);
-fail4:
+fail5:
     BufferWriter_Free(&con->udp_send_writer);
+#ifdef BADVPN_LINUX
+fail4:
+#endif
     BDatagram_RecvAsync_Free(&con->udp_dgram);
     BDatagram_SendAsync_Free(&con->udp_dgram);
+    if (con->local_port_index >= 0) {
+        connection_free_port(con);
+    }
+fail3:
     BDatagram_Free(&con->udp_dgram);
 fail2:
     PacketProtoFlow_Free(&con->send_ppflow);
@@ -1177,8 +1684,14 @@ void connection_free (struct connection *con)
         // remove from client's connections list
         LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
         
+#ifdef BADVPN_UDPGW_USE_HASH
+        // remove from client's connections hash
+        UdpgwConnectionsHashRef ref = {con, con};
+        UdpgwConnectionsHash_Remove(&client->connections_hash, 0, ref);
+#else
         // remove from client's connections tree
         BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
+#endif
         
         // free UDP
         connection_free_udp(con);
@@ -1234,10 +1747,54 @@ void connection_free_udp (struct connection *con)
     BDatagram_RecvAsync_Free(&con->udp_dgram);
     BDatagram_SendAsync_Free(&con->udp_dgram);
     
+    // release local port
+    if (con->local_port_index >= 0) {
+        connection_free_port(con);
+    }
+    
     // free UDP dgram
     BDatagram_Free(&con->udp_dgram);
 }
 
+void connection_free_port (struct connection *con)
+{
+    ASSERT(con->local_port_index >= 0)
+    struct remote_ports *rp = con->remote_ports;
+    
+    // remove from remote's LRU list
+    LinkedList1_Remove(&rp->lru_list, &con->lru_list_node);
+    
+    // remove from remote's ports tree
+    UdpgwPortsTree_Remove(&rp->ports_tree, 0, con);
+    
+    // free remote ports entry if no longer used
+    if (UdpgwPortsTree_IsEmpty(&rp->ports_tree)) {
+        BAVL_Remove(&remote_ports_tree, &rp->tree_node);
+        free(rp);
+    }
+    
+    con->local_port_index = -1;
+}
+
+void connection_touch (struct connection *con)
+{
+    struct client *client = con->client;
+    ASSERT(!con->closing)
+    
+    // set last use time
+    con->last_use_time = btime_gettime();
+    
+    // move connection to front
+    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
+    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    
+    // move connection to the back of the remote's LRU list
+    if (con->local_port_index >= 0) {
+        LinkedList1_Remove(&con->remote_ports->lru_list, &con->lru_list_node);
+        LinkedList1_Append(&con->remote_ports->lru_list, &con->lru_list_node);
+    }
+}
+
 void connection_first_job_handler (struct connection *con)
 {
     ASSERT(!con->closing)
@@ -1305,19 +1862,14 @@ void connection_send_to_client (struct connection *con, uint8_t flags, const uin
 
 int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len)
 {
-    struct client *client = con->client;
     ASSERT(!con->closing)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= options.udp_mtu)
     
     connection_log(con, BLOG_DEBUG, "from client %d bytes", data_len);
     
-    // set last use time
-    con->last_use_time = btime_gettime();
-    
-    // move connection to front
-    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
-    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    // update last use
+    connection_touch(con);
     
     // get buffer location
     uint8_t *out;
@@ -1354,8 +1906,14 @@ void connection_close (struct connection *con)
     // remove from client's connections list
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // remove from client's connections hash
+    UdpgwConnectionsHashRef ref = {con, con};
+    UdpgwConnectionsHash_Remove(&client->connections_hash, 0, ref);
+#else
     // remove from client's connections tree
     BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
+#endif
     
     // free UDP
     connection_free_udp(con);
@@ -1396,19 +1954,14 @@ void connection_dgram_handler_event (struct connection *con, int event)
 
 void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len)
 {
-    struct client *client = con->client;
     ASSERT(!con->closing)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= options.udp_mtu)
     
     connection_log(con, BLOG_DEBUG, "from UDP %d bytes", data_len);
     
-    // set last use time
-    con->last_use_time = btime_gettime();
-    
-    // move connection to front
-    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
-    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    // update last use
+    connection_touch(con);
     
     // accept packet
     PacketPassInterface_Done(&con->udp_recv_if);
@@ -1419,22 +1972,39 @@ void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data,
 
 struct connection * find_connection (struct client *client, uint16_t conid)
 {
+#ifdef BADVPN_UDPGW_USE_HASH
+    UdpgwConnectionsHashRef ref = UdpgwConnectionsHash_Lookup(&client->connections_hash, 0, conid);
+    if (!ref.link) {
+        return NULL;
+    }
+    struct connection *con = ref.ptr;
+#else
     BAVLNode *tree_node = BAVL_LookupExact(&client->connections_tree, &conid);
     if (!tree_node) {
         return NULL;
     }
     struct connection *con = UPPER_OBJECT(tree_node, struct connection, connections_tree_node);
+#endif
     ASSERT(con->conid == conid)
     ASSERT(!con->closing)
     
     return con;
 }
 
+int baddr_comparator (void *unused, BAddr *v1, BAddr *v2)
+{
+    return BAddr_CompareOrder(v1, v2);
+}
+
+#ifndef BADVPN_UDPGW_USE_HASH
+
 int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
 {
     return B_COMPARE(*v1, *v2);
 }
 
+#endif
+
 void maybe_update_dns (void)
 {
 #ifndef BADVPN_USE_WINAPI
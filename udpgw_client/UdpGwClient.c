@@ -32,13 +32,18 @@
 #include <misc/offset.h>
 #include <misc/byteorder.h>
 #include <misc/compare.h>
+#include <misc/hashfun.h>
 #include <base/BLog.h>
 
 #include <udpgw_client/UdpGwClient.h>
 
 #include <generated/blog_channel_UdpGwClient.h>
 
+#ifdef BADVPN_UDPGW_USE_HASH
+static size_t conaddr_hash (struct UdpGwClient_conaddr *conaddr);
+#else
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+#endif
 static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2);
 static void free_server (UdpGwClient *o);
 static void decoder_handler_error (UdpGwClient *o);
@@ -54,11 +59,50 @@ static void connection_first_job_handler (struct UdpGwClient_connection *con);
 static void connection_send (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len);
 static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct UdpGwClient_conaddr conaddr);
 
+#ifdef BADVPN_UDPGW_USE_HASH
+
+#include "UdpGwClient_conaddr_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "UdpGwClient_conid_hash.h"
+#include <structure/CHash_impl.h>
+
+static int write_addr_for_hash (uint8_t *out, BAddr addr)
+{
+    switch (addr.type) {
+        case BADDR_TYPE_IPV4:
+            memcpy(out, &addr.ipv4.ip, sizeof(addr.ipv4.ip));
+            memcpy(out + sizeof(addr.ipv4.ip), &addr.ipv4.port, sizeof(addr.ipv4.port));
+            return sizeof(addr.ipv4.ip) + sizeof(addr.ipv4.port);
+        case BADDR_TYPE_IPV6:
+            memcpy(out, addr.ipv6.ip, sizeof(addr.ipv6.ip));
+            memcpy(out + sizeof(addr.ipv6.ip), &addr.ipv6.port, sizeof(addr.ipv6.port));
+            return sizeof(addr.ipv6.ip) + sizeof(addr.ipv6.port);
+        default:
+            return 0;
+    }
+}
+
+static size_t conaddr_hash (struct UdpGwClient_conaddr *conaddr)
+{
+    // hash the significant bytes only, BAddr has padding and unused union space
+    uint8_t data[2 * (sizeof(conaddr->remote_addr.ipv6.ip) + sizeof(conaddr->remote_addr.ipv6.port))];
+    int len = 0;
+    len += write_addr_for_hash(data + len, conaddr->remote_addr);
+    len += write_addr_for_hash(data + len, conaddr->local_addr);
+    
+    return badvpn_djb2_hash_bin(data, len);
+}
+
+#else
+
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
 {
     return B_COMPARE(*v1, *v2);
 }
 
+#endif
+
 static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2)
 {
     int r = BAddr_CompareOrder(&v1->remote_addr, &v2->remote_addr);
@@ -197,22 +241,30 @@ static void keepalive_if_handler_done (UdpGwClient *o)
 
 static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
 {
+#ifdef BADVPN_UDPGW_USE_HASH
+    return UdpGwClient__ConaddrHash_Lookup(&o->connections_hash_by_conaddr, 0, &conaddr).ptr;
+#else
     BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conaddr, &conaddr);
     if (!tree_node) {
         return NULL;
     }
     
     return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conaddr_node);
+#endif
 }
 
 static struct UdpGwClient_connection * find_connection_by_conid (UdpGwClient *o, uint16_t conid)
 {
+#ifdef BADVPN_UDPGW_USE_HASH
+    return UdpGwClient__ConidHash_Lookup(&o->connections_hash_by_conid, 0, conid).ptr;
+#else
     BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conid, &conid);
     if (!tree_node) {
         return NULL;
     }
     
     return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conid_node);
+#endif
 }
 
 static uint16_t find_unused_conid (UdpGwClient *o)
@@ -270,11 +322,22 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     }
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // insert to connections hash by conaddr
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
+    UdpGwClient__ConaddrHashRef conaddr_ref = {con, con};
+    ASSERT_EXECUTE(UdpGwClient__ConaddrHash_Insert(&o->connections_hash_by_conaddr, 0, conaddr_ref, NULL))
+    
+    // insert to connections hash by conid
+    UdpGwClient__ConidHashRef conid_ref = {con, con};
+    ASSERT_EXECUTE(UdpGwClient__ConidHash_Insert(&o->connections_hash_by_conid, 0, conid_ref, NULL))
+#else
     // insert to connections tree by conaddr
     ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
     
     // insert to connections tree by conid
     ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node, NULL))
+#endif
     
     // insert to connections list
     LinkedList1_Append(&o->connections_list, &con->connections_list_node);
@@ -303,11 +366,21 @@ static void connection_free (struct UdpGwClient_connection *con)
     // remove from connections list
     LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // remove from connections hash by conid
+    UdpGwClient__ConidHashRef conid_ref = {con, con};
+    UdpGwClient__ConidHash_Remove(&o->connections_hash_by_conid, 0, conid_ref);
+    
+    // remove from connections hash by conaddr
+    UdpGwClient__ConaddrHashRef conaddr_ref = {con, con};
+    UdpGwClient__ConaddrHash_Remove(&o->connections_hash_by_conaddr, 0, conaddr_ref);
+#else
     // remove from connections tree by conid
     BAVL_Remove(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node);
     
     // remove from connections tree by conaddr
     BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
+#endif
     
     // free PacketProtoFlow
     PacketProtoFlow_Free(&con->send_ppflow);
@@ -387,6 +460,18 @@ static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct
     // get least recently used connection
     struct UdpGwClient_connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct UdpGwClient_connection, connections_list_node);
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // remove from connections hash by conaddr
+    UdpGwClient__ConaddrHashRef conaddr_ref = {con, con};
+    UdpGwClient__ConaddrHash_Remove(&o->connections_hash_by_conaddr, 0, conaddr_ref);
+    
+    // set new conaddr
+    con->conaddr = conaddr;
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
+    
+    // insert to connections hash by conaddr
+    ASSERT_EXECUTE(UdpGwClient__ConaddrHash_Insert(&o->connections_hash_by_conaddr, 0, conaddr_ref, NULL))
+#else
     // remove from connections tree by conaddr
     BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
     
@@ -395,6 +480,7 @@ static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct
     
     // insert to connections tree by conaddr
     ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
+#endif
     
     return con;
 }
@@ -428,11 +514,25 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     o->udpgw_mtu = udpgw_compute_mtu(o->udp_mtu);
     o->pp_mtu = o->udpgw_mtu + sizeof(struct packetproto_header);
     
+#ifdef BADVPN_UDPGW_USE_HASH
+    // init connections hash by conaddr
+    if (!UdpGwClient__ConaddrHash_Init(&o->connections_hash_by_conaddr, o->max_connections)) {
+        BLog(BLOG_ERROR, "UdpGwClient__ConaddrHash_Init failed");
+        goto fail0;
+    }
+    
+    // init connections hash by conid
+    if (!UdpGwClient__ConidHash_Init(&o->connections_hash_by_conid, o->max_connections)) {
+        BLog(BLOG_ERROR, "UdpGwClient__ConidHash_Init failed");
+        goto fail1;
+    }
+#else
     // init connections tree by conaddr
     BAVL_Init(&o->connections_tree_by_conaddr, OFFSET_DIFF(struct UdpGwClient_connection, conaddr, connections_tree_by_conaddr_node), (BAVL_comparator)conaddr_comparator, NULL);
     
     // init connections tree by conid
     BAVL_Init(&o->connections_tree_by_conid, OFFSET_DIFF(struct UdpGwClient_connection, conid, connections_tree_by_conid_node), (BAVL_comparator)uint16_comparator, NULL);
+#endif
     
     // init connections list
     LinkedList1_Init(&o->connections_list);
@@ -451,7 +551,7 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     
     // init send queue
     if (!PacketPassFairQueue_Init(&o->send_queue, PacketPassInactivityMonitor_GetInput(&o->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1)) {
-        goto fail0;
+        goto fail2;
     }
     
     // construct keepalive packet
@@ -475,9 +575,15 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail0:
+fail2:
     PacketPassInactivityMonitor_Free(&o->send_monitor);
     PacketPassConnector_Free(&o->send_connector);
+#ifdef BADVPN_UDPGW_USE_HASH
+    UdpGwClient__ConidHash_Free(&o->connections_hash_by_conid);
+fail1:
+    UdpGwClient__ConaddrHash_Free(&o->connections_hash_by_conaddr);
+fail0:
+#endif
     return 0;
 }
 
@@ -510,6 +616,14 @@ void UdpGwClient_Free (UdpGwClient *o)
     
     // free send connector
     PacketPassConnector_Free(&o->send_connector);
+    
+#ifdef BADVPN_UDPGW_USE_HASH
+    // free connections hash by conid
+    UdpGwClient__ConidHash_Free(&o->connections_hash_by_conid);
+    
+    // free connections hash by conaddr
+    UdpGwClient__ConaddrHash_Free(&o->connections_hash_by_conaddr);
+#endif
 }
 
 void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
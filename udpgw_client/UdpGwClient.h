@@ -35,6 +35,7 @@
 #include <misc/debug.h>
 #include <misc/packed.h>
 #include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <system/BAddr.h>
@@ -49,6 +50,23 @@
 typedef void (*UdpGwClient_handler_servererror) (void *user);
 typedef void (*UdpGwClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
+struct UdpGwClient_conaddr {
+    BAddr local_addr;
+    BAddr remote_addr;
+};
+
+#ifdef BADVPN_UDPGW_USE_HASH
+
+struct UdpGwClient_connection;
+
+#include "UdpGwClient_conaddr_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "UdpGwClient_conid_hash.h"
+#include <structure/CHash_decl.h>
+
+#endif
+
 B_START_PACKED
 struct UdpGwClient__keepalive_packet {
     struct packetproto_header pp;
@@ -67,8 +85,13 @@ typedef struct {
     UdpGwClient_handler_received handler_received;
     int udpgw_mtu;
     int pp_mtu;
+#ifdef BADVPN_UDPGW_USE_HASH
+    UdpGwClient__ConaddrHash connections_hash_by_conaddr;
+    UdpGwClient__ConidHash connections_hash_by_conid;
+#else
     BAVL connections_tree_by_conaddr;
     BAVL connections_tree_by_conid;
+#endif
     LinkedList1 connections_list;
     int num_connections;
     int next_conid;
@@ -86,11 +109,6 @@ typedef struct {
     DebugObject d_obj;
 } UdpGwClient;
 
-struct UdpGwClient_conaddr {
-    BAddr local_addr;
-    BAddr remote_addr;
-};
-
 struct UdpGwClient_connection {
     UdpGwClient *client;
     struct UdpGwClient_conaddr conaddr;
@@ -102,8 +120,14 @@ struct UdpGwClient_connection {
     BufferWriter *send_if;
     PacketProtoFlow send_ppflow;
     PacketPassFairQueueFlow send_qflow;
+#ifdef BADVPN_UDPGW_USE_HASH
+    size_t conaddr_hash;
+    struct UdpGwClient_connection *conaddr_hash_next;
+    struct UdpGwClient_connection *conid_hash_next;
+#else
     BAVLNode connections_tree_by_conaddr_node;
     BAVLNode connections_tree_by_conid_node;
+#endif
     LinkedList1Node connections_list_node;
 };
 